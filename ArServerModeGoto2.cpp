@@ -34,6 +34,11 @@ Amherst, NH 03031
 
 #include "ArServerModeGoto2.h"
 
+const long ArServerModeGoto2::ourTravelBucketLimits[NUM_TRAVEL_BUCKETS - 1] =
+  { 5000, 10000, 20000, 30000, 60000, 120000, 300000 };
+
+static const double ourTravelMetricBounds[] =
+  { 1000, 2000, 5000, 10000, 20000, 30000, 60000, 120000, 300000, 600000 };
 
 AREXPORT ArServerModeGoto2::ArServerModeGoto2(
 	ArServerBase *server, ArRobot *robot, ArPathPlanningTask *pathTask,
@@ -47,49 +52,115 @@ AREXPORT ArServerModeGoto2::ArServerModeGoto2(
   myServerHomeCB(this, &ArServerModeGoto2::serverHome),
   myServerTourGoalsCB(this, &ArServerModeGoto2::serverTourGoals),
   myServerGoalNameCB(this, &ArServerModeGoto2::serverGoalName),
-  myTourGoalsInListSimpleCommandCB(this, &ArServerModeGoto2::tourGoalsInListCommand)
+  myServerGoalQuarantineCB(this, &ArServerModeGoto2::serverGoalQuarantine),
+  myServerClearGoalQuarantineCB(this, &ArServerModeGoto2::serverClearGoalQuarantine),
+  myMapChangedCB(this, &ArServerModeGoto2::mapChanged),
+  myClearGoalQuarantineCB(this, &ArServerModeGoto2::clearGoalQuarantine),
+  myNewGoalCB(this, &ArServerModeGoto2::newGoal),
+  myTaskFinishedCB(this, &ArServerModeGoto2::addTaskDwellTime),
+  myViaPointPassedCB(this, &ArServerModeGoto2::viaPointPassed),
+  myServerGoalStatsCB(this, &ArServerModeGoto2::serverGoalStats),
+  myDumpGoalStatsCB(this, &ArServerModeGoto2::dumpGoalStatsCommand),
+  myGoalStatsWriter(this),
+  myTourGoalsInListSimpleCommandCB(this, &ArServerModeGoto2::tourGoalsInListCommand),
+  myProfiledGoalDoneCB(&myGoalDoneCB, "ArServerModeGoto2::goalDone"),
+  myProfiledGoalFailedCB(&myGoalFailedCB, "ArServerModeGoto2::goalFailed"),
+  myProfiledNewGoalCB(&myNewGoalCB, "ArServerModeGoto2::newGoal")
 {
 
   myServer = server;
   myRobot = robot;
   myPathTask = pathTask;
+  myMapLockStats = ArnlLockProfiler::getStats("map");
   myGoingHome = false;
   myTouringGoals = false;
   myMap = arMap;
   myHome = home;
   myGetHomePoseCB = getHomePoseCB;
   myAmTouringGoalsInList = false;
-
-  myPathTask->addGoalDoneCB(&myGoalDoneCB);
-  myPathTask->addGoalFailedCB(&myGoalFailedCB);
+  myTourIndex = -1;
+  myQuarantineFailures = 2;
+  myQuarantineBackoffSecs = 30;
+  myQuarantineMaxBackoffSecs = 600;
+  myWaitingForQuarantine = false;
+  myHaveLegStartTime = false;
+  myGotoStatusChanged = false;
+  myGotoModeChanged = false;
+  myProgressMutex.setLogName("ArServerModeGoto2::myProgressMutex");
+  myGotoStatusMutex.setLogName("ArServerModeGoto2::myGotoStatusMutex");
+  myGoalStatsFile[0] = '\0';
+  myGoalStatsDumpPeriodSecs = 0;
+  myViaPoints = ArnlViaPoints::getViaPoints(pathTask, robot);
+
+  ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal();
+  myGoalsArrivedMetric = metrics->getCounter("goto_goals_arrived_total",
+    "Goals reached by the path planner");
+  myGoalsFailedMetric = metrics->getCounter("goto_goals_failed_total",
+    "Goals the path planner failed to reach");
+  myGoalsQuarantinedMetric = metrics->getCounter("goto_goals_quarantined_total",
+    "Times a tour goal was quarantined after repeated failures");
+  myGoalsPassedMetric = metrics->getCounter("goto_goals_passed_total",
+    "Via-point tour goals passed through without stopping");
+  myPlanTimeMetric = metrics->getMSecsHistogram("goto_plan_msecs",
+    "Time spent planning a path to a goal");
+  myTravelTimeMetric = metrics->getHistogram("goto_travel_msecs",
+    "Time from setting a goal to reaching it", ourTravelMetricBounds,
+    sizeof(ourTravelMetricBounds) / sizeof(ourTravelMetricBounds[0]));
+  myDwellTimeMetric = metrics->getHistogram("goto_dwell_msecs",
+    "Time tasks spent at a goal after reaching it", ourTravelMetricBounds,
+    sizeof(ourTravelMetricBounds) / sizeof(ourTravelMetricBounds[0]));
+
+  myPathTask->addGoalDoneCB(&myProfiledGoalDoneCB);
+  myPathTask->addGoalFailedCB(&myProfiledGoalFailedCB);
+  myPathTask->addNewGoalCB(&myProfiledNewGoalCB);
   addModeData("gotoGoal", "sends the robot to the goal", 
-	      &myServerGotoGoalCB, 
+	      ArnlCallbackProfiler::wrap(&myServerGotoGoalCB, "gotoGoal request"), 
 	      "string: goal", "none", "Navigation", "RETURN_NONE");
     
   addModeData("gotoPose", 
 	      "sends the robot to a given x, y and optional heading", 
-	      &myServerGotoPoseCB, 
+	      ArnlCallbackProfiler::wrap(&myServerGotoPoseCB, "gotoPose request"), 
 	      "byte4: x byte4: y (optional) byte4: th", "none", "Navigation",
 	      "RETURN_NONE");
   addModeData("home", "Sends the robot to where it started up",
-	      &myServerHomeCB, "none", "none", "Navigation", "RETURN_NONE");
-  myServer->addData("goalName", "current goal name", &myServerGoalNameCB, "none", "string", "Navigation", "RETURN_SINGLE");
+	      ArnlCallbackProfiler::wrap(&myServerHomeCB, "home request"), "none", "none", "Navigation", "RETURN_NONE");
+  myServer->addData("goalName", "current goal name", ArnlCallbackProfiler::wrap(&myServerGoalNameCB, "goalName request"), "none", "string", "Navigation", "RETURN_SINGLE");
   if (myMap != NULL)
   {
     addModeData("tourGoals",
 		"sends the robot on a tour of all the goals",
-		&myServerTourGoalsCB, "none", 
+		ArnlCallbackProfiler::wrap(&myServerTourGoalsCB, "tourGoals request"), "none", 
 		"none", "Navigation", "RETURN_NONE");
+    myMap->addMapChangedCB(&myMapChangedCB);
+    rebuildGoalStatsIndex();
   }
+  myServer->addData("goalStats",
+		    "gets performance statistics for each goal",
+		    ArnlCallbackProfiler::wrap(&myServerGoalStatsCB, "goalStats request"), "none",
+		    "<repeat until empty packet> (string: goal, uByte4: arrivals, uByte4: failures, uByte4: travel count, uByte4: mean travel msecs, uByte4: min travel msecs, uByte4: max travel msecs, <repeat 8> uByte4: travel histogram count (<5s, <10s, <20s, <30s, <1m, <2m, <5m, >=5m), uByte4: mean plan msecs, uByte4: max plan msecs, uByte4: dwell count, uByte4: mean dwell msecs, uByte4: max dwell msecs), one goal per packet",
+		    "NavigationInfo", "RETURN_UNTIL_EMPTY");
+  myServer->addData("goalQuarantine",
+		    "gets the list of tour goals skipped because they failed repeatedly",
+		    ArnlCallbackProfiler::wrap(&myServerGoalQuarantineCB, "goalQuarantine request"), "none",
+		    "<repeat> string: goal, uByte2: failures, uByte4: msecs until retry",
+		    "NavigationInfo", "RETURN_SINGLE");
+  myServer->addData("clearGoalQuarantine",
+		    "forgets tour goal failures so quarantined goals are tried again",
+		    ArnlCallbackProfiler::wrap(&myServerClearGoalQuarantineCB, "clearGoalQuarantine request"), "none", "none",
+		    "Navigation", "RETURN_NONE");
   myServer->addData("getGoals", "gets the list of goals", 
-		    &myServerGetGoalsCB, "none", 
+		    ArnlCallbackProfiler::wrap(&myServerGetGoalsCB, "getGoals request"), "none", 
 		    "<repeat> string: goal", "NavigationInfo", 
 		    "RETURN_SINGLE");
 }
 
 AREXPORT ArServerModeGoto2::~ArServerModeGoto2()
 {
-
+  if (myMap != NULL)
+    myMap->remMapChangedCB(&myMapChangedCB);
+  myPathTask->remGoalDoneCB(&myProfiledGoalDoneCB);
+  myPathTask->remGoalFailedCB(&myProfiledGoalFailedCB);
+  myPathTask->remNewGoalCB(&myProfiledNewGoalCB);
 }
 
 AREXPORT void ArServerModeGoto2::activate(void)
@@ -106,13 +177,15 @@ AREXPORT void ArServerModeGoto2::activate(void)
   }
   else
   {
-    if (myGoalName.size() > 0)
+    myProgressMutex.lock();
+    const std::string goalName = myGoalName;
+    myProgressMutex.unlock();
+    if (goalName.size() > 0)
     {
-      if(!myPathTask->pathPlanToGoal(myGoalName.c_str()))
+      if(!planToGoal(goalName))
       {
-        ArLog::log(ArLog::Terse, "Error: Could not plan a path to \"%s\".", myGoalName.c_str());
-        myStatus = "Failed to plan to ";
-        myStatus += myGoalName;
+        ArLog::log(ArLog::Terse, "Error: Could not plan a path to \"%s\".", goalName.c_str());
+        setGotoStatus("Failed to plan to " + goalName);
       }
     }
     else
@@ -120,7 +193,7 @@ AREXPORT void ArServerModeGoto2::activate(void)
       if(!myPathTask->pathPlanToPose(myGoalPose, myUseHeading))
       {
         ArLog::log(ArLog::Terse, "Error: Could not plan a path to point.");
-        myStatus = "Failed to plan to point";
+        setGotoStatus("Failed to plan to point");
       }
     }
   }
@@ -132,17 +205,43 @@ AREXPORT void ArServerModeGoto2::activate(void)
 AREXPORT void ArServerModeGoto2::deactivate(void)
 {
   baseDeactivate();
+  myViaPoints->cancel(&myViaPointPassedCB);
   myPathTask->cancelPathPlan();
 }
 
 AREXPORT void ArServerModeGoto2::userTask(void)
 {
+  static ArnlCallbackInfo *profilerInfo = ArnlCallbackProfiler::getInfo("ArServerModeGoto2::userTask");
+  ArnlCallbackTimer profilerTimer(profilerInfo);
   
   if (!myDone)
   {
     setActivityTimeToNow();
 
   }
+
+  // Status and mode set in other threads are only copied to myStatus and
+  // myMode here, in the robot thread, where they are read (e.g. by
+  // ArnlTelemetryPublisher).
+  myGotoStatusMutex.lock();
+  if (myGotoStatusChanged)
+    myStatus = myGotoStatus;
+  else
+    // e.g. set through ArnlRobotMailbox
+    myGotoStatus = myStatus;
+  myGotoStatusChanged = false;
+  if (myGotoModeChanged)
+    myMode = myGotoMode;
+  myGotoModeChanged = false;
+  myGotoStatusMutex.unlock();
+
+  // If the tour stalled because every goal was quarantined, resume it as soon
+  // as one of them may be tried again.
+  if (myTouringGoals && myWaitingForQuarantine && anyGoalQuarantineExpired())
+  {
+    ArLog::log(ArLog::Normal, "Tour goals: goal quarantine expired, resuming tour.");
+    planToNextTourGoal();
+  }
 }
 
 AREXPORT void ArServerModeGoto2::gotoPose(ArPose pose, bool useHeading)
@@ -150,8 +249,8 @@ AREXPORT void ArServerModeGoto2::gotoPose(ArPose pose, bool useHeading)
   reset();
   myGoalPose = pose;
   myUseHeading = useHeading;
-  myStatus = "Going to point";
-  myMode = "Goto point";
+  setGotoStatus("Going to point");
+  setGotoMode("Goto point");
   activate();
 }
 
@@ -164,18 +263,19 @@ AREXPORT void ArServerModeGoto2::home(void)
     myGoalPose = myHome;
   myUseHeading = true;
   myGoingHome = true;
-  myStatus = "Returning home";
-  myMode = "Go home";
+  setGotoStatus("Returning home");
+  setGotoMode("Go home");
   activate();
 }
 
 AREXPORT void ArServerModeGoto2::gotoGoal(const char *goal)
 {
   reset();
+  myProgressMutex.lock();
   myGoalName = goal;
-  myMode = "Goto goal";
-  myStatus = "Going to ";
-  myStatus += goal;
+  myProgressMutex.unlock();
+  setGotoMode("Goto goal");
+  setGotoStatus(std::string("Going to ") + goal);
   activate();
 }
 
@@ -183,12 +283,16 @@ AREXPORT void ArServerModeGoto2::tourGoals(void)
 {
   std::string onGoal;
 
+  myProgressMutex.lock();
   onGoal = myGoalName;
+  myProgressMutex.unlock();
   reset();
+  myProgressMutex.lock();
   myGoalName = onGoal;
   myTouringGoals = true;
   myAmTouringGoalsInList = false;
-  myMode = "Touring goals";
+  myProgressMutex.unlock();
+  setGotoMode("Touring goals");
   ArLog::log(ArLog::Normal, "Touring goals");
   //findNextTourGoal(); moved to activate()
   activate();
@@ -197,13 +301,18 @@ AREXPORT void ArServerModeGoto2::tourGoals(void)
 /** Does not check if goals listed are valid goals. */
 AREXPORT void ArServerModeGoto2::tourGoalsInList(std::deque<std::string> goalList)
 {
+  myProgressMutex.lock();
   std::string onGoal = myGoalName;
+  myProgressMutex.unlock();
   reset();
+  myProgressMutex.lock();
   myGoalName = onGoal;
   myTouringGoals = true;
   myAmTouringGoalsInList = true;
   myTouringGoalsList = goalList;
-  myMode = "Touring goals";
+  myTourIndex = -1;
+  myProgressMutex.unlock();
+  setGotoMode("Touring goals");
   ArLog::log(ArLog::Normal, "Tour goals: touring %d goals from given list", goalList.size());
   //findNextTourGoal(); moved to activate()
   
@@ -217,6 +326,29 @@ AREXPORT void ArServerModeGoto2::addTourGoalsInListSimpleCommand(ArServerHandler
     "Tour goals in the given list. Separate goal names with commas. "\
     "To add multiple goals with a common prefix, use the prefix followed by a *.",
     &myTourGoalsInListSimpleCommandCB);
+  commandsServer->addCommand("ClearGoalQuarantine",
+    "Forget tour goal failures, so that goals skipped because they failed "\
+    "repeatedly are tried again.",
+    &myClearGoalQuarantineCB);
+}
+
+AREXPORT void ArServerModeGoto2::addToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("QuarantineFailures", &myQuarantineFailures,
+		      "Number of consecutive failures to plan to or reach a goal while touring goals after which the goal is quarantined (skipped without planning) for a while. 0 disables quarantine.",
+		      0),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("QuarantineBackoff", &myQuarantineBackoffSecs,
+		      "Seconds a goal is skipped the first time it is quarantined. This doubles each further time it is quarantined until it is reached again.",
+		      1),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("QuarantineMaxBackoff", &myQuarantineMaxBackoffSecs,
+		      "Maximum number of seconds a goal is skipped when quarantined.",
+		      1),
+	  section, ArPriority::NORMAL);
 }
 
 
@@ -236,7 +368,12 @@ char *strtok_r(char *str, const char *delim, char **thing)
 
 AREXPORT void ArServerModeGoto2::tourGoalsInListCommand(ArArgumentBuilder *args)
 {
-  char *str = strdup(args->getFullString());
+  tourGoalsInList(args->getFullString());
+}
+
+AREXPORT bool ArServerModeGoto2::tourGoalsInList(const char *goalList)
+{
+  char *str = strdup(goalList);
   char *strtokpriv;
   char *tok = strtok_r(str, ",", &strtokpriv);
   //ArArgumentBuilder splitArgs(512, ','); // ArgumentBuilder always splits on
@@ -265,7 +402,7 @@ AREXPORT void ArServerModeGoto2::tourGoalsInListCommand(ArArgumentBuilder *args)
       std::string::size_type starPos = s.find('*');
       if(starPos == s.npos)
       {
-        myMap->lock();
+        myMapLockStats->lock(myMap, ARNL_LOCK_SITE);
         if(myMap->findMapObject(s.c_str(), "Goal") || myMap->findMapObject(s.c_str(), "GoalWithHeading"))
         {
           ArLog::log(ArLog::Normal, "Tour goals: adding \"%s\" to tour list.", s.c_str());
@@ -275,14 +412,14 @@ AREXPORT void ArServerModeGoto2::tourGoalsInListCommand(ArArgumentBuilder *args)
         {
           ArLog::log(ArLog::Terse, "Tour goals: Warning: not adding \"%s\" to tour list; no goal by that name found in the map.", s.c_str());
         }
-        myMap->unlock();
+        myMapLockStats->unlock(myMap);
       }
       else if(starPos == s.size()-1)
       {
         // Find matching goals
         std::string prefix = s.substr(0, starPos);
         ArLog::log(ArLog::Normal, "Tour goals: searching for goals with prefix \"%s\"...", prefix.c_str());
-        myMap->lock();
+        myMapLockStats->lock(myMap, ARNL_LOCK_SITE);
         for(std::list<ArMapObject*>::const_iterator i = myMap->getMapObjects()->begin();
             i != myMap->getMapObjects()->end(); i++)
         {
@@ -297,13 +434,13 @@ AREXPORT void ArServerModeGoto2::tourGoalsInListCommand(ArArgumentBuilder *args)
             goals.push_back(goalName);
           }
         }
-        myMap->unlock();
+        myMapLockStats->unlock(myMap);
       }
       else
       {
         ArLog::log(ArLog::Terse, "Tour goals: Error in goal list; the \'*\' wildcard must be the last character in the goal name (in \"%s\"). starPos=%d, npos=%d, size=%d", s.c_str(), starPos, s.npos, s.size());
         free(str);
-        return;
+        return false;
       }
     }
 
@@ -312,6 +449,7 @@ AREXPORT void ArServerModeGoto2::tourGoalsInListCommand(ArArgumentBuilder *args)
   }
   free(str);
   tourGoalsInList(goals);
+  return true;
 }
 
 
@@ -320,13 +458,16 @@ size_t ArServerModeGoto2::numGoalsTouring()
   if(!myTouringGoals) return 0;
   if(myAmTouringGoalsInList)
   {
-    return myTouringGoalsList.size();
+    myProgressMutex.lock();
+    size_t count = myTouringGoalsList.size();
+    myProgressMutex.unlock();
+    return count;
   }
   else
   {
     if(!myMap) return 0;
     size_t count = 0;
-    myMap->lock();
+    myMapLockStats->lock(myMap, ARNL_LOCK_SITE);
     for (std::list<ArMapObject*>::const_iterator i = myMap->getMapObjects()->begin(); 
          i != myMap->getMapObjects()->end(); 
          i++)
@@ -338,27 +479,37 @@ size_t ArServerModeGoto2::numGoalsTouring()
         ++count;
       }
     }
-    myMap->unlock();
+    myMapLockStats->unlock(myMap);
     return count;
   }
 }
 
 void ArServerModeGoto2::findNextTourGoal(void)
 {
+  myProgressMutex.lock();
   if (myMap == NULL)
   {
     myGoalName = "";
+    myProgressMutex.unlock();
     return;
   }
 
 
-  if(myAmTouringGoalsInList)
+  if(myResumeTourGoal.size() > 0)
+  {
+    // Resuming a tour of all goals: go on to the goal it was going to
+    myGoalName = myResumeTourGoal;
+    myResumeTourGoal = "";
+    myTourIndex = getGoalIndex(myGoalName.c_str());
+  }
+  else if(myAmTouringGoalsInList)
   {
     // If we are selecting goals from a list, return the head
     // and move it to the back.
     myGoalName = myTouringGoalsList.front();
     myTouringGoalsList.pop_front();
     myTouringGoalsList.push_back(myGoalName);
+    myTourIndex = (myTourIndex + 1) % (int)myTouringGoalsList.size();
     ArLog::log(ArLog::Verbose, "Tour goals: popped next goal \"%s\" from user's list.", myGoalName.c_str());
   }
   else
@@ -370,7 +521,7 @@ void ArServerModeGoto2::findNextTourGoal(void)
     bool nextGoalIt = false;
     bool gotGoal = false;
     std::string firstGoal;
-    myMap->lock();
+    myMapLockStats->lock(myMap, ARNL_LOCK_SITE);
     for (objIt = myMap->getMapObjects()->begin(); 
          objIt != myMap->getMapObjects()->end(); 
          objIt++)
@@ -393,53 +544,263 @@ void ArServerModeGoto2::findNextTourGoal(void)
           firstGoal = obj->getName();
       }
     }
-    myMap->unlock();
+    myMapLockStats->unlock(myMap);
     if (!gotGoal)
       myGoalName = firstGoal;
+    myTourIndex = getGoalIndex(myGoalName.c_str());
   }
 
-  myStatus = "Touring to ";
-  myStatus += myGoalName;
+  setGotoStatus("Touring to " + myGoalName);
+  myProgressMutex.unlock();
   //myPathTask->unlock();
   //myRobot->unlock();
 
 }
 
 
+AREXPORT bool ArServerModeGoto2::getProgress(std::string *goalName, bool *touring,
+					     std::deque<std::string> *tourList)
+{
+  myProgressMutex.lock();
+  if (!myIsActive || myGoingHome || myGoalName.size() == 0 ||
+      (myDone && !myTouringGoals))
+  {
+    myProgressMutex.unlock();
+    return false;
+  }
+  *goalName = myGoalName;
+  *touring = myTouringGoals;
+  tourList->clear();
+  if (myTouringGoals && myAmTouringGoalsInList)
+  {
+    // findNextTourGoal() moved the current goal to the back of the list
+    *tourList = myTouringGoalsList;
+    if (tourList->size() > 0 && tourList->back() == myGoalName)
+    {
+      tourList->push_front(tourList->back());
+      tourList->pop_back();
+    }
+  }
+  myProgressMutex.unlock();
+  return true;
+}
+
+AREXPORT void ArServerModeGoto2::resumeProgress(const std::string& goalName, bool touring,
+						const std::deque<std::string>& tourList)
+{
+  if (!touring)
+  {
+    gotoGoal(goalName.c_str());
+  }
+  else if (tourList.size() > 0)
+  {
+    // Start the list at the goal, which findNextTourGoal() takes first
+    std::deque<std::string> goals(tourList);
+    for (size_t i = 0; i < goals.size() && goals.front() != goalName; i++)
+    {
+      goals.push_back(goals.front());
+      goals.pop_front();
+    }
+    tourGoalsInList(goals);
+  }
+  else
+  {
+    // Not held through tourGoals(), which plans when it activates the mode
+    myProgressMutex.lock();
+    myResumeTourGoal = goalName;
+    myProgressMutex.unlock();
+    tourGoals();
+    // In case the mode could not be activated
+    myProgressMutex.lock();
+    myResumeTourGoal = "";
+    myProgressMutex.unlock();
+  }
+}
+
 void ArServerModeGoto2::reset(void)
 {
+  myViaPoints->cancel(&myViaPointPassedCB);
+  myProgressMutex.lock();
+  myTourIndex = -1;
   myGoingHome = false;
   myTouringGoals = false;
   myGoalName = "";
+  myProgressMutex.unlock();
   myUseHeading = true;
 }
 
 // keep trying to plan to goals in tour, until either one suceeds or all goals fail
+// Quarantined goals are skipped without calling the planner at all.
 void ArServerModeGoto2::planToNextTourGoal()
 {
   size_t failedCount = 0;
+  size_t skippedCount = 0;
   size_t numGoals = numGoalsTouring();
-  while(failedCount < numGoals) 
+  myWaitingForQuarantine = false;
+  while(failedCount + skippedCount < numGoals) 
   {
+    // Not planned with myProgressMutex locked: planning calls goal callbacks
+    myProgressMutex.lock();
     findNextTourGoal();
-    if(myPathTask->pathPlanToGoal(myGoalName.c_str()))
+    const std::string goalName = myGoalName;
+    myProgressMutex.unlock();
+    if(checkGoalQuarantined(goalName))
+    {
+      ++skippedCount;
+      ArLog::log(ArLog::Verbose, "Tour goals: skipping quarantined goal \"%s\".", goalName.c_str());
+      continue;
+    }
+    if(planToGoal(goalName))
     {
+      // Plan the next goal as the robot passes a via-point, instead of stopping there
+      if(myViaPoints->isViaPoint(goalName))
+        myViaPoints->watch(goalName, &myViaPointPassedCB);
       return;
     }
     else
     {
       ++failedCount;
-      ArLog::log(ArLog::Terse, "Tour goals: Warning: failed to plan a path to \"%s\".", myGoalName.c_str());
+      ArLog::log(ArLog::Terse, "Tour goals: Warning: failed to plan a path to \"%s\".", goalName.c_str());
+      recordGoalFailure(goalName);
+    }
+  }
+  myGoalFailuresMutex.lock();
+  bool anyQuarantined = false;
+  for (std::map<std::string, GoalFailureInfo>::const_iterator i = myGoalFailures.begin();
+       i != myGoalFailures.end(); ++i)
+  {
+    if (i->second.quarantined)
+    {
+      anyQuarantined = true;
+      break;
     }
   }
+  myGoalFailuresMutex.unlock();
+  if (anyQuarantined)
+  {
+    // userTask() resumes the tour when a quarantine expires
+    ArLog::log(ArLog::Terse, "Tour goals: Warning: no goal could be planned to, and some goals are quarantined. Waiting for a quarantine to expire.");
+    setGotoStatus("Touring goals: waiting for quarantined goals");
+    myWaitingForQuarantine = true;
+    return;
+  }
   ArLog::log(ArLog::Terse, "Tour goals: Warning: failed to find a path to any goal.");
-  myStatus = "Failed touring goals: All goals failed.";
+  setGotoStatus("Failed touring goals: All goals failed.");
+}
+
+void ArServerModeGoto2::recordGoalFailure(const std::string& goalName)
+{
+  if (myQuarantineFailures <= 0 || goalName.size() == 0)
+    return;
+  myGoalFailuresMutex.lock();
+  GoalFailureInfo& info = myGoalFailures[goalName];
+  ++info.consecutiveFailures;
+  if (!info.quarantined && 
+      info.consecutiveFailures >= (unsigned int)myQuarantineFailures)
+  {
+    // Double the backoff each time the goal is quarantined again, until it
+    // is reached.
+    long backoff = myQuarantineBackoffSecs * 1000L;
+    long maxBackoff = myQuarantineMaxBackoffSecs * 1000L;
+    for (unsigned int i = 0; i < info.timesQuarantined && backoff < maxBackoff; i++)
+      backoff *= 2;
+    if (backoff > maxBackoff)
+      backoff = maxBackoff;
+    ++info.timesQuarantined;
+    info.quarantined = true;
+    info.backoffMSecs = backoff;
+    info.retryTime.setToNow();
+    info.retryTime.addMSec(backoff);
+    myGoalsQuarantinedMetric->add();
+    ArLog::log(ArLog::Normal, "Tour goals: quarantining goal \"%s\" for %.1f sec after %u consecutive failures.", goalName.c_str(), backoff / 1000.0, info.consecutiveFailures);
+  }
+  myGoalFailuresMutex.unlock();
+}
+
+void ArServerModeGoto2::recordGoalReached(const std::string& goalName)
+{
+  myGoalFailuresMutex.lock();
+  myGoalFailures.erase(goalName);
+  myGoalFailuresMutex.unlock();
+}
+
+bool ArServerModeGoto2::checkGoalQuarantined(const std::string& goalName)
+{
+  bool ret = false;
+  myGoalFailuresMutex.lock();
+  std::map<std::string, GoalFailureInfo>::iterator it = myGoalFailures.find(goalName);
+  if (it != myGoalFailures.end() && it->second.quarantined)
+  {
+    if (it->second.retryTime.mSecTo() > 0)
+    {
+      ret = true;
+    }
+    else
+    {
+      // Backoff expired; try it once more. One more failure quarantines it
+      // again (with a longer backoff).
+      ArLog::log(ArLog::Normal, "Tour goals: releasing goal \"%s\" from quarantine.", goalName.c_str());
+      it->second.quarantined = false;
+      if (myQuarantineFailures > 0)
+        it->second.consecutiveFailures = myQuarantineFailures - 1;
+    }
+  }
+  myGoalFailuresMutex.unlock();
+  return ret;
+}
+
+bool ArServerModeGoto2::anyGoalQuarantineExpired()
+{
+  bool ret = true;
+  myGoalFailuresMutex.lock();
+  for (std::map<std::string, GoalFailureInfo>::const_iterator i = myGoalFailures.begin();
+       i != myGoalFailures.end(); ++i)
+  {
+    if (!i->second.quarantined)
+      continue;
+    if (i->second.retryTime.mSecTo() <= 0)
+    {
+      ret = true;
+      break;
+    }
+    ret = false;
+  }
+  myGoalFailuresMutex.unlock();
+  return ret;
+}
+
+AREXPORT bool ArServerModeGoto2::isGoalQuarantined(const char *goalName)
+{
+  bool ret = false;
+  myGoalFailuresMutex.lock();
+  std::map<std::string, GoalFailureInfo>::const_iterator it = myGoalFailures.find(goalName);
+  if (it != myGoalFailures.end())
+    ret = it->second.quarantined && it->second.retryTime.mSecTo() > 0;
+  myGoalFailuresMutex.unlock();
+  return ret;
+}
+
+AREXPORT void ArServerModeGoto2::clearGoalQuarantine(void)
+{
+  myGoalFailuresMutex.lock();
+  if (!myGoalFailures.empty())
+    ArLog::log(ArLog::Normal, "Tour goals: clearing goal failure history and quarantine.");
+  myGoalFailures.clear();
+  myGoalFailuresMutex.unlock();
+  // If the tour stalled waiting for a quarantine, userTask() now resumes it.
+}
+
+void ArServerModeGoto2::mapChanged(void)
+{
+  // Goals may have moved or obstacles may have been removed.
+  clearGoalQuarantine();
+  rebuildGoalStatsIndex();
 }
 
 // TODO move this to ArPathPlanningTask
-ArMapObject* ArServerModeGoto2::getCurrentGoalObject()
+ArMapObject* ArServerModeGoto2::getGoalObject(const std::string& name)
 {
-  const char *goalName = myGoalName.c_str();
+  const char *goalName = name.c_str();
   ArMapObject *obj = myMap->findMapObject(goalName, "GoalWithHeading");
   if(!obj) obj = myMap->findMapObject(goalName, "Goal");
   return obj;
@@ -447,86 +808,155 @@ ArMapObject* ArServerModeGoto2::getCurrentGoalObject()
 
 void ArServerModeGoto2::goalDone(ArPose /*pose*/)
 {
+  // Statistics are kept for every goal the path planner reaches, whether
+  // this mode or something else (e.g. an ArnlASyncTask) sent it there.
+  recordGoalStats(true);
   if (!myIsActive)
     return;
+  myProgressMutex.lock();
+  const std::string goalName = myGoalName;
+  myProgressMutex.unlock();
   if (myGoingHome)
   {
     myDone = true;
-    myStatus = "Returned home";
+    setGotoStatus("Returned home");
   }
   else if (myTouringGoals)
   {
-    ArMapObject *obj = getCurrentGoalObject();
+    if (!isCurrentTourGoal(goalName))
+      return;
+    recordGoalReached(goalName);
+    ArMapObject *obj = getGoalObject(goalName);
     if(obj) myTourCallbacks.invoke(obj);
     planToNextTourGoal();
   }
-  else if (myGoalName.size() > 0)
+  else if (goalName.size() > 0)
   {
     myDone = true;
-    myStatus = "Arrived at ";
-    myStatus += myGoalName;
+    setGotoStatus("Arrived at " + goalName);
   }
   else
   {
     myDone = false;
-    myStatus = "Arrived at point";
+    setGotoStatus("Arrived at point");
   }
 }
 
+/** Called in the ArnlTimerWheel's thread, so it may race goalDone() and
+ * goalFailed() in the path planning thread: whichever comes second sees that
+ * the tour has moved on and does nothing. */
+void ArServerModeGoto2::viaPointPassed(const std::string& goalName, const ArPose& /*pose*/)
+{
+  myProgressMutex.lock();
+  const bool current = (myIsActive && myTouringGoals && goalName == myGoalName);
+  myProgressMutex.unlock();
+  if (!current)
+    return;
+  myGoalsPassedMetric->add();
+  recordGoalReached(goalName);
+  ArLog::log(ArLog::Verbose, "Tour goals: passed via-point \"%s\".", goalName.c_str());
+  planToNextTourGoal();
+}
+
 void ArServerModeGoto2::goalFailed(ArPose /*pose*/)
 {
+  recordGoalStats(false);
   if (!myIsActive)
     return;
   if (myPathTask->getAriaMap() == NULL || 
       strlen(myPathTask->getAriaMap()->getFileName()) <= 0)
   {
     myDone = true;
-    myStatus = "Failed driving because map empty";
+    setGotoStatus("Failed driving because map empty");
     ArLog::log(ArLog::Normal, "Failed driving because map empty");
     return;
   }
+  const std::string oldStatus = getGotoStatus();
+  myProgressMutex.lock();
+  const std::string goalName = myGoalName;
+  myProgressMutex.unlock();
   if (myTouringGoals)
   {
-    if (ArUtil::strcasecmp(myStatus, "Robot lost") == 0)
+    if (!isCurrentTourGoal(goalName))
+      return;
+    if (ArUtil::strcasecmp(oldStatus, "Robot lost") == 0)
     {
-      myStatus = "Failed touring because robot lost";
+      setGotoStatus("Failed touring because robot lost");
     }
     else
     {
+      recordGoalFailure(goalName);
       planToNextTourGoal();
     }
   }
   else
   {
     myDone = true;
-    std::string oldStatus;
-    oldStatus = myStatus;
+    std::string status;
     if (myGoingHome)
-      myStatus = "Failed to get home";
-    else if (myGoalName.size() > 0)
+      status = "Failed to get home";
+    else if (goalName.size() > 0)
     {
-      myStatus = "Failed to get to ";
-      myStatus += myGoalName;
+      status = "Failed to get to ";
+      status += goalName;
     }
     else
     {
-      myStatus = "Failed to get to point";
+      status = "Failed to get to point";
     }
 
     
     if (ArUtil::strcasecmp(oldStatus, "Robot lost") == 0)
     {
-      myStatus += " because robot lost";
+      status += " because robot lost";
     }
     else 
     {
       char failureStr[512];
       myPathTask->getFailureString(failureStr, sizeof(failureStr));
-      myStatus += " (" + std::string(failureStr) + ")";
+      status += " (" + std::string(failureStr) + ")";
     }
+    setGotoStatus(status);
   }
 }
 
+/** Whether the goal the path planner just reached or failed is the tour's
+ * current goal @a goalName, rather than a via-point the tour has already
+ * gone on from (see viaPointPassed()) */
+bool ArServerModeGoto2::isCurrentTourGoal(const std::string& goalName)
+{
+  const std::string planned = myPathTask->getCurrentGoalName();
+  if (planned.empty() || planned == goalName)
+    return true;
+  ArLog::log(ArLog::Verbose, "Tour goals: ignoring the end of \"%s\"; the tour has gone on to \"%s\".",
+	     planned.c_str(), goalName.c_str());
+  return false;
+}
+
+void ArServerModeGoto2::setGotoStatus(const std::string& status)
+{
+  myGotoStatusMutex.lock();
+  myGotoStatus = status;
+  myGotoStatusChanged = true;
+  myGotoStatusMutex.unlock();
+}
+
+void ArServerModeGoto2::setGotoMode(const char *mode)
+{
+  myGotoStatusMutex.lock();
+  myGotoMode = mode;
+  myGotoModeChanged = true;
+  myGotoStatusMutex.unlock();
+}
+
+std::string ArServerModeGoto2::getGotoStatus(void)
+{
+  myGotoStatusMutex.lock();
+  std::string status = myGotoStatus;
+  myGotoStatusMutex.unlock();
+  return status;
+}
+
 AREXPORT void ArServerModeGoto2::serverGotoGoal(ArServerClient * /*client*/, 
 					       ArNetPacket *packet)
 {
@@ -590,7 +1020,7 @@ AREXPORT void ArServerModeGoto2::serverGetGoals(ArServerClient *client,
     return;
   }
 
-  myMap->lock();
+  myMapLockStats->lock(myMap, ARNL_LOCK_SITE);
   std::list<ArMapObject *>::iterator objIt;
   ArMapObject* obj;
   for (objIt = myMap->getMapObjects()->begin(); 
@@ -604,7 +1034,7 @@ AREXPORT void ArServerModeGoto2::serverGetGoals(ArServerClient *client,
       sendPacket.strToBuf(obj->getName());
     }
   }
-  myMap->unlock();
+  myMapLockStats->unlock(myMap);
   client->sendPacketTcp(&sendPacket);
 }
 
@@ -617,12 +1047,352 @@ AREXPORT void ArServerModeGoto2::serverGetGoals(ArServerClient *client,
 void ArServerModeGoto2::serverGoalName(ArServerClient *client, ArNetPacket * /*pkt*/)
 {
     ArNetPacket retPkt;
+    myProgressMutex.lock();
     retPkt.strToBuf(myGoalName.c_str());
+    myProgressMutex.unlock();
     client->sendPacketTcp(&retPkt);
 }
 
 
+void ArServerModeGoto2::serverGoalQuarantine(ArServerClient *client, ArNetPacket * /*pkt*/)
+{
+  ArNetPacket retPkt;
+  myGoalFailuresMutex.lock();
+  for (std::map<std::string, GoalFailureInfo>::const_iterator i = myGoalFailures.begin();
+       i != myGoalFailures.end(); ++i)
+  {
+    if (!i->second.quarantined)
+      continue;
+    long msecs = i->second.retryTime.mSecTo();
+    if (msecs < 0)
+      msecs = 0;
+    retPkt.strToBuf(i->first.c_str());
+    retPkt.uByte2ToBuf(i->second.consecutiveFailures);
+    retPkt.uByte4ToBuf(msecs);
+  }
+  myGoalFailuresMutex.unlock();
+  client->sendPacketTcp(&retPkt);
+}
+
+void ArServerModeGoto2::serverClearGoalQuarantine(ArServerClient * /*client*/, ArNetPacket * /*pkt*/)
+{
+  clearGoalQuarantine();
+}
+
+
+void ArServerModeGoto2::rebuildGoalStatsIndex(void)
+{
+  if (myMap == NULL)
+    return;
+  std::vector<std::string> names;
+  myMapLockStats->lock(myMap, ARNL_LOCK_SITE);
+  for (std::list<ArMapObject*>::const_iterator i = myMap->getMapObjects()->begin();
+       i != myMap->getMapObjects()->end(); i++)
+  {
+    ArMapObject *obj = (*i);
+    if (strcasecmp(obj->getType(), "GoalWithHeading") == 0 ||
+        strcasecmp(obj->getType(), "Goal") == 0)
+      names.push_back(obj->getName());
+  }
+  myMapLockStats->unlock(myMap);
+
+  myGoalStatsMutex.lock();
+  std::vector<GoalStats> stats(names.size());
+  std::map<std::string, size_t> index;
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    // keep statistics of goals that are still in the map
+    GoalStats *old = findGoalStats(names[i]);
+    if (old != NULL)
+      stats[i] = *old;
+    index[names[i]] = i;
+  }
+  myGoalStats.swap(stats);
+  myGoalStatsNames.swap(names);
+  myGoalStatsIndex.swap(index);
+  myGoalStatsMutex.unlock();
+}
+
+ArServerModeGoto2::GoalStats *ArServerModeGoto2::findGoalStats(const std::string& goalName)
+{
+  std::map<std::string, size_t>::const_iterator it = myGoalStatsIndex.find(goalName);
+  if (it == myGoalStatsIndex.end())
+    return NULL;
+  return &myGoalStats[it->second];
+}
+
+bool ArServerModeGoto2::planToGoal(const std::string& goalName)
+{
+  ArTime started;
+  started.setToNow();
+  bool ret = myPathTask->pathPlanToGoal(goalName.c_str());
+  long msecs = started.mSecSince();
+  myPlanTimeMetric->observe(msecs);
+  myGoalStatsMutex.lock();
+  GoalStats *stats = findGoalStats(goalName);
+  if (stats != NULL)
+  {
+    ++stats->planCount;
+    stats->planTotalMSecs += msecs;
+    if (msecs > stats->planMaxMSecs)
+      stats->planMaxMSecs = msecs;
+  }
+  myGoalStatsMutex.unlock();
+  return ret;
+}
+
+void ArServerModeGoto2::newGoal(ArPose /*pose*/)
+{
+  myGoalStatsMutex.lock();
+  myLegStartTime.setToNow();
+  myHaveLegStartTime = true;
+  myGoalStatsMutex.unlock();
+}
+
+void ArServerModeGoto2::recordGoalStats(bool arrived)
+{
+  std::string goalName = myPathTask->getCurrentGoalName();
+  if (arrived)
+    myGoalsArrivedMetric->add();
+  else
+    myGoalsFailedMetric->add();
+  myGoalStatsMutex.lock();
+  if (arrived && myHaveLegStartTime)
+    myTravelTimeMetric->observe(myLegStartTime.mSecSince());
+  GoalStats *stats = findGoalStats(goalName);
+  if (stats != NULL)
+  {
+    if (!arrived)
+    {
+      ++stats->failures;
+    }
+    else
+    {
+      ++stats->arrivals;
+      if (myHaveLegStartTime)
+      {
+        long msecs = myLegStartTime.mSecSince();
+        if (stats->travelCount == 0 || msecs < stats->travelMinMSecs)
+          stats->travelMinMSecs = msecs;
+        if (msecs > stats->travelMaxMSecs)
+          stats->travelMaxMSecs = msecs;
+        ++stats->travelCount;
+        stats->travelTotalMSecs += msecs;
+        int bucket = 0;
+        while (bucket < NUM_TRAVEL_BUCKETS - 1 && 
+               msecs >= ourTravelBucketLimits[bucket])
+          bucket++;
+        ++stats->travelHistogram[bucket];
+      }
+    }
+  }
+  myHaveLegStartTime = false;
+  myGoalStatsMutex.unlock();
+  checkGoalStatsDump();
+}
+
+AREXPORT int ArServerModeGoto2::getGoalIndex(const char *goalName)
+{
+  int ret = -1;
+  myGoalStatsMutex.lock();
+  std::map<std::string, size_t>::const_iterator it = myGoalStatsIndex.find(goalName);
+  if (it != myGoalStatsIndex.end())
+    ret = (int)it->second;
+  myGoalStatsMutex.unlock();
+  return ret;
+}
+
+AREXPORT int ArServerModeGoto2::getTourIndex(void)
+{
+  if (!myTouringGoals)
+    return -1;
+  myProgressMutex.lock();
+  int index = myTourIndex;
+  myProgressMutex.unlock();
+  return index;
+}
+
+AREXPORT void ArServerModeGoto2::addTaskDwellTime(const std::string& goalName, long msecs)
+{
+  myDwellTimeMetric->observe(msecs);
+  myGoalStatsMutex.lock();
+  GoalStats *stats = findGoalStats(goalName);
+  if (stats != NULL)
+  {
+    ++stats->dwellCount;
+    stats->dwellTotalMSecs += msecs;
+    if (msecs > stats->dwellMaxMSecs)
+      stats->dwellMaxMSecs = msecs;
+  }
+  myGoalStatsMutex.unlock();
+}
+
+AREXPORT void ArServerModeGoto2::addGoalStatsToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("GoalStatsFile", myGoalStatsFile,
+		      "CSV file to periodically write per-goal statistics to. Empty to disable.",
+		      sizeof(myGoalStatsFile)),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("GoalStatsDumpPeriod", &myGoalStatsDumpPeriodSecs,
+		      "Minimum seconds between writes of GoalStatsFile. The file is written when a goal is reached or fails and this much time has passed. 0 disables periodic writes.",
+		      0),
+	  section, ArPriority::NORMAL);
+}
+
+AREXPORT void ArServerModeGoto2::addGoalStatsSimpleCommand(ArServerHandlerCommands *commandsServer)
+{
+  commandsServer->addCommand("DumpGoalStats",
+    "Write per-goal statistics to the configured GoalStatsFile.",
+    &myDumpGoalStatsCB);
+}
+
+void ArServerModeGoto2::dumpGoalStatsCommand(void)
+{
+  if (myGoalStatsFile[0] == '\0')
+  {
+    ArLog::log(ArLog::Normal, "Goal stats: no GoalStatsFile configured, not writing statistics.");
+    return;
+  }
+  dumpGoalStats(myGoalStatsFile);
+}
+
+// Stats only change when a goal is reached or fails, so it is enough to check
+// whether a dump is due then, rather than in a timer. The file is written in
+// myGoalStatsWriter's thread, not the path planning thread this is called in.
+void ArServerModeGoto2::checkGoalStatsDump(void)
+{
+  if (myGoalStatsFile[0] == '\0' || myGoalStatsDumpPeriodSecs <= 0)
+    return;
+  if (myLastGoalStatsDump.mSecSince() < myGoalStatsDumpPeriodSecs * 1000L)
+    return;
+  myLastGoalStatsDump.setToNow();
+  myGoalStatsWriter.request(myGoalStatsFile);
+}
+
+ArServerModeGoto2::GoalStatsWriter::GoalStatsWriter(ArServerModeGoto2 *mode) :
+  myMode(mode),
+  myStarted(false)
+{
+  myMutex.setLogName("ArServerModeGoto2::GoalStatsWriter::myMutex");
+  setThreadName("ArServerModeGoto2 goal stats");
+}
+
+ArServerModeGoto2::GoalStatsWriter::~GoalStatsWriter()
+{
+  if (myStarted)
+  {
+    stopRunning();
+    myCondition.signal();
+    join();
+  }
+}
+
+void ArServerModeGoto2::GoalStatsWriter::request(const std::string& fileName)
+{
+  myMutex.lock();
+  myFileName = fileName;
+  const bool start = !myStarted;
+  myStarted = true;
+  myMutex.unlock();
+  if (start)
+    runAsync();
+  else
+    myCondition.signal();
+}
+
+void *ArServerModeGoto2::GoalStatsWriter::runThread(void *)
+{
+  while (getRunning())
+  {
+    myMutex.lock();
+    const std::string fileName = myFileName;
+    myFileName.clear();
+    myMutex.unlock();
+    if (fileName.empty())
+      // request() signals; the timeout covers a signal just before waiting
+      myCondition.timedWait(1000);
+    else
+      myMode->dumpGoalStats(fileName.c_str());
+  }
+  return NULL;
+}
+
+AREXPORT bool ArServerModeGoto2::dumpGoalStats(const char *fileName)
+{
+  // Copy the table so the file is written without holding the lock
+  myGoalStatsMutex.lock();
+  std::vector<GoalStats> stats = myGoalStats;
+  std::vector<std::string> names = myGoalStatsNames;
+  myGoalStatsMutex.unlock();
+
+  FILE *file = fopen(fileName, "w");
+  if (file == NULL)
+  {
+    ArLog::log(ArLog::Terse, "Goal stats: Error: could not open \"%s\" for writing: %s", fileName, strerror(errno));
+    return false;
+  }
+  fprintf(file, "goal,arrivals,failures,travelCount,travelMeanMSecs,travelMinMSecs,travelMaxMSecs");
+  for (int b = 0; b < NUM_TRAVEL_BUCKETS - 1; b++)
+    fprintf(file, ",travelUnder%ldMSecs", ourTravelBucketLimits[b]);
+  fprintf(file, ",travelOver%ldMSecs", ourTravelBucketLimits[NUM_TRAVEL_BUCKETS - 2]);
+  fprintf(file, ",planCount,planMeanMSecs,planMaxMSecs,dwellCount,dwellMeanMSecs,dwellMaxMSecs\n");
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    const GoalStats& s = stats[i];
+    fprintf(file, "\"%s\",%u,%u,%u,%.0f,%ld,%ld", names[i].c_str(), 
+	    s.arrivals, s.failures, s.travelCount, 
+	    s.travelCount > 0 ? s.travelTotalMSecs / s.travelCount : 0.0,
+	    s.travelMinMSecs, s.travelMaxMSecs);
+    for (int b = 0; b < NUM_TRAVEL_BUCKETS; b++)
+      fprintf(file, ",%u", s.travelHistogram[b]);
+    fprintf(file, ",%u,%.0f,%ld,%u,%.0f,%ld\n", 
+	    s.planCount, s.planCount > 0 ? s.planTotalMSecs / s.planCount : 0.0,
+	    s.planMaxMSecs,
+	    s.dwellCount, s.dwellCount > 0 ? s.dwellTotalMSecs / s.dwellCount : 0.0,
+	    s.dwellMaxMSecs);
+  }
+  fclose(file);
+  ArLog::log(ArLog::Verbose, "Goal stats: wrote statistics for %d goals to \"%s\".", (int)stats.size(), fileName);
+  return true;
+}
+
+// One packet per goal (a packet holds a few hundred at most), then an empty one
+void ArServerModeGoto2::serverGoalStats(ArServerClient *client, ArNetPacket * /*pkt*/)
+{
+  // Copied so as not to hold the lock while sending
+  myGoalStatsMutex.lock();
+  std::vector<GoalStats> stats = myGoalStats;
+  std::vector<std::string> names = myGoalStatsNames;
+  myGoalStatsMutex.unlock();
+  ArNetPacket retPkt;
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    const GoalStats& s = stats[i];
+    retPkt.empty();
+    retPkt.strToBuf(names[i].c_str());
+    retPkt.uByte4ToBuf(s.arrivals);
+    retPkt.uByte4ToBuf(s.failures);
+    retPkt.uByte4ToBuf(s.travelCount);
+    retPkt.uByte4ToBuf(s.travelCount > 0 ? (unsigned int)(s.travelTotalMSecs / s.travelCount) : 0);
+    retPkt.uByte4ToBuf(s.travelMinMSecs);
+    retPkt.uByte4ToBuf(s.travelMaxMSecs);
+    for (int b = 0; b < NUM_TRAVEL_BUCKETS; b++)
+      retPkt.uByte4ToBuf(s.travelHistogram[b]);
+    retPkt.uByte4ToBuf(s.planCount > 0 ? (unsigned int)(s.planTotalMSecs / s.planCount) : 0);
+    retPkt.uByte4ToBuf(s.planMaxMSecs);
+    retPkt.uByte4ToBuf(s.dwellCount);
+    retPkt.uByte4ToBuf(s.dwellCount > 0 ? (unsigned int)(s.dwellTotalMSecs / s.dwellCount) : 0);
+    retPkt.uByte4ToBuf(s.dwellMaxMSecs);
+    client->sendPacketTcp(&retPkt);
+  }
+  retPkt.empty();
+  client->sendPacketTcp(&retPkt);
+}
+
+
 AREXPORT void ArServerModeGoto2::addTourGoalCallback(ArFunctor1<ArMapObject*> *func)
 {
-  // TODO add a callback type to ARNL which provides the ArMapObject*.
+  myTourCallbacks.addCallback(func);
 }
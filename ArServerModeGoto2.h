@@ -30,9 +30,15 @@ Amherst, NH 03031
 #include "ArServerMode.h"
 #include "ArPathPlanningTask.h"
 #include "ArBaseLocalizationTask.h"
+#include "ArnlMetrics.h"
+#include "ArnlCallbackProfiler.h"
+#include "ArnlLockProfiler.h"
+#include "ArnlViaPoints.h"
 
 #include <deque>
 #include <string>
+#include <map>
+#include <vector>
 
 //class ArPathPlanningTask;
 class ArActionPlanAndMoveToGoal;
@@ -65,6 +71,13 @@ public:
    */
   AREXPORT void tourGoalsInList(std::deque<std::string> goalList);
 
+  /** Tour the goals in a comma-separated list, expanding items ending in a
+   *  wildcard (*) to matching goals and omitting invalid goals, as for the
+   *  TourGoalsList simple command.
+   *  @return false if the list has a misplaced wildcard
+   */
+  AREXPORT bool tourGoalsInList(const char *goalList);
+
   /** Add a "tour" command to the given "simple commands" object. This
    *  simple (custom) command accepts a comma-separated list of goals,
    *  builds a list of goals, expanding items ending in a wildcard (*)
@@ -73,9 +86,85 @@ public:
    */
   AREXPORT void addTourGoalsInListSimpleCommand(ArServerHandlerCommands *commandsServer);
 
+  /** Add parameters to the given ArConfig section that control how goals
+   *  which repeatedly fail during a tour are quarantined (see
+   *  clearGoalQuarantine()).
+   */
+  AREXPORT void addToConfig(ArConfig *config, const char *section = "Tour goals");
+
+  /** Forget all recorded tour goal failures and release any quarantined
+   *  goals, so that they are tried again on the next pass of the tour.
+   *  This is done automatically when the map changes, and may also be done
+   *  with the clearGoalQuarantine networking request or the
+   *  ClearGoalQuarantine simple command (e.g. after an obstacle blocking
+   *  some goals has been removed).
+   */
+  AREXPORT void clearGoalQuarantine(void);
+
+  /** @return true if the goal is currently quarantined, and will be skipped
+   * when touring goals.
+   */
+  AREXPORT bool isGoalQuarantined(const char *goalName);
+
+  /** Add parameters to the given ArConfig section that control the
+   *  periodic CSV dump of per-goal statistics (see dumpGoalStats()).
+   */
+  AREXPORT void addGoalStatsToConfig(ArConfig *config, const char *section = "Goal statistics");
+
+  /** Write the per-goal statistics table to a CSV file, one row per goal.
+   *  This is done periodically if GoalStatsFile and GoalStatsDumpPeriod are
+   *  configured, and on the DumpGoalStats simple command.
+   *  @return false if the file could not be written
+   */
+  AREXPORT bool dumpGoalStats(const char *fileName);
+
+  /** Add the DumpGoalStats simple command to the given "simple commands"
+   *  object. */
+  AREXPORT void addGoalStatsSimpleCommand(ArServerHandlerCommands *commandsServer);
+
+  /** Record the time a task spent at a goal (dwell time). Usually called
+   *  through the functor returned by getTaskFinishedCB().
+   */
+  AREXPORT void addTaskDwellTime(const std::string& goalName, long msecs);
+
+  /** @return functor that records task dwell times at goals; pass it to
+   *  ArnlASyncTask::addTaskFinishedCB().
+   */
+  ArFunctor2<const std::string&, long> *getTaskFinishedCB(void)
+    { return &myTaskFinishedCB; }
+
+  /** @return index of the named goal among the goals in the map (in map
+   *  order), or -1 if there is no such goal */
+  AREXPORT int getGoalIndex(const char *goalName);
+
+  /** @return position of the current goal in the tour (index in the list
+   *  given to tourGoalsInList(), or index among the map's goals when touring
+   *  all goals), or -1 if not touring goals */
+  AREXPORT int getTourIndex(void);
+
+  /** Where the mode is going, so that it can be resumed after a restart (see
+   *  ArnlCheckpoint): the goal it is going to, whether it is touring goals,
+   *  and when touring a list, the list starting at that goal (empty when
+   *  touring all goals).
+   *  @return false if the mode is not active, is done, or is going home or
+   *  to a point rather than a goal. Locks myProgressMutex, so the robot
+   *  need not be locked */
+  AREXPORT bool getProgress(std::string *goalName, bool *touring,
+			    std::deque<std::string> *tourList);
+
+  /** Go on from where getProgress() said the mode was: go to @a goalName,
+   *  or tour from it (through @a tourList, or all goals if it is empty) */
+  AREXPORT void resumeProgress(const std::string& goalName, bool touring,
+			       const std::deque<std::string>& tourList);
+
   /** Add a callback which is called for each goal when touring goals */
   AREXPORT void addTourGoalCallback(ArFunctor1<ArMapObject*> *callback);
 
+  /** @return the via-points passed through (instead of stopped at) when
+   *  touring goals; add their settings to ArConfig with
+   *  ArnlViaPoints::addToConfig() */
+  ArnlViaPoints *getViaPoints(void) { return myViaPoints; }
+
   /** @internal */
   AREXPORT virtual bool isAutoResumeAfterInterrupt(void);
 
@@ -108,6 +197,14 @@ protected:
   /// Set myGoalName to the name of the next goal in the tour
   void findNextTourGoal(void);
 
+  /** Set the status from any thread; userTask() copies it to myStatus in
+      the robot thread, so that myStatus is only written there. */
+  void setGotoStatus(const std::string& status);
+  /// Set the mode from any thread; userTask() copies it to myMode, like the status
+  void setGotoMode(const char *mode);
+  /// @return the status last set with setGotoStatus(), or through ArnlRobotMailbox
+  std::string getGotoStatus(void);
+
   /** @return number of goals in current tour, or 0 if none */
   size_t numGoalsTouring();
 
@@ -115,14 +212,161 @@ protected:
   /// Keep trying to plan paths to goals in a tour, until either a plan succeeds or all the goals fail.
   void planToNextTourGoal();
 
-  ArMapObject *getCurrentGoalObject();
+  ArMapObject *getGoalObject(const std::string& goalName);
+  bool isCurrentTourGoal(const std::string& goalName);
 
+  /// Failure history of one goal, used to quarantine goals that keep failing.
+  struct GoalFailureInfo
+  {
+    GoalFailureInfo() : consecutiveFailures(0), timesQuarantined(0),
+      quarantined(false), backoffMSecs(0) {}
+    unsigned int consecutiveFailures;
+    unsigned int timesQuarantined;
+    bool quarantined;
+    long backoffMSecs;
+    ArTime retryTime;
+  };
+
+  /// Record a failure to plan to or reach a tour goal, possibly quarantining it.
+  void recordGoalFailure(const std::string& goalName);
+
+  /// Forget the failure history of a goal once it has been reached.
+  void recordGoalReached(const std::string& goalName);
+
+  /// @return true if the goal is quarantined and its backoff has not yet expired.
+  bool checkGoalQuarantined(const std::string& goalName);
+
+  /// @return true if any quarantined goal's backoff has expired, or no goal
+  /// is quarantined any more.
+  bool anyGoalQuarantineExpired();
+
+  void mapChanged(void);
+
+  /// Number of travel time histogram buckets in GoalStats
+  enum { NUM_TRAVEL_BUCKETS = 8 };
+
+  /// Upper bounds (msecs) of all but the last travel time histogram bucket
+  static const long ourTravelBucketLimits[NUM_TRAVEL_BUCKETS - 1];
+
+  /// Performance statistics for one goal in the map
+  struct GoalStats
+  {
+    GoalStats() : arrivals(0), failures(0),
+      travelCount(0), travelTotalMSecs(0), travelMinMSecs(0), travelMaxMSecs(0),
+      planCount(0), planTotalMSecs(0), planMaxMSecs(0),
+      dwellCount(0), dwellTotalMSecs(0), dwellMaxMSecs(0)
+    {
+      for (int i = 0; i < NUM_TRAVEL_BUCKETS; i++)
+        travelHistogram[i] = 0;
+    }
+    unsigned int arrivals;
+    unsigned int failures;
+    /// Travel time from the previous goal (from when this goal was set)
+    unsigned int travelCount;
+    double travelTotalMSecs;
+    long travelMinMSecs;
+    long travelMaxMSecs;
+    unsigned int travelHistogram[NUM_TRAVEL_BUCKETS];
+    /// Time spent in pathPlanToGoal() planning to this goal
+    unsigned int planCount;
+    double planTotalMSecs;
+    long planMaxMSecs;
+    /// Time tasks spent at this goal after arriving (see addTaskDwellTime())
+    unsigned int dwellCount;
+    double dwellTotalMSecs;
+    long dwellMaxMSecs;
+  };
+
+  /// Rebuild myGoalStats when the map changes, keeping stats of goals that remain
+  void rebuildGoalStatsIndex(void);
+
+  /// @return stats for the goal, or NULL if it is not in the map. Lock myGoalStatsMutex first.
+  GoalStats *findGoalStats(const std::string& goalName);
+
+  /// Plan a path to the named goal, recording how long planning took.
+  bool planToGoal(const std::string& goalName);
+
+  /// Record arrival or failure at the path planning task's current goal
+  void recordGoalStats(bool arrived);
+
+  /// Dump the stats to the configured file (in myGoalStatsWriter's thread) if the configured period has elapsed
+  void checkGoalStatsDump(void);
+
+  /** Writes GoalStatsFile in its own thread, so that the path planning
+   *  thread, in which goals are reached, does not wait for the file */
+  class GoalStatsWriter : public ArASyncTask
+  {
+  public:
+    GoalStatsWriter(ArServerModeGoto2 *mode);
+    virtual ~GoalStatsWriter();
+    /// Write @a fileName, starting the thread if need be
+    void request(const std::string& fileName);
+    virtual void *runThread(void *arg);
+  protected:
+    ArServerModeGoto2 *myMode;
+    ArMutex myMutex;
+    ArCondition myCondition;
+    bool myStarted;
+    /// File to write, if any (protected by myMutex)
+    std::string myFileName;
+  };
+
+  void newGoal(ArPose pose);
+
+  /// Called by myViaPoints when the robot passes the tour goal it was heading for: plan the next one
+  void viaPointPassed(const std::string& goalName, const ArPose& pose);
+  void serverGoalStats(ArServerClient *client, ArNetPacket *packet);
+  void dumpGoalStatsCommand(void);
+
+  /// Stats for each goal, indexed by position of the goal in the map (see myGoalStatsIndex)
+  std::vector<GoalStats> myGoalStats;
+  std::vector<std::string> myGoalStatsNames;
+  std::map<std::string, size_t> myGoalStatsIndex;
+  ArMutex myGoalStatsMutex;
+
+  ArnlCounter *myGoalsArrivedMetric;
+  ArnlCounter *myGoalsFailedMetric;
+  ArnlCounter *myGoalsQuarantinedMetric;
+  ArnlCounter *myGoalsPassedMetric;
+  ArnlHistogram *myPlanTimeMetric;
+  ArnlHistogram *myTravelTimeMetric;
+  ArnlHistogram *myDwellTimeMetric;
+  ArTime myLegStartTime;
+  bool myHaveLegStartTime;
+  char myGoalStatsFile[1024];
+  int myGoalStatsDumpPeriodSecs;
+  ArTime myLastGoalStatsDump;
+  void serverGoalQuarantine(ArServerClient *client, ArNetPacket *packet);
+  void serverClearGoalQuarantine(ArServerClient *client, ArNetPacket *packet);
+
+  std::map<std::string, GoalFailureInfo> myGoalFailures;
+  ArMutex myGoalFailuresMutex;
+  int myQuarantineFailures;
+  int myQuarantineBackoffSecs;
+  int myQuarantineMaxBackoffSecs;
+  /// True if the tour is stalled because every goal is quarantined or failed
+  bool myWaitingForQuarantine;
+
+  ArMutex myGotoStatusMutex;
+  /// Copied to myStatus by userTask() if myGotoStatusChanged (protected by myGotoStatusMutex)
+  std::string myGotoStatus;
+  bool myGotoStatusChanged;
+  /// Copied to myMode by userTask() if myGotoModeChanged (protected by myGotoStatusMutex)
+  std::string myGotoMode;
+  bool myGotoModeChanged;
+
+  /** Protects myGoalName and the tour's progress (myTourIndex,
+   * myTouringGoalsList, myResumeTourGoal), which the path planning, timer
+   * wheel, server and robot threads, and getProgress() and resumeProgress()
+   * for ArnlCheckpoint, all use. Never held while planning. */
+  ArMutex myProgressMutex;
   ArPose myGoalPose;
   bool myDone;
   bool myUseHeading;
   std::string myGoalName;
   bool myGoingHome;
   ArMapInterface *myMap;
+  ArnlLockStats *myMapLockStats;
   ArPose myHome;
   ArRetFunctor<ArPose> *myGetHomePoseCB;
   bool myTouringGoals;
@@ -135,14 +379,34 @@ protected:
   ArFunctor2C<ArServerModeGoto2, ArServerClient *, ArNetPacket *> myServerHomeCB;
   ArFunctor2C<ArServerModeGoto2, ArServerClient *, ArNetPacket *> myServerTourGoalsCB;
   ArFunctor2C<ArServerModeGoto2, ArServerClient *, ArNetPacket *> myServerGoalNameCB;
+  ArFunctor2C<ArServerModeGoto2, ArServerClient *, ArNetPacket *> myServerGoalQuarantineCB;
+  ArFunctor2C<ArServerModeGoto2, ArServerClient *, ArNetPacket *> myServerClearGoalQuarantineCB;
+  ArFunctorC<ArServerModeGoto2> myMapChangedCB;
+  ArFunctorC<ArServerModeGoto2> myClearGoalQuarantineCB;
+  ArFunctor1C<ArServerModeGoto2, ArPose> myNewGoalCB;
+  ArFunctor2C<ArServerModeGoto2, const std::string&, long> myTaskFinishedCB;
+  ArFunctor2C<ArServerModeGoto2, const std::string&, const ArPose&> myViaPointPassedCB;
+  ArnlViaPoints *myViaPoints;
+  ArFunctor2C<ArServerModeGoto2, ArServerClient *, ArNetPacket *> myServerGoalStatsCB;
+  ArFunctorC<ArServerModeGoto2> myDumpGoalStatsCB;
+  /// After myGoalStats, so that its thread is stopped first
+  GoalStatsWriter myGoalStatsWriter;
 
   void serverGoalName(ArServerClient* client, ArNetPacket* pkt);
   void pathPlannerStateChanged();
   std::deque<std::string> myTouringGoalsList; ///< @todo use an ArArgumentBuilder instead of a deque?
   bool myAmTouringGoalsInList;
+  /// Goal for findNextTourGoal() to start a tour of all goals at (see resumeProgress())
+  std::string myResumeTourGoal;
+  int myTourIndex;
   ArFunctor1C<ArServerModeGoto2, ArArgumentBuilder*> myTourGoalsInListSimpleCommandCB;
   AREXPORT void tourGoalsInListCommand(ArArgumentBuilder *args); ///< Used as callback from ArServerHandlerCommands (simple/custom commands)
 
+  /// Registered with the path planning task in place of the callbacks above, for ArnlCallbackProfiler
+  ArnlProfiledFunctor1<ArPose> myProfiledGoalDoneCB;
+  ArnlProfiledFunctor1<ArPose> myProfiledGoalFailedCB;
+  ArnlProfiledFunctor1<ArPose> myProfiledNewGoalCB;
+
   ArCallbackList1<ArMapObject*> myTourCallbacks;
 };
 
@@ -10,6 +10,17 @@ All rights reserved. 
 #include "ArNetworking.h"
 #include "Arnl.h"
 #include "ArPathPlanningTask.h"
+#include "ArnlMetrics.h"
+#include "ArnlThreadScheduler.h"
+#include "ArnlCallbackProfiler.h"
+#include "ArnlLockProfiler.h"
+#include "ArnlTaskWatchdog.h"
+#include "ArnlGoalFuture.h"
+#include "ArnlMotionSequence.h"
+#include "ArnlRobotMailbox.h"
+#include "ArnlViaPoints.h"
+#include "ArnlPathTask.h"
+#include "ArnlClock.h"
 
 /**
   Use this to help run your own custom tasks or activities, triggered when ARNL navigation
@@ -52,12 +63,46 @@ All rights reserved. 
   <tt>new</tt>.
 
   The base class adds a config section named for the task containing a flag
-  to enable or disable the task.  You may add additional configuration
+  to enable or disable the task, and the task's expected and maximum
+  durations (see setDurations()).  You may add additional configuration
   parameters to this section if desired by calling addConfigParam().
 
+  Each run of the task is watched by ArnlTaskWatchdog: a warning is logged if
+  it runs longer than its expected duration, and it is cancelled if it runs
+  longer than its maximum duration. Cancellation is cooperative: runTask()
+  should check cancelRequested() between steps and return early if it is
+  true. waitForMoveDone() stops waiting when the task is cancelled.
+
+  To drive the robot through several steps at a goal (e.g. approach, wait,
+  back up), build an ArnlMotionSequence and pass it to runMotion(), which
+  runs the steps back-to-back in the robot thread, then waitForMotion();
+  this avoids locking the robot and polling from the task thread for each
+  step.
+
+  To command the robot from a task thread without locking it (which would
+  make concurrent tasks wait for each other and for the robot thread), use
+  getMailbox(): for example getMailbox()->setDigitalOutputs(mask, bits).
+
 
   You may call nextGoal("goal name"); to plan to another goal if desired.
-  (This is just a shortcut to calling ArPathPlanningTask::pathPlanToGoal()).
+  (This is a shortcut to calling ArPathPlanningTask::pathPlanToGoal()). It
+  returns an ArnlGoalFuture which completes when the robot arrives, fails, or
+  the goal is preempted by another, so a task can wait for the outcome or
+  chain the next step with ArnlGoalFuture::then().
+
+  If the goal given to nextGoal() is a via-point (see ArnlViaPoints), the
+  robot does not stop there: as it passes, the future completes with status
+  PASSED, and the task is run (if the goal name matches) as it would be on
+  arriving, so that it can send the robot on to the next goal. Use
+  isViaPoint(getLastGoalName()) in runTask() to skip work which needs the
+  robot to have stopped.
+
+  A task may be given any ArnlPathTask instead of an ArPathPlanningTask: for
+  example ArnlSimulatedNavigation, to run it in virtual time without a robot
+  (see ArnlVirtualTime.h and taskChainSimulator). Via-points are looked up in
+  the path planning task's map, so without one no goal is a via-point. Task
+  threads are counted by ArnlClock, so that in virtual time each runs until
+  it waits before time moves on.
 
 
   C++ Code Examples:
@@ -165,9 +210,34 @@ public:
   ) :
     myName(name),
     myGoalDoneCB(this, &ArnlASyncTask::goalDone),
+    myProfiledGoalDoneCB(&myGoalDoneCB, (name + " goalDone").c_str()),
+    myGoalReachedCB(this, &ArnlASyncTask::goalReached),
+    myGoalFailedCB(this, &ArnlASyncTask::goalFailed),
+    myGoalInterruptedCB(this, &ArnlASyncTask::goalInterrupted),
+    myViaPointPassedCB(this, &ArnlASyncTask::viaPointPassed),
+    myPathPlanningTaskAdapter(pp),
+    myFunctor(functor), myAllocatedFunctor(false)
+  {
+    init(&myPathPlanningTaskAdapter, robot, argParser, goalPrefix, goalSuffix);
+  }
+
+  /// Supply a callback functor to call at goals reached with @a pathTask (e.g. ArnlSimulatedNavigation)
+  ArnlASyncTask(ArnlPathTask *pathTask, ArRobot *robot, 
+    const std::string& name, TaskFunctor *functor,
+    ArArgumentParser *argParser = NULL,
+    const std::string& goalPrefix = "", const std::string& goalSuffix = ""
+  ) :
+    myName(name),
+    myGoalDoneCB(this, &ArnlASyncTask::goalDone),
+    myProfiledGoalDoneCB(&myGoalDoneCB, (name + " goalDone").c_str()),
+    myGoalReachedCB(this, &ArnlASyncTask::goalReached),
+    myGoalFailedCB(this, &ArnlASyncTask::goalFailed),
+    myGoalInterruptedCB(this, &ArnlASyncTask::goalInterrupted),
+    myViaPointPassedCB(this, &ArnlASyncTask::viaPointPassed),
+    myPathPlanningTaskAdapter(NULL),
     myFunctor(functor), myAllocatedFunctor(false)
   {
-    init(pp, robot, argParser, goalPrefix, goalPrefix);
+    init(pathTask, robot, argParser, goalPrefix, goalSuffix);
   }
 
 protected:
@@ -189,31 +259,92 @@ protected:
   ) :
     myName(name),
     myGoalDoneCB(this, &ArnlASyncTask::goalDone),
+    myProfiledGoalDoneCB(&myGoalDoneCB, (name + " goalDone").c_str()),
+    myGoalReachedCB(this, &ArnlASyncTask::goalReached),
+    myGoalFailedCB(this, &ArnlASyncTask::goalFailed),
+    myGoalInterruptedCB(this, &ArnlASyncTask::goalInterrupted),
+    myViaPointPassedCB(this, &ArnlASyncTask::viaPointPassed),
+    myPathPlanningTaskAdapter(pp),
     myFunctor(new NullTaskFunctor()), myAllocatedFunctor(true)
   {
-    init(pp, robot, argParser, goalPrefix, goalPrefix);
+    init(&myPathPlanningTaskAdapter, robot, argParser, goalPrefix, goalSuffix);
+  }
+
+  /// Use this when defining a subclass that overrides runTask(), to run at goals reached with @a pathTask
+  ArnlASyncTask(ArnlPathTask *pathTask, ArRobot *robot, 
+    const std::string& name = "unnamed ArnlASyncTask",
+    ArArgumentParser *argParser = NULL,
+    const std::string& goalPrefix = "", const std::string& goalSuffix = ""
+  ) :
+    myName(name),
+    myGoalDoneCB(this, &ArnlASyncTask::goalDone),
+    myProfiledGoalDoneCB(&myGoalDoneCB, (name + " goalDone").c_str()),
+    myGoalReachedCB(this, &ArnlASyncTask::goalReached),
+    myGoalFailedCB(this, &ArnlASyncTask::goalFailed),
+    myGoalInterruptedCB(this, &ArnlASyncTask::goalInterrupted),
+    myViaPointPassedCB(this, &ArnlASyncTask::viaPointPassed),
+    myPathPlanningTaskAdapter(NULL),
+    myFunctor(new NullTaskFunctor()), myAllocatedFunctor(true)
+  {
+    init(pathTask, robot, argParser, goalPrefix, goalSuffix);
   }
 
   virtual ~ArnlASyncTask()
   {
     // config->remParam(getConfigSectionName(), "Enabled"); // XXX TODO when ArConfig has remParam
-    if(myPathPlanningTask) myPathPlanningTask->remGoalDoneCB(&myGoalDoneCB);
+    if(myPathTask)
+    {
+      myPathTask->remGoalDoneCB(&myProfiledGoalDoneCB);
+      myPathTask->remGoalDoneCB(&myGoalReachedCB);
+      myPathTask->remGoalFailedCB(&myGoalFailedCB);
+      myPathTask->remGoalInterruptedCB(&myGoalInterruptedCB);
+    }
+    if(myViaPoints)
+      myViaPoints->cancel(&myViaPointPassedCB);
     if(myAllocatedFunctor) delete myFunctor;
   }
 
 private:
-  void init(ArPathPlanningTask *pp, ArRobot *robot, ArArgumentParser *argParser,
+  void init(ArnlPathTask *pathTask, ArRobot *robot, ArArgumentParser *argParser,
     const std::string& goalPrefix, const std::string& goalSuffix
   )
 	{
-    myPathPlanningTask = pp;
+    myPathTask = pathTask;
 		myRobot = robot;
     myEnabled = true;
     myHaveGoalNamePrefix = false;
     myHaveGoalNameSuffix = false;
+    myRunRequestedUSecs = 0;
+    myRunMutex.setLogName("ArnlASyncTask::myRunMutex");
+    myExpectedDuration = 0;
+    myMaxDuration = 0;
+    // Created now so that it has the robot's pose by the time a task needs it
+    ArnlRobotMailbox::getMailbox(robot);
+    myViaPoints = pathTask->getPathPlanningTask() != NULL ?
+      ArnlViaPoints::getViaPoints(pathTask->getPathPlanningTask(), robot) : NULL;
+    myLockStats = ArnlLockProfiler::getStats(std::string("task ") + getName());
 		ArConfig *config = Aria::getConfig();
 		config->addParam(ArConfigArg("Enabled", &myEnabled, "Whether this task is enabled"), getConfigSectionName());
-		myPathPlanningTask->addGoalDoneCB(&myGoalDoneCB);
+    config->addParam(ArConfigArg("ExpectedDuration", &myExpectedDuration,
+      "A warning is logged if the task runs longer than this (sec). 0 for no expected duration.", 0),
+      getConfigSectionName());
+    config->addParam(ArConfigArg("MaxDuration", &myMaxDuration,
+      "The task is cancelled if it runs longer than this (sec). 0 for no limit.", 0),
+      getConfigSectionName());
+		myPathTask->addGoalDoneCB(&myProfiledGoalDoneCB);
+    myPathTask->addGoalDoneCB(&myGoalReachedCB);
+    myPathTask->addGoalFailedCB(&myGoalFailedCB);
+    myPathTask->addGoalInterruptedCB(&myGoalInterruptedCB);
+    ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal();
+    myRunsMetric = metrics->getCounter(ArnlMetricsRegistry::withLabel("arnl_task_runs_total", "task", getName()),
+      "Times a task was run at a goal");
+    myRunningMetric = metrics->getGauge(ArnlMetricsRegistry::withLabel("arnl_task_threads_running", "task", getName()),
+      "Task threads currently running");
+    myDurationMetric = metrics->getMSecsHistogram(ArnlMetricsRegistry::withLabel("arnl_task_duration_msecs", "task", getName()),
+      "Time a task took to run at a goal");
+    myStartDelayMetric = metrics->getHistogram(ArnlMetricsRegistry::withLabel("arnl_task_start_delay_usecs", "task", getName()),
+      "Time from reaching a goal until the task thread started running",
+      ArnlThreadScheduler::ourLatencyBounds, ArnlThreadScheduler::ourNumLatencyBounds);
     if(goalPrefix != "")
       runIfGoalNamePrefix(goalPrefix);
     if(goalSuffix != "")
@@ -236,30 +367,110 @@ public:
     myGoalNameSuffix = suffix;
   }
 
+  /** Set the default durations of the task, in seconds (which may be
+   * changed in the task's config section). If a run of the task takes
+   * longer than @a expectedSecs a warning is logged; if it takes longer than
+   * @a maxSecs it is cancelled (see cancelRequested()). 0 disables either.
+   */
+  void setDurations(int expectedSecs, int maxSecs)
+  {
+    myExpectedDuration = expectedSecs;
+    myMaxDuration = maxSecs;
+  }
+
+  /** Add a callback to be called in the task thread each time the task
+   * finishes at a goal, with the goal name and the time in milliseconds the
+   * task took (i.e. how long the task dwelled at the goal). For example, pass
+   * ArServerModeGoto2::getTaskFinishedCB() to include task dwell times in
+   * its goal statistics.
+   */
+  void addTaskFinishedCB(ArFunctor2<const std::string&, long> *cb)
+  {
+    lock();
+    myTaskFinishedCBs.push_back(cb);
+    unlock();
+  }
+
+  void remTaskFinishedCB(ArFunctor2<const std::string&, long> *cb)
+  {
+    lock();
+    myTaskFinishedCBs.remove(cb);
+    unlock();
+  }
+
 protected:
   /** Override this method in a subclass to perform task actions, if no functor
     * has been supplied.. */
   virtual void runTask() {}
 
 
-  /// Utility that you can use to easily set a new goal on the path planner task
-  void nextGoal(const std::string goalName)
+  /** Utility that you can use to easily set a new goal on the path planner
+   * task (ArnlPathTask::pathPlanToGoal()). The returned future completes (in the path planning thread) when
+   * the robot arrives at the goal, fails to get there, or the goal is
+   * interrupted by another goal or mode.
+   */
+  ArnlGoalFuture nextGoal(const std::string goalName)
   {
     ArLog::log(ArLog::Normal, "%s: Going to new goal: %s", getName(), goalName.c_str());
-    myPathPlanningTask->pathPlanToGoal(goalName.c_str());
+    ArnlGoalPromise promise(goalName);
+    if(!myPathTask->pathPlanToGoal(goalName.c_str()))
+    {
+      promise.complete(ArnlGoalResult::FAILED, getRobotPose());
+      return promise.getFuture();
+    }
+    // Added after the goal is set, so that the interruption of a previous goal doesn't complete it
+    myGoalsMutex.lock();
+    myPendingGoals.push_back(promise);
+    myGoalsMutex.unlock();
+    if(myViaPoints && myViaPoints->isViaPoint(goalName))
+      myViaPoints->watch(goalName, &myViaPointPassedCB);
+    return promise.getFuture();
   }
 
   /// Utility in case you are using ArRobot::move() in a task but want to wait in that task thread for the movement
-  void waitForMoveDone()
+  /// (without locking the robot: see ArnlRobotMailbox::isMoveDone())
+  /// @return false if the task was cancelled before the movement was done
+  bool waitForMoveDone()
   {
-    myRobot->lock();
-    while(!myRobot->isMoveDone())
+    ArnlRobotMailbox *mailbox = getMailbox();
+    // The robot's state as of the cycle before the move was commanded is not enough
+    const unsigned long cycles = mailbox->getCycles();
+    while(mailbox->getCycles() == cycles || !mailbox->isMoveDone())
     {
-      myRobot->unlock();
-      ArUtil::sleep(100);
-      myRobot->lock();
+      if(cancelRequested())
+        return false;
+      ArUtil::sleep(20);
     }
-    myRobot->unlock();
+    return true;
+  }
+
+  /** Run the steps of @a seq in the robot thread (see ArnlMotionExecutor),
+   * preempting any motion sequence already running for this robot. The
+   * returned future completes when all steps are done.
+   */
+  ArnlGoalFuture runMotion(const ArnlMotionSequence& seq)
+  {
+    return ArnlMotionExecutor::getExecutor(myRobot)->run(seq);
+  }
+
+  /// Wait in the task thread for a future from runMotion(); if the task is cancelled, cancel the motion too
+  ArnlGoalResult waitForMotion(const ArnlGoalFuture& future)
+  {
+    while(!future.waitFor(100))
+    {
+      if(cancelRequested())
+      {
+        ArnlMotionExecutor::getExecutor(myRobot)->cancel(future);
+        return future.wait();
+      }
+    }
+    return future.getResult();
+  }
+
+  /// Whether this run of the task has been cancelled for exceeding its maximum duration. Call from runTask().
+  bool cancelRequested() const
+  {
+    return ArnlTaskWatchdog::cancelRequested();
   }
 
 protected:
@@ -270,31 +481,110 @@ protected:
   bool addConfigParam(const ArConfigArg &arg) {
     return Aria::getConfig()->addParam(arg, getConfigSectionName());
   }
-  void lock() {
-    myMutex.lock();
+  /// Lock the task's mutex. Pass ARNL_LOCK_SITE as @a site to have lock profiling report the caller.
+  void lock(const char *site = "ArnlASyncTask::lock") {
+    myLockStats->lock(&myMutex, site);
   }
 
   void unlock() {
-    myMutex.unlock();
+    myLockStats->unlock(&myMutex);
   }
 
   ArRobot *getRobot() { return myRobot; }
 
-  ArPathPlanningTask *getPathPlanningTask() { return myPathPlanningTask; }
+  /// Commands for the robot thread, which do not need the robot locked
+  ArnlRobotMailbox *getMailbox() { return ArnlRobotMailbox::getMailbox(myRobot); }
+
+  /// Whether the robot passes through @a goalName without stopping (see ArnlViaPoints)
+  bool isViaPoint(const std::string& goalName) { return myViaPoints && myViaPoints->isViaPoint(goalName); }
+
+  /** Called in the path planning thread when the task should run at a goal
+   * (getLastGoalName(), getLastGoalPose()). The default creates a thread which
+   * calls runTask() and the functor. A subclass which runs the task some
+   * other way should call taskStarting() and taskFinished() around each run.
+   */
+  virtual void startTask()
+  {
+    ArnlClock::threadStarting();
+    runAsync();
+  }
+
+  std::string getLastGoalName()
+  {
+    myRunMutex.lock();
+    const std::string goalName = myLastGoalName;
+    myRunMutex.unlock();
+    return goalName;
+  }
+
+  ArPose getLastGoalPose()
+  {
+    myRunMutex.lock();
+    const ArPose pose = myLastGoalPose;
+    myRunMutex.unlock();
+    return pose;
+  }
+
+  /// Count a run of the task as started (for its metrics)
+  void taskStarting()
+  {
+    myRunsMetric->add();
+    myRunningMetric->add(1);
+  }
+
+  /// Count a run of the task as finished after @a msecs, and call the task finished callbacks
+  void taskFinished(const std::string& goalName, long msecs)
+  {
+    myRunningMetric->add(-1);
+    myDurationMetric->observe(msecs);
+    lock();
+    std::list<ArFunctor2<const std::string&, long>*> cbs = myTaskFinishedCBs;
+    unlock();
+    for(std::list<ArFunctor2<const std::string&, long>*>::const_iterator i = cbs.begin(); i != cbs.end(); ++i)
+      (*i)->invoke(goalName, msecs);
+  }
+
+  /// NULL if the task was given an ArnlPathTask with no ArPathPlanningTask behind it
+  ArPathPlanningTask *getPathPlanningTask() { return myPathTask->getPathPlanningTask(); }
+
+  ArnlPathTask *getPathTask() { return myPathTask; }
 
 private:
   std::string myName;
-	ArPathPlanningTask *myPathPlanningTask;
+	ArnlPathTask *myPathTask;
   ArFunctor1C<ArnlASyncTask, ArPose> myGoalDoneCB;
+  ArnlProfiledFunctor1<ArPose> myProfiledGoalDoneCB;
+  ArFunctor1C<ArnlASyncTask, ArPose> myGoalReachedCB;
+  ArFunctor1C<ArnlASyncTask, ArPose> myGoalFailedCB;
+  ArFunctor1C<ArnlASyncTask, ArPose> myGoalInterruptedCB;
+  ArFunctor2C<ArnlASyncTask, const std::string&, const ArPose&> myViaPointPassedCB;
+  /// Used by the constructors given an ArPathPlanningTask
+  ArnlPathPlanningTaskAdapter myPathPlanningTaskAdapter;
+  /// NULL without an ArPathPlanningTask
+  ArnlViaPoints *myViaPoints;
+  ArMutex myGoalsMutex;
+  std::list<ArnlGoalPromise> myPendingGoals;
   ArRobot *myRobot;
   bool myEnabled;
   ArMutex myMutex;
+  ArnlLockStats *myLockStats;
   bool myHaveGoalNamePrefix, myHaveGoalNameSuffix;
   std::string myGoalNamePrefix, myGoalNameSuffix;
   TaskFunctor* myFunctor;
   bool myAllocatedFunctor;
+  /** Held by goalDone(), which runs in the path planning thread, or in the
+   * timer wheel's thread for a via-point (protects the three below) */
+  ArMutex myRunMutex;
   ArPose myLastGoalPose;
   std::string myLastGoalName;
+  std::list<ArFunctor2<const std::string&, long>*> myTaskFinishedCBs;
+  ArnlCounter *myRunsMetric;
+  ArnlGauge *myRunningMetric;
+  ArnlHistogram *myDurationMetric;
+  ArnlHistogram *myStartDelayMetric;
+  long long myRunRequestedUSecs;
+  int myExpectedDuration;
+  int myMaxDuration;
 
   /// ArASyncTask calls this in the new thread. Call subclass overloaded
   /// runTask() and invoke functor. (Either of which may be empty and do nothing
@@ -302,11 +592,26 @@ private:
   /// @internal
   AREXPORT virtual void *runThread(void *)
   {
+    ArnlClock::threadStarted();
+    myRunMutex.lock();
+    const long long requested = myRunRequestedUSecs;
     const std::string gn = myLastGoalName;
-    const ArPose& p = myLastGoalPose;
+    const ArPose p = myLastGoalPose;
+    myRunMutex.unlock();
+    myStartDelayMetric->observe((double)(ArnlThreadScheduler::getMonotonicUSecs() - requested));
+    ArnlThreadScheduler::threadStarted(ArnlThreadScheduler::TASKS);
     ArLog::log(ArLog::Normal, "%s: Running at %s (%.2f, %.2f, %.2f) ...", getName(), gn.c_str(), p.getX(), p.getY(), p.getTh());
+    ArTime started;
+    started.setToNow();
+    taskStarting();
+    ArnlTaskWatchdog::Watch *watch = ArnlTaskWatchdog::getGlobal()->begin(getName(),
+      myExpectedDuration * 1000L, myMaxDuration * 1000L, myRobot);
     runTask();
-    myFunctor->invoke(gn, p);
+    if(!cancelRequested())
+      myFunctor->invoke(gn, p);
+    ArnlTaskWatchdog::getGlobal()->end(watch);
+    taskFinished(gn, started.mSecSince());
+    ArnlClock::threadFinished();
     return 0;
   }
 
@@ -319,16 +624,94 @@ private:
 	{
     if(myEnabled && matchCriteria())
     {
+      const std::string goalName = myPathTask->getCurrentGoalName();
+      // startTask() only starts a thread or schedules a coroutine, so it is
+      // quick enough to call with the mutex held
+      myRunMutex.lock();
       myLastGoalPose = pose;
-      myLastGoalName = myPathPlanningTask->getCurrentGoalName();
-      runAsync();
+      myLastGoalName = goalName;
+      myRunRequestedUSecs = ArnlThreadScheduler::getMonotonicUSecs();
+      startTask();
+      myRunMutex.unlock();
     }
 	}
 
+  /// @internal
+  ArPose getRobotPose()
+  {
+    return getMailbox()->getPose();
+  }
+
+  /** Path planning callbacks which complete the futures returned by
+   * nextGoal(). Only one goal is active at a time, so any outcome completes
+   * all pending futures: those for another goal as preempted.
+   * @internal
+   */
+  void goalReached(ArPose)
+  {
+    finishGoals(ArnlGoalResult::ARRIVED, myPathTask->getCurrentGoalName());
+  }
+
+  /// @internal
+  void goalFailed(ArPose)
+  {
+    finishGoals(ArnlGoalResult::FAILED, myPathTask->getCurrentGoalName());
+  }
+
+  /// @internal
+  void goalInterrupted(ArPose)
+  {
+    finishGoals(ArnlGoalResult::PREEMPTED, "");
+  }
+
+  /** Called (in the timer wheel's thread) when the robot passes a via-point
+   * requested with nextGoal(): complete its future, and run the task as if
+   * the robot had arrived there.
+   * @internal
+   */
+  void viaPointPassed(const std::string& goalName, const ArPose& pose)
+  {
+    std::list<ArnlGoalPromise> passed;
+    myGoalsMutex.lock();
+    for(std::list<ArnlGoalPromise>::iterator i = myPendingGoals.begin(); i != myPendingGoals.end(); )
+    {
+      if(i->getGoalName() == goalName)
+      {
+        passed.push_back(*i);
+        i = myPendingGoals.erase(i);
+      }
+      else
+        ++i;
+    }
+    myGoalsMutex.unlock();
+    for(std::list<ArnlGoalPromise>::iterator i = passed.begin(); i != passed.end(); ++i)
+      i->complete(ArnlGoalResult::PASSED, pose);
+    goalDone(pose);
+  }
+
+  /// @internal
+  void finishGoals(ArnlGoalResult::Status status, const std::string& goalName)
+  {
+    myGoalsMutex.lock();
+    if(myPendingGoals.empty())
+    {
+      myGoalsMutex.unlock();
+      return;
+    }
+    std::list<ArnlGoalPromise> goals;
+    goals.swap(myPendingGoals);
+    myGoalsMutex.unlock();
+    const ArPose pose = getRobotPose();
+    for(std::list<ArnlGoalPromise>::iterator i = goals.begin(); i != goals.end(); ++i)
+      i->complete(i->getGoalName() == goalName ? status : ArnlGoalResult::PREEMPTED, pose);
+  }
+
   /// Check whether any criteria for running the task match the current goal
   /// @internal
   bool matchCriteria()
   {
+    if(!myHaveGoalNamePrefix && !myHaveGoalNameSuffix)
+      return true;
     if(myHaveGoalNamePrefix && goalNamePrefixMatch(myGoalNamePrefix))
       return true;
     if(myHaveGoalNameSuffix && goalNameSuffixMatch(myGoalNameSuffix))
@@ -341,15 +724,17 @@ private:
   bool goalNamePrefixMatch(const std::string& prefix)
   {
     // todo more efficient compare
-    return (myPathPlanningTask->getCurrentGoalName().compare(0, prefix.size(), prefix) == 0);
+    return (myPathTask->getCurrentGoalName().compare(0, prefix.size(), prefix) == 0);
   }
 
   /// @internal
   bool goalNameSuffixMatch(const std::string& suffix)
   {
     // todo more efficient compare
-    const std::string& currentname = myPathPlanningTask->getCurrentGoalName();
-    return (currentname.compare(currentname.size()-suffix.size(), currentname.size(), suffix));
+    const std::string& currentname = myPathTask->getCurrentGoalName();
+    if(currentname.size() < suffix.size())
+      return false;
+    return (currentname.compare(currentname.size()-suffix.size(), suffix.size(), suffix) == 0);
   }
 };
 
@@ -0,0 +1,161 @@
+#ifndef ARNLASYNCTASKEXAMPLE_H
+#define ARNLASYNCTASKEXAMPLE_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include "ArnlASyncTask.h"
+
+/* The example goal chain task of arnlServerWithAsyncTaskChain, also run in
+ * virtual time by taskChainSimulator.
+ */
+class ArnlASyncTaskExample : public virtual ArnlASyncTask
+{
+  ArServerMode *myServerMode;
+  int myCurrentGoal;
+  int myNumGoals;
+  int myApproachDist;
+public:
+  ArnlASyncTaskExample(ArPathPlanningTask *pp, ArRobot *robot, ArServerMode *servermode, ArArgumentParser *argParser) : 
+    ArnlAsyncTask(pp, robot, "Example ARNL Goal Task", argParser),
+    myServerMode(servermode), myCurrentGoal(1), myNumGoals(4), myApproachDist(250)
+	{	
+    init();
+	}
+
+  /// With another path planner, e.g. ArnlSimulatedNavigation in taskChainSimulator (@a servermode may be NULL)
+  ArnlASyncTaskExample(ArnlPathTask *pathTask, ArRobot *robot, ArServerMode *servermode, ArArgumentParser *argParser) : 
+    ArnlAsyncTask(pathTask, robot, "Example ARNL Goal Task", argParser),
+    myServerMode(servermode), myCurrentGoal(1), myNumGoals(4), myApproachDist(250)
+	{	
+    init();
+	}
+
+private:
+  void init()
+  {
+    // Add some parameters to ArConfig so they can be changed in MobileEyes.
+		addConfigParam(ArConfigArg("ApproachDist", &myApproachDist, "distance to approach drop point"));
+		addConfigParam(ArConfigArg("NumGoals", &myNumGoals, "number of goals in chain"));
+
+    // Each run normally takes about 5 seconds; give up on it after a minute.
+    setDurations(15, 60);
+
+    ArLog::log(ArLog::Normal, "ArArnlASyncTaskExample created:  will perform tasks at each goal, and then send ARNL to another. ");
+  }
+
+public:
+  /// Set the chain length and approach distance (otherwise set with ArConfig)
+  void setChain(int numGoals, int approachDist)
+  {
+    lock(ARNL_LOCK_SITE);
+    myNumGoals = numGoals;
+    myApproachDist = approachDist;
+    unlock();
+  }
+
+  /// Position in the chain, saved by ArnlCheckpoint
+  int getCurrentGoal()
+  {
+    lock(ARNL_LOCK_SITE);
+    int currentGoal = myCurrentGoal;
+    unlock();
+    return currentGoal;
+  }
+
+  void setCurrentGoal(int currentGoal)
+  {
+    lock(ARNL_LOCK_SITE);
+    myCurrentGoal = currentGoal;
+    unlock();
+  }
+
+  /* This is called at each goal point.  It moves the robot forward a bit, waits 3 seconds
+   * then backs the mobile robot up.  Then it tells the ARNL path planner to
+   * navigate to the next goal point in the chain (named Goal 0, Goal 1, Goal 2, etc.)
+   * The last goal point is special, no action and the chain of ARNL goals
+   * stops.  The robot will wait at this goal point until sent to the first
+   * goal manually from MobileEyes.
+   */
+	void runTask()
+	{
+    // Make copies of variables shared between threads 
+    lock(ARNL_LOCK_SITE);
+    int currentGoal = myCurrentGoal;
+    int numGoals = myNumGoals;
+    int moveDist = myApproachDist;
+    unlock();
+
+		// if at end of chain, stop chain
+		if(currentGoal == numGoals)
+		{
+			ArLog::log(ArLog::Normal, "Waiting to be loaded, end of chain.");
+			if(myServerMode) getMailbox()->setStatus("End of goal chain.");
+      lock(ARNL_LOCK_SITE);
+			myCurrentGoal = 1;
+      unlock();
+			return; // end of thread
+		}
+
+
+
+    /* In this example, we will move the robot forward a bit, wait, then move it
+       back. 
+
+       In your application, you could do somethng here like trigger devices, cameras,
+       sensors, output, speech, etc.  You can access the current goal name and
+       use that to control the activity, or use that goal name to obtain the
+       goal object from the map ArMap object which has additional properties of
+       the goal.
+    */
+
+    // A via-point is only a waypoint: the robot is passing through it, so
+    // just go on to the next goal.
+    if(!isViaPoint(getLastGoalName()))
+    {
+      ArLog::log(ArLog::Normal, "Would do goal-specific task at goal %d.", currentGoal);
+
+      // Move forward a bit, wait, and back up a bit. The steps are run
+      // back-to-back by the robot thread; this thread just waits for the end.
+      ArnlMotionSequence approach("approach");
+      approach.status("Moving forward").move(moveDist).dwell(500)
+        .status("Waiting 3 sec").dwell(3000)
+        .status("Backing up a bit").move(-moveDist).dwell(500);
+      if(!waitForMotion(runMotion(approach)).arrived())
+      {
+        // Cancelled by the task watchdog, or preempted by another motion sequence
+        return;
+      }
+    }
+
+
+		/* Go to the next goal in the chain. The name is assumed to be "Goal X"
+		   where X is the goal index number.  You could use another scheme for
+		   naming goals, or you could store a list of strings in this class
+    */
+		++currentGoal;
+		if(currentGoal > numGoals) currentGoal = 0;
+		char name[128];
+		snprintf(name, 127, "Goal %d", currentGoal); 
+		ArLog::log(ArLog::Normal, "Going to next goal %s", name);
+    if(myServerMode) getMailbox()->setStatus("ASyncTask example done. Going to next goal.");
+    nextGoal(name);
+
+    // Save the new goal index
+    lock(ARNL_LOCK_SITE);
+    myCurrentGoal = currentGoal;
+    unlock();
+
+    // This is the end of the thread. 
+    return;
+	}
+	
+};
+
+
+#endif
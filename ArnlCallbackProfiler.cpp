@@ -0,0 +1,203 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlCallbackProfiler.h"
+#include "ArnlThreadScheduler.h"
+
+#include <algorithm>
+#include <vector>
+
+std::atomic<bool> ArnlCallbackProfiler::ourEnabled(false);
+std::atomic<long long> ArnlCallbackProfiler::ourCallbackBudgetUSecs(0);
+thread_local ArnlCallbackProfiler::Cycle *ArnlCallbackProfiler::ourCycle = NULL;
+ArMutex ArnlCallbackProfiler::ourInfoMutex;
+std::map<std::string, ArnlCallbackInfo *> ArnlCallbackProfiler::ourInfos;
+
+ArnlCallbackTimer::ArnlCallbackTimer(ArnlCallbackInfo *info) :
+  myInfo(info),
+  myStartUSecs(ArnlCallbackProfiler::isEnabled() ? ArnlThreadScheduler::getMonotonicUSecs() : 0)
+{
+}
+
+ArnlCallbackTimer::~ArnlCallbackTimer()
+{
+  if (myStartUSecs != 0)
+    ArnlCallbackProfiler::record(myInfo, ArnlThreadScheduler::getMonotonicUSecs() - myStartUSecs);
+}
+
+ArnlCallbackProfiler::ArnlCallbackProfiler(ArRobot *robot, ArnlMetricsRegistry *metrics) :
+  myRobot(robot),
+  myMetrics(metrics),
+  mySuppressedLogs(0),
+  myConfigEnabled(false),
+  myCycleBudget(0),
+  myCallbackBudget(20),
+  myNumOffenders(5),
+  myCycleStartedCB(this, &ArnlCallbackProfiler::cycleStarted),
+  myCycleEndedCB(this, &ArnlCallbackProfiler::cycleEnded),
+  myProcessFileCB(this, &ArnlCallbackProfiler::processFile)
+{
+  myCycle.startUSecs = 0;
+  myCycle.numEntries = 0;
+  myOverrunsMetric = myMetrics->getCounter("arnl_robot_cycle_overruns_total",
+    "Robot cycles which took longer than the cycle budget");
+  myCycleMetric = myMetrics->getMSecsHistogram("arnl_robot_cycle_msecs",
+    "Time from the start of sensor interpretation to the end of user tasks in each robot cycle");
+  myRobot->lock();
+  // Before any other sensor interpretation task, and after all user tasks
+  myRobot->addSensorInterpTask("ArnlCallbackProfiler start", 10000, &myCycleStartedCB);
+  myRobot->addUserTask("ArnlCallbackProfiler end", 1, &myCycleEndedCB);
+  myRobot->unlock();
+}
+
+ArnlCallbackProfiler::~ArnlCallbackProfiler()
+{
+  myRobot->lock();
+  myRobot->remSensorInterpTask(&myCycleStartedCB);
+  myRobot->remUserTask(&myCycleEndedCB);
+  myRobot->unlock();
+}
+
+void ArnlCallbackProfiler::addToConfig(ArConfig *config, const char *section)
+{
+  myConfigEnabled = ourEnabled;
+  config->addParam(
+	  ArConfigArg("Enabled", &myConfigEnabled,
+		      "Time profiled callbacks and log those taking the most time in robot cycles which overrun"),
+	  section, ArPriority::DETAILED);
+  config->addParam(
+	  ArConfigArg("CycleBudget", &myCycleBudget,
+		      "Robot cycles taking longer than this (ms) are logged. 0 uses the robot's cycle time.",
+		      0),
+	  section, ArPriority::DETAILED);
+  config->addParam(
+	  ArConfigArg("CallbackBudget", &myCallbackBudget,
+		      "Profiled callbacks outside the robot thread taking longer than this (ms) are logged. 0 disables.",
+		      0),
+	  section, ArPriority::DETAILED);
+  config->addParam(
+	  ArConfigArg("NumOffenders", &myNumOffenders,
+		      "Number of callbacks to log for each overrun",
+		      1, ARNL_PROFILER_MAX_CYCLE_ENTRIES),
+	  section, ArPriority::DETAILED);
+  config->addProcessFileCB(&myProcessFileCB, 40);
+}
+
+bool ArnlCallbackProfiler::processFile(void)
+{
+  ourCallbackBudgetUSecs = (long long)myCallbackBudget * 1000;
+  ourEnabled = myConfigEnabled;
+  return true;
+}
+
+ArnlCallbackInfo *ArnlCallbackProfiler::getInfo(const std::string& name)
+{
+  ourInfoMutex.lock();
+  std::map<std::string, ArnlCallbackInfo *>::iterator it = ourInfos.find(name);
+  ArnlCallbackInfo *info;
+  if (it != ourInfos.end())
+  {
+    info = it->second;
+  }
+  else
+  {
+    info = new ArnlCallbackInfo;
+    info->name = name;
+    info->durations = ArnlMetricsRegistry::getGlobal()->getHistogram(
+      ArnlMetricsRegistry::withLabel("arnl_callback_duration_usecs", "callback", name),
+      "Time taken by each invocation of a profiled callback",
+      ArnlThreadScheduler::ourLatencyBounds, ArnlThreadScheduler::ourNumLatencyBounds);
+    ourInfos[name] = info;
+  }
+  ourInfoMutex.unlock();
+  return info;
+}
+
+ArFunctor *ArnlCallbackProfiler::wrap(ArFunctor *functor, const char *name)
+{
+  return new ArnlProfiledFunctor(functor, name);
+}
+
+void ArnlCallbackProfiler::record(ArnlCallbackInfo *info, long long usecs)
+{
+  info->durations->observe((double)usecs);
+  Cycle *cycle = ourCycle;
+  if (cycle != NULL)
+  {
+    // In the robot thread: remember it for the end of the cycle
+    if (cycle->numEntries < ARNL_PROFILER_MAX_CYCLE_ENTRIES)
+    {
+      cycle->entries[cycle->numEntries].info = info;
+      cycle->entries[cycle->numEntries].usecs = usecs;
+      cycle->numEntries++;
+    }
+    return;
+  }
+  const long long budget = ourCallbackBudgetUSecs.load(std::memory_order_relaxed);
+  if (budget > 0 && usecs > budget)
+    ArLog::log(ArLog::Normal, "ArnlCallbackProfiler: %s took %.1f ms (budget %lld ms)",
+	       info->name.c_str(), usecs / 1000.0, budget / 1000);
+}
+
+void ArnlCallbackProfiler::cycleStarted(void)
+{
+  // Only the robot thread sees this cycle record
+  ourCycle = &myCycle;
+  myCycle.numEntries = 0;
+  myCycle.startUSecs = isEnabled() ? ArnlThreadScheduler::getMonotonicUSecs() : 0;
+}
+
+void ArnlCallbackProfiler::cycleEnded(void)
+{
+  if (myCycle.startUSecs == 0)
+    return;
+  const long long cycleUSecs = ArnlThreadScheduler::getMonotonicUSecs() - myCycle.startUSecs;
+  myCycleMetric->observe(cycleUSecs / 1000.0);
+  const long long budgetUSecs = 1000LL * (myCycleBudget > 0 ? myCycleBudget : myRobot->getCycleTime());
+  if (cycleUSecs <= budgetUSecs)
+    return;
+  myOverrunsMetric->add();
+  if (myLastLogTime.mSecSince() < 1000)
+  {
+    mySuppressedLogs++;
+    return;
+  }
+  logOffenders(cycleUSecs, budgetUSecs);
+  myLastLogTime.setToNow();
+  mySuppressedLogs = 0;
+}
+
+static bool longerEntry(const std::pair<long long, ArnlCallbackInfo *>& a,
+  const std::pair<long long, ArnlCallbackInfo *>& b)
+{
+  return a.first > b.first;
+}
+
+void ArnlCallbackProfiler::logOffenders(long long cycleUSecs, long long budgetUSecs)
+{
+  // Total the time of each callback (which may have run more than once)
+  std::vector<std::pair<long long, ArnlCallbackInfo *> > totals;
+  long long profiledUSecs = 0;
+  for (int i = 0; i < myCycle.numEntries; i++)
+  {
+    const CycleEntry& e = myCycle.entries[i];
+    profiledUSecs += e.usecs;
+    size_t j;
+    for (j = 0; j < totals.size() && totals[j].second != e.info; j++)
+      ;
+    if (j == totals.size())
+      totals.push_back(std::pair<long long, ArnlCallbackInfo *>(0, e.info));
+    totals[j].first += e.usecs;
+  }
+  std::sort(totals.begin(), totals.end(), longerEntry);
+
+  ArLog::log(ArLog::Normal, "ArnlCallbackProfiler: robot cycle took %.1f ms (budget %.1f ms, %d overruns not logged since last report):",
+	     cycleUSecs / 1000.0, budgetUSecs / 1000.0, mySuppressedLogs);
+  for (size_t i = 0; i < totals.size() && (int)i < myNumOffenders; i++)
+    ArLog::log(ArLog::Normal, "ArnlCallbackProfiler:   %8.2f ms  %s",
+	       totals[i].first / 1000.0, totals[i].second->name.c_str());
+  ArLog::log(ArLog::Normal, "ArnlCallbackProfiler:   %8.2f ms  (not profiled)",
+	     (cycleUSecs - profiledUSecs) / 1000.0);
+}
@@ -0,0 +1,230 @@
+#ifndef ARNLCALLBACKPROFILER_H
+#define ARNLCALLBACKPROFILER_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include "ArnlMetrics.h"
+
+#include <atomic>
+#include <string>
+
+/// Maximum number of profiled callbacks remembered per robot cycle
+#define ARNL_PROFILER_MAX_CYCLE_ENTRIES 64
+
+/**
+  Timing data for one profiled callback: a histogram of its durations in
+  microseconds (arnl_callback_duration_usecs{callback="name"}). Obtain with
+  ArnlCallbackProfiler::getInfo().
+*/
+struct ArnlCallbackInfo
+{
+  std::string name;
+  ArnlHistogram *durations;
+};
+
+/**
+  Times the scope it is declared in, if profiling is enabled, and records
+  the duration for the given callback. ArnlProfiledFunctor and its
+  variants use this; it can also be used directly in callbacks which are
+  not registered as functors, such as ArServerMode::userTask().
+
+  @code{.cpp}
+  void MyMode::userTask()
+  {
+    static ArnlCallbackInfo *info = ArnlCallbackProfiler::getInfo("MyMode::userTask");
+    ArnlCallbackTimer timer(info);
+    ...
+  }
+  @endcode
+*/
+class ArnlCallbackTimer
+{
+public:
+  ArnlCallbackTimer(ArnlCallbackInfo *info);
+  ~ArnlCallbackTimer();
+
+protected:
+  ArnlCallbackInfo *myInfo;
+  long long myStartUSecs;
+};
+
+/**
+  Attributes the time taken in the robot thread to the callbacks executed
+  in it, and finds callbacks which take too long in other threads.
+
+  Callbacks are profiled by registering an ArnlProfiledFunctor (or
+  ArnlProfiledFunctor1, ArnlProfiledFunctor2) wrapping the original functor
+  in place of it, or with ArnlCallbackTimer. When profiling is disabled the
+  wrappers cost one flag check per call; when enabled, two clock reads.
+
+  Each robot cycle is timed from the start of sensor interpretation to the
+  end of the user tasks. When a cycle takes longer than CycleBudget (by
+  default the robot's cycle time), the overrun is counted
+  (arnl_robot_cycle_overruns_total) and the profiled callbacks which took
+  the most time in that cycle are logged, along with the time not
+  accounted for by any of them (ARIA and ARNL's own tasks). Logging is
+  limited to once per second. A profiled callback in any other thread which
+  takes longer than CallbackBudget is logged.
+
+  Create one instance for the robot, and call addToConfig() to add the
+  "Callback profiling" parameters (profiling is disabled by default).
+*/
+class ArnlCallbackProfiler
+{
+public:
+  ArnlCallbackProfiler(ArRobot *robot, ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  ~ArnlCallbackProfiler();
+
+  void addToConfig(ArConfig *config, const char *section = "Callback profiling");
+
+  void setEnabled(bool enabled) { ourEnabled = enabled; }
+  static bool isEnabled(void) { return ourEnabled.load(std::memory_order_relaxed); }
+
+  /// Get (creating if needed) the timing data for the named callback
+  static ArnlCallbackInfo *getInfo(const std::string& name);
+
+  /// Wrap a functor so that its invocations are profiled. The wrapper lives as long as the program.
+  static ArFunctor *wrap(ArFunctor *functor, const char *name);
+  template<class P1>
+  static ArFunctor1<P1> *wrap(ArFunctor1<P1> *functor, const char *name);
+  template<class P1, class P2>
+  static ArFunctor2<P1, P2> *wrap(ArFunctor2<P1, P2> *functor, const char *name);
+
+  /// @internal Record a callback's duration (called by ArnlCallbackTimer)
+  static void record(ArnlCallbackInfo *info, long long usecs);
+
+protected:
+  struct CycleEntry
+  {
+    ArnlCallbackInfo *info;
+    long long usecs;
+  };
+
+  struct Cycle
+  {
+    long long startUSecs;
+    int numEntries;
+    CycleEntry entries[ARNL_PROFILER_MAX_CYCLE_ENTRIES];
+  };
+
+  void cycleStarted(void);
+  void cycleEnded(void);
+  void logOffenders(long long cycleUSecs, long long budgetUSecs);
+  bool processFile(void);
+
+  ArRobot *myRobot;
+  ArnlMetricsRegistry *myMetrics;
+  Cycle myCycle;
+  ArnlCounter *myOverrunsMetric;
+  ArnlHistogram *myCycleMetric;
+  ArTime myLastLogTime;
+  int mySuppressedLogs;
+
+  bool myConfigEnabled;
+  int myCycleBudget;
+  int myCallbackBudget;
+  int myNumOffenders;
+
+  ArFunctorC<ArnlCallbackProfiler> myCycleStartedCB;
+  ArFunctorC<ArnlCallbackProfiler> myCycleEndedCB;
+  ArRetFunctorC<bool, ArnlCallbackProfiler> myProcessFileCB;
+
+  static std::atomic<bool> ourEnabled;
+  static std::atomic<long long> ourCallbackBudgetUSecs;
+  static thread_local Cycle *ourCycle;
+  static ArMutex ourInfoMutex;
+  static std::map<std::string, ArnlCallbackInfo *> ourInfos;
+};
+
+/// Profiling wrapper for an ArFunctor (e.g. a robot sensor interpretation or user task)
+class ArnlProfiledFunctor : public ArFunctor
+{
+public:
+  ArnlProfiledFunctor(ArFunctor *functor, const char *name) :
+    myFunctor(functor), myInfo(ArnlCallbackProfiler::getInfo(name)) {}
+
+  virtual void invoke(void)
+  {
+    ArnlCallbackTimer timer(myInfo);
+    myFunctor->invoke();
+  }
+
+protected:
+  ArFunctor *myFunctor;
+  ArnlCallbackInfo *myInfo;
+};
+
+/// Profiling wrapper for an ArFunctor1 (e.g. a path planning goal callback)
+template<class P1>
+class ArnlProfiledFunctor1 : public ArFunctor1<P1>
+{
+public:
+  ArnlProfiledFunctor1(ArFunctor1<P1> *functor, const char *name) :
+    myFunctor(functor), myInfo(ArnlCallbackProfiler::getInfo(name)) {}
+
+  virtual void invoke(void)
+  {
+    ArnlCallbackTimer timer(myInfo);
+    myFunctor->invoke();
+  }
+
+  virtual void invoke(P1 p1)
+  {
+    ArnlCallbackTimer timer(myInfo);
+    myFunctor->invoke(p1);
+  }
+
+protected:
+  ArFunctor1<P1> *myFunctor;
+  ArnlCallbackInfo *myInfo;
+};
+
+/// Profiling wrapper for an ArFunctor2 (e.g. a server request handler)
+template<class P1, class P2>
+class ArnlProfiledFunctor2 : public ArFunctor2<P1, P2>
+{
+public:
+  ArnlProfiledFunctor2(ArFunctor2<P1, P2> *functor, const char *name) :
+    myFunctor(functor), myInfo(ArnlCallbackProfiler::getInfo(name)) {}
+
+  virtual void invoke(void)
+  {
+    ArnlCallbackTimer timer(myInfo);
+    myFunctor->invoke();
+  }
+
+  virtual void invoke(P1 p1)
+  {
+    ArnlCallbackTimer timer(myInfo);
+    myFunctor->invoke(p1);
+  }
+
+  virtual void invoke(P1 p1, P2 p2)
+  {
+    ArnlCallbackTimer timer(myInfo);
+    myFunctor->invoke(p1, p2);
+  }
+
+protected:
+  ArFunctor2<P1, P2> *myFunctor;
+  ArnlCallbackInfo *myInfo;
+};
+
+template<class P1>
+ArFunctor1<P1> *ArnlCallbackProfiler::wrap(ArFunctor1<P1> *functor, const char *name)
+{
+  return new ArnlProfiledFunctor1<P1>(functor, name);
+}
+
+template<class P1, class P2>
+ArFunctor2<P1, P2> *ArnlCallbackProfiler::wrap(ArFunctor2<P1, P2> *functor, const char *name)
+{
+  return new ArnlProfiledFunctor2<P1, P2>(functor, name);
+}
+
+#endif
@@ -0,0 +1,460 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlCheckpoint.h"
+#include "ArServerModeGoto2.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+ArnlCheckpoint::ArnlCheckpoint(ArRobot *robot, ArLocalizationTask *locTask,
+			       ArPathPlanningTask *pathTask, ArServerModeGoto2 *modeGoto) :
+  myRobot(robot),
+  myLocTask(locTask),
+  myPathTask(pathTask),
+  myModeGoto(modeGoto),
+  myMap(pathTask->getAriaMap()),
+  myRobotLockStats(ArnlLockProfiler::getStats("robot")),
+  myPeriodMSecs(1000),
+  mySyncPeriodSecs(30),
+  myMaxAgeSecs(3600),
+  mySpreadDist(100),
+  mySpreadAngle(5),
+  myVerifyMSecs(3000),
+  myResumeWork(true),
+  myRestored(false),
+  myMapChanges(1),
+  myMapIdChanges(0),
+  myExitCB(this, &ArnlCheckpoint::exitCB),
+  myMapChangedCB(this, &ArnlCheckpoint::mapChanged)
+{
+  myMutex.setLogName("ArnlCheckpoint::myMutex");
+  myMapIdMutex.setLogName("ArnlCheckpoint::myMapIdMutex");
+  setThreadName("ArnlCheckpoint");
+  myFileName[0] = '\0';
+  Aria::addExitCallback(&myExitCB);
+  if (myMap != NULL)
+    myMap->addMapChangedCB(&myMapChangedCB);
+}
+
+ArnlCheckpoint::~ArnlCheckpoint()
+{
+  const bool running = getRunning();
+  stopRunning();
+  // It may be saving; it stops within a period
+  if (running)
+    join();
+  Aria::remExitCallback(&myExitCB);
+  if (myMap != NULL)
+    myMap->remMapChangedCB(&myMapChangedCB);
+}
+
+void ArnlCheckpoint::addToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("CheckpointFile", myFileName,
+		      "File to keep the robot's last localized pose and current goal or tour in, so that after a restart it localizes there and carries on. Empty for none.",
+		      sizeof(myFileName)),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("CheckpointPeriod", &myPeriodMSecs,
+		      "How often to save the checkpoint if it has changed (msec)", 100),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("CheckpointSyncPeriod", &mySyncPeriodSecs,
+		      "How often to flush the checkpoint to disk when only the robot's pose has changed (sec). Changes of goal or tour are flushed at once.", 0),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("CheckpointMaxAge", &myMaxAgeSecs,
+		      "Ignore the checkpoint at startup if the robot was last localized more than this long ago (sec), 0 for no limit", 0),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("CheckpointSpreadDist", &mySpreadDist,
+		      "How far from the checkpointed pose to look for the robot at startup (mm)", 0),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("CheckpointSpreadAngle", &mySpreadAngle,
+		      "How far from the checkpointed heading to look for the robot at startup (deg)", 0, 180),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("CheckpointVerifyTime", &myVerifyMSecs,
+		      "How long to wait for the robot to be localized at the checkpointed pose before localizing at home instead (msec)", 0),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("CheckpointResumeWork", &myResumeWork,
+		      "Resume the goal or tour the robot was on when the server stopped"),
+	  section, ArPriority::NORMAL);
+}
+
+void ArnlCheckpoint::addValue(const char *name, ArRetFunctor<int> *getCB, ArFunctor1<int> *setCB)
+{
+  Value value;
+  value.name = name;
+  value.getCB = getCB;
+  value.setCB = setCB;
+  myMutex.lock();
+  myValues.push_back(value);
+  myMutex.unlock();
+}
+
+bool ArnlCheckpoint::restoreLocalization(void)
+{
+  myRestored = false;
+  if (myFileName[0] == '\0')
+    return false;
+  State state;
+  if (!read(&state))
+    return false;
+  std::string mapName, mapChecksum;
+  getMapId(&mapName, &mapChecksum);
+  if (state.mapName != mapName || state.mapChecksum != mapChecksum)
+  {
+    // The pose and goals may not be where they were, or may not be at all
+    ArLog::log(ArLog::Normal, "ArnlCheckpoint: %s was made on map \"%s\" (checksum %s), not \"%s\" (checksum %s): not using it",
+	       myFileName, state.mapName.c_str(), state.mapChecksum.c_str(), mapName.c_str(),
+	       mapChecksum.c_str());
+    return false;
+  }
+  if (!state.havePose)
+  {
+    ArLog::log(ArLog::Normal, "ArnlCheckpoint: %s has no localized pose", myFileName);
+    return false;
+  }
+  const long age = (long)time(NULL) - state.poseTime;
+  if (myMaxAgeSecs > 0 && age > myMaxAgeSecs)
+  {
+    ArLog::log(ArLog::Normal, "ArnlCheckpoint: the robot was last localized %ld sec ago, not using %s",
+	       age, myFileName);
+    return false;
+  }
+
+  ArLog::log(ArLog::Normal, "ArnlCheckpoint: localizing at (%.0f, %.0f, %.1f), where the robot was %ld sec ago",
+	     state.pose.getX(), state.pose.getY(), state.pose.getTh(), age);
+  myLocTask->setRobotPose(state.pose, ArPose(mySpreadDist, mySpreadDist, mySpreadAngle));
+  const double threshold = myLocTask->getLocalizationThreshold();
+  double score = 0;
+  ArTime started;
+  do
+  {
+    // The score is not that of the new pose until localization has run
+    ArUtil::sleep(100);
+    score = myLocTask->getLocalizationScore();
+    if (score >= threshold && !myLocTask->getRobotIsLostFlag())
+    {
+      ArLog::log(ArLog::Normal, "ArnlCheckpoint: localized with score %.2f after %ld ms",
+		 score, started.mSecSince());
+      myRestored = true;
+      myRestoredState = state;
+      return true;
+    }
+  } while (started.mSecSince() < myVerifyMSecs);
+  ArLog::log(ArLog::Normal, "ArnlCheckpoint: localization score at the checkpointed pose is %.2f, below %.2f: the robot may have been moved",
+	     score, threshold);
+  return false;
+}
+
+void ArnlCheckpoint::resume(void)
+{
+  if (myFileName[0] == '\0')
+    return;
+  if (myRestored)
+  {
+    myMutex.lock();
+    // Keep the checkpointed pose until the robot is localized again
+    myLastState = myRestoredState;
+    myMutex.unlock();
+  }
+  if (myRestored && myResumeWork)
+  {
+    const State& state = myRestoredState;
+    for (size_t i = 0; i < state.values.size(); i++)
+    {
+      for (size_t j = 0; j < myValues.size(); j++)
+      {
+	if (myValues[j].name == state.values[i].first)
+	{
+	  ArLog::log(ArLog::Normal, "ArnlCheckpoint: restoring %s = %d",
+		     state.values[i].first.c_str(), state.values[i].second);
+	  myValues[j].setCB->invoke(state.values[i].second);
+	}
+      }
+    }
+    if (state.goalName.size() > 0)
+    {
+      if (!state.touring)
+	ArLog::log(ArLog::Normal, "ArnlCheckpoint: going on to goal \"%s\"", state.goalName.c_str());
+      else if (state.tourList.empty())
+	ArLog::log(ArLog::Normal, "ArnlCheckpoint: resuming tour of all goals at \"%s\"",
+		   state.goalName.c_str());
+      else
+	ArLog::log(ArLog::Normal, "ArnlCheckpoint: resuming tour of %d goals at \"%s\"",
+		   (int)state.tourList.size(), state.goalName.c_str());
+      myModeGoto->resumeProgress(state.goalName, state.touring, state.tourList);
+    }
+  }
+  runAsync();
+}
+
+void *ArnlCheckpoint::runThread(void *)
+{
+  while (getRunning())
+  {
+    save(false);
+    ArUtil::sleep(myPeriodMSecs > 100 ? myPeriodMSecs : 100);
+  }
+  return NULL;
+}
+
+/// Aria is exiting: save what the robot was doing last
+void ArnlCheckpoint::exitCB(void)
+{
+  if (getRunning())
+    save(true);
+}
+
+void ArnlCheckpoint::mapChanged(void)
+{
+  myMapIdMutex.lock();
+  myMapChanges++;
+  myMapIdMutex.unlock();
+}
+
+void ArnlCheckpoint::getMapId(std::string *mapName, std::string *mapChecksum)
+{
+  myMapIdMutex.lock();
+  const unsigned int changes = myMapChanges;
+  if (myMapIdChanges == changes)
+  {
+    *mapName = myMapName;
+    *mapChecksum = myMapChecksum;
+    myMapIdMutex.unlock();
+    return;
+  }
+  myMapIdMutex.unlock();
+
+  mapName->clear();
+  mapChecksum->clear();
+  if (myMap == NULL)
+    return;
+  // Worked out from the map as it is, which takes a while for a large map
+  unsigned char digest[ArMD5Calculator::DIGEST_LENGTH];
+  myMap->lock();
+  if (myMap->getFileName() != NULL)
+    *mapName = myMap->getFileName();
+  const bool haveChecksum = myMap->calculateChecksum(digest, sizeof(digest));
+  myMap->unlock();
+  if (haveChecksum)
+  {
+    char hex[3];
+    for (size_t i = 0; i < sizeof(digest); i++)
+    {
+      snprintf(hex, sizeof(hex), "%02x", digest[i]);
+      *mapChecksum += hex;
+    }
+  }
+
+  myMapIdMutex.lock();
+  // Unless the map changed again meanwhile
+  if (myMapChanges == changes)
+  {
+    myMapIdChanges = changes;
+    myMapName = *mapName;
+    myMapChecksum = *mapChecksum;
+  }
+  myMapIdMutex.unlock();
+}
+
+void ArnlCheckpoint::getState(const State& last, State *state)
+{
+  getMapId(&state->mapName, &state->mapChecksum);
+  state->havePose = last.havePose;
+  state->pose = last.pose;
+  state->score = last.score;
+  state->poseTime = last.poseTime;
+  const double score = myLocTask->getLocalizationScore();
+  if (score >= myLocTask->getLocalizationThreshold() && !myLocTask->getRobotIsLostFlag())
+  {
+    state->havePose = true;
+    myRobotLockStats->lock(myRobot, ARNL_LOCK_SITE);
+    state->pose = myRobot->getPose();
+    myRobotLockStats->unlock(myRobot);
+    state->score = score;
+    state->poseTime = (long)time(NULL);
+  }
+
+  state->goalName.clear();
+  state->touring = false;
+  state->tourList.clear();
+  const bool goto2 = myModeGoto->getProgress(&state->goalName, &state->touring, &state->tourList);
+  if (!goto2)
+  {
+    // Going to a goal some other way, e.g. sent by an ArnlASyncTask
+    state->goalName.clear();
+    const ArPathPlanningTask::LocalPathState pathState = myPathTask->getState();
+    if (pathState == ArPathPlanningTask::PLANNING_PATH || pathState == ArPathPlanningTask::MOVING_TO_GOAL)
+      state->goalName = myPathTask->getCurrentGoalName();
+  }
+
+  state->values.clear();
+  for (size_t i = 0; i < myValues.size(); i++)
+    state->values.push_back(std::make_pair(myValues[i].name, myValues[i].getCB->invokeR()));
+}
+
+void ArnlCheckpoint::format(const State& state, std::string *pose, std::string *work)
+{
+  char buf[256];
+  *pose = "map " + state.mapName + "\n";
+  *pose += "mapChecksum " + state.mapChecksum + "\n";
+  if (state.havePose)
+  {
+    // Rounded, so that noise while standing still is not a change
+    snprintf(buf, sizeof(buf), "pose %.0f %.0f %.1f %.2f\n", state.pose.getX(), state.pose.getY(),
+	     state.pose.getTh(), state.score);
+    *pose += buf;
+  }
+  work->clear();
+  if (state.goalName.size() > 0)
+  {
+    *work += "goal " + state.goalName + "\n";
+    *work += state.touring ? "touring 1\n" : "touring 0\n";
+    for (size_t i = 0; i < state.tourList.size(); i++)
+      *work += "tourGoal " + state.tourList[i] + "\n";
+  }
+  for (size_t i = 0; i < state.values.size(); i++)
+  {
+    snprintf(buf, sizeof(buf), "value %s %d\n", state.values[i].first.c_str(), state.values[i].second);
+    *work += buf;
+  }
+}
+
+void ArnlCheckpoint::save(bool force)
+{
+  myMutex.lock();
+  State state;
+  getState(myLastState, &state);
+  std::string pose, work;
+  format(state, &pose, &work);
+  const bool workChanged = work != myLastWork;
+  // Only the time the robot was localized there changed: keep that up to
+  // date, but not every period
+  const bool refresh = state.poseTime != myLastState.poseTime &&
+    myLastWrite.secSince() >= mySyncPeriodSecs;
+  if (!force && !workChanged && pose == myLastPose && !refresh)
+  {
+    myMutex.unlock();
+    return;
+  }
+  const bool sync = force || workChanged || myLastSync.secSince() >= mySyncPeriodSecs;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "poseTime %ld\n", state.poseTime);
+  if (write("# ArnlCheckpoint\n" + pose + buf + work, sync))
+  {
+    myLastState = state;
+    myLastPose = pose;
+    myLastWork = work;
+    myLastWrite.setToNow();
+    if (sync)
+      myLastSync.setToNow();
+  }
+  myMutex.unlock();
+}
+
+/** Write a new file and rename it over the old one, so that a crash while
+ * writing leaves the old checkpoint. If @a sync, flush it and the rename to
+ * disk before returning */
+bool ArnlCheckpoint::write(const std::string& contents, bool sync)
+{
+  const std::string tmpName = std::string(myFileName) + ".tmp";
+  FILE *file = fopen(tmpName.c_str(), "w");
+  if (file == NULL)
+  {
+    ArLog::log(ArLog::Terse, "ArnlCheckpoint: Error: could not write %s: %s", tmpName.c_str(), strerror(errno));
+    return false;
+  }
+  bool ok = fputs(contents.c_str(), file) >= 0 && fflush(file) == 0;
+#ifndef WIN32
+  if (ok && sync)
+    ok = fsync(fileno(file)) == 0;
+#endif
+  if (fclose(file) != 0)
+    ok = false;
+#ifdef WIN32
+  // rename() does not replace a file on Windows
+  if (ok)
+    remove(myFileName);
+#endif
+  if (!ok || rename(tmpName.c_str(), myFileName) != 0)
+  {
+    ArLog::log(ArLog::Terse, "ArnlCheckpoint: Error: could not save %s: %s", myFileName, strerror(errno));
+    remove(tmpName.c_str());
+    return false;
+  }
+#ifndef WIN32
+  if (sync)
+  {
+    // The rename is only on disk once the directory is
+    std::string dir = myFileName;
+    const size_t slash = dir.rfind('/');
+    dir = slash == std::string::npos ? "." : slash == 0 ? "/" : dir.substr(0, slash);
+    const int fd = open(dir.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+      fsync(fd);
+      close(fd);
+    }
+  }
+#endif
+  return true;
+}
+
+bool ArnlCheckpoint::read(State *state)
+{
+  FILE *file = fopen(myFileName, "r");
+  if (file == NULL)
+  {
+    ArLog::log(ArLog::Normal, "ArnlCheckpoint: no checkpoint in %s", myFileName);
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *arg = strchr(line, ' ');
+    if (arg == NULL)
+      continue;
+    *arg++ = '\0';
+    double x, y, th, score;
+    char name[128];
+    int value;
+    if (strcmp(line, "map") == 0)
+      state->mapName = arg;
+    else if (strcmp(line, "mapChecksum") == 0)
+      state->mapChecksum = arg;
+    else if (strcmp(line, "pose") == 0 && sscanf(arg, "%lf %lf %lf %lf", &x, &y, &th, &score) == 4)
+    {
+      state->havePose = true;
+      state->pose.setPose(x, y, th);
+      state->score = score;
+    }
+    else if (strcmp(line, "poseTime") == 0)
+      state->poseTime = atol(arg);
+    else if (strcmp(line, "goal") == 0)
+      state->goalName = arg;
+    else if (strcmp(line, "touring") == 0)
+      state->touring = atoi(arg) != 0;
+    else if (strcmp(line, "tourGoal") == 0)
+      state->tourList.push_back(arg);
+    else if (strcmp(line, "value") == 0 && sscanf(arg, "%127s %d", name, &value) == 2)
+      state->values.push_back(std::make_pair(std::string(name), value));
+  }
+  fclose(file);
+  return true;
+}
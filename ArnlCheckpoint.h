@@ -0,0 +1,169 @@
+#ifndef ARNLCHECKPOINT_H
+#define ARNLCHECKPOINT_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+#include "Arnl.h"
+#include "ArPathPlanningTask.h"
+#include "ArLocalizationTask.h"
+
+#include "ArnlLockProfiler.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+class ArServerModeGoto2;
+
+/**
+  Keeps a small checkpoint file of where the robot is and what it is doing,
+  so that after the server is restarted it can carry on within seconds
+  rather than localizing from scratch and waiting to be given work again.
+
+  The checkpoint holds the map (its file name and checksum), the last pose
+  at which the robot was well localized on it (and the localization score
+  there), the goal ArServerModeGoto2 (or an
+  ArnlASyncTask, through the path planner) was going to, the tour and the
+  robot's place in it, and any integers the program adds with addValue()
+  (e.g. a task chain's position). It is saved every CheckpointPeriod msecs
+  when it has changed, by writing a new file and renaming it over the old
+  one, so the file is always either the old or the new checkpoint. Changes
+  to what the robot is doing are flushed to disk (fsync) straight away;
+  changes of pose alone only every CheckpointSyncPeriod secs, since the
+  robot moving writes a new checkpoint every period.
+
+  At startup, instead of localizeRobotAtHomeBlocking():
+
+  @code{.cpp}
+  if (!checkpoint.restoreLocalization())
+    locTask.localizeRobotAtHomeBlocking();
+  ...
+  checkpoint.addValue("chainGoal", &getChainGoalCB, &setChainGoalCB);
+  robot.enableMotors();
+  checkpoint.resume();
+  @endcode
+
+  restoreLocalization() localizes the robot around the checkpointed pose
+  alone, and returns false (so the usual home localization is done) if
+  there is no checkpoint, it was made on another map (or another version of
+  this one), it is older than CheckpointMaxAge secs, or the localization
+  score does not reach the threshold there (e.g. the robot was
+  moved while the server was stopped). resume() sets the added values,
+  resumes the goal or tour, and starts saving checkpoints.
+
+  Configured in ArConfig (section "Warm restart"); with no CheckpointFile
+  it does nothing.
+*/
+class ArnlCheckpoint : public ArASyncTask
+{
+public:
+  ArnlCheckpoint(ArRobot *robot, ArLocalizationTask *locTask, ArPathPlanningTask *pathTask,
+		 ArServerModeGoto2 *modeGoto);
+  virtual ~ArnlCheckpoint();
+
+  void addToConfig(ArConfig *config, const char *section = "Warm restart");
+
+  /** Add an integer to save in the checkpoint, got with @a getCB, and given
+   * to @a setCB by resume(). Add before calling resume() */
+  void addValue(const char *name, ArRetFunctor<int> *getCB, ArFunctor1<int> *setCB);
+
+  /** Read the checkpoint and localize the robot at its pose. Call once the
+   * map is loaded. @return false if that could not be done */
+  bool restoreLocalization(void);
+
+  /** Restore the values and the goal or tour from the checkpoint read by
+   * restoreLocalization() (if it succeeded), and start saving checkpoints */
+  void resume(void);
+
+  virtual void *runThread(void *arg);
+
+protected:
+  struct Value
+  {
+    std::string name;
+    ArRetFunctor<int> *getCB;
+    ArFunctor1<int> *setCB;
+  };
+
+  /// What is kept in the checkpoint
+  struct State
+  {
+    State() : havePose(false), score(0), poseTime(0), touring(false) {}
+    /// The map's file name and MD5 checksum (in hex), which the pose and goals are on
+    std::string mapName;
+    std::string mapChecksum;
+    bool havePose;
+    ArPose pose;
+    double score;
+    /// When the robot was localized at the pose (secs since the epoch)
+    long poseTime;
+    std::string goalName;
+    bool touring;
+    std::deque<std::string> tourList;
+    std::vector<std::pair<std::string, int> > values;
+  };
+
+  bool read(State *state);
+  /** Get the current map's file name and checksum, working the checksum out
+   * again only if the map has changed since it was last */
+  void getMapId(std::string *mapName, std::string *mapChecksum);
+  void mapChanged(void);
+  /// Get the current state, keeping the last well localized pose from @a last
+  void getState(const State& last, State *state);
+  /// The map and pose part of the checkpoint, and the rest
+  void format(const State& state, std::string *pose, std::string *work);
+  /** Save the checkpoint if it has changed (or anyway, and sync it, if @a
+   * force) */
+  void save(bool force);
+  bool write(const std::string& contents, bool sync);
+  void exitCB(void);
+
+  ArRobot *myRobot;
+  ArLocalizationTask *myLocTask;
+  ArPathPlanningTask *myPathTask;
+  ArServerModeGoto2 *myModeGoto;
+  ArMapInterface *myMap;
+  ArnlLockStats *myRobotLockStats;
+
+  char myFileName[1024];
+  int myPeriodMSecs;
+  int mySyncPeriodSecs;
+  int myMaxAgeSecs;
+  int mySpreadDist;
+  int mySpreadAngle;
+  int myVerifyMSecs;
+  bool myResumeWork;
+
+  std::vector<Value> myValues;
+  /// The checkpoint read by restoreLocalization(), if it localized the robot there
+  bool myRestored;
+  State myRestoredState;
+
+  ArMutex myMutex;
+  /// What was last saved, and when it was written and synced to disk (protected by myMutex)
+  State myLastState;
+  std::string myLastPose;
+  std::string myLastWork;
+  ArTime myLastWrite;
+  ArTime myLastSync;
+
+  /** Not myMutex, which is held while locking the map, since the map may be
+   * locked when it calls mapChanged() */
+  ArMutex myMapIdMutex;
+  /// Counted by mapChanged() (protected by myMapIdMutex)
+  unsigned int myMapChanges;
+  /// The map's id and the count of changes it was worked out at (protected by myMapIdMutex)
+  unsigned int myMapIdChanges;
+  std::string myMapName;
+  std::string myMapChecksum;
+
+  ArFunctorC<ArnlCheckpoint> myExitCB;
+  ArFunctorC<ArnlCheckpoint> myMapChangedCB;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef ARNLCLOCK_H
+#define ARNLCLOCK_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <time.h>
+
+/**
+  The time which the task framework's timers, motion dwells and goal
+  durations go by (ArnlTimerWheel, ArnlMotionExecutor, ArnlGoalFuture).
+
+  Normally this is the monotonic clock. ArnlVirtualTimeExecutor switches it
+  to virtual time, which starts at the current time and then only moves
+  when advanceVirtual() is called, so that a task chain can be run against
+  simulated robot and path planning backends as fast as its callbacks
+  allow, with the same timings every run.
+
+  Profiling (ArnlThreadScheduler::getMonotonicUSecs(), the callback and lock
+  profilers) always uses the real clock.
+
+  In virtual time, threads which the task framework starts (ArnlASyncTask's
+  task threads) are counted, so that time only moves on once all of them
+  are waiting: threadStarting() counts a thread before it is created, and
+  the thread calls threadStarted() and threadFinished(). A counted thread
+  runs only while holding the turn, which the executor holds while it runs
+  events, so counted threads and events never run at once. A counted thread
+  waiting for an ArnlGoalFuture is a Sleeper: it gives up the turn, and is
+  woken (counted again) when the future completes or, for a timed wait, by
+  the executor when virtual time reaches its wake-up time. Counted threads
+  still run in whatever order they get the turn, so event order is only the
+  same every run if no two of them are woken at once.
+*/
+class ArnlClock
+{
+public:
+  /// Current time in microseconds (monotonic, or virtual if isVirtual())
+  static long long getUSecs(void)
+  {
+    const long long v = virtualUSecs().load(std::memory_order_acquire);
+    return v >= 0 ? v : getRealUSecs();
+  }
+
+  static long long getMSecs(void) { return getUSecs() / 1000; }
+
+  static bool isVirtual(void) { return virtualUSecs().load(std::memory_order_acquire) >= 0; }
+
+  /// Switch to virtual time, stopped at the current time
+  static void startVirtual(void)
+  {
+    long long expected = -1;
+    virtualUSecs().compare_exchange_strong(expected, getRealUSecs());
+  }
+
+  /// Move virtual time forward to @a usecs (never back)
+  static void advanceVirtual(long long usecs)
+  {
+    long long v = virtualUSecs().load(std::memory_order_relaxed);
+    while (v >= 0 && usecs > v &&
+	   !virtualUSecs().compare_exchange_weak(v, usecs, std::memory_order_release))
+      ;
+  }
+
+  /// Switch back to the monotonic clock
+  static void stopVirtual(void) { virtualUSecs().store(-1, std::memory_order_release); }
+
+  static long long getRealUSecs(void)
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  /// A counted thread waiting, for @a cond (with @a mutex), or until @a wakeUSecs if that is not -1
+  struct Sleeper
+  {
+    Sleeper(std::mutex *m, std::condition_variable *c, long long wake) :
+      mutex(m), cond(c), wakeUSecs(wake), woken(false) {}
+    std::mutex *mutex;
+    std::condition_variable *cond;
+    long long wakeUSecs;
+    /// Set, with @a mutex locked, when the thread is counted again
+    bool woken;
+    std::multimap<long long, Sleeper *>::iterator pos;
+  };
+
+  /// In virtual time, count a thread about to be created, before it can run (call in the creating thread)
+  static void threadStarting(void)
+  {
+    if (!isVirtual())
+      return;
+    threads().fetch_add(1);
+    busyThreads().fetch_add(1);
+  }
+
+  /// Call first in a thread counted by threadStarting(): wait for the turn
+  static void threadStarted(void)
+  {
+    if (!isVirtual())
+      return;
+    counted() = true;
+    turn().lock();
+  }
+
+  /// Call last in a thread which called threadStarted()
+  static void threadFinished(void)
+  {
+    if (!counted())
+      return;
+    counted() = false;
+    turn().unlock();
+    threads().fetch_sub(1);
+    busyThreads().fetch_sub(1);
+  }
+
+  /// Whether this thread is counted (between threadStarted() and threadFinished())
+  static bool isCounted(void) { return counted(); }
+
+  /// Counted threads which have not finished, whether running or waiting
+  static int getThreads(void) { return threads().load(); }
+
+  /** A counted thread (with @a sleeper's mutex locked) is about to wait for
+   * @a sleeper's condition: give up the turn, and until woken, don't count
+   * it. */
+  static void sleep(Sleeper *sleeper)
+  {
+    if (sleeper->wakeUSecs >= 0)
+      sleeper->pos = sleepers().insert(std::make_pair(sleeper->wakeUSecs, sleeper));
+    busyThreads().fetch_sub(1);
+    turn().unlock();
+  }
+
+  /** Count @a sleeper's thread again, if it was not already woken. Call with
+   * its mutex locked, before notifying its condition. */
+  static void wake(Sleeper *sleeper)
+  {
+    if (sleeper->woken)
+      return;
+    sleeper->woken = true;
+    busyThreads().fetch_add(1);
+  }
+
+  /// Call in a woken thread (with @a sleeper's mutex not locked): wait for the turn
+  static void awake(Sleeper *sleeper)
+  {
+    turn().lock();
+    if (sleeper->wakeUSecs >= 0)
+      sleepers().erase(sleeper->pos);
+  }
+
+  /** For the executor, holding the turn: the time at which the next timed
+   * wait ends. @return false if no counted thread is in a timed wait */
+  static bool getNextWakeUSecs(long long *usecs)
+  {
+    if (sleepers().empty())
+      return false;
+    *usecs = sleepers().begin()->first;
+    return true;
+  }
+
+  /// For the executor, holding the turn: wake the threads whose timed waits end by now, in order
+  static void wakeSleepers(void)
+  {
+    const long long now = getUSecs();
+    for (std::multimap<long long, Sleeper *>::iterator i = sleepers().begin();
+	 i != sleepers().end() && i->first <= now; ++i)
+    {
+      Sleeper *sleeper = i->second;
+      {
+	std::lock_guard<std::mutex> guard(*sleeper->mutex);
+	wake(sleeper);
+      }
+      // The sleeper can't return from awake() until the executor gives up the turn
+      sleeper->cond->notify_all();
+    }
+  }
+
+  /// For the executor: take the turn, to run events
+  static void lockTurn(void) { turn().lock(); }
+  static void unlockTurn(void) { turn().unlock(); }
+
+  /** For the executor, holding the turn: give it up until every counted
+   * thread is waiting or finished, then take it back */
+  static void waitForThreads(void)
+  {
+    if (busyThreads().load() == 0)
+      return;
+    turn().unlock();
+    while (busyThreads().load() > 0)
+      std::this_thread::yield();
+    turn().lock();
+  }
+
+protected:
+  /// Virtual time, or -1 when using the monotonic clock
+  static std::atomic<long long>& virtualUSecs(void)
+  {
+    static std::atomic<long long> usecs(-1);
+    return usecs;
+  }
+
+  /// Counted threads not finished, and of those, the ones not waiting
+  static std::atomic<int>& threads(void)
+  {
+    static std::atomic<int> n(0);
+    return n;
+  }
+
+  static std::atomic<int>& busyThreads(void)
+  {
+    static std::atomic<int> n(0);
+    return n;
+  }
+
+  static bool& counted(void)
+  {
+    static thread_local bool c = false;
+    return c;
+  }
+
+  /// Held by the running counted thread, or by the executor while running events
+  static std::mutex& turn(void)
+  {
+    static std::mutex m;
+    return m;
+  }
+
+  /// Counted threads in timed waits, by wake-up time (protected by the turn)
+  static std::multimap<long long, Sleeper *>& sleepers(void)
+  {
+    static std::multimap<long long, Sleeper *> s;
+    return s;
+  }
+};
+
+#endif
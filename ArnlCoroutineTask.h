@@ -0,0 +1,223 @@
+#ifndef ARNLCOROUTINETASK_H
+#define ARNLCOROUTINETASK_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlASyncTask.h"
+#include "ArnlTimerWheel.h"
+
+// ArnlCoroutineTask requires C++20 coroutines (e.g. build with -std=c++20)
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define ARNL_HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifdef ARNL_HAVE_COROUTINES
+
+#include <coroutine>
+#include <string>
+
+class ArnlCoroutineTask;
+
+/// A functor which resumes a suspended coroutine, for use as a timer or other callback
+class ArnlCoroutineResumer : public ArFunctor
+{
+public:
+  ArnlCoroutineResumer() {}
+  virtual void invoke() { myHandle.resume(); }
+  void setHandle(std::coroutine_handle<> handle) { myHandle = handle; }
+protected:
+  std::coroutine_handle<> myHandle;
+};
+
+/**
+  The return type of an ArnlCoroutineTask::runCoroutine() body. The body
+  starts in the timer wheel's thread shortly after it is created, and its
+  frame is freed when it returns.
+*/
+class ArnlTaskCoroutine
+{
+public:
+  struct promise_type
+  {
+    ArnlCoroutineTask *myTask;
+    std::string myGoalName;
+    ArTime myStarted;
+    ArnlCoroutineResumer myStarter;
+
+    promise_type() : myTask(NULL) {}
+    ArnlTaskCoroutine get_return_object()
+    {
+      return ArnlTaskCoroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+    std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+    void return_void();
+    void unhandled_exception();
+  };
+
+  explicit ArnlTaskCoroutine(std::coroutine_handle<promise_type> handle) : myHandle(handle) {}
+
+  std::coroutine_handle<promise_type> getHandle() const { return myHandle; }
+
+protected:
+  std::coroutine_handle<promise_type> myHandle;
+};
+
+/**
+  An ArnlASyncTask whose task is written as a C++20 coroutine instead of a
+  thread. Override runCoroutine() and use co_await with sleep(), move() and
+  arriveAt() where a runTask() would block:
+
+  @code{.cpp}
+  class MyTask : public ArnlCoroutineTask
+  {
+  public:
+    MyTask(ArPathPlanningTask *path, ArRobot *robot) :
+      ArnlCoroutineTask(path, robot, "My Coroutine Task") {}
+
+  protected:
+    virtual ArnlTaskCoroutine runCoroutine(std::string goalName, ArPose pose)
+    {
+      co_await move(250);
+      co_await sleep(3000);
+      co_await move(-250);
+      ArnlGoalResult r = co_await arriveAt("Goal 2");
+      if(!r.arrived())
+        ArLog::log(ArLog::Normal, "%s: could not get to Goal 2", getName());
+    }
+  };
+  @endcode
+
+  A suspended coroutine holds no thread, only its frame (its arguments and
+  local variables, typically a few hundred bytes), so any number of runs
+  may be waiting at once. Coroutines are resumed in the ArnlTimerWheel's
+  thread: by a timer after sleep(), when the robot thread has finished the
+  movement after move() or motion(), or when the future from nextGoal()
+  completes after arriveAt(). Code between co_await expressions
+  therefore runs in that shared thread and should not block; if something
+  has to, start a thread for it (or use runTask() for that task).
+
+  Arguments to runCoroutine() are passed by value since the coroutine may
+  outlive the caller's variables; do not make it take references.
+
+  Runs are counted in the task's metrics and call its task finished
+  callbacks like runTask() runs, but are not watched by ArnlTaskWatchdog
+  (which watches threads).
+*/
+class ArnlCoroutineTask : public ArnlASyncTask
+{
+public:
+  ArnlCoroutineTask(ArPathPlanningTask *pp, ArRobot *robot,
+    const std::string& name = "unnamed ArnlCoroutineTask",
+    ArArgumentParser *argParser = NULL,
+    const std::string& goalPrefix = "", const std::string& goalSuffix = ""
+  ) :
+    ArnlASyncTask(pp, robot, name, argParser, goalPrefix, goalSuffix)
+  {
+  }
+
+  /// Awaitable which resumes after a delay (see sleep())
+  class SleepAwaiter
+  {
+  public:
+    explicit SleepAwaiter(long msecs) : myMSecs(msecs) {}
+    SleepAwaiter(const SleepAwaiter&) = delete;
+    bool await_ready() const { return myMSecs <= 0; }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      myResumer.setHandle(handle);
+      ArnlTimerWheel::getGlobal()->scheduleAfter(myMSecs, &myResumer);
+    }
+    void await_resume() {}
+  protected:
+    long myMSecs;
+    ArnlCoroutineResumer myResumer;
+  };
+
+  /// Awaitable which resumes when an ArnlGoalFuture completes, with its result (see arriveAt())
+  class GoalAwaiter : public ArnlGoalFuture::ResultCB
+  {
+  public:
+    explicit GoalAwaiter(const ArnlGoalFuture& future) : myFuture(future) {}
+    GoalAwaiter(const GoalAwaiter&) = delete;
+    bool await_ready() const { return myFuture.isDone(); }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      myResumer.setHandle(handle);
+      myFuture.then(this);
+    }
+    ArnlGoalResult await_resume() const { return myFuture.getResult(); }
+
+    /// Called with the result (in the path planning or robot thread): resume in the timer wheel's thread
+    virtual void invoke(const ArnlGoalResult&) { ArnlTimerWheel::getGlobal()->scheduleAfter(0, &myResumer); }
+    virtual void invoke() {}
+  protected:
+    ArnlGoalFuture myFuture;
+    ArnlCoroutineResumer myResumer;
+  };
+
+protected:
+  /** Override this with the task's coroutine body, which is run at each
+   * goal (as selected by the goal name prefix or suffix, see
+   * ArnlASyncTask). */
+  virtual ArnlTaskCoroutine runCoroutine(std::string goalName, ArPose pose) = 0;
+
+  /// co_await sleep(msecs) to wait without blocking a thread
+  SleepAwaiter sleep(long msecs) { return SleepAwaiter(msecs); }
+
+  /// co_await move(dist) to move the robot forward (or back if negative) @a dist mm and wait until it is done
+  GoalAwaiter move(double dist) { return motion(ArnlMotionSequence("move").move(dist)); }
+
+  /** co_await arriveAt(goalName) to send the robot to a goal (with
+   * nextGoal()) and wait for it to arrive, fail, or be preempted. The result
+   * is the ArnlGoalResult. */
+  GoalAwaiter arriveAt(const std::string& goalName) { return GoalAwaiter(nextGoal(goalName)); }
+
+  /** co_await motion(seq) to run a motion sequence in the robot thread (with
+   * runMotion()) and wait until all its steps are done. The result is the
+   * ArnlGoalResult (PREEMPTED if another sequence replaced it). */
+  GoalAwaiter motion(const ArnlMotionSequence& seq) { return GoalAwaiter(runMotion(seq)); }
+
+  /// co_await on a future from nextGoal() to wait for its result
+  GoalAwaiter arriveAt(const ArnlGoalFuture& future) { return GoalAwaiter(future); }
+
+  /// Create the coroutine for this goal and start it in the timer wheel's thread
+  virtual void startTask()
+  {
+    ArnlTaskCoroutine coroutine = runCoroutine(getLastGoalName(), getLastGoalPose());
+    ArnlTaskCoroutine::promise_type& promise = coroutine.getHandle().promise();
+    promise.myTask = this;
+    promise.myGoalName = getLastGoalName();
+    promise.myStarted.setToNow();
+    promise.myStarter.setHandle(coroutine.getHandle());
+    ArLog::log(ArLog::Normal, "%s: Running at %s", getName(), getLastGoalName().c_str());
+    taskStarting();
+    ArnlTimerWheel::getGlobal()->scheduleAfter(0, &promise.myStarter);
+  }
+
+private:
+  friend struct ArnlTaskCoroutine::promise_type;
+};
+
+inline void ArnlTaskCoroutine::promise_type::return_void()
+{
+  if(myTask != NULL)
+    myTask->taskFinished(myGoalName, myStarted.mSecSince());
+}
+
+inline void ArnlTaskCoroutine::promise_type::unhandled_exception()
+{
+  ArLog::log(ArLog::Terse, "ArnlTaskCoroutine: %s ended with an exception at %s",
+    myTask != NULL ? myTask->getName() : "task", myGoalName.c_str());
+  if(myTask != NULL)
+    myTask->taskFinished(myGoalName, myStarted.mSecSince());
+}
+
+#endif // ARNL_HAVE_COROUTINES
+
+#endif
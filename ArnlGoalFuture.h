@@ -0,0 +1,228 @@
+#ifndef ARNLGOALFUTURE_H
+#define ARNLGOALFUTURE_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include "ArnlClock.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/// The outcome of a goal requested with ArnlASyncTask::nextGoal() or ArnlRemoteASyncTask::nextGoal()
+struct ArnlGoalResult
+{
+  enum Status {
+    PENDING,   ///< Not reached, failed or preempted yet
+    ARRIVED,   ///< The robot reached the goal
+    FAILED,    ///< The path planner could not plan or follow a path to the goal
+    PREEMPTED, ///< Another goal or mode replaced this goal before it was reached
+    PASSED     ///< The robot passed through the goal without stopping (see ArnlViaPoints)
+  };
+
+  Status status;
+  std::string goalName;
+  /// Robot pose (if known) when the goal was reached, failed or preempted
+  ArPose pose;
+  /// Time from the request until the outcome, in milliseconds (of ArnlClock time)
+  long msecs;
+
+  ArnlGoalResult() : status(PENDING), msecs(0) {}
+
+  bool isDone() const { return status != PENDING; }
+  bool arrived() const { return status == ARRIVED; }
+  /// Whether the robot got to the goal, stopping there or passing through it
+  bool reached() const { return status == ARRIVED || status == PASSED; }
+
+  static const char *getStatusName(Status status)
+  {
+    switch(status)
+    {
+    case PENDING: return "pending";
+    case ARRIVED: return "arrived";
+    case FAILED: return "failed";
+    case PREEMPTED: return "preempted";
+    case PASSED: return "passed";
+    }
+    return "unknown";
+  }
+};
+
+/**
+  A handle to the outcome of a goal request, which completes when the robot
+  arrives at the goal, fails to, or the goal is preempted. Copies refer to
+  the same outcome.
+
+  Use then() to have a callback invoked with the result when it completes,
+  so that a task can continue (e.g. request the next goal) without a thread
+  waiting for it; or wait() in a task thread; or, in an ArnlCoroutineTask,
+  co_await arriveAt().
+
+  @code{.cpp}
+  ArnlGoalFuture f = nextGoal("Goal 2");
+  ArnlGoalResult r = f.wait();
+  if(!r.arrived())
+    ArLog::log(ArLog::Normal, "%s %s after %ld ms", r.goalName.c_str(), ArnlGoalResult::getStatusName(r.status), r.msecs);
+  @endcode
+*/
+class ArnlGoalFuture
+{
+public:
+  typedef ArFunctor1<const ArnlGoalResult&> ResultCB;
+
+  /// An invalid future (isValid() is false)
+  ArnlGoalFuture() {}
+
+  bool isValid() const { return (bool)myState; }
+
+  bool isDone() const
+  {
+    std::lock_guard<std::mutex> guard(myState->mutex);
+    return myState->result.isDone();
+  }
+
+  /// @return the result so far (status PENDING if not done)
+  ArnlGoalResult getResult() const
+  {
+    std::lock_guard<std::mutex> guard(myState->mutex);
+    return myState->result;
+  }
+
+  /// Block until done, and return the result
+  ArnlGoalResult wait() const
+  {
+    std::unique_lock<std::mutex> guard(myState->mutex);
+    if(!myState->result.isDone() && ArnlClock::isCounted())
+      sleep(guard, -1);
+    while(!myState->result.isDone())
+      myState->cond.wait(guard);
+    return myState->result;
+  }
+
+  /** Block until done or @a msecs (of ArnlClock time) have passed.
+   * @return true if done */
+  bool waitFor(long msecs) const
+  {
+    std::unique_lock<std::mutex> guard(myState->mutex);
+    if(!myState->result.isDone() && ArnlClock::isCounted())
+    {
+      sleep(guard, ArnlClock::getUSecs() + msecs * 1000LL);
+      return myState->result.isDone();
+    }
+    return myState->cond.wait_for(guard, std::chrono::milliseconds(msecs),
+      [this] { return myState->result.isDone(); });
+  }
+
+  /** Invoke @a cb (not copied; it must remain valid until invoked) with the
+   * result when done: in the thread which completes the goal (e.g. the path
+   * planning thread), or immediately in this thread if already done. */
+  void then(ResultCB *cb) const
+  {
+    std::unique_lock<std::mutex> guard(myState->mutex);
+    if(!myState->result.isDone())
+    {
+      myState->callbacks.push_back(cb);
+      return;
+    }
+    ArnlGoalResult result = myState->result;
+    guard.unlock();
+    cb->invoke(result);
+  }
+
+protected:
+  friend class ArnlGoalPromise;
+
+  struct State
+  {
+    std::mutex mutex;
+    std::condition_variable cond;
+    ArnlGoalResult result;
+    long long requestedMSecs;
+    std::list<ResultCB *> callbacks;
+    /// Threads counted by ArnlClock waiting for this (in virtual time)
+    std::list<ArnlClock::Sleeper *> sleepers;
+  };
+
+  explicit ArnlGoalFuture(const std::shared_ptr<State>& state) : myState(state) {}
+
+  /** Wait in a thread counted by ArnlClock (with the state's mutex locked by
+   * @a guard) until done or virtual time reaches @a wakeUSecs (-1 for no limit) */
+  void sleep(std::unique_lock<std::mutex>& guard, long long wakeUSecs) const
+  {
+    ArnlClock::Sleeper sleeper(&myState->mutex, &myState->cond, wakeUSecs);
+    myState->sleepers.push_back(&sleeper);
+    ArnlClock::sleep(&sleeper);
+    while(!sleeper.woken)
+      myState->cond.wait(guard);
+    myState->sleepers.remove(&sleeper);
+    // Not with the mutex locked: whoever has the turn may complete this
+    guard.unlock();
+    ArnlClock::awake(&sleeper);
+    guard.lock();
+  }
+
+  std::shared_ptr<State> myState;
+};
+
+/// The completing side of an ArnlGoalFuture, kept by whatever tracks the goal
+class ArnlGoalPromise
+{
+public:
+  /// No future yet (isValid() is false), e.g. for a slot assigned later
+  ArnlGoalPromise() {}
+
+  explicit ArnlGoalPromise(const std::string& goalName) :
+    myState(std::make_shared<ArnlGoalFuture::State>())
+  {
+    myState->result.goalName = goalName;
+    myState->requestedMSecs = ArnlClock::getMSecs();
+  }
+
+  ArnlGoalFuture getFuture() const { return ArnlGoalFuture(myState); }
+
+  bool isValid() const { return (bool)myState; }
+
+  const std::string& getGoalName() const { return myState->result.goalName; }
+
+  /// Whether this and @a other complete the same future
+  bool operator==(const ArnlGoalPromise& other) const { return myState == other.myState; }
+
+  /// Whether @a future is one this completes
+  bool isFor(const ArnlGoalFuture& future) const { return myState == future.myState; }
+
+  /** Complete the future with @a status (not PENDING) and the robot's @a pose,
+   * waking waiters and invoking then() callbacks in this thread.
+   * @return false if it was already complete */
+  bool complete(ArnlGoalResult::Status status, const ArPose& pose)
+  {
+    std::unique_lock<std::mutex> guard(myState->mutex);
+    if(myState->result.isDone())
+      return false;
+    myState->result.status = status;
+    myState->result.pose = pose;
+    myState->result.msecs = (long)(ArnlClock::getMSecs() - myState->requestedMSecs);
+    ArnlGoalResult result = myState->result;
+    std::list<ArnlGoalFuture::ResultCB *> cbs;
+    cbs.swap(myState->callbacks);
+    for(std::list<ArnlClock::Sleeper *>::const_iterator i = myState->sleepers.begin(); i != myState->sleepers.end(); ++i)
+      ArnlClock::wake(*i);
+    guard.unlock();
+    myState->cond.notify_all();
+    for(std::list<ArnlGoalFuture::ResultCB *>::const_iterator i = cbs.begin(); i != cbs.end(); ++i)
+      (*i)->invoke(result);
+    return true;
+  }
+
+protected:
+  std::shared_ptr<ArnlGoalFuture::State> myState;
+};
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef ARNLLOCALTASKCLIENT_H
+#define ARNLLOCALTASKCLIENT_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/// Default path of the Unix domain socket opened by ArnlLocalTaskServer
+#define ARNL_LOCAL_TASK_DEFAULT_SOCKET "/tmp/arnlTasks.sock"
+
+/**
+  Client side of the local (same computer) task transport: connects to the
+  Unix domain socket opened by ArnlLocalTaskServer in an ARNL server,
+  receives goal started, reached and failed events, and sends goal requests.
+  Used by ArnlRemoteASyncTask when constructed with a socket path instead of
+  an ArClientBase, avoiding TCP and ArNetworking packet handling.
+
+  The protocol is one line of text per message.
+  From the server:
+    - <tt>going X Y TH GOALNAME</tt>
+    - <tt>arrived X Y TH GOALNAME</tt>
+    - <tt>failed X Y TH GOALNAME</tt>
+    - <tt>pong TOKEN</tt>
+  To the server:
+    - <tt>goto GOALNAME</tt>
+    - <tt>ping TOKEN</tt>
+
+  Events are received in a thread run by this object, and callbacks are
+  invoked in that thread.
+
+  Not available on Windows.
+*/
+class ArnlLocalTaskClient : public virtual ArASyncTask
+{
+public:
+  typedef ArFunctor2<const std::string&, const ArPose&> GoalEventCB;
+
+  ArnlLocalTaskClient() : myFD(-1), myLastPong(0)
+  {
+    setThreadName("ArnlLocalTaskClient");
+  }
+
+  virtual ~ArnlLocalTaskClient()
+  {
+    // Joined so that the thread is not reading the socket or calling
+    // callbacks when the socket is closed and this is destroyed
+    const bool running = getRunning();
+    stopRunning();
+#ifndef WIN32
+    // Wakes the thread from poll() at once
+    myMutex.lock();
+    if(myFD >= 0)
+      shutdown(myFD, SHUT_RDWR);
+    myMutex.unlock();
+#endif
+    if(running)
+      join();
+    disconnect();
+  }
+
+  /// Connect to the server's socket and start receiving events
+  bool connect(const char *socketPath = ARNL_LOCAL_TASK_DEFAULT_SOCKET)
+  {
+#ifdef WIN32
+    ArLog::log(ArLog::Terse, "ArnlLocalTaskClient: local task transport is not available on Windows.");
+    return false;
+#else
+    disconnect();
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+      return false;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    if(::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+      ArLog::log(ArLog::Terse, "ArnlLocalTaskClient: Error: could not connect to %s: %s", socketPath, strerror(errno));
+      ::close(fd);
+      return false;
+    }
+    myMutex.lock();
+    myFD = fd;
+    myPath = socketPath;
+    myMutex.unlock();
+    runAsync();
+    ArLog::log(ArLog::Normal, "ArnlLocalTaskClient: connected to %s", socketPath);
+    return true;
+#endif
+  }
+
+  void disconnect()
+  {
+#ifndef WIN32
+    myMutex.lock();
+    if(myFD >= 0)
+    {
+      shutdown(myFD, SHUT_RDWR);
+      ::close(myFD);
+      myFD = -1;
+    }
+    myMutex.unlock();
+#endif
+  }
+
+  bool isConnected()
+  {
+    myMutex.lock();
+    bool ret = (myFD >= 0);
+    myMutex.unlock();
+    return ret;
+  }
+
+  const char *getPath() const { return myPath.c_str(); }
+
+  /// Request that the server go to the named goal
+  bool requestGoal(const std::string& goalName)
+  {
+    return sendLine("goto " + goalName);
+  }
+
+  /// Send a ping; use waitForPong() to wait for the reply (used to measure latency)
+  bool ping(unsigned long token)
+  {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "ping %lu", token);
+    return sendLine(buf);
+  }
+
+  /// Wait up to @a msecs for the pong reply to ping(@a token)
+  bool waitForPong(unsigned long token, unsigned int msecs)
+  {
+    std::unique_lock<std::mutex> guard(myPongMutex);
+    return myPongCondition.wait_for(guard, std::chrono::milliseconds(msecs),
+      [this, token] { return myLastPong == token; });
+  }
+
+  void addGoalReachedCB(GoalEventCB *cb) { myMutex.lock(); myReachedCBs.push_back(cb); myMutex.unlock(); }
+  void remGoalReachedCB(GoalEventCB *cb) { myMutex.lock(); myReachedCBs.remove(cb); myMutex.unlock(); }
+  void addGoalFailedCB(GoalEventCB *cb) { myMutex.lock(); myFailedCBs.push_back(cb); myMutex.unlock(); }
+  void remGoalFailedCB(GoalEventCB *cb) { myMutex.lock(); myFailedCBs.remove(cb); myMutex.unlock(); }
+  /// Called when the server's path planner starts toward a new goal (from any source)
+  void addGoalStartedCB(GoalEventCB *cb) { myMutex.lock(); myStartedCBs.push_back(cb); myMutex.unlock(); }
+  void remGoalStartedCB(GoalEventCB *cb) { myMutex.lock(); myStartedCBs.remove(cb); myMutex.unlock(); }
+
+  /// @internal
+  virtual void *runThread(void *)
+  {
+#ifndef WIN32
+    std::string buffer;
+    char chunk[1024];
+    while(getRunning())
+    {
+      myMutex.lock();
+      int fd = myFD;
+      myMutex.unlock();
+      if(fd < 0)
+        break;
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      int r = poll(&pfd, 1, 100);
+      if(r == 0 || (r < 0 && errno == EINTR))
+        continue;
+      ssize_t n = (r > 0) ? ::read(fd, chunk, sizeof(chunk)) : -1;
+      if(n <= 0)
+      {
+        ArLog::log(ArLog::Terse, "ArnlLocalTaskClient: lost connection to %s", myPath.c_str());
+        disconnect();
+        break;
+      }
+      buffer.append(chunk, n);
+      std::string::size_type eol;
+      while((eol = buffer.find('\n')) != std::string::npos)
+      {
+        handleLine(buffer.substr(0, eol));
+        buffer.erase(0, eol + 1);
+      }
+    }
+#endif
+    return NULL;
+  }
+
+protected:
+  bool sendLine(const std::string& line)
+  {
+#ifdef WIN32
+    return false;
+#else
+    std::string msg = line + "\n";
+    myMutex.lock();
+    bool ok = (myFD >= 0);
+    size_t sent = 0;
+    while(ok && sent < msg.size())
+    {
+      ssize_t n = send(myFD, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+      if(n < 0 && errno == EINTR)
+        continue;
+      ok = (n > 0);
+      if(ok)
+        sent += n;
+    }
+    myMutex.unlock();
+    return ok;
+#endif
+  }
+
+  void handleLine(const std::string& line)
+  {
+    std::string::size_type sp = line.find(' ');
+    std::string cmd = line.substr(0, sp);
+    std::string rest = (sp == std::string::npos) ? "" : line.substr(sp + 1);
+    if(cmd == "pong")
+    {
+      {
+        std::lock_guard<std::mutex> guard(myPongMutex);
+        myLastPong = strtoul(rest.c_str(), NULL, 10);
+      }
+      myPongCondition.notify_all();
+      return;
+    }
+    if(cmd != "arrived" && cmd != "failed" && cmd != "going")
+      return;
+    double x = 0, y = 0, th = 0;
+    int consumed = 0;
+    if(sscanf(rest.c_str(), "%lf %lf %lf %n", &x, &y, &th, &consumed) < 3)
+      return;
+    const std::string goalName = rest.substr(consumed);
+    const ArPose pose(x, y, th);
+    myMutex.lock();
+    std::list<GoalEventCB*> cbs = (cmd == "arrived") ? myReachedCBs : (cmd == "failed") ? myFailedCBs : myStartedCBs;
+    myMutex.unlock();
+    for(std::list<GoalEventCB*>::const_iterator i = cbs.begin(); i != cbs.end(); ++i)
+      (*i)->invoke(goalName, pose);
+  }
+
+  ArMutex myMutex;
+  int myFD;
+  std::string myPath;
+  std::list<GoalEventCB*> myReachedCBs;
+  std::list<GoalEventCB*> myFailedCBs;
+  std::list<GoalEventCB*> myStartedCBs;
+  /// Waited on with myPongCondition, so that a pong between checking and waiting is not missed
+  std::mutex myPongMutex;
+  std::condition_variable myPongCondition;
+  /// Token of the last pong (protected by myPongMutex)
+  unsigned long myLastPong;
+};
+
+#endif
@@ -0,0 +1,321 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlLocalTaskServer.h"
+#include "ArServerModeGoto2.h"
+
+#include <vector>
+
+ArnlLocalTaskServer::ArnlLocalTaskServer(ArPathPlanningTask *pathTask,
+  ArServerModeGoto2 *gotoMode, const char *socketPath) :
+  myPathTask(pathTask),
+  myGotoMode(gotoMode),
+  mySocketPath(socketPath),
+  myListenFD(-1),
+  myGoalDoneCB(this, &ArnlLocalTaskServer::goalDone),
+  myGoalFailedCB(this, &ArnlLocalTaskServer::goalFailed),
+  myNewGoalCB(this, &ArnlLocalTaskServer::newGoal),
+  myProfiledGoalDoneCB(&myGoalDoneCB, "ArnlLocalTaskServer::goalDone"),
+  myProfiledGoalFailedCB(&myGoalFailedCB, "ArnlLocalTaskServer::goalFailed"),
+  myProfiledNewGoalCB(&myNewGoalCB, "ArnlLocalTaskServer::newGoal"),
+  myProcessFileCB(this, &ArnlLocalTaskServer::processFile)
+{
+  setThreadName("ArnlLocalTaskServer");
+  myMutex.setLogName("ArnlLocalTaskServer::myMutex");
+  strncpy(myConfigSocketPath, socketPath, sizeof(myConfigSocketPath) - 1);
+  myConfigSocketPath[sizeof(myConfigSocketPath) - 1] = '\0';
+  myPathTask->addGoalDoneCB(&myProfiledGoalDoneCB);
+  myPathTask->addGoalFailedCB(&myProfiledGoalFailedCB);
+  myPathTask->addNewGoalCB(&myProfiledNewGoalCB);
+}
+
+ArnlLocalTaskServer::~ArnlLocalTaskServer()
+{
+  myPathTask->remGoalDoneCB(&myProfiledGoalDoneCB);
+  myPathTask->remGoalFailedCB(&myProfiledGoalFailedCB);
+  myPathTask->remNewGoalCB(&myProfiledNewGoalCB);
+  // Joined so that the thread is not reading the sockets or handling a
+  // request when they are closed and this is destroyed
+  const bool running = getRunning();
+  stopRunning();
+#ifndef WIN32
+  // Wakes the thread from poll() at once
+  myMutex.lock();
+  for (std::list<Client>::iterator it = myClients.begin(); it != myClients.end(); ++it)
+    shutdown(it->fd, SHUT_RDWR);
+  if (myListenFD >= 0)
+    shutdown(myListenFD, SHUT_RDWR);
+  myMutex.unlock();
+#endif
+  if (running)
+    join();
+  close();
+}
+
+void ArnlLocalTaskServer::addToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("LocalTaskSocket", myConfigSocketPath,
+		      "Path of the Unix domain socket on which task programs on this computer receive goal events and request goals. Empty disables.",
+		      sizeof(myConfigSocketPath)),
+	  section, ArPriority::DETAILED);
+  config->addProcessFileCB(&myProcessFileCB, 40);
+}
+
+bool ArnlLocalTaskServer::processFile(void)
+{
+  if (mySocketPath != myConfigSocketPath)
+  {
+    close();
+    mySocketPath = myConfigSocketPath;
+  }
+  open();
+  return true;
+}
+
+bool ArnlLocalTaskServer::open(void)
+{
+#ifdef WIN32
+  ArLog::log(ArLog::Terse, "ArnlLocalTaskServer: the local task socket is not available on Windows.");
+  return false;
+#else
+  myMutex.lock();
+  if (myListenFD >= 0 || mySocketPath.empty())
+  {
+    myMutex.unlock();
+    return true;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    ArLog::log(ArLog::Terse, "ArnlLocalTaskServer: Error: could not create socket: %s", strerror(errno));
+    myMutex.unlock();
+    return false;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, mySocketPath.c_str(), sizeof(addr.sun_path) - 1);
+  // Remove a socket left behind by a previous server process
+  unlink(mySocketPath.c_str());
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+  {
+    ArLog::log(ArLog::Terse, "ArnlLocalTaskServer: Error: could not open socket %s: %s", mySocketPath.c_str(), strerror(errno));
+    ::close(fd);
+    myMutex.unlock();
+    return false;
+  }
+  myListenFD = fd;
+  myOpenPath = mySocketPath;
+  myMutex.unlock();
+  if (!getRunning())
+    runAsync();
+  ArLog::log(ArLog::Normal, "ArnlLocalTaskServer: accepting local task connections on %s", mySocketPath.c_str());
+  return true;
+#endif
+}
+
+void ArnlLocalTaskServer::close(void)
+{
+#ifndef WIN32
+  myMutex.lock();
+  for (std::list<Client>::iterator it = myClients.begin(); it != myClients.end(); ++it)
+    ::close(it->fd);
+  myClients.clear();
+  if (myListenFD >= 0)
+  {
+    ::close(myListenFD);
+    myListenFD = -1;
+    unlink(myOpenPath.c_str());
+  }
+  myMutex.unlock();
+#endif
+}
+
+int ArnlLocalTaskServer::getNumClients(void)
+{
+  myMutex.lock();
+  int n = (int)myClients.size();
+  myMutex.unlock();
+  return n;
+}
+
+void *ArnlLocalTaskServer::runThread(void *)
+{
+#ifndef WIN32
+  std::vector<struct pollfd> fds;
+  char chunk[1024];
+  while (getRunning())
+  {
+    fds.clear();
+    myMutex.lock();
+    if (myListenFD >= 0)
+    {
+      struct pollfd p = { myListenFD, POLLIN, 0 };
+      fds.push_back(p);
+    }
+    for (std::list<Client>::iterator it = myClients.begin(); it != myClients.end(); ++it)
+    {
+      struct pollfd p = { it->fd, POLLIN, 0 };
+      fds.push_back(p);
+    }
+    int listenFD = myListenFD;
+    myMutex.unlock();
+
+    if (fds.empty())
+    {
+      ArUtil::sleep(100);
+      continue;
+    }
+    // Time out so that changes to the socket (close(), reconfiguration) are noticed
+    if (poll(&fds[0], fds.size(), 100) <= 0)
+      continue;
+
+    // Complete lines are handled after releasing the mutex, since goal
+    // requests call into the path planner or server mode.
+    std::list<std::pair<int, std::string> > lines;
+    myMutex.lock();
+    for (size_t i = 0; i < fds.size(); ++i)
+    {
+      if (fds[i].revents == 0)
+        continue;
+      if (fds[i].fd == listenFD)
+      {
+        if (listenFD != myListenFD)
+          continue;
+        int clientFD = accept(listenFD, NULL, NULL);
+        if (clientFD >= 0)
+        {
+          Client c;
+          c.fd = clientFD;
+          myClients.push_back(c);
+          ArLog::log(ArLog::Normal, "ArnlLocalTaskServer: local task client connected (%d connected)", (int)myClients.size());
+        }
+        continue;
+      }
+      std::list<Client>::iterator it;
+      for (it = myClients.begin(); it != myClients.end() && it->fd != fds[i].fd; ++it)
+        ;
+      // Already closed by broadcast() or close()
+      if (it == myClients.end())
+        continue;
+      ssize_t n = ::read(it->fd, chunk, sizeof(chunk));
+      if (n <= 0)
+      {
+        ::close(it->fd);
+        myClients.erase(it);
+        ArLog::log(ArLog::Normal, "ArnlLocalTaskServer: local task client disconnected (%d connected)", (int)myClients.size());
+        continue;
+      }
+      it->buffer.append(chunk, n);
+      std::string::size_type eol;
+      while ((eol = it->buffer.find('\n')) != std::string::npos)
+      {
+        lines.push_back(std::pair<int, std::string>(it->fd, it->buffer.substr(0, eol)));
+        it->buffer.erase(0, eol + 1);
+      }
+    }
+    myMutex.unlock();
+
+    for (std::list<std::pair<int, std::string> >::iterator l = lines.begin(); l != lines.end(); ++l)
+      handleLine(l->first, l->second);
+  }
+#endif
+  return NULL;
+}
+
+void ArnlLocalTaskServer::handleLine(int fd, const std::string& line)
+{
+  std::string::size_type sp = line.find(' ');
+  std::string cmd = line.substr(0, sp);
+  std::string arg = (sp == std::string::npos) ? "" : line.substr(sp + 1);
+  if (cmd == "ping")
+  {
+    sendLine(fd, "pong " + arg);
+  }
+  else if (cmd == "goto" && !arg.empty())
+  {
+    ArLog::log(ArLog::Normal, "ArnlLocalTaskServer: local task requested goal %s", arg.c_str());
+    if (myGotoMode != NULL)
+      myGotoMode->gotoGoal(arg.c_str());
+    else
+      myPathTask->pathPlanToGoal(arg.c_str());
+  }
+  else
+  {
+    ArLog::log(ArLog::Verbose, "ArnlLocalTaskServer: ignoring unknown request \"%s\"", line.c_str());
+  }
+}
+
+void ArnlLocalTaskServer::goalDone(ArPose pose)
+{
+  broadcast("arrived", pose);
+}
+
+void ArnlLocalTaskServer::goalFailed(ArPose pose)
+{
+  broadcast("failed", pose);
+}
+
+void ArnlLocalTaskServer::newGoal(ArPose pose)
+{
+  broadcast("going", pose);
+}
+
+void ArnlLocalTaskServer::broadcast(const char *event, const ArPose& pose)
+{
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s %.0f %.0f %.1f %s", event,
+	   pose.getX(), pose.getY(), pose.getTh(), myPathTask->getCurrentGoalName().c_str());
+  myMutex.lock();
+  std::list<Client>::iterator it = myClients.begin();
+  while (it != myClients.end())
+  {
+    std::list<Client>::iterator next = it;
+    ++next;
+    sendLine(it->fd, buf);
+    it = next;
+  }
+  myMutex.unlock();
+}
+
+/// Writes without blocking; a client whose socket buffer is full is disconnected
+bool ArnlLocalTaskServer::sendLine(int fd, const std::string& line)
+{
+#ifdef WIN32
+  return false;
+#else
+  std::string msg = line + "\n";
+  myMutex.lock();
+  ssize_t n;
+  do
+    n = send(fd, msg.data(), msg.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+  while (n < 0 && errno == EINTR);
+  bool ok = (n == (ssize_t)msg.size());
+  if (!ok)
+  {
+    ArLog::log(ArLog::Normal, "ArnlLocalTaskServer: disconnecting local task client which is not keeping up");
+    closeClient(fd);
+  }
+  myMutex.unlock();
+  return ok;
+#endif
+}
+
+/// Must be called with myMutex locked
+void ArnlLocalTaskServer::closeClient(int fd)
+{
+#ifndef WIN32
+  for (std::list<Client>::iterator it = myClients.begin(); it != myClients.end(); ++it)
+  {
+    if (it->fd == fd)
+    {
+      ::close(fd);
+      myClients.erase(it);
+      return;
+    }
+  }
+#endif
+}
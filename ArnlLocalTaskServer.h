@@ -0,0 +1,95 @@
+#ifndef ARNLLOCALTASKSERVER_H
+#define ARNLLOCALTASKSERVER_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+#include "Arnl.h"
+#include "ArPathPlanningTask.h"
+
+#include "ArnlLocalTaskClient.h"
+#include "ArnlCallbackProfiler.h"
+
+#include <list>
+#include <string>
+
+class ArServerModeGoto2;
+
+/**
+  Server side of the local task transport: accepts connections from task
+  programs on the same computer (ArnlRemoteASyncTask constructed with a
+  socket path, or ArnlLocalTaskClient) on a Unix domain socket, sends them
+  goal started, reached and failed events, and carries out their goal
+  requests.
+  See ArnlLocalTaskClient for the protocol.
+
+  Events are written to the clients from the path planning thread's
+  callbacks without blocking: a client which is not reading its socket is
+  disconnected rather than allowed to delay the path planner.
+
+  The socket path is set by the LocalTaskSocket parameter (empty to disable)
+  after addToConfig() is called.
+
+  Not available on Windows.
+*/
+class ArnlLocalTaskServer : public ArASyncTask
+{
+public:
+  /** @param gotoMode If given, goal requests activate this mode (like the
+      "gotoGoal" request), otherwise they go directly to @a pathTask. */
+  ArnlLocalTaskServer(ArPathPlanningTask *pathTask, ArServerModeGoto2 *gotoMode = NULL,
+    const char *socketPath = ARNL_LOCAL_TASK_DEFAULT_SOCKET);
+  virtual ~ArnlLocalTaskServer();
+
+  void addToConfig(ArConfig *config, const char *section = "Local tasks");
+
+  /// Open the socket and start accepting connections (also done when the config is loaded, if addToConfig() was called)
+  bool open(void);
+
+  /// Disconnect all clients and remove the socket
+  void close(void);
+
+  /// @return number of connected clients
+  int getNumClients(void);
+
+  virtual void *runThread(void *arg);
+
+protected:
+  void goalDone(ArPose pose);
+  void goalFailed(ArPose pose);
+  void newGoal(ArPose pose);
+  void broadcast(const char *event, const ArPose& pose);
+  void handleLine(int fd, const std::string& line);
+  bool sendLine(int fd, const std::string& line);
+  void closeClient(int fd);
+  bool processFile(void);
+
+  struct Client
+  {
+    int fd;
+    std::string buffer;
+  };
+
+  ArPathPlanningTask *myPathTask;
+  ArServerModeGoto2 *myGotoMode;
+  ArMutex myMutex;
+  std::string mySocketPath;
+  std::string myOpenPath;
+  char myConfigSocketPath[108];
+  int myListenFD;
+  std::list<Client> myClients;
+
+  ArFunctor1C<ArnlLocalTaskServer, ArPose> myGoalDoneCB;
+  ArFunctor1C<ArnlLocalTaskServer, ArPose> myGoalFailedCB;
+  ArFunctor1C<ArnlLocalTaskServer, ArPose> myNewGoalCB;
+  ArnlProfiledFunctor1<ArPose> myProfiledGoalDoneCB;
+  ArnlProfiledFunctor1<ArPose> myProfiledGoalFailedCB;
+  ArnlProfiledFunctor1<ArPose> myProfiledNewGoalCB;
+  ArRetFunctorC<bool, ArnlLocalTaskServer> myProcessFileCB;
+};
+
+#endif
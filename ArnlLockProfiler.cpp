@@ -0,0 +1,235 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlLockProfiler.h"
+
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+std::atomic<bool> ArnlLockStats::ourEnabled(false);
+ArMutex ArnlLockProfiler::ourStatsMutex;
+std::map<std::string, ArnlLockStats *> ArnlLockProfiler::ourStats;
+
+ArnlLockStats::ArnlLockStats(const std::string& name, ArnlMetricsRegistry *metrics) :
+  myName(name),
+  myDepth(0),
+  myHolderSite(NULL),
+  myHeldSinceUSecs(0)
+{
+  myStatsMutex.setLogName("ArnlLockStats::myStatsMutex");
+  myWaitMetric = metrics->getCounter(ArnlMetricsRegistry::withLabel("arnl_lock_wait_usecs_total", "lock", name),
+    "Time spent waiting to acquire a profiled lock");
+  myHoldMetric = metrics->getCounter(ArnlMetricsRegistry::withLabel("arnl_lock_hold_usecs_total", "lock", name),
+    "Time a profiled lock was held");
+  myContendedMetric = metrics->getCounter(ArnlMetricsRegistry::withLabel("arnl_lock_contended_total", "lock", name),
+    "Acquisitions of a profiled lock which found it held by another thread");
+}
+
+void ArnlLockStats::acquired(const char *site, long long startUSecs, bool contended)
+{
+  const long long now = ArnlThreadScheduler::getMonotonicUSecs();
+  const long long wait = now - startUSecs;
+  // A recursive lock is held from the outermost lock() to its unlock()
+  if (myDepth++ == 0)
+  {
+    myHolderSite = site;
+    myHeldSinceUSecs = now;
+  }
+  myWaitMetric->add(wait);
+  if (contended)
+    myContendedMetric->add();
+
+  myStatsMutex.lock();
+  SiteStats& s = mySites[site];
+  s.count++;
+  if (contended)
+    s.contended++;
+  s.waitUSecs += wait;
+  if (wait > s.maxWaitUSecs)
+    s.maxWaitUSecs = wait;
+  myStatsMutex.unlock();
+}
+
+void ArnlLockStats::released(void)
+{
+  if (myDepth == 0 || --myDepth > 0)
+    return;
+  const long long hold = ArnlThreadScheduler::getMonotonicUSecs() - myHeldSinceUSecs;
+  const char *site = myHolderSite;
+  myHoldMetric->add(hold);
+
+  myStatsMutex.lock();
+  SiteStats& s = mySites[site];
+  s.holdUSecs += hold;
+  if (hold > s.maxHoldUSecs)
+    s.maxHoldUSecs = hold;
+  myStatsMutex.unlock();
+}
+
+static bool moreWait(const std::pair<const char *, long long>& a,
+  const std::pair<const char *, long long>& b)
+{
+  return a.second > b.second;
+}
+
+void ArnlLockStats::writeReport(std::string *out)
+{
+  myStatsMutex.lock();
+  std::map<const char *, SiteStats> sites = mySites;
+  myStatsMutex.unlock();
+
+  SiteStats total;
+  memset(&total, 0, sizeof(total));
+  std::vector<std::pair<const char *, long long> > order;
+  for (std::map<const char *, SiteStats>::const_iterator it = sites.begin(); it != sites.end(); ++it)
+  {
+    const SiteStats& s = it->second;
+    total.count += s.count;
+    total.contended += s.contended;
+    total.waitUSecs += s.waitUSecs;
+    total.maxWaitUSecs = std::max(total.maxWaitUSecs, s.maxWaitUSecs);
+    total.holdUSecs += s.holdUSecs;
+    total.maxHoldUSecs = std::max(total.maxHoldUSecs, s.maxHoldUSecs);
+    order.push_back(std::pair<const char *, long long>(it->first, s.waitUSecs));
+  }
+  std::sort(order.begin(), order.end(), moreWait);
+
+  char buf[512];
+  snprintf(buf, sizeof(buf),
+	   "%s: %lld acquisitions, %lld contended, wait %.1f ms total %.2f ms max, hold %.1f ms total %.2f ms max\n",
+	   myName.c_str(), total.count, total.contended, total.waitUSecs / 1000.0,
+	   total.maxWaitUSecs / 1000.0, total.holdUSecs / 1000.0, total.maxHoldUSecs / 1000.0);
+  *out += buf;
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    const SiteStats& s = sites[order[i].first];
+    snprintf(buf, sizeof(buf),
+	     "  %s: %lld acquisitions, %lld contended, wait %.1f ms total %.2f ms max, hold %.1f ms total %.2f ms max\n",
+	     order[i].first, s.count, s.contended, s.waitUSecs / 1000.0,
+	     s.maxWaitUSecs / 1000.0, s.holdUSecs / 1000.0, s.maxHoldUSecs / 1000.0);
+    *out += buf;
+  }
+}
+
+void ArnlLockStats::reset(void)
+{
+  myStatsMutex.lock();
+  mySites.clear();
+  myStatsMutex.unlock();
+}
+
+
+ArnlLockProfiler::ArnlLockProfiler(ArServerBase *server, ArServerHandlerCommands *commands) :
+  myServer(server),
+  myConfigEnabled(false),
+  myServerLockContentionCB(this, &ArnlLockProfiler::serverLockContention),
+  myLogReportCB(this, &ArnlLockProfiler::logReport),
+  myResetCB(this, &ArnlLockProfiler::reset),
+  myExitCB(this, &ArnlLockProfiler::logReport),
+  myProcessFileCB(this, &ArnlLockProfiler::processFile)
+{
+  if (myServer != NULL)
+    myServer->addData("lockContention",
+		      "gets lock contention statistics (enable in the Lock profiling config section)",
+		      &myServerLockContentionCB, "none",
+		      "<repeat> string: report line", "RobotInfo", "RETURN_SINGLE");
+  if (commands != NULL)
+  {
+    commands->addCommand("LogLockContention",
+			 "Logs lock contention statistics",
+			 &myLogReportCB);
+    commands->addCommand("ResetLockContention",
+			 "Forgets lock contention statistics collected so far",
+			 &myResetCB);
+  }
+  Aria::addExitCallback(&myExitCB, 30);
+}
+
+ArnlLockProfiler::~ArnlLockProfiler()
+{
+  Aria::remExitCallback(&myExitCB);
+}
+
+void ArnlLockProfiler::addToConfig(ArConfig *config, const char *section)
+{
+  myConfigEnabled = ArnlLockStats::ourEnabled;
+  config->addParam(
+	  ArConfigArg("Enabled", &myConfigEnabled,
+		      "Measure wait and hold times of the map and task locks, and of the robot lock where it is taken outside the robot thread"),
+	  section, ArPriority::DETAILED);
+  config->addProcessFileCB(&myProcessFileCB, 40);
+}
+
+bool ArnlLockProfiler::processFile(void)
+{
+  ArnlLockStats::ourEnabled = myConfigEnabled;
+  return true;
+}
+
+ArnlLockStats *ArnlLockProfiler::getStats(const std::string& name)
+{
+  ourStatsMutex.lock();
+  std::map<std::string, ArnlLockStats *>::iterator it = ourStats.find(name);
+  ArnlLockStats *stats;
+  if (it != ourStats.end())
+  {
+    stats = it->second;
+  }
+  else
+  {
+    stats = new ArnlLockStats(name, ArnlMetricsRegistry::getGlobal());
+    ourStats[name] = stats;
+  }
+  ourStatsMutex.unlock();
+  return stats;
+}
+
+void ArnlLockProfiler::writeReport(std::string *out)
+{
+  ourStatsMutex.lock();
+  std::map<std::string, ArnlLockStats *> stats = ourStats;
+  ourStatsMutex.unlock();
+  if (!ArnlLockStats::ourEnabled)
+    *out += "Lock profiling is disabled.\n";
+  for (std::map<std::string, ArnlLockStats *>::iterator it = stats.begin(); it != stats.end(); ++it)
+    it->second->writeReport(out);
+}
+
+void ArnlLockProfiler::logReport(void)
+{
+  std::string report;
+  writeReport(&report);
+  ArLog::log(ArLog::Normal, "ArnlLockProfiler: lock contention:");
+  std::string::size_type start = 0, eol;
+  while ((eol = report.find('\n', start)) != std::string::npos)
+  {
+    ArLog::log(ArLog::Normal, "ArnlLockProfiler: %s", report.substr(start, eol - start).c_str());
+    start = eol + 1;
+  }
+}
+
+void ArnlLockProfiler::reset(void)
+{
+  ourStatsMutex.lock();
+  for (std::map<std::string, ArnlLockStats *>::iterator it = ourStats.begin(); it != ourStats.end(); ++it)
+    it->second->reset();
+  ourStatsMutex.unlock();
+}
+
+void ArnlLockProfiler::serverLockContention(ArServerClient *client, ArNetPacket *)
+{
+  std::string report;
+  writeReport(&report);
+  ArNetPacket sending;
+  std::string::size_type start = 0, eol;
+  while ((eol = report.find('\n', start)) != std::string::npos)
+  {
+    sending.strToBuf(report.substr(start, eol - start).c_str());
+    start = eol + 1;
+  }
+  client->sendPacketTcp(&sending);
+}
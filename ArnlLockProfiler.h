@@ -0,0 +1,158 @@
+#ifndef ARNLLOCKPROFILER_H
+#define ARNLLOCKPROFILER_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include "ArnlMetrics.h"
+#include "ArnlThreadScheduler.h"
+
+#include <atomic>
+#include <map>
+#include <string>
+
+#define ARNL_LOCK_STRINGIFY2(x) #x
+#define ARNL_LOCK_STRINGIFY(x) ARNL_LOCK_STRINGIFY2(x)
+
+/// Identifies the place a lock is taken ("file:line"), for ArnlLockStats::lock()
+#define ARNL_LOCK_SITE (__FILE__ ":" ARNL_LOCK_STRINGIFY(__LINE__))
+
+/**
+  Contention statistics for one lock (an ArMutex, ArRobot, ArMapInterface,
+  or anything else with lock(), tryLock() and unlock() methods), taken
+  through lock() and unlock() here instead of directly:
+
+  @code{.cpp}
+  static ArnlLockStats *mapLockStats = ArnlLockProfiler::getStats("map");
+  mapLockStats->lock(myMap, ARNL_LOCK_SITE);
+  ...
+  mapLockStats->unlock(myMap);
+  @endcode
+
+  For each call site, the number of acquisitions, how many found the lock
+  held by another thread, and the total and maximum time spent waiting for
+  and holding the lock are recorded. Only acquisitions made through this
+  object are measured. When lock profiling is disabled (the default) these
+  just call the lock's own methods.
+*/
+class ArnlLockStats
+{
+public:
+  ArnlLockStats(const std::string& name, ArnlMetricsRegistry *metrics);
+
+  template<class T>
+  void lock(T *lockable, const char *site)
+  {
+    if (!ourEnabled.load(std::memory_order_relaxed))
+    {
+      lockable->lock();
+      return;
+    }
+    const long long start = ArnlThreadScheduler::getMonotonicUSecs();
+    bool contended = false;
+    if (lockable->tryLock() != 0)
+    {
+      contended = true;
+      lockable->lock();
+    }
+    acquired(site, start, contended);
+  }
+
+  template<class T>
+  void unlock(T *lockable)
+  {
+    released();
+    lockable->unlock();
+  }
+
+  const std::string& getName() const { return myName; }
+
+  /// Append a text report of this lock's statistics, one line per call site
+  void writeReport(std::string *out);
+
+  /// Forget the statistics collected so far
+  void reset(void);
+
+  static std::atomic<bool> ourEnabled;
+
+protected:
+  struct SiteStats
+  {
+    long long count;
+    long long contended;
+    long long waitUSecs;
+    long long maxWaitUSecs;
+    long long holdUSecs;
+    long long maxHoldUSecs;
+  };
+
+  void acquired(const char *site, long long startUSecs, bool contended);
+  void released(void);
+
+  std::string myName;
+  ArMutex myStatsMutex;
+  /// Keyed by the site strings' addresses (normally from ARNL_LOCK_SITE), to avoid copying them
+  std::map<const char *, SiteStats> mySites;
+
+  // Only changed by the thread holding the lock
+  int myDepth;
+  const char *myHolderSite;
+  long long myHeldSinceUSecs;
+
+  ArnlCounter *myWaitMetric;
+  ArnlCounter *myHoldMetric;
+  ArnlCounter *myContendedMetric;
+};
+
+/**
+  Keeps the ArnlLockStats for each named lock, and reports them: in the
+  "lockContention" networking request (one line per string), the
+  LogLockContention and ResetLockContention simple commands, and in the
+  log when the program exits.
+
+  Lock profiling is enabled by the Enabled parameter in the "Lock
+  profiling" section after addToConfig() is called.
+*/
+class ArnlLockProfiler
+{
+public:
+  ArnlLockProfiler(ArServerBase *server = NULL, ArServerHandlerCommands *commands = NULL);
+  ~ArnlLockProfiler();
+
+  void addToConfig(ArConfig *config, const char *section = "Lock profiling");
+
+  void setEnabled(bool enabled) { ArnlLockStats::ourEnabled = enabled; }
+
+  /// Get (creating if needed) the statistics for the named lock
+  static ArnlLockStats *getStats(const std::string& name);
+
+  /// Text report of all locks, each followed by its call sites in order of total wait time
+  static void writeReport(std::string *out);
+
+  /// Log the report
+  void logReport(void);
+
+  void reset(void);
+
+protected:
+  void serverLockContention(ArServerClient *client, ArNetPacket *packet);
+  bool processFile(void);
+
+  ArServerBase *myServer;
+  bool myConfigEnabled;
+  ArFunctor2C<ArnlLockProfiler, ArServerClient *, ArNetPacket *> myServerLockContentionCB;
+  ArFunctorC<ArnlLockProfiler> myLogReportCB;
+  ArFunctorC<ArnlLockProfiler> myResetCB;
+  ArFunctorC<ArnlLockProfiler> myExitCB;
+  ArRetFunctorC<bool, ArnlLockProfiler> myProcessFileCB;
+
+  static ArMutex ourStatsMutex;
+  static std::map<std::string, ArnlLockStats *> ourStats;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef ARNLMAILBOX_H
+#define ARNLMAILBOX_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+  A bounded queue of items posted by any number of threads and taken by a
+  single thread (such as the robot thread, once per cycle), without locks:
+  posting claims a slot with one compare-and-swap and never waits for the
+  consumer, so a task thread is never blocked by the robot loop or by other
+  task threads. post() fails when the mailbox is full.
+
+  Each slot carries a sequence number saying whether it is free for the
+  producer of a given position or holds an item for the consumer (see
+  Dmitry Vyukov's bounded MPMC queue, here with a single consumer). Items
+  are copied into and out of their slot, so T should be cheap to copy.
+*/
+template<class T>
+class ArnlMailbox
+{
+public:
+  /// @param capacity rounded up to a power of two
+  explicit ArnlMailbox(size_t capacity)
+  {
+    size_t n = 2;
+    while (n < capacity)
+      n <<= 1;
+    myMask = n - 1;
+    myCells = new Cell[n];
+    for (size_t i = 0; i < n; i++)
+      myCells[i].seq.store(i, std::memory_order_relaxed);
+    myTail.store(0, std::memory_order_relaxed);
+    myHead = 0;
+  }
+
+  ~ArnlMailbox() { delete [] myCells; }
+
+  /// Add @a item (from any thread). @return false if the mailbox is full
+  bool post(const T& item)
+  {
+    size_t pos = myTail.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;)
+    {
+      cell = &myCells[pos & myMask];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+      if (diff == 0)
+      {
+	if (myTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+	  break;
+      }
+      else if (diff < 0)
+	return false;
+      else
+	pos = myTail.load(std::memory_order_relaxed);
+    }
+    cell->item = item;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Remove the oldest item into @a item (from the consumer thread only). @return false if empty
+  bool take(T *item)
+  {
+    Cell *cell = &myCells[myHead & myMask];
+    const size_t seq = cell->seq.load(std::memory_order_acquire);
+    if ((ptrdiff_t)seq - (ptrdiff_t)(myHead + 1) < 0)
+      return false;
+    *item = cell->item;
+    cell->item = T();
+    cell->seq.store(myHead + myMask + 1, std::memory_order_release);
+    myHead++;
+    return true;
+  }
+
+  size_t getCapacity() const { return myMask + 1; }
+
+protected:
+  struct Cell
+  {
+    std::atomic<size_t> seq;
+    T item;
+  };
+
+  ArnlMailbox(const ArnlMailbox&);
+  ArnlMailbox& operator=(const ArnlMailbox&);
+
+  Cell *myCells;
+  size_t myMask;
+  /// Next position to post to (shared by producers)
+  alignas(64) std::atomic<size_t> myTail;
+  /// Next position to take from (consumer only)
+  alignas(64) size_t myHead;
+};
+
+#endif
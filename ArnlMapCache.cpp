@@ -0,0 +1,381 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlMapCache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char ourMagic[8] = { 'A', 'r', 'n', 'l', 'M', 'a', 'p', 'C' };
+const unsigned int ourVersion = 1;
+
+/** Start of a cache file. It is followed by the map's text other than the
+ * points and lines (padded to a multiple of 8 bytes), the points as x,y
+ * pairs of ints, and the lines as x1,y1,x2,y2 ints, all in this machine's
+ * byte order. */
+struct Header
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int headerSize;
+  /// Checksum and size of the map file the cache was made from
+  unsigned long long checksum;
+  unsigned long long fileSize;
+  unsigned long long textBytes;
+  unsigned long long numPoints;
+  unsigned long long numLines;
+};
+
+unsigned long long padded(unsigned long long bytes)
+{
+  return (bytes + 7) & ~7ULL;
+}
+
+/// 64-bit FNV-1a
+void addToChecksum(unsigned long long *sum, const char *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    *sum ^= (unsigned char)data[i];
+    *sum *= 1099511628211ULL;
+  }
+}
+
+const unsigned long long ourChecksumStart = 14695981039346656037ULL;
+
+/// Read a line of any length, with its newline. @return false at the end of the file
+bool readLine(FILE *file, std::string *line)
+{
+  line->clear();
+  char buf[4096];
+  while (fgets(buf, sizeof(buf), file) != NULL)
+  {
+    *line += buf;
+    if (line->size() > 0 && (*line)[line->size() - 1] == '\n')
+      return true;
+  }
+  return line->size() > 0;
+}
+
+/// Parse exactly @a n ints separated by spaces from @a line
+bool parseInts(const char *line, int *values, int n)
+{
+  char *end;
+  for (int i = 0; i < n; i++)
+  {
+    values[i] = strtol(line, &end, 10);
+    if (end == line)
+      return false;
+    line = end;
+  }
+  while (*line == ' ' || *line == '\t' || *line == '\r' || *line == '\n')
+    line++;
+  return *line == '\0';
+}
+
+}
+
+ArnlMapCache::ArnlMapCache() :
+  myEnabled(true),
+  myMap(NULL),
+  myMapChangedCB(this, &ArnlMapCache::mapChanged)
+{
+  myMutex.setLogName("ArnlMapCache::myMutex");
+  setThreadName("ArnlMapCache");
+}
+
+ArnlMapCache::~ArnlMapCache()
+{
+  stopRunning();
+  if (myMap != NULL)
+    myMap->remMapChangedCB(&myMapChangedCB);
+}
+
+void ArnlMapCache::parseArgs(ArArgumentParser *parser)
+{
+  if (parser->checkArgument("-noMapCache"))
+    myEnabled = false;
+#ifdef WIN32
+  myEnabled = false;
+#endif
+}
+
+std::string ArnlMapCache::getPath(const char *mapDirectory, const char *fileName)
+{
+  if (fileName[0] == '/' || mapDirectory == NULL || mapDirectory[0] == '\0')
+    return fileName;
+  std::string path = mapDirectory;
+  if (path[path.size() - 1] != '/')
+    path += "/";
+  return path + fileName;
+}
+
+std::string ArnlMapCache::getCachePath(const std::string& path)
+{
+  const size_t slash = path.rfind('/');
+  if (slash == std::string::npos)
+    return "." + path + ".cache";
+  return path.substr(0, slash + 1) + "." + path.substr(slash + 1) + ".cache";
+}
+
+bool ArnlMapCache::checksum(const std::string& path, unsigned long long *sum, unsigned long long *size)
+{
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  *sum = ourChecksumStart;
+  *size = 0;
+  char buf[65536];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+  {
+    addToChecksum(sum, buf, len);
+    *size += len;
+  }
+  fclose(file);
+  return true;
+}
+
+bool ArnlMapCache::isCurrent(const std::string& path)
+{
+  FILE *file = fopen(getCachePath(path).c_str(), "rb");
+  if (file == NULL)
+    return false;
+  Header header;
+  const bool haveHeader = fread(&header, sizeof(header), 1, file) == 1;
+  fclose(file);
+  unsigned long long sum, size;
+  return haveHeader && memcmp(header.magic, ourMagic, sizeof(ourMagic)) == 0 &&
+    header.version == ourVersion && checksum(path, &sum, &size) &&
+    header.checksum == sum && header.fileSize == size;
+}
+
+bool ArnlMapCache::load(ArnlCachedMap *map, const std::string& path, const char *fileName)
+{
+#ifdef WIN32
+  return false;
+#else
+  // Taken first, so that a map file changed while reading is read again
+  struct stat fileStat;
+  unsigned long long sum, size;
+  if (stat(path.c_str(), &fileStat) != 0 || !checksum(path, &sum, &size))
+    return false;
+  const std::string cachePath = getCachePath(path);
+  const int fd = open(cachePath.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header))
+  {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  const Header *header = (const Header *)data;
+  const unsigned long long expectedSize = sizeof(Header) + padded(header->textBytes) +
+    (header->numPoints * 2 + header->numLines * 4) * sizeof(int);
+  if (memcmp(header->magic, ourMagic, sizeof(ourMagic)) != 0 || header->version != ourVersion ||
+      header->headerSize != sizeof(Header) || header->checksum != sum ||
+      header->fileSize != size || expectedSize != (unsigned long long)st.st_size)
+  {
+    ArLog::log(ArLog::Normal, "ArnlMapCache: %s is out of date", cachePath.c_str());
+    munmap(data, st.st_size);
+    return false;
+  }
+
+  const char *text = (const char *)data + sizeof(Header);
+  const int *points = (const int *)(text + padded(header->textBytes));
+  const int *lines = points + header->numPoints * 2;
+  std::vector<ArPose> poses;
+  poses.reserve(header->numPoints);
+  for (unsigned long long i = 0; i < header->numPoints; i++)
+    poses.push_back(ArPose(points[2 * i], points[2 * i + 1]));
+  std::vector<ArLineSegment> segments;
+  segments.reserve(header->numLines);
+  for (unsigned long long i = 0; i < header->numLines; i++)
+    segments.push_back(ArLineSegment(lines[4 * i], lines[4 * i + 1], lines[4 * i + 2], lines[4 * i + 3]));
+
+  bool ok = true;
+  map->lock();
+  map->clear();
+  map->setSourceFileName(NULL, fileName, true);
+  // The rest of the map is only the header and objects: parse it as usual
+  std::string line;
+  const char *end = text + header->textBytes;
+  for (const char *p = text; ok && p < end; )
+  {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (eol == NULL)
+      eol = end;
+    line.assign(p, eol - p);
+    ok = map->parseLine(&line[0]);
+    p = eol + 1;
+  }
+  if (ok)
+  {
+    map->parsingComplete();
+    map->setPoints(&poses);
+    map->setLines(&segments);
+    map->setReadFileStat(fileStat);
+  }
+  map->unlock();
+  munmap(data, st.st_size);
+  if (!ok)
+    ArLog::log(ArLog::Normal, "ArnlMapCache: could not parse %s", cachePath.c_str());
+  return ok;
+#endif
+}
+
+bool ArnlMapCache::save(const std::string& path)
+{
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  Header header;
+  memcpy(header.magic, ourMagic, sizeof(ourMagic));
+  header.version = ourVersion;
+  header.headerSize = sizeof(Header);
+  header.checksum = ourChecksumStart;
+  header.fileSize = 0;
+  std::string text;
+  std::vector<int> points;
+  std::vector<int> lines;
+  enum { TEXT, LINES, DATA } section = TEXT;
+  bool cacheable = true;
+  std::string line;
+  while (readLine(file, &line))
+  {
+    addToChecksum(&header.checksum, line.data(), line.size());
+    header.fileSize += line.size();
+    const size_t len = line.find_last_not_of("\r\n") + 1;
+    int values[4];
+    if (line.compare(0, len, "LINES") == 0)
+      section = LINES;
+    else if (line.compare(0, len, "DATA") == 0)
+      section = DATA;
+    else if (len == 0 && section != TEXT)
+      continue;
+    else if (section == LINES && parseInts(line.c_str(), values, 4))
+      lines.insert(lines.end(), values, values + 4);
+    else if (section == DATA && parseInts(line.c_str(), values, 2))
+      points.insert(points.end(), values, values + 2);
+    else if (section != TEXT)
+      // Another section (e.g. another scan type's points) after these
+      cacheable = false;
+    else
+      text += line.substr(0, len) + "\n";
+  }
+  fclose(file);
+  if (!cacheable)
+  {
+    ArLog::log(ArLog::Verbose, "ArnlMapCache: %s has sections after its points, not caching it", path.c_str());
+    return false;
+  }
+  header.textBytes = text.size();
+  header.numPoints = points.size() / 2;
+  header.numLines = lines.size() / 4;
+  text.resize(padded(text.size()), '\0');
+
+  const std::string cachePath = getCachePath(path);
+  const std::string tmpPath = cachePath + ".tmp";
+  file = fopen(tmpPath.c_str(), "wb");
+  if (file == NULL)
+  {
+    ArLog::log(ArLog::Normal, "ArnlMapCache: could not write %s: %s", tmpPath.c_str(), strerror(errno));
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(text.data(), 1, text.size(), file) == text.size() &&
+    (points.empty() || fwrite(&points[0], sizeof(int), points.size(), file) == points.size()) &&
+    (lines.empty() || fwrite(&lines[0], sizeof(int), lines.size(), file) == lines.size());
+  if (fclose(file) != 0)
+    ok = false;
+  // Renamed into place so that a cache is never read half written
+  if (!ok || rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+  {
+    ArLog::log(ArLog::Normal, "ArnlMapCache: could not write %s: %s", cachePath.c_str(), strerror(errno));
+    remove(tmpPath.c_str());
+    return false;
+  }
+  ArLog::log(ArLog::Normal, "ArnlMapCache: wrote %s (%llu points, %llu lines)", cachePath.c_str(),
+	     header.numPoints, header.numLines);
+  return true;
+}
+
+bool ArnlMapCache::readMap(ArnlCachedMap *map, const char *mapDirectory, const char *fileName)
+{
+  const std::string path = getPath(mapDirectory, fileName);
+  ArTime started;
+  if (myEnabled && load(map, path, fileName))
+  {
+    ArLog::log(ArLog::Normal, "ArnlMapCache: read %s from its cache in %ld ms", fileName, started.mSecSince());
+    return true;
+  }
+  if (!map->readFile(fileName))
+    return false;
+  ArLog::log(ArLog::Verbose, "ArnlMapCache: read %s in %ld ms", fileName, started.mSecSince());
+  if (myEnabled)
+    requestSave(path);
+  return true;
+}
+
+void ArnlMapCache::watch(ArMapInterface *map, const char *mapDirectory)
+{
+  myMutex.lock();
+  myMap = map;
+  myMapDirectory = mapDirectory;
+  myMutex.unlock();
+  map->addMapChangedCB(&myMapChangedCB);
+}
+
+void ArnlMapCache::mapChanged(void)
+{
+  const char *fileName = myMap->getFileName();
+  if (myEnabled && fileName != NULL && fileName[0] != '\0')
+    requestSave(getPath(myMapDirectory.c_str(), fileName));
+}
+
+void ArnlMapCache::requestSave(const std::string& path)
+{
+  myMutex.lock();
+  myPendingPath = path;
+  myMutex.unlock();
+  myCondition.signal();
+}
+
+void *ArnlMapCache::runThread(void *)
+{
+  while (getRunning())
+  {
+    myMutex.lock();
+    const std::string path = myPendingPath;
+    myPendingPath.clear();
+    myMutex.unlock();
+    if (path.empty())
+    {
+      // requestSave() signals; the timeout covers a signal just before waiting
+      myCondition.timedWait(100);
+      continue;
+    }
+    if (!isCurrent(path))
+      save(path);
+  }
+  return NULL;
+}
@@ -0,0 +1,129 @@
+#ifndef ARNLMAPCACHE_H
+#define ARNLMAPCACHE_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include <string>
+#include <sys/stat.h>
+
+/**
+  An ArMap which can be read by ArnlMapCache::load(), which records the map
+  file's stat as ArMap::readFile() would.
+
+  ArMap keeps the stat of the file it read, and its configuration pass
+  (when the parameter file sets the Map) reads the file again unless it has
+  the same name and time as that. A map read from the cache has no stat of
+  its own, so this gives it, through getReadFileStat(), which ArMap::set()
+  copies to the map it sets. Reading the file as usual forgets it.
+*/
+class ArnlCachedMap : public ArMap
+{
+public:
+  ArnlCachedMap(const char *baseDirectory = "./", bool addToGlobalConfig = false) :
+    ArMap(baseDirectory, addToGlobalConfig), myHaveStat(false)
+  {
+  }
+
+  virtual bool readFile(const char *fileName, char *errorBuffer = NULL, size_t errorBufferLen = 0,
+			unsigned char *md5DigestBuffer = NULL, size_t md5DigestBufferLen = 0)
+  {
+    myHaveStat = false;
+    return ArMap::readFile(fileName, errorBuffer, errorBufferLen, md5DigestBuffer, md5DigestBufferLen);
+  }
+
+  virtual struct stat getReadFileStat() const
+  {
+    return myHaveStat ? myStat : ArMap::getReadFileStat();
+  }
+
+  /// Set the stat of the map file read from its cache (with the map locked)
+  void setReadFileStat(const struct stat& fileStat)
+  {
+    myStat = fileStat;
+    myHaveStat = true;
+  }
+
+protected:
+  bool myHaveStat;
+  struct stat myStat;
+};
+
+/**
+  Keeps a binary copy of each map file's points and lines beside it (in
+  ".<name>.cache"), so that large maps, which take seconds to parse, can be
+  read in the time it takes to read the file.
+
+  The cache holds the map's points and lines (the DATA and LINES sections)
+  as arrays of integers, which are used as they are from the memory-mapped
+  file, and the rest of the map (header, objects such as goals, and map
+  info) as text, which is given to ArMap::parseLine(). It is only used if
+  its checksum of the map file matches the map file, so a map edited or
+  replaced since the cache was written is read from the text as usual, and
+  its cache written again.
+
+  readMap() reads a map through the cache into an ArnlCachedMap
+  (ArnlMapPreloader and ArnlMapSet do so when given an ArnlMapCache); watch() keeps the cache of the program's map up to
+  date as it is changed (e.g. from MobileEyes), in this task's thread, so
+  the next startup is fast too. -noMapCache on the command line turns the
+  cache off.
+
+  Maps with more than one scan type, whose points are in other sections
+  after DATA, are not cached. Not available on Windows.
+*/
+class ArnlMapCache : public ArASyncTask
+{
+public:
+  ArnlMapCache();
+  virtual ~ArnlMapCache();
+
+  /// Check for -noMapCache
+  void parseArgs(ArArgumentParser *parser);
+
+  /** Read @a fileName (in @a mapDirectory unless it is an absolute path)
+   * into @a map, from its cache if that is up to date, otherwise from the
+   * file, then (in this task's thread, once running) writing the cache.
+   * @return false if the map could not be read */
+  bool readMap(ArnlCachedMap *map, const char *mapDirectory, const char *fileName);
+
+  /// Write the cache of @a map's file (in @a mapDirectory) when it changes
+  void watch(ArMapInterface *map, const char *mapDirectory);
+
+  virtual void *runThread(void *arg);
+
+  /** Read @a map from the cache of the map file at @a path, naming it @a
+   * fileName, and give it the map file's stat. @return false if there is
+   * no cache, or it is out of date */
+  static bool load(ArnlCachedMap *map, const std::string& path, const char *fileName);
+  /// Write the cache of the map file at @a path. @return false if it could not be
+  static bool save(const std::string& path);
+  /// @return true if the cache of the map file at @a path is up to date
+  static bool isCurrent(const std::string& path);
+
+  /// @return the path of @a fileName in @a mapDirectory
+  static std::string getPath(const char *mapDirectory, const char *fileName);
+  /// @return the path of the cache of the map file at @a path
+  static std::string getCachePath(const std::string& path);
+
+protected:
+  static bool checksum(const std::string& path, unsigned long long *sum, unsigned long long *size);
+  void requestSave(const std::string& path);
+  void mapChanged(void);
+
+  bool myEnabled;
+  ArMapInterface *myMap;
+  std::string myMapDirectory;
+
+  ArMutex myMutex;
+  ArCondition myCondition;
+  /// Map file whose cache is to be written, if any (protected by myMutex)
+  std::string myPendingPath;
+
+  ArFunctorC<ArnlMapCache> myMapChangedCB;
+};
+
+#endif
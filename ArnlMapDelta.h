@@ -0,0 +1,596 @@
+#ifndef ARNLMAPDELTA_H
+#define ARNLMAPDELTA_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/**
+  A map's contents in the form sent by ArnlMapDeltaServer: its points and
+  lines as sorted arrays of integers, so that two versions of a map can be
+  compared cheaply, and the rest of the map (header, objects such as goals,
+  map info) as text.
+
+  Used by the server to keep recent versions of its map, and by clients
+  (see mapTransferBenchmark) to keep their copy up to date with
+  ArnlMapDelta::apply() and write it as a map file.
+*/
+class ArnlMapContents
+{
+public:
+  struct Line
+  {
+    int x1, y1, x2, y2;
+    bool operator<(const Line& other) const
+    {
+      if (x1 != other.x1) return x1 < other.x1;
+      if (y1 != other.y1) return y1 < other.y1;
+      if (x2 != other.x2) return x2 < other.x2;
+      return y2 < other.y2;
+    }
+    bool operator==(const Line& other) const
+    {
+      return x1 == other.x1 && y1 == other.y1 && x2 == other.x2 && y2 == other.y2;
+    }
+  };
+
+  /// The map before its LINES and DATA sections, one line each
+  std::string text;
+  /// Any sections after LINES and DATA (e.g. other scan types' points)
+  std::string tail;
+  /// Points packed by packPoint(), sorted
+  std::vector<long long> points;
+  /// Sorted
+  std::vector<Line> lines;
+
+  ArnlMapContents() : mySection(TEXT) {}
+
+  /// Shifted unsigned, since shifting a negative x left is undefined before C++20
+  static long long packPoint(int x, int y)
+  { return (long long)(((unsigned long long)(unsigned int)x << 32) | (unsigned int)y); }
+  static int pointX(long long p) { return (int)(p >> 32); }
+  static int pointY(long long p) { return (int)(unsigned int)(p & 0xffffffffLL); }
+
+  void clear()
+  {
+    text.clear();
+    tail.clear();
+    points.clear();
+    lines.clear();
+  }
+
+  /// Take @a map's contents; lock the map first
+  void readFrom(ArMapInterface *map)
+  {
+    clear();
+    mySection = TEXT;
+    ArFunctor1C<ArnlMapContents, const char *> lineCB(this, &ArnlMapContents::addLine);
+    map->writeToFunctor(&lineCB, "");
+    std::sort(points.begin(), points.end());
+    std::sort(lines.begin(), lines.end());
+  }
+
+  /// Write as a map file. @return false if it could not be written
+  bool writeFile(const char *path) const
+  {
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+      return false;
+    fputs(text.c_str(), file);
+    if (!lines.empty())
+    {
+      fputs("LINES\n", file);
+      for (size_t i = 0; i < lines.size(); i++)
+        fprintf(file, "%d %d %d %d\n", lines[i].x1, lines[i].y1, lines[i].x2, lines[i].y2);
+    }
+    fputs("DATA\n", file);
+    for (size_t i = 0; i < points.size(); i++)
+      fprintf(file, "%d %d\n", pointX(points[i]), pointY(points[i]));
+    fputs(tail.c_str(), file);
+    return fclose(file) == 0;
+  }
+
+protected:
+  void addLine(const char *line)
+  {
+    std::string s = line;
+    s.erase(s.find_last_not_of("\r\n") + 1);
+    char *end;
+    if (s == "LINES" && mySection != TAIL)
+      mySection = LINES;
+    else if (s == "DATA" && mySection != TAIL)
+      mySection = DATA;
+    else if (s.empty() && (mySection == LINES || mySection == DATA))
+      return;
+    else if (mySection == LINES)
+    {
+      Line l;
+      const char *p = s.c_str();
+      int *v[4] = { &l.x1, &l.y1, &l.x2, &l.y2 };
+      int i;
+      for (i = 0; i < 4; i++, p = end)
+      {
+        *v[i] = strtol(p, &end, 10);
+        if (end == p)
+          break;
+      }
+      if (i == 4)
+        lines.push_back(l);
+      else
+        startTail(s);
+    }
+    else if (mySection == DATA)
+    {
+      const char *p = s.c_str();
+      const int x = strtol(p, &end, 10);
+      const char *q = end;
+      const int y = strtol(q, &end, 10);
+      if (end != p && end != q)
+        points.push_back(packPoint(x, y));
+      else
+        startTail(s);
+    }
+    else if (mySection == TAIL)
+      tail += s + "\n";
+    else
+      text += s + "\n";
+  }
+
+  void startTail(const std::string& s)
+  {
+    mySection = TAIL;
+    tail += s + "\n";
+  }
+
+  enum Section { TEXT, LINES, DATA, TAIL };
+  Section mySection;
+};
+
+/**
+  Encodes the changes between two versions of a map (ArnlMapContents) as a
+  compact payload, and applies them to a client's copy.
+
+  The payload holds the points and lines removed and added, each list
+  sorted and delta encoded as variable length integers, and the lines of
+  the text and tail removed and added, if they changed (e.g. a point edit
+  changes only the header's NumPoints, MinPos and MaxPos lines). When the
+  text changed too much for that to be smaller, the whole new text is sent
+  instead. Given no older version, it is the whole map. Payloads are
+  further compressed with zlib by compress().
+*/
+class ArnlMapDelta
+{
+public:
+  enum Flags { FULL = 1, HAS_TEXT = 2, HAS_TAIL = 4, TEXT_EDITS = 8, TAIL_EDITS = 16 };
+
+  /// What a getMapDelta reply holds (see ArnlMapDeltaServer)
+  enum ReplyKind
+  {
+    REPLY_CHANGES = 0, ///< The changes since the client's version
+    REPLY_FULL = 1, ///< The whole map
+    REPLY_NO_MAP = 2, ///< Nothing: the server has no map yet
+    REPLY_FAILED = 3 ///< Nothing: the reply could not be made
+  };
+
+  /** Encode the changes from @a from to @a to in @a payload, or the whole of
+   * @a to if @a from is NULL */
+  static void encode(const ArnlMapContents *from, const ArnlMapContents& to, std::string *payload)
+  {
+    payload->clear();
+    unsigned int flags = 0;
+    std::string textEdits, tailEdits;
+    if (from == NULL)
+      flags = FULL | HAS_TEXT | HAS_TAIL;
+    else
+    {
+      flags |= textFlags(from->text, to.text, &textEdits, HAS_TEXT, TEXT_EDITS);
+      flags |= textFlags(from->tail, to.tail, &tailEdits, HAS_TAIL, TAIL_EDITS);
+    }
+    putVarint(payload, flags);
+    if (flags & HAS_TEXT)
+      putString(payload, to.text);
+    else if (flags & TEXT_EDITS)
+      *payload += textEdits;
+    if (flags & HAS_TAIL)
+      putString(payload, to.tail);
+    else if (flags & TAIL_EDITS)
+      *payload += tailEdits;
+
+    std::vector<long long> removedPoints, addedPoints;
+    std::vector<ArnlMapContents::Line> removedLines, addedLines;
+    if (from != NULL)
+    {
+      std::set_difference(from->points.begin(), from->points.end(), to.points.begin(), to.points.end(),
+                          std::back_inserter(removedPoints));
+      std::set_difference(to.points.begin(), to.points.end(), from->points.begin(), from->points.end(),
+                          std::back_inserter(addedPoints));
+      std::set_difference(from->lines.begin(), from->lines.end(), to.lines.begin(), to.lines.end(),
+                          std::back_inserter(removedLines));
+      std::set_difference(to.lines.begin(), to.lines.end(), from->lines.begin(), from->lines.end(),
+                          std::back_inserter(addedLines));
+      putPoints(payload, removedPoints);
+      putPoints(payload, addedPoints);
+      putLines(payload, removedLines);
+      putLines(payload, addedLines);
+    }
+    else
+    {
+      putPoints(payload, removedPoints);
+      putPoints(payload, to.points);
+      putLines(payload, removedLines);
+      putLines(payload, to.lines);
+    }
+  }
+
+  /** Apply @a payload, from encode(), to @a contents. @return false if it is
+   * malformed, leaving @a contents unchanged */
+  static bool apply(const std::string& payload, ArnlMapContents *contents)
+  {
+    size_t pos = 0;
+    unsigned long long flags;
+    std::string text, tail;
+    std::vector<long long> removedPoints, addedPoints;
+    std::vector<ArnlMapContents::Line> removedLines, addedLines;
+    if (!getVarint(payload, &pos, &flags) ||
+        ((flags & HAS_TEXT) && !getString(payload, &pos, &text)) ||
+        (!(flags & HAS_TEXT) && (flags & TEXT_EDITS) && !applyLineEdits(payload, &pos, contents->text, &text)) ||
+        ((flags & HAS_TAIL) && !getString(payload, &pos, &tail)) ||
+        (!(flags & HAS_TAIL) && (flags & TAIL_EDITS) && !applyLineEdits(payload, &pos, contents->tail, &tail)) ||
+        !getPoints(payload, &pos, &removedPoints) || !getPoints(payload, &pos, &addedPoints) ||
+        !getLines(payload, &pos, &removedLines) || !getLines(payload, &pos, &addedLines) ||
+        pos != payload.size())
+      return false;
+
+    if (flags & FULL)
+    {
+      contents->points.clear();
+      contents->lines.clear();
+    }
+    if (flags & (HAS_TEXT | TEXT_EDITS))
+      contents->text.swap(text);
+    if (flags & (HAS_TAIL | TAIL_EDITS))
+      contents->tail.swap(tail);
+    update(&contents->points, removedPoints, addedPoints);
+    update(&contents->lines, removedLines, addedLines);
+    return true;
+  }
+
+  /// zlib compress @a in into @a out at @a level (0 to 9)
+  static bool compress(const std::string& in, std::string *out, int level = Z_DEFAULT_COMPRESSION)
+  {
+    uLongf len = compressBound(in.size());
+    out->resize(len);
+    if (compress2((Bytef *)&(*out)[0], &len, (const Bytef *)in.data(), in.size(), level) != Z_OK)
+      return false;
+    out->resize(len);
+    return true;
+  }
+
+  /// Uncompress @a in, which is @a size bytes uncompressed, into @a out
+  static bool uncompress(const std::string& in, size_t size, std::string *out)
+  {
+    out->resize(size);
+    uLongf len = size;
+    if (size == 0)
+      return in.empty();
+    return ::uncompress((Bytef *)&(*out)[0], &len, (const Bytef *)in.data(), in.size()) == Z_OK &&
+      len == size;
+  }
+
+protected:
+  /// Differing in more lines than this, text is sent whole rather than worked out line by line
+  enum { MAX_LINE_EDITS = 1000 };
+
+  /// Lines [start, start + removed) of the old text replaced by @a added
+  struct Hunk
+  {
+    size_t start;
+    size_t removed;
+    std::vector<std::string> added;
+  };
+
+  /** How to send the change from @a from to @a to: not at all, as @a
+   * editsFlag with the line edits in @a edits, or whole as @a wholeFlag if
+   * that is smaller */
+  static unsigned int textFlags(const std::string& from, const std::string& to, std::string *edits,
+                                unsigned int wholeFlag, unsigned int editsFlag)
+  {
+    if (from == to)
+      return 0;
+    std::vector<Hunk> hunks;
+    if (!diffLines(splitLines(from), splitLines(to), &hunks))
+      return wholeFlag;
+    putLineEdits(edits, hunks);
+    return edits->size() < to.size() ? editsFlag : wholeFlag;
+  }
+
+  /// Each line without its newline; text always ends with one
+  static std::vector<std::string> splitLines(const std::string& text)
+  {
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < text.size())
+    {
+      size_t end = text.find('\n', start);
+      if (end == std::string::npos)
+        end = text.size();
+      lines.push_back(text.substr(start, end - start));
+      start = end + 1;
+    }
+    return lines;
+  }
+
+  /** The fewest lines to remove from @a a and add to make @a b (Myers'
+   * diff), as hunks in order. @return false if there are more than
+   * MAX_LINE_EDITS of them */
+  static bool diffLines(const std::vector<std::string>& a, const std::vector<std::string>& b,
+                        std::vector<Hunk> *hunks)
+  {
+    const int n = (int)a.size();
+    const int m = (int)b.size();
+    const int maxEdits = n + m < MAX_LINE_EDITS ? n + m : MAX_LINE_EDITS;
+    // For each number of edits d, the furthest x reached on each diagonal
+    // k = x - y from -d to d, at trace[d][k + d]
+    std::vector<std::vector<int> > trace;
+    bool done = false;
+    for (int d = 0; d <= maxEdits && !done; d++)
+    {
+      trace.push_back(std::vector<int>(2 * d + 1, 0));
+      std::vector<int>& v = trace[d];
+      for (int k = -d; k <= d && !done; k += 2)
+      {
+        int x = 0;
+        if (d > 0)
+        {
+          const std::vector<int>& prev = trace[d - 1];
+          if (k == -d || (k != d && prev[k - 1 + d - 1] < prev[k + 1 + d - 1]))
+            x = prev[k + 1 + d - 1];
+          else
+            x = prev[k - 1 + d - 1] + 1;
+        }
+        int y = x - k;
+        while (x < n && y < m && a[x] == b[y])
+        {
+          x++;
+          y++;
+        }
+        v[k + d] = x;
+        done = x >= n && y >= m;
+      }
+    }
+    if (!done)
+      return false;
+
+    // Back from the end, one edit for each d: true to add b[line] before
+    // a[pos], false to remove a[pos]
+    std::vector<std::pair<bool, std::pair<int, int> > > edits;
+    int x = n, y = m;
+    for (int d = (int)trace.size() - 1; d > 0; d--)
+    {
+      const std::vector<int>& prev = trace[d - 1];
+      const int k = x - y;
+      const bool add = k == -d || (k != d && prev[k - 1 + d - 1] < prev[k + 1 + d - 1]);
+      const int prevK = add ? k + 1 : k - 1;
+      x = prev[prevK + d - 1];
+      y = x - prevK;
+      edits.push_back(std::make_pair(add, std::make_pair(x, y)));
+    }
+    hunks->clear();
+    for (size_t i = edits.size(); i-- > 0; )
+    {
+      const bool add = edits[i].first;
+      const size_t pos = edits[i].second.first;
+      if (hunks->empty() || hunks->back().start + hunks->back().removed != pos)
+      {
+        Hunk hunk;
+        hunk.start = pos;
+        hunk.removed = 0;
+        hunks->push_back(hunk);
+      }
+      if (add)
+        hunks->back().added.push_back(b[edits[i].second.second]);
+      else
+        hunks->back().removed++;
+    }
+    return true;
+  }
+
+  /// Each hunk as its start after the last one's end, lines removed, and lines added
+  static void putLineEdits(std::string *out, const std::vector<Hunk>& hunks)
+  {
+    putVarint(out, hunks.size());
+    size_t end = 0;
+    for (size_t i = 0; i < hunks.size(); i++)
+    {
+      putVarint(out, hunks[i].start - end);
+      putVarint(out, hunks[i].removed);
+      putVarint(out, hunks[i].added.size());
+      for (size_t j = 0; j < hunks[i].added.size(); j++)
+        putString(out, hunks[i].added[j]);
+      end = hunks[i].start + hunks[i].removed;
+    }
+  }
+
+  /// Read line edits from putLineEdits() and apply them to @a from, giving @a to
+  static bool applyLineEdits(const std::string& in, size_t *pos, const std::string& from, std::string *to)
+  {
+    const std::vector<std::string> lines = splitLines(from);
+    unsigned long long numHunks;
+    // Each hunk takes at least three bytes
+    if (!getVarint(in, pos, &numHunks) || numHunks > (in.size() - *pos) / 3)
+      return false;
+    to->clear();
+    size_t end = 0;
+    for (unsigned long long i = 0; i < numHunks; i++)
+    {
+      unsigned long long skip, removed, added;
+      if (!getVarint(in, pos, &skip) || !getVarint(in, pos, &removed) || !getVarint(in, pos, &added) ||
+          skip > lines.size() - end || removed > lines.size() - end - skip ||
+          added > in.size() - *pos)
+        return false;
+      for (size_t j = end; j < end + skip; j++)
+        *to += lines[j] + "\n";
+      std::string line;
+      for (unsigned long long j = 0; j < added; j++)
+      {
+        if (!getString(in, pos, &line))
+          return false;
+        *to += line + "\n";
+      }
+      end += skip + removed;
+    }
+    for (size_t j = end; j < lines.size(); j++)
+      *to += lines[j] + "\n";
+    return true;
+  }
+
+  template<class T>
+  static void update(std::vector<T> *items, const std::vector<T>& removed, const std::vector<T>& added)
+  {
+    std::vector<T> kept;
+    kept.reserve(items->size() + added.size());
+    std::set_difference(items->begin(), items->end(), removed.begin(), removed.end(),
+                        std::back_inserter(kept));
+    const size_t middle = kept.size();
+    kept.insert(kept.end(), added.begin(), added.end());
+    std::inplace_merge(kept.begin(), kept.begin() + middle, kept.end());
+    items->swap(kept);
+  }
+
+  static void putVarint(std::string *out, unsigned long long v)
+  {
+    while (v >= 0x80)
+    {
+      *out += (char)(v | 0x80);
+      v >>= 7;
+    }
+    *out += (char)v;
+  }
+
+  static bool getVarint(const std::string& in, size_t *pos, unsigned long long *v)
+  {
+    *v = 0;
+    for (int shift = 0; shift < 64 && *pos < in.size(); shift += 7)
+    {
+      const unsigned char c = in[(*pos)++];
+      *v |= (unsigned long long)(c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  /// Signed differences as varints, small either side of zero
+  static void putSigned(std::string *out, long long v)
+  {
+    putVarint(out, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+  }
+
+  static bool getSigned(const std::string& in, size_t *pos, long long *v)
+  {
+    unsigned long long u;
+    if (!getVarint(in, pos, &u))
+      return false;
+    *v = (long long)(u >> 1) ^ -(long long)(u & 1);
+    return true;
+  }
+
+  static void putString(std::string *out, const std::string& s)
+  {
+    putVarint(out, s.size());
+    *out += s;
+  }
+
+  static bool getString(const std::string& in, size_t *pos, std::string *s)
+  {
+    unsigned long long len;
+    if (!getVarint(in, pos, &len) || len > in.size() - *pos)
+      return false;
+    s->assign(in, *pos, len);
+    *pos += len;
+    return true;
+  }
+
+  /// Sorted, so each point is sent as its difference from the one before
+  static void putPoints(std::string *out, const std::vector<long long>& points)
+  {
+    putVarint(out, points.size());
+    long long x = 0, y = 0;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      putSigned(out, ArnlMapContents::pointX(points[i]) - x);
+      putSigned(out, ArnlMapContents::pointY(points[i]) - y);
+      x = ArnlMapContents::pointX(points[i]);
+      y = ArnlMapContents::pointY(points[i]);
+    }
+  }
+
+  static bool getPoints(const std::string& in, size_t *pos, std::vector<long long> *points)
+  {
+    unsigned long long n;
+    // Each point takes at least two bytes
+    if (!getVarint(in, pos, &n) || n > (in.size() - *pos) / 2)
+      return false;
+    points->reserve(n);
+    long long x = 0, y = 0, dx, dy;
+    for (unsigned long long i = 0; i < n; i++)
+    {
+      if (!getSigned(in, pos, &dx) || !getSigned(in, pos, &dy))
+        return false;
+      x += dx;
+      y += dy;
+      points->push_back(ArnlMapContents::packPoint((int)x, (int)y));
+    }
+    return true;
+  }
+
+  static void putLines(std::string *out, const std::vector<ArnlMapContents::Line>& lines)
+  {
+    putVarint(out, lines.size());
+    ArnlMapContents::Line last = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+      putSigned(out, (long long)lines[i].x1 - last.x1);
+      putSigned(out, (long long)lines[i].y1 - last.y1);
+      putSigned(out, (long long)lines[i].x2 - lines[i].x1);
+      putSigned(out, (long long)lines[i].y2 - lines[i].y1);
+      last = lines[i];
+    }
+  }
+
+  static bool getLines(const std::string& in, size_t *pos, std::vector<ArnlMapContents::Line> *lines)
+  {
+    unsigned long long n;
+    if (!getVarint(in, pos, &n) || n > (in.size() - *pos) / 4)
+      return false;
+    lines->reserve(n);
+    ArnlMapContents::Line l = { 0, 0, 0, 0 };
+    long long v[4];
+    for (unsigned long long i = 0; i < n; i++)
+    {
+      for (int j = 0; j < 4; j++)
+        if (!getSigned(in, pos, &v[j]))
+          return false;
+      l.x1 = (int)(l.x1 + v[0]);
+      l.y1 = (int)(l.y1 + v[1]);
+      l.x2 = (int)(l.x1 + v[2]);
+      l.y2 = (int)(l.y1 + v[3]);
+      lines->push_back(l);
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,241 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlMapDeltaServer.h"
+#include "ArnlCallbackProfiler.h"
+
+#include <stdio.h>
+#include <time.h>
+
+namespace {
+
+/// Of compressed payload in each reply packet, well under ArNetPacket's limit
+const size_t ourChunkBytes = 16000;
+
+/// The size of @a contents written as a map file
+size_t textBytes(const ArnlMapContents& contents)
+{
+  size_t bytes = contents.text.size() + contents.tail.size() + sizeof("LINES\nDATA\n") - 1;
+  char buf[64];
+  for (size_t i = 0; i < contents.points.size(); i++)
+    bytes += snprintf(buf, sizeof(buf), "%d %d\n", ArnlMapContents::pointX(contents.points[i]),
+		      ArnlMapContents::pointY(contents.points[i]));
+  for (size_t i = 0; i < contents.lines.size(); i++)
+    bytes += snprintf(buf, sizeof(buf), "%d %d %d %d\n", contents.lines[i].x1, contents.lines[i].y1,
+		      contents.lines[i].x2, contents.lines[i].y2);
+  return bytes;
+}
+
+}
+
+ArnlMapDeltaServer::ArnlMapDeltaServer(ArServerBase *server, ArMapInterface *map,
+				       ArnlMetricsRegistry *metrics) :
+  myServer(server),
+  myMap(map),
+  myMetrics(metrics),
+  myVersionsKept(8),
+  myCompressionLevel(6),
+  myEpoch((unsigned int)time(NULL)),
+  myChanged(true),
+  myLastVersion(0),
+  myMapChangedCB(this, &ArnlMapDeltaServer::mapChanged),
+  myGetMapDeltaCB(this, &ArnlMapDeltaServer::serverGetMapDelta)
+{
+  myMutex.setLogName("ArnlMapDeltaServer::myMutex");
+  setThreadName("ArnlMapDeltaServer");
+  myEncodeMetric = myMetrics->getMSecsHistogram("arnl_map_delta_encode_msecs",
+						"Time taken to make and compress a getMapDelta reply");
+  myMap->addMapChangedCB(&myMapChangedCB);
+  myServer->addData("getMapDelta",
+		    "gets the changes to the map since the given version, or the whole map, compressed",
+		    ArnlCallbackProfiler::wrap(&myGetMapDeltaCB, "getMapDelta request"),
+		    "uByte4: epoch, uByte4: version (0 0 for none)",
+		    "<repeat> uByte4: epoch, uByte4: version, uByte: kind (0 changes, 1 whole map, 2 no map yet, 3 failed), uByte4: payload size, uByte4: compressed size, uByte4: offset, uByte2: length, data",
+		    "Map", "RETURN_COMPLEX");
+  myServer->addData("mapDeltaUpdated",
+		    "sent when the map changes, with its new version, for getMapDelta",
+		    NULL, "none", "uByte4: epoch, uByte4: version", "Map", "RETURN_SINGLE");
+}
+
+ArnlMapDeltaServer::~ArnlMapDeltaServer()
+{
+  stopRunning();
+  myMap->remMapChangedCB(&myMapChangedCB);
+}
+
+void ArnlMapDeltaServer::addToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("MapDeltaVersions", &myVersionsKept,
+		      "How many versions of the map to keep, so that clients with any of them are sent only the changes since", 1),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("MapDeltaCompression", &myCompressionLevel,
+		      "zlib compression level of the map sent to clients, from 0 (none, fastest) to 9 (smallest)", 0, 9),
+	  section, ArPriority::NORMAL);
+}
+
+void ArnlMapDeltaServer::mapChanged(void)
+{
+  myMutex.lock();
+  myChanged = true;
+  myMutex.unlock();
+  myCondition.signal();
+}
+
+void *ArnlMapDeltaServer::runThread(void *)
+{
+  while (getRunning())
+  {
+    myMutex.lock();
+    const bool changed = myChanged;
+    myChanged = false;
+    myMutex.unlock();
+    if (changed)
+      takeVersion();
+    else
+      // mapChanged() signals; the timeout covers a signal just before waiting
+      myCondition.timedWait(1000);
+  }
+  return NULL;
+}
+
+void ArnlMapDeltaServer::takeVersion(void)
+{
+  ArTime started;
+  Version version;
+  myMap->lock();
+  version.contents.readFrom(myMap);
+  myMap->unlock();
+  version.textBytes = textBytes(version.contents);
+
+  myMutex.lock();
+  if (!myVersions.empty())
+  {
+    const ArnlMapContents& last = myVersions.back().contents;
+    if (last.text == version.contents.text && last.tail == version.contents.tail &&
+	last.points == version.contents.points && last.lines == version.contents.lines)
+    {
+      // e.g. the map file read again unchanged
+      myMutex.unlock();
+      return;
+    }
+  }
+  version.version = ++myLastVersion;
+  myVersions.push_back(version);
+  while (myVersions.size() > (size_t)(myVersionsKept > 1 ? myVersionsKept : 1))
+    myVersions.pop_front();
+  myReplies.clear();
+  myMutex.unlock();
+
+  myMetrics->getGauge("arnl_map_delta_version", "Current version of the map, as sent by getMapDelta")->set(version.version);
+  ArLog::log(ArLog::Normal, "ArnlMapDeltaServer: map version %u (%d points, %d lines) in %ld ms",
+	     version.version, (int)version.contents.points.size(), (int)version.contents.lines.size(),
+	     started.mSecSince());
+  ArNetPacket sendPacket;
+  sendPacket.uByte4ToBuf(myEpoch);
+  sendPacket.uByte4ToBuf(version.version);
+  myServer->broadcastPacketTcp(&sendPacket, "mapDeltaUpdated");
+}
+
+const ArnlMapDeltaServer::Reply *ArnlMapDeltaServer::getReply(unsigned int fromEpoch, unsigned int fromVersion)
+{
+  if (myVersions.empty())
+    return NULL;
+  const Version& current = myVersions.back();
+  const Version *from = NULL;
+  for (size_t i = 0; i < myVersions.size() && from == NULL && fromEpoch == myEpoch; i++)
+    if (myVersions[i].version == fromVersion)
+      from = &myVersions[i];
+  // 0 for the whole map
+  const unsigned int key = from != NULL ? fromVersion : 0;
+  std::map<unsigned int, Reply>::iterator it = myReplies.find(key);
+  if (it != myReplies.end())
+    return &it->second;
+
+  ArTime started;
+  std::string payload;
+  ArnlMapDelta::encode(from != NULL ? &from->contents : NULL, current.contents, &payload);
+  if (from != NULL)
+  {
+    // Many changes (e.g. the map rebuilt from new scans) are sent as the whole map
+    const Reply *full = getReply(0, 0);
+    if (full != NULL && payload.size() >= full->payloadBytes)
+      return &(myReplies[key] = *full);
+  }
+  Reply& reply = myReplies[key];
+  reply.full = from == NULL;
+  reply.payloadBytes = payload.size();
+  if (!ArnlMapDelta::compress(payload, &reply.compressed, myCompressionLevel))
+  {
+    ArLog::log(ArLog::Terse, "ArnlMapDeltaServer: Error: could not compress the map");
+    // Not kept, so that the next request tries again
+    myReplies.erase(key);
+    return NULL;
+  }
+  myEncodeMetric->observe(started.mSecSince());
+  return &reply;
+}
+
+void ArnlMapDeltaServer::serverGetMapDelta(ArServerClient *client, ArNetPacket *packet)
+{
+  const unsigned int fromEpoch = packet->bufToUByte4();
+  const unsigned int fromVersion = packet->bufToUByte4();
+
+  myMutex.lock();
+  const Reply *reply = getReply(fromEpoch, fromVersion);
+  const unsigned int version = myVersions.empty() ? 0 : myVersions.back().version;
+  const size_t mapTextBytes = myVersions.empty() ? 0 : myVersions.back().textBytes;
+  ArnlMapDelta::ReplyKind kind = ArnlMapDelta::REPLY_NO_MAP;
+  if (reply != NULL)
+    kind = reply->full ? ArnlMapDelta::REPLY_FULL : ArnlMapDelta::REPLY_CHANGES;
+  else if (!myVersions.empty())
+    kind = ArnlMapDelta::REPLY_FAILED;
+  const size_t payloadBytes = reply != NULL ? reply->payloadBytes : 0;
+  // Copied so as not to hold the mutex while sending
+  const std::string compressed = reply != NULL ? reply->compressed : std::string();
+  myMutex.unlock();
+
+  size_t sent = 0;
+  size_t offset = 0;
+  do
+  {
+    const size_t len = compressed.size() - offset < ourChunkBytes ? compressed.size() - offset : ourChunkBytes;
+    ArNetPacket sendPacket;
+    sendPacket.uByte4ToBuf(myEpoch);
+    sendPacket.uByte4ToBuf(version);
+    sendPacket.uByteToBuf(kind);
+    sendPacket.uByte4ToBuf(payloadBytes);
+    sendPacket.uByte4ToBuf(compressed.size());
+    sendPacket.uByte4ToBuf(offset);
+    sendPacket.uByte2ToBuf(len);
+    if (len > 0)
+      sendPacket.dataToBuf(compressed.data() + offset, len);
+    client->sendPacketTcp(&sendPacket);
+    sent += sendPacket.getLength();
+    offset += len;
+  } while (offset < compressed.size());
+
+  const char *kindName = kind == ArnlMapDelta::REPLY_FULL ? "full" :
+    kind == ArnlMapDelta::REPLY_CHANGES ? "delta" : "none";
+  myMetrics->getCounter(ArnlMetricsRegistry::withLabel("arnl_map_delta_requests_total", "kind", kindName),
+			"getMapDelta replies, with the whole map, only changes, or none")->add();
+  myMetrics->getCounter(ArnlMetricsRegistry::withLabel("arnl_map_delta_sent_bytes_total", "kind", kindName),
+			"Bytes sent in getMapDelta replies")->add(sent);
+  myMetrics->getCounter(ArnlMetricsRegistry::withLabel("arnl_map_delta_payload_bytes_total", "kind", kindName),
+			"Bytes of getMapDelta replies before compression")->add(payloadBytes);
+  if (kind == ArnlMapDelta::REPLY_NO_MAP)
+    ArLog::log(ArLog::Normal, "ArnlMapDeltaServer: no map to send to %s yet", client->getIPString());
+  else if (kind == ArnlMapDelta::REPLY_FAILED)
+    ArLog::log(ArLog::Normal, "ArnlMapDeltaServer: could not send map version %u to %s", version,
+	       client->getIPString());
+  else if (kind == ArnlMapDelta::REPLY_FULL)
+    ArLog::log(ArLog::Normal, "ArnlMapDeltaServer: sent map version %u to %s: %.1f KB (%.1f KB uncompressed, %.1f KB as text)",
+	       version, client->getIPString(), sent / 1024.0, payloadBytes / 1024.0, mapTextBytes / 1024.0);
+  else
+    ArLog::log(ArLog::Normal, "ArnlMapDeltaServer: sent changes from map version %u to %u to %s: %.1f KB (%.1f KB uncompressed, whole map %.1f KB as text)",
+	       fromVersion, version, client->getIPString(), sent / 1024.0, payloadBytes / 1024.0,
+	       mapTextBytes / 1024.0);
+}
@@ -0,0 +1,117 @@
+#ifndef ARNLMAPDELTASERVER_H
+#define ARNLMAPDELTASERVER_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include "ArnlMapDelta.h"
+#include "ArnlMetrics.h"
+
+#include <deque>
+#include <map>
+#include <string>
+
+/**
+  Sends clients which already have a version of the map only what changed
+  since, compressed, rather than the whole map that ArServerHandlerMap's
+  getMap sends each time the map changes.
+
+  The map is versioned: each time it changes, this task's thread takes a
+  copy of it (as an ArnlMapContents), keeping the last MapDeltaVersions of
+  them, and broadcasts mapDeltaUpdated with the new version. A client then
+  requests getMapDelta with the version it has, and is sent the points,
+  lines, and lines of the header and objects, added and removed since.
+  A client with no version, or one too old to be kept, or for which the
+  changes would be larger than the whole map, is sent the whole map. Either
+  way the payload (see ArnlMapDelta) is zlib compressed. Payloads are kept
+  until the map changes again, so each is only made once however many
+  clients ask for it.
+
+  Requests:
+    - getMapDelta: <tt>uByte4 epoch, uByte4 version</tt> of the client's copy,
+      0 0 for none. Replied to with one or more packets of <tt>uByte4 epoch,
+      uByte4 version, uByte kind, uByte4 payload size, uByte4 compressed
+      size, uByte4 offset, uByte2 length, data</tt>, whose data together are
+      the compressed payload. The kind (an ArnlMapDelta::ReplyKind) is 0 for
+      the changes since the client's version, 1 for the whole map, or, with
+      no payload, 2 if the server has no map yet and 3 if the reply could not
+      be made; a client keeps its copy for those two.
+    - mapDeltaUpdated: broadcast with <tt>uByte4 epoch, uByte4 version</tt>
+      when the map changes.
+
+  The epoch is the time the server started, so that versions from an
+  earlier run are not mistaken for this one's.
+
+  The bytes sent are counted by the
+  arnl_map_delta_sent_bytes_total{kind="delta"|"full"|"none"} counters, and the
+  bytes before compression by arnl_map_delta_payload_bytes_total, and each
+  reply is logged with the size of the whole map as text for comparison.
+  mapTransferBenchmark measures both ways of getting the map.
+
+  MobileEyes and MobilePlanner know nothing of this and still use
+  ArServerHandlerMap.
+*/
+class ArnlMapDeltaServer : public ArASyncTask
+{
+public:
+  ArnlMapDeltaServer(ArServerBase *server, ArMapInterface *map,
+		     ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlMapDeltaServer();
+
+  void addToConfig(ArConfig *config, const char *section = "Map delta");
+
+  virtual void *runThread(void *arg);
+
+protected:
+  struct Version
+  {
+    unsigned int version;
+    ArnlMapContents contents;
+    /// Size of the map as text, for comparison
+    size_t textBytes;
+  };
+
+  struct Reply
+  {
+    bool full;
+    size_t payloadBytes;
+    std::string compressed;
+  };
+
+  /** Make the reply to a client with @a fromVersion (with myMutex locked).
+   * @return NULL if there is no map yet, or it could not be compressed */
+  const Reply *getReply(unsigned int fromEpoch, unsigned int fromVersion);
+  void takeVersion(void);
+
+  void mapChanged(void);
+  void serverGetMapDelta(ArServerClient *client, ArNetPacket *packet);
+
+  ArServerBase *myServer;
+  ArMapInterface *myMap;
+  ArnlMetricsRegistry *myMetrics;
+  ArnlHistogram *myEncodeMetric;
+
+  int myVersionsKept;
+  int myCompressionLevel;
+
+  const unsigned int myEpoch;
+  ArMutex myMutex;
+  ArCondition myCondition;
+  /// Set by mapChanged(), to take a copy of the map (protected by myMutex)
+  bool myChanged;
+  /// Oldest first (protected by myMutex)
+  std::deque<Version> myVersions;
+  unsigned int myLastVersion;
+  /// Replies to the current version, by the client's version (protected by myMutex)
+  std::map<unsigned int, Reply> myReplies;
+
+  ArFunctorC<ArnlMapDeltaServer> myMapChangedCB;
+  ArFunctor2C<ArnlMapDeltaServer, ArServerClient *, ArNetPacket *> myGetMapDeltaCB;
+};
+
+#endif
@@ -0,0 +1,297 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlMapSet.h"
+
+#include <stdio.h>
+#include <string.h>
+
+ArnlMapSet::ArnlMapSet(ArMapInterface *map, const char *mapDirectory, ArnlMapCache *cache,
+		       ArnlMetricsRegistry *metrics) :
+  myMap(map),
+  myMapDirectory(mapDirectory),
+  myCache(cache),
+  myMetrics(metrics),
+  myWantedChanged(false),
+  mySwitching(false),
+  myProcessFileCB(this, &ArnlMapSet::processFile),
+  myMapChangedCB(this, &ArnlMapSet::mapChanged),
+  mySwitchCB(this, &ArnlMapSet::switchCommand),
+  myStatusCB(this, &ArnlMapSet::logStatus)
+{
+  myMutex.setLogName("ArnlMapSet::myMutex");
+  mySwitchMutex.setLogName("ArnlMapSet::mySwitchMutex");
+  setThreadName("ArnlMapSet");
+  myPreloadMaps[0] = '\0';
+  mySwitchMetric = myMetrics->getMSecsHistogram("arnl_map_switch_msecs",
+						"Time taken to switch to a map with ArnlMapSet");
+  myMap->addMapChangedCB(&myMapChangedCB);
+}
+
+ArnlMapSet::~ArnlMapSet()
+{
+  stopRunning();
+  myMap->remMapChangedCB(&myMapChangedCB);
+}
+
+void ArnlMapSet::addToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("PreloadMaps", myPreloadMaps,
+		      "Maps to keep in memory, separated by commas, so that the robot can be switched to one of them at once with the SwitchMap command",
+		      sizeof(myPreloadMaps)),
+	  section, ArPriority::NORMAL);
+  config->addProcessFileCB(&myProcessFileCB, 40);
+}
+
+void ArnlMapSet::addSimpleCommands(ArServerHandlerCommands *commands)
+{
+  commands->addStringCommand("SwitchMap",
+    "Switch to the given map, at once if it is one of the PreloadMaps.",
+    &mySwitchCB);
+  commands->addCommand("MapSetStatus",
+    "Log the maps kept in memory by PreloadMaps, and the memory they take.",
+    &myStatusCB);
+}
+
+bool ArnlMapSet::processFile(void)
+{
+  std::vector<std::string> wanted;
+  const std::string list = myPreloadMaps;
+  for (size_t start = 0; start <= list.size(); )
+  {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos)
+      end = list.size();
+    // Strip preceding and following whitespace
+    const size_t first = list.find_first_not_of(" \t", start);
+    const size_t last = list.find_last_not_of(" \t", end - 1);
+    if (first < end && last != std::string::npos && last >= first)
+      wanted.push_back(list.substr(first, last - first + 1));
+    start = end + 1;
+  }
+
+  myMutex.lock();
+  myWanted = wanted;
+  myWantedChanged = true;
+  myMutex.unlock();
+  myCondition.signal();
+  return true;
+}
+
+int ArnlMapSet::findEntry(const char *fileName)
+{
+  for (size_t i = 0; i < myEntries.size(); i++)
+    if (strcasecmp(myEntries[i].fileName.c_str(), fileName) == 0)
+      return (int)i;
+  return -1;
+}
+
+ArMap *ArnlMapSet::readMap(const std::string& fileName)
+{
+  // Not in the configuration: this is only a copy
+  ArnlCachedMap *map = new ArnlCachedMap(myMapDirectory.c_str(), false);
+  map->setIgnoreCase(true);
+  const bool ok = myCache != NULL ?
+    myCache->readMap(map, myMapDirectory.c_str(), fileName.c_str()) :
+    map->readFile(fileName.c_str());
+  if (!ok)
+  {
+    delete map;
+    return NULL;
+  }
+  return map;
+}
+
+/// The points, lines and objects (which are nearly all of a large map), roughly
+size_t ArnlMapSet::estimateBytes(ArMapInterface *map)
+{
+  size_t bytes = 0;
+  std::vector<ArPose> *points = map->getPoints();
+  if (points != NULL)
+    bytes += points->capacity() * sizeof(ArPose);
+  std::vector<ArLineSegment> *lines = map->getLines();
+  if (lines != NULL)
+    bytes += lines->capacity() * sizeof(ArLineSegment);
+  std::list<ArMapObject *> *objects = map->getMapObjects();
+  if (objects != NULL)
+    // and their names and descriptions
+    bytes += objects->size() * (sizeof(ArMapObject) + 128);
+  return bytes;
+}
+
+void *ArnlMapSet::runThread(void *)
+{
+  while (getRunning())
+  {
+    myMutex.lock();
+    if (myWantedChanged)
+    {
+      // Drop maps no longer listed
+      for (size_t i = myEntries.size(); i-- > 0; )
+      {
+	bool wanted = false;
+	for (size_t j = 0; j < myWanted.size() && !wanted; j++)
+	  wanted = strcasecmp(myWanted[j].c_str(), myEntries[i].fileName.c_str()) == 0;
+	if (!wanted)
+	{
+	  ArLog::log(ArLog::Normal, "ArnlMapSet: dropping %s", myEntries[i].fileName.c_str());
+	  myMetrics->getGauge(ArnlMetricsRegistry::withLabel("arnl_preloaded_map_bytes", "map", myEntries[i].fileName))->set(0);
+	  myEntries.erase(myEntries.begin() + i);
+	}
+      }
+      myWantedChanged = false;
+    }
+    // A map to read: one listed but not read yet, or changed since
+    std::string fileName;
+    for (size_t i = 0; i < myWanted.size() && fileName.empty(); i++)
+    {
+      const int e = findEntry(myWanted[i].c_str());
+      if (e < 0 || myEntries[e].stale)
+	fileName = myWanted[i];
+    }
+    myMutex.unlock();
+    if (fileName.empty())
+    {
+      // processFile() and mapChanged() signal; the timeout covers a signal just before waiting
+      myCondition.timedWait(1000);
+      continue;
+    }
+
+    ArTime started;
+    ArMap *map = readMap(fileName);
+    const long msecs = started.mSecSince();
+    myMutex.lock();
+    int e = findEntry(fileName.c_str());
+    if (e < 0)
+    {
+      Entry entry;
+      entry.fileName = fileName;
+      myEntries.push_back(entry);
+      e = (int)myEntries.size() - 1;
+    }
+    Entry& entry = myEntries[e];
+    // A map which could not be read is left out until the list or map changes
+    entry.map.reset(map);
+    entry.stale = false;
+    entry.bytes = map != NULL ? estimateBytes(map) : 0;
+    myMetrics->getGauge(ArnlMetricsRegistry::withLabel("arnl_preloaded_map_bytes", "map", fileName),
+			"Memory taken by a map kept by ArnlMapSet (approximate)")->set(entry.bytes);
+    if (map != NULL)
+      ArLog::log(ArLog::Normal, "ArnlMapSet: preloaded %s in %ld ms (%.1f MB)", fileName.c_str(),
+		 msecs, entry.bytes / 1048576.0);
+    else
+      ArLog::log(ArLog::Terse, "ArnlMapSet: Error: could not read %s", fileName.c_str());
+    myMutex.unlock();
+  }
+  return NULL;
+}
+
+bool ArnlMapSet::switchTo(const char *fileName)
+{
+  ArTime started;
+  mySwitchMutex.lock();
+  myMutex.lock();
+  int e = findEntry(fileName);
+  std::shared_ptr<ArMap> map;
+  if (e >= 0 && !myEntries[e].stale)
+    map = myEntries[e].map;
+  myMutex.unlock();
+  if (!map)
+  {
+    ArLog::log(ArLog::Normal, "ArnlMapSet: %s is not preloaded, reading it", fileName);
+    map.reset(readMap(fileName));
+    if (!map)
+    {
+      ArLog::log(ArLog::Terse, "ArnlMapSet: Error: could not read %s, not switching to it", fileName);
+      mySwitchMutex.unlock();
+      return false;
+    }
+    myMutex.lock();
+    e = findEntry(fileName);
+    if (e >= 0)
+    {
+      // It is listed: keep what was read
+      myEntries[e].map = map;
+      myEntries[e].stale = false;
+      myEntries[e].bytes = estimateBytes(map.get());
+    }
+    myMutex.unlock();
+  }
+
+  myMutex.lock();
+  mySwitching = true;
+  myMutex.unlock();
+  // Not with myMutex locked, since the map may be locked when it calls
+  // mapChanged(); the map's own callbacks, through which the planning and
+  // localization tasks take the new map, are called after it is unlocked
+  myMap->lock();
+  myMap->set(map.get());
+  myMap->unlock();
+  myMap->mapChanged();
+  myMutex.lock();
+  mySwitching = false;
+  myMutex.unlock();
+  mySwitchMutex.unlock();
+  setMapParam(fileName);
+
+  const long msecs = started.mSecSince();
+  mySwitchMetric->observe(msecs);
+  ArLog::log(ArLog::Normal, "ArnlMapSet: switched to %s in %ld ms", fileName, msecs);
+  return true;
+}
+
+/// Set the Map parameter, so that loading the configuration again keeps this map
+void ArnlMapSet::setMapParam(const char *fileName)
+{
+  ArConfigSection *section = Aria::getConfig()->findSection("Files");
+  ArConfigArg *param = section != NULL ? section->findParam("Map") : NULL;
+  if (param != NULL)
+    param->setString(fileName);
+}
+
+/// The map was changed: if not by switchTo(), it may be a map of the set which was edited
+void ArnlMapSet::mapChanged(void)
+{
+  myMutex.lock();
+  if (!mySwitching)
+  {
+    const int e = findEntry(myMap->getFileName());
+    if (e >= 0)
+      myEntries[e].stale = true;
+  }
+  myMutex.unlock();
+  myCondition.signal();
+}
+
+void ArnlMapSet::switchCommand(ArArgumentBuilder *args)
+{
+  switchTo(args->getFullString());
+}
+
+void ArnlMapSet::logStatus(void)
+{
+  myMutex.lock();
+  size_t total = 0;
+  for (size_t i = 0; i < myEntries.size(); i++)
+    total += myEntries[i].bytes;
+  ArLog::log(ArLog::Normal, "ArnlMapSet: %d of %d maps preloaded, %.1f MB:", (int)myEntries.size(),
+	     (int)myWanted.size(), total / 1048576.0);
+  const char *current = myMap->getFileName();
+  for (size_t i = 0; i < myWanted.size(); i++)
+  {
+    const int e = findEntry(myWanted[i].c_str());
+    const bool isCurrent = current != NULL && strcasecmp(current, myWanted[i].c_str()) == 0;
+    if (e < 0)
+      ArLog::log(ArLog::Normal, "ArnlMapSet:   %-32s not read yet", myWanted[i].c_str());
+    else if (!myEntries[e].map)
+      ArLog::log(ArLog::Normal, "ArnlMapSet:   %-32s could not be read", myWanted[i].c_str());
+    else
+      ArLog::log(ArLog::Normal, "ArnlMapSet:   %-32s %8.1f MB%s%s", myWanted[i].c_str(),
+		 myEntries[e].bytes / 1048576.0, myEntries[e].stale ? " (changed, reading again)" : "",
+		 isCurrent ? " (current)" : "");
+  }
+  myMutex.unlock();
+}
@@ -0,0 +1,108 @@
+#ifndef ARNLMAPSET_H
+#define ARNLMAPSET_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include "ArnlMapCache.h"
+#include "ArnlMetrics.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+  Keeps a set of maps (e.g. one per floor) read into memory, so that the
+  robot can be switched to another of them in milliseconds, rather than
+  the seconds it takes to read and parse a large map when the Map parameter
+  is changed.
+
+  The maps are listed in the PreloadMaps parameter (section "Map set"), and
+  read in this task's thread, through an ArnlMapCache if given. switchTo(),
+  or the SwitchMap simple command, copies one into the program's map and
+  calls its map changed callbacks, through which ArPathPlanningTask,
+  ArLocalizationTask, ArForbiddenRangeDevice and ArServerHandlerMap take the
+  new map as they would one read from its file, and sets the Map parameter
+  to it so that the configuration agrees. Switching to a map not in the set
+  reads it first. The robot then needs localizing on the new map as usual.
+
+  A map in the set which is changed while it is the program's map (e.g.
+  edited in MobilePlanner and sent from MobileEyes) is read into the set
+  again. The MapSetStatus simple command logs the maps in the set and about
+  how much memory each takes, which is also given by the
+  arnl_preloaded_map_bytes{map="..."} gauges.
+*/
+class ArnlMapSet : public ArASyncTask
+{
+public:
+  ArnlMapSet(ArMapInterface *map, const char *mapDirectory, ArnlMapCache *cache = NULL,
+	     ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlMapSet();
+
+  void addToConfig(ArConfig *config, const char *section = "Map set");
+  /// Add the SwitchMap and MapSetStatus simple commands
+  void addSimpleCommands(ArServerHandlerCommands *commands);
+
+  /** Make @a fileName the program's map. @return false if it could not be
+   * read */
+  bool switchTo(const char *fileName);
+
+  /// Log the maps in the set, and the memory each takes
+  void logStatus(void);
+
+  virtual void *runThread(void *arg);
+
+protected:
+  struct Entry
+  {
+    std::string fileName;
+    /// Shared, so that switchTo() can copy it into the program's map without myMutex locked
+    std::shared_ptr<ArMap> map;
+    size_t bytes;
+    /// Changed since it was read
+    bool stale;
+  };
+
+  /// @return the position of @a fileName in myEntries, or -1 (with myMutex locked)
+  int findEntry(const char *fileName);
+  ArMap *readMap(const std::string& fileName);
+  void setMapParam(const char *fileName);
+  static size_t estimateBytes(ArMapInterface *map);
+
+  bool processFile(void);
+  void mapChanged(void);
+  void switchCommand(ArArgumentBuilder *args);
+
+  ArMapInterface *myMap;
+  std::string myMapDirectory;
+  ArnlMapCache *myCache;
+  ArnlMetricsRegistry *myMetrics;
+  ArnlHistogram *mySwitchMetric;
+
+  char myPreloadMaps[1024];
+
+  /** Held through each switchTo(), so that one switch is done at a time.
+   * Not myMutex, which mapChanged() takes, and which is therefore never
+   * held while locking the map. */
+  ArMutex mySwitchMutex;
+  ArMutex myMutex;
+  ArCondition myCondition;
+  /// Maps to have in the set, once the thread has read them (protected by myMutex)
+  std::vector<std::string> myWanted;
+  bool myWantedChanged;
+  std::vector<Entry> myEntries;
+  /// Whether the map is being changed by switchTo() (protected by myMutex)
+  bool mySwitching;
+
+  ArRetFunctorC<bool, ArnlMapSet> myProcessFileCB;
+  ArFunctorC<ArnlMapSet> myMapChangedCB;
+  ArFunctor1C<ArnlMapSet, ArArgumentBuilder *> mySwitchCB;
+  ArFunctorC<ArnlMapSet> myStatusCB;
+};
+
+#endif
@@ -0,0 +1,475 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlMetrics.h"
+
+#include <stdio.h>
+
+static std::atomic<int> ourNextShard(0);
+
+int ArnlMetric::shardIndex()
+{
+  // Each thread is given the next slot the first time it updates a metric.
+  static thread_local int shard = -1;
+  if (shard < 0)
+    shard = ourNextShard.fetch_add(1, std::memory_order_relaxed) % ARNL_METRICS_SHARDS;
+  return shard;
+}
+
+static void appendSample(std::string *out, const std::string& name,
+  const char *suffix, const char *extraLabel, double value)
+{
+  // Insert the suffix before any labels, and add the extra label to them.
+  std::string::size_type brace = name.find('{');
+  std::string base = name.substr(0, brace);
+  std::string labels;
+  if (brace != std::string::npos)
+    labels = name.substr(brace + 1, name.size() - brace - 2);
+  if (extraLabel != NULL && extraLabel[0] != '\0')
+  {
+    if (!labels.empty())
+      labels += ",";
+    labels += extraLabel;
+  }
+  char buf[64];
+  snprintf(buf, sizeof(buf), " %.17g\n", value);
+  *out += base;
+  *out += suffix;
+  if (!labels.empty())
+    *out += "{" + labels + "}";
+  *out += buf;
+}
+
+
+ArnlCounter::ArnlCounter(const std::string& name, const std::string& help) :
+  ArnlMetric(name, help, COUNTER)
+{
+  for (int i = 0; i < ARNL_METRICS_SHARDS; i++)
+    myShards[i].value.store(0);
+}
+
+long long ArnlCounter::get() const
+{
+  long long total = 0;
+  for (int i = 0; i < ARNL_METRICS_SHARDS; i++)
+    total += myShards[i].value.load(std::memory_order_relaxed);
+  return total;
+}
+
+void ArnlCounter::writeSamples(std::string *out) const
+{
+  appendSample(out, myName, "", NULL, (double)get());
+}
+
+
+ArnlGauge::ArnlGauge(const std::string& name, const std::string& help,
+  ArRetFunctor<double> *doubleFunctor, ArRetFunctor<int> *intFunctor) :
+  ArnlMetric(name, help, GAUGE),
+  myValue(0),
+  myDoubleFunctor(doubleFunctor),
+  myIntFunctor(intFunctor)
+{
+}
+
+double ArnlGauge::get() const
+{
+  if (myDoubleFunctor != NULL)
+    return myDoubleFunctor->invokeR();
+  if (myIntFunctor != NULL)
+    return myIntFunctor->invokeR();
+  return myValue.load(std::memory_order_relaxed);
+}
+
+void ArnlGauge::writeSamples(std::string *out) const
+{
+  appendSample(out, myName, "", NULL, get());
+}
+
+
+ArnlHistogram::ArnlHistogram(const std::string& name, const std::string& help,
+  const double *bounds, size_t numBounds) :
+  ArnlMetric(name, help, HISTOGRAM)
+{
+  if (numBounds > ARNL_METRICS_MAX_BUCKETS)
+  {
+    ArLog::log(ArLog::Terse, "ArnlHistogram: %s: Warning: only using the first %d of %d bucket bounds.", name.c_str(), ARNL_METRICS_MAX_BUCKETS, (int)numBounds);
+    numBounds = ARNL_METRICS_MAX_BUCKETS;
+  }
+  myNumBounds = numBounds;
+  for (size_t i = 0; i < numBounds; i++)
+    myBounds[i] = bounds[i];
+  for (int s = 0; s < ARNL_METRICS_SHARDS; s++)
+  {
+    for (int b = 0; b <= ARNL_METRICS_MAX_BUCKETS; b++)
+      myShards[s].counts[b].store(0);
+    myShards[s].sum.store(0);
+  }
+}
+
+void ArnlHistogram::observe(double value)
+{
+  size_t bucket = 0;
+  while (bucket < myNumBounds && value > myBounds[bucket])
+    bucket++;
+  Shard& shard = myShards[shardIndex()];
+  shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  double old = shard.sum.load(std::memory_order_relaxed);
+  while (!shard.sum.compare_exchange_weak(old, old + value, std::memory_order_relaxed))
+    ;
+}
+
+long long ArnlHistogram::getCount() const
+{
+  long long total = 0;
+  for (int s = 0; s < ARNL_METRICS_SHARDS; s++)
+    for (size_t b = 0; b <= myNumBounds; b++)
+      total += myShards[s].counts[b].load(std::memory_order_relaxed);
+  return total;
+}
+
+double ArnlHistogram::getSum() const
+{
+  double total = 0;
+  for (int s = 0; s < ARNL_METRICS_SHARDS; s++)
+    total += myShards[s].sum.load(std::memory_order_relaxed);
+  return total;
+}
+
+void ArnlHistogram::getBuckets(std::vector<double> *bounds,
+  std::vector<long long> *cumulativeCounts) const
+{
+  bounds->assign(myBounds, myBounds + myNumBounds);
+  cumulativeCounts->assign(myNumBounds + 1, 0);
+  for (size_t b = 0; b <= myNumBounds; b++)
+    for (int s = 0; s < ARNL_METRICS_SHARDS; s++)
+      (*cumulativeCounts)[b] += myShards[s].counts[b].load(std::memory_order_relaxed);
+  for (size_t b = 1; b <= myNumBounds; b++)
+    (*cumulativeCounts)[b] += (*cumulativeCounts)[b - 1];
+}
+
+void ArnlHistogram::writeSamples(std::string *out) const
+{
+  std::vector<double> bounds;
+  std::vector<long long> counts;
+  getBuckets(&bounds, &counts);
+  char label[64];
+  for (size_t b = 0; b < bounds.size(); b++)
+  {
+    snprintf(label, sizeof(label), "le=\"%g\"", bounds[b]);
+    appendSample(out, myName, "_bucket", label, (double)counts[b]);
+  }
+  appendSample(out, myName, "_bucket", "le=\"+Inf\"", (double)counts.back());
+  appendSample(out, myName, "_sum", NULL, getSum());
+  appendSample(out, myName, "_count", NULL, (double)counts.back());
+}
+
+
+ArnlMetricsRegistry::ArnlMetricsRegistry()
+{
+  myMutex.setLogName("ArnlMetricsRegistry::myMutex");
+}
+
+ArnlMetricsRegistry::~ArnlMetricsRegistry()
+{
+  for (std::map<std::string, ArnlMetric *>::iterator i = myMetrics.begin();
+       i != myMetrics.end(); ++i)
+    delete i->second;
+}
+
+ArnlMetricsRegistry *ArnlMetricsRegistry::getGlobal()
+{
+  static ArnlMetricsRegistry ourGlobal;
+  return &ourGlobal;
+}
+
+std::string ArnlMetricsRegistry::withLabel(const std::string& name, const std::string& label,
+  const std::string& value)
+{
+  std::string escaped;
+  for (size_t i = 0; i < value.size(); i++)
+  {
+    if (value[i] == '\\' || value[i] == '"')
+      escaped += '\\';
+    if (value[i] == '\n')
+      escaped += "\\n";
+    else
+      escaped += value[i];
+  }
+  // Added to any labels the name already has
+  if (!name.empty() && name[name.size() - 1] == '}')
+    return name.substr(0, name.size() - 1) + "," + label + "=\"" + escaped + "\"}";
+  return name + "{" + label + "=\"" + escaped + "\"}";
+}
+
+ArnlMetric *ArnlMetricsRegistry::find(const std::string& name, ArnlMetric::Type type)
+{
+  std::map<std::string, ArnlMetric *>::const_iterator it = myMetrics.find(name);
+  if (it == myMetrics.end())
+    return NULL;
+  if (it->second->getType() != type)
+  {
+    ArLog::log(ArLog::Terse, "ArnlMetricsRegistry: Error: metric %s already exists with a different type.", name.c_str());
+    return NULL;
+  }
+  return it->second;
+}
+
+void ArnlMetricsRegistry::add(ArnlMetric *metric)
+{
+  // Replaces (and leaks) any metric of another type with the same name, since
+  // pointers to it may still be in use.
+  myMetrics[metric->getName()] = metric;
+}
+
+ArnlCounter *ArnlMetricsRegistry::getCounter(const std::string& name, const std::string& help)
+{
+  myMutex.lock();
+  ArnlCounter *ret = (ArnlCounter *)find(name, ArnlMetric::COUNTER);
+  if (ret == NULL)
+  {
+    ret = new ArnlCounter(name, help);
+    add(ret);
+  }
+  myMutex.unlock();
+  return ret;
+}
+
+ArnlGauge *ArnlMetricsRegistry::getGauge(const std::string& name, const std::string& help)
+{
+  myMutex.lock();
+  ArnlGauge *ret = (ArnlGauge *)find(name, ArnlMetric::GAUGE);
+  if (ret == NULL)
+  {
+    ret = new ArnlGauge(name, help);
+    add(ret);
+  }
+  myMutex.unlock();
+  return ret;
+}
+
+ArnlGauge *ArnlMetricsRegistry::getGauge(const std::string& name, const std::string& help,
+  ArRetFunctor<double> *functor)
+{
+  myMutex.lock();
+  ArnlGauge *ret = (ArnlGauge *)find(name, ArnlMetric::GAUGE);
+  if (ret == NULL)
+  {
+    ret = new ArnlGauge(name, help, functor);
+    add(ret);
+  }
+  myMutex.unlock();
+  return ret;
+}
+
+ArnlGauge *ArnlMetricsRegistry::getGauge(const std::string& name, const std::string& help,
+  ArRetFunctor<int> *functor)
+{
+  myMutex.lock();
+  ArnlGauge *ret = (ArnlGauge *)find(name, ArnlMetric::GAUGE);
+  if (ret == NULL)
+  {
+    ret = new ArnlGauge(name, help, NULL, functor);
+    add(ret);
+  }
+  myMutex.unlock();
+  return ret;
+}
+
+ArnlHistogram *ArnlMetricsRegistry::getHistogram(const std::string& name,
+  const std::string& help, const double *bounds, size_t numBounds)
+{
+  myMutex.lock();
+  ArnlHistogram *ret = (ArnlHistogram *)find(name, ArnlMetric::HISTOGRAM);
+  if (ret == NULL)
+  {
+    ret = new ArnlHistogram(name, help, bounds, numBounds);
+    add(ret);
+  }
+  myMutex.unlock();
+  return ret;
+}
+
+ArnlHistogram *ArnlMetricsRegistry::getMSecsHistogram(const std::string& name,
+  const std::string& help)
+{
+  static const double bounds[] =
+    { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 60000 };
+  return getHistogram(name, help, bounds, sizeof(bounds) / sizeof(bounds[0]));
+}
+
+void ArnlMetricsRegistry::writeText(std::string *out)
+{
+  myMutex.lock();
+  // Metrics are sorted by name, so those with the same base name (differing
+  // only by labels) are adjacent and share HELP and TYPE lines.
+  std::string lastBase;
+  for (std::map<std::string, ArnlMetric *>::const_iterator i = myMetrics.begin();
+       i != myMetrics.end(); ++i)
+  {
+    const ArnlMetric *m = i->second;
+    std::string base = m->getName().substr(0, m->getName().find('{'));
+    if (base != lastBase)
+    {
+      if (!m->getHelp().empty())
+        *out += "# HELP " + base + " " + m->getHelp() + "\n";
+      *out += "# TYPE " + base + " ";
+      switch (m->getType())
+      {
+        case ArnlMetric::COUNTER: *out += "counter\n"; break;
+        case ArnlMetric::GAUGE: *out += "gauge\n"; break;
+        case ArnlMetric::HISTOGRAM: *out += "histogram\n"; break;
+      }
+      lastBase = base;
+    }
+    m->writeSamples(out);
+  }
+  myMutex.unlock();
+}
+
+
+ArServerHandlerMetrics::ArServerHandlerMetrics(ArServerBase *server,
+  ArnlMetricsRegistry *registry) :
+  myServer(server),
+  myRegistry(registry),
+  myMetricsCB(this, &ArServerHandlerMetrics::serverMetrics)
+{
+  myServer->addData("metrics",
+		    "gets server, mode and task metrics in text exposition format",
+		    &myMetricsCB, "none", "<repeat> string: line, in packets of a few KB, then an empty packet",
+		    "RobotInfo", "RETURN_UNTIL_EMPTY");
+}
+
+void ArServerHandlerMetrics::serverMetrics(ArServerClient *client, ArNetPacket * /*packet*/)
+{
+  // Well under ArNetPacket's limit, whatever the length of the last line added
+  const unsigned int packetBytes = 8000;
+  std::string text;
+  myRegistry->writeText(&text);
+  ArNetPacket sendPacket;
+  std::string::size_type start = 0;
+  while (start < text.size())
+  {
+    std::string::size_type end = text.find('\n', start);
+    if (end == std::string::npos)
+      end = text.size();
+    sendPacket.strToBuf(text.substr(start, end - start).c_str());
+    start = end + 1;
+    if (sendPacket.getDataLength() >= packetBytes)
+    {
+      client->sendPacketTcp(&sendPacket);
+      sendPacket.empty();
+    }
+  }
+  if (sendPacket.getDataLength() > 0)
+    client->sendPacketTcp(&sendPacket);
+  sendPacket.empty();
+  client->sendPacketTcp(&sendPacket);
+}
+
+
+ArnlMetricsHttpServer::ArnlMetricsHttpServer(ArnlMetricsRegistry *registry, int port) :
+  myRegistry(registry),
+  myOpen(false),
+  myPort(port),
+  myOpenPort(0),
+  myProcessFileCB(this, &ArnlMetricsHttpServer::processFile)
+{
+  setThreadName("ArnlMetricsHttpServer");
+  if (myPort > 0)
+    open(myPort);
+}
+
+ArnlMetricsHttpServer::~ArnlMetricsHttpServer()
+{
+  // Joined so that the thread is not serving a client (reading the registry,
+  // writing the socket) when the socket is closed and this is destroyed
+  const bool running = getRunning();
+  stopRunning();
+  if (running)
+    join();
+  open(0);
+}
+
+void ArnlMetricsHttpServer::addToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("MetricsHttpPort", &myPort,
+		      "Local TCP port on which metrics are served as plain text over HTTP (on 127.0.0.1 only). 0 disables.",
+		      0, 65535),
+	  section, ArPriority::DETAILED);
+  config->addProcessFileCB(&myProcessFileCB, 40);
+}
+
+bool ArnlMetricsHttpServer::processFile(void)
+{
+  if (myPort != myOpenPort)
+    open(myPort);
+  return true;
+}
+
+bool ArnlMetricsHttpServer::open(int port)
+{
+  mySocketMutex.lock();
+  if (myOpen)
+  {
+    myServerSocket.close();
+    myOpen = false;
+    myOpenPort = 0;
+  }
+  if (port <= 0)
+  {
+    mySocketMutex.unlock();
+    return true;
+  }
+  if (!myServerSocket.open(port, ArSocket::TCP, "127.0.0.1"))
+  {
+    ArLog::log(ArLog::Terse, "ArnlMetricsHttpServer: Error: could not open port %d.", port);
+    mySocketMutex.unlock();
+    return false;
+  }
+  myServerSocket.setNonBlock();
+  myOpen = true;
+  myOpenPort = port;
+  mySocketMutex.unlock();
+  ArLog::log(ArLog::Normal, "ArnlMetricsHttpServer: serving metrics on http://127.0.0.1:%d/", port);
+  if (!getRunning())
+    runAsync();
+  return true;
+}
+
+void *ArnlMetricsHttpServer::runThread(void *)
+{
+  while (getRunning())
+  {
+    ArSocket client;
+    mySocketMutex.lock();
+    bool accepted = myOpen && myServerSocket.accept(&client);
+    mySocketMutex.unlock();
+    if (accepted)
+      serveClient(&client);
+    else
+      ArUtil::sleep(100);
+  }
+  return NULL;
+}
+
+void ArnlMetricsHttpServer::serveClient(ArSocket *client)
+{
+  // The request itself doesn't matter; read (and discard) what has arrived.
+  char request[1024];
+  client->read(request, sizeof(request), 100);
+
+  std::string text;
+  myRegistry->writeText(&text);
+  char header[256];
+  snprintf(header, sizeof(header),
+	   "HTTP/1.0 200 OK\r\n"
+	   "Content-Type: text/plain; version=0.0.4\r\n"
+	   "Content-Length: %lu\r\n"
+	   "Connection: close\r\n\r\n", (unsigned long)text.size());
+  client->write(header, strlen(header));
+  client->write(text.c_str(), text.size());
+  client->close();
+}
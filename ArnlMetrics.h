@@ -0,0 +1,259 @@
+#ifndef ARNLMETRICS_H
+#define ARNLMETRICS_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Number of per-thread accumulation slots in each counter and histogram
+#define ARNL_METRICS_SHARDS 16
+
+/// Maximum number of buckets (not counting the overflow bucket) in an ArnlHistogram
+#define ARNL_METRICS_MAX_BUCKETS 16
+
+/**
+  Base class for metrics kept in an ArnlMetricsRegistry.
+
+  A metric name may include Prometheus style labels, e.g.
+  <tt>arnl_task_runs_total{task="Example"}</tt>; metrics sharing a name
+  before the labels are listed together.
+*/
+class ArnlMetric
+{
+public:
+  enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+  ArnlMetric(const std::string& name, const std::string& help, Type type) :
+    myName(name), myHelp(help), myType(type) {}
+  virtual ~ArnlMetric() {}
+
+  const std::string& getName() const { return myName; }
+  const std::string& getHelp() const { return myHelp; }
+  Type getType() const { return myType; }
+
+  /// Append the current value(s) in text exposition format, one sample per line
+  virtual void writeSamples(std::string *out) const = 0;
+
+protected:
+  /// Index of the accumulation slot used by the calling thread
+  static int shardIndex();
+
+  std::string myName;
+  std::string myHelp;
+  Type myType;
+};
+
+/**
+  A monotonically increasing count. add() is lock-free: each thread adds to
+  its own slot (on its own cache line), and get() sums the slots, so
+  counting from the robot or path planning threads costs one uncontended
+  atomic add.
+*/
+class ArnlCounter : public ArnlMetric
+{
+public:
+  ArnlCounter(const std::string& name, const std::string& help);
+
+  void add(long long n = 1)
+  {
+    myShards[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  long long get() const;
+
+  virtual void writeSamples(std::string *out) const;
+
+protected:
+  struct Shard
+  {
+    std::atomic<long long> value;
+    char pad[64 - sizeof(std::atomic<long long>)];
+  };
+  Shard myShards[ARNL_METRICS_SHARDS];
+};
+
+/**
+  A value which may go up or down. Either set() it, or supply a functor
+  which is called to obtain the value whenever the metrics are exported.
+*/
+class ArnlGauge : public ArnlMetric
+{
+public:
+  ArnlGauge(const std::string& name, const std::string& help,
+    ArRetFunctor<double> *doubleFunctor = NULL,
+    ArRetFunctor<int> *intFunctor = NULL);
+
+  void set(double value) { myValue.store(value, std::memory_order_relaxed); }
+
+  void add(double delta)
+  {
+    double old = myValue.load(std::memory_order_relaxed);
+    while (!myValue.compare_exchange_weak(old, old + delta, std::memory_order_relaxed))
+      ;
+  }
+
+  double get() const;
+
+  virtual void writeSamples(std::string *out) const;
+
+protected:
+  std::atomic<double> myValue;
+  ArRetFunctor<double> *myDoubleFunctor;
+  ArRetFunctor<int> *myIntFunctor;
+};
+
+/**
+  Distribution of observed values (e.g. durations in milliseconds) in
+  buckets with fixed upper bounds, plus the count and sum of all
+  observations. Like ArnlCounter, each thread accumulates into its own slot.
+*/
+class ArnlHistogram : public ArnlMetric
+{
+public:
+  ArnlHistogram(const std::string& name, const std::string& help,
+    const double *bounds, size_t numBounds);
+
+  void observe(double value);
+
+  /// @return total number of observations
+  long long getCount() const;
+
+  /// @return sum of all observations
+  double getSum() const;
+
+  /// Get cumulative counts of observations <= each bound (and the total count last)
+  void getBuckets(std::vector<double> *bounds, std::vector<long long> *cumulativeCounts) const;
+
+  virtual void writeSamples(std::string *out) const;
+
+protected:
+  struct Shard
+  {
+    std::atomic<long long> counts[ARNL_METRICS_MAX_BUCKETS + 1];
+    std::atomic<double> sum;
+    char pad[64];
+  };
+  double myBounds[ARNL_METRICS_MAX_BUCKETS];
+  size_t myNumBounds;
+  Shard myShards[ARNL_METRICS_SHARDS];
+};
+
+/**
+  Set of named counters, gauges and histograms which parts of the server
+  (ArServerModeGoto2, ArnlASyncTask, the server's main()) publish to, and
+  exporters (ArServerHandlerMetrics, ArnlMetricsHttpServer) read.
+
+  Metrics are created on first request and live as long as the registry;
+  requesting an existing name returns the same object, so keep the pointer
+  rather than looking it up each time a value changes. Only creating and
+  exporting metrics takes a lock; updating them does not.
+*/
+class ArnlMetricsRegistry
+{
+public:
+  ArnlMetricsRegistry();
+  ~ArnlMetricsRegistry();
+
+  /// The registry used by the classes in this package
+  static ArnlMetricsRegistry *getGlobal();
+
+  /** @return @a name with the label @a label="@a value" added, e.g.
+   *  withLabel("arnl_task_runs_total", "task", name). @a value may be
+   *  anything (e.g. a file name): quotes and backslashes in it are escaped. */
+  static std::string withLabel(const std::string& name, const std::string& label,
+    const std::string& value);
+
+  ArnlCounter *getCounter(const std::string& name, const std::string& help = "");
+
+  ArnlGauge *getGauge(const std::string& name, const std::string& help = "");
+
+  /// Get a gauge whose value is obtained from @a functor when exported
+  ArnlGauge *getGauge(const std::string& name, const std::string& help, ArRetFunctor<double> *functor);
+
+  /// Get a gauge whose value is obtained from @a functor when exported
+  ArnlGauge *getGauge(const std::string& name, const std::string& help, ArRetFunctor<int> *functor);
+
+  /// Get a histogram; @a bounds (up to ARNL_METRICS_MAX_BUCKETS ascending
+  /// upper bucket bounds) are used only when it is first created
+  ArnlHistogram *getHistogram(const std::string& name, const std::string& help,
+    const double *bounds, size_t numBounds);
+
+  /// Get a histogram of durations in milliseconds with default buckets from 1 ms to 60 s
+  ArnlHistogram *getMSecsHistogram(const std::string& name, const std::string& help = "");
+
+  /// Write all metrics in Prometheus text exposition format
+  void writeText(std::string *out);
+
+protected:
+  ArnlMetric *find(const std::string& name, ArnlMetric::Type type);
+  void add(ArnlMetric *metric);
+
+  ArMutex myMutex;
+  std::map<std::string, ArnlMetric *> myMetrics;
+};
+
+/**
+  Provides the "metrics" networking request, which returns the contents of
+  a metrics registry in text exposition format, one line per string, in as
+  many packets as it takes, followed by an empty packet.
+*/
+class ArServerHandlerMetrics
+{
+public:
+  ArServerHandlerMetrics(ArServerBase *server,
+    ArnlMetricsRegistry *registry = ArnlMetricsRegistry::getGlobal());
+
+protected:
+  void serverMetrics(ArServerClient *client, ArNetPacket *packet);
+
+  ArServerBase *myServer;
+  ArnlMetricsRegistry *myRegistry;
+  ArFunctor2C<ArServerHandlerMetrics, ArServerClient *, ArNetPacket *> myMetricsCB;
+};
+
+/**
+  Serves the contents of a metrics registry as plain text over HTTP on a
+  local (127.0.0.1) TCP port, for scraping by a monitoring agent on the
+  robot. Any request on the port gets the full text in reply.
+
+  The port is set by the MetricsHttpPort parameter (0 disables the
+  endpoint) after addToConfig() is called, and the endpoint is reopened
+  when it changes.
+*/
+class ArnlMetricsHttpServer : public ArASyncTask
+{
+public:
+  ArnlMetricsHttpServer(ArnlMetricsRegistry *registry = ArnlMetricsRegistry::getGlobal(),
+    int port = 0);
+  virtual ~ArnlMetricsHttpServer();
+
+  void addToConfig(ArConfig *config, const char *section = "Metrics");
+
+  /// Open the endpoint on the given port (0 to close it)
+  bool open(int port);
+
+  virtual void *runThread(void *arg);
+
+protected:
+  bool processFile(void);
+  void serveClient(ArSocket *client);
+
+  ArnlMetricsRegistry *myRegistry;
+  ArMutex mySocketMutex;
+  ArSocket myServerSocket;
+  bool myOpen;
+  int myPort;
+  int myOpenPort;
+  ArRetFunctorC<bool, ArnlMetricsHttpServer> myProcessFileCB;
+};
+
+#endif
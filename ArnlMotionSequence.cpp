@@ -0,0 +1,211 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlMotionSequence.h"
+
+ArMutex ArnlMotionExecutor::ourExecutorsMutex;
+std::map<ArRobot *, ArnlMotionExecutor *> ArnlMotionExecutor::ourExecutors;
+
+ArnlMotionExecutor::ArnlMotionExecutor(ArRobot *robot, ArnlMetricsRegistry *metrics) :
+  myRobot(robot),
+  myRequests(16),
+  myNumPending(0),
+  myRunning(false),
+  myCycleCB(this, &ArnlMotionExecutor::robotCycle),
+  myProfiledCycleCB(&myCycleCB, "ArnlMotionExecutor"),
+  myMetrics(metrics)
+{
+  myDurationMetric = myMetrics->getMSecsHistogram("arnl_motion_sequence_msecs",
+    "Time from starting a motion sequence until it was done or preempted");
+  myRobot->lock();
+  // After the robot's pose is updated, before actions are resolved
+  myRobot->addSensorInterpTask("ArnlMotionExecutor", 40, &myProfiledCycleCB);
+  myRobot->unlock();
+}
+
+ArnlMotionExecutor::ArnlMotionExecutor(ArnlMetricsRegistry *metrics) :
+  myRobot(NULL),
+  myRequests(16),
+  myNumPending(0),
+  myRunning(false),
+  myCycleCB(this, &ArnlMotionExecutor::robotCycle),
+  myProfiledCycleCB(&myCycleCB, "ArnlMotionExecutor"),
+  myMetrics(metrics)
+{
+  myDurationMetric = myMetrics->getMSecsHistogram("arnl_motion_sequence_msecs",
+    "Time from starting a motion sequence until it was done or preempted");
+}
+
+ArnlMotionExecutor::~ArnlMotionExecutor()
+{
+  if (myRobot != NULL)
+  {
+    myRobot->lock();
+    myRobot->remSensorInterpTask(&myProfiledCycleCB);
+  }
+  // A subclass's overrides are gone by now, so don't call getRobotPose()
+  if (myRunning)
+  {
+    if (myRobot != NULL)
+      myRobot->clearDirectMotion();
+    myRunning = false;
+    myCurrent.promise.complete(ArnlGoalResult::PREEMPTED, ArPose());
+  }
+  if (myRobot != NULL)
+    myRobot->unlock();
+  Request request;
+  while (myRequests.take(&request))
+    if (request.sequence.promise.isValid())
+      request.sequence.promise.complete(ArnlGoalResult::PREEMPTED, ArPose());
+}
+
+ArnlMotionExecutor *ArnlMotionExecutor::getExecutor(ArRobot *robot)
+{
+  ourExecutorsMutex.lock();
+  ArnlMotionExecutor *&executor = ourExecutors[robot];
+  if (executor == NULL)
+    executor = new ArnlMotionExecutor(robot);
+  ourExecutorsMutex.unlock();
+  return executor;
+}
+
+void ArnlMotionExecutor::setExecutor(ArRobot *robot, ArnlMotionExecutor *executor)
+{
+  ourExecutorsMutex.lock();
+  if (executor != NULL)
+    ourExecutors[robot] = executor;
+  else
+    ourExecutors.erase(robot);
+  ourExecutorsMutex.unlock();
+}
+
+ArnlGoalFuture ArnlMotionExecutor::run(const ArnlMotionSequence& seq)
+{
+  Request request;
+  request.sequence.promise = ArnlGoalPromise(seq.getName());
+  request.sequence.steps = seq.getSteps();
+  const ArnlGoalFuture future = request.sequence.promise.getFuture();
+  myNumPending++;
+  if (!myRequests.post(request))
+  {
+    myNumPending--;
+    ArLog::log(ArLog::Normal, "ArnlMotionExecutor: Warning: too many requests waiting, %s failed",
+	       seq.getName().c_str());
+    request.sequence.promise.complete(ArnlGoalResult::FAILED, ArPose());
+  }
+  return future;
+}
+
+void ArnlMotionExecutor::cancel(const ArnlGoalFuture& future)
+{
+  Request request;
+  request.cancel = future;
+  // Only fails if the mailbox is full of sequences, which preempt this one anyway
+  myRequests.post(request);
+}
+
+bool ArnlMotionExecutor::isBusy(void)
+{
+  return myNumPending > 0 || myRunning;
+}
+
+/// Robot sensor interpretation task: take requests, and start as many steps as can be done this cycle
+void ArnlMotionExecutor::robotCycle(void)
+{
+  Request request;
+  while (myRequests.take(&request))
+  {
+    if (request.cancel.isValid())
+    {
+      if (myRunning && myCurrent.promise.isFor(request.cancel))
+	finish(ArnlGoalResult::PREEMPTED);
+      continue;
+    }
+    // A later sequence replaces this one
+    if (myRunning)
+      finish(ArnlGoalResult::PREEMPTED);
+    myCurrent = request.sequence;
+    myRunning = true;
+    myNumPending--;
+  }
+  if (!myRunning)
+    return;
+
+  while (myCurrent.step < myCurrent.steps.size())
+  {
+    const ArnlMotionSequence::Step& step = myCurrent.steps[myCurrent.step];
+    if (!myCurrent.stepStarted)
+    {
+      startStep(step);
+      myCurrent.stepStarted = true;
+      myCurrent.stepStartMSecs = ArnlClock::getMSecs();
+    }
+    if (!stepDone(step))
+      return;
+    myCurrent.step++;
+    myCurrent.stepStarted = false;
+  }
+  finish(ArnlGoalResult::ARRIVED);
+}
+
+void ArnlMotionExecutor::startStep(const ArnlMotionSequence::Step& step)
+{
+  switch (step.type)
+  {
+  case ArnlMotionSequence::MOVE:
+    myRobot->clearDirectMotion();
+    myRobot->move(step.value);
+    break;
+  case ArnlMotionSequence::HEADING:
+    myRobot->clearDirectMotion();
+    myRobot->setDeltaHeading(step.value);
+    break;
+  case ArnlMotionSequence::DWELL:
+    myRobot->stop();
+    break;
+  case ArnlMotionSequence::STATUS:
+    {
+      ArLog::log(ArLog::Normal, "ArnlMotionExecutor: %s", step.text.c_str());
+      ArServerMode *mode = ArServerMode::getActiveMode();
+      if (mode != NULL)
+	mode->setStatus(step.text.c_str());
+    }
+    break;
+  }
+}
+
+bool ArnlMotionExecutor::stepDone(const ArnlMotionSequence::Step& step)
+{
+  switch (step.type)
+  {
+  case ArnlMotionSequence::MOVE:
+    return myRobot->isMoveDone();
+  case ArnlMotionSequence::HEADING:
+    return myRobot->isHeadingDone();
+  case ArnlMotionSequence::DWELL:
+    return ArnlClock::getMSecs() - myCurrent.stepStartMSecs >= (long long)step.value;
+  case ArnlMotionSequence::STATUS:
+    return true;
+  }
+  return true;
+}
+
+/// End the current sequence. Call in the robot thread (or with the robot locked).
+void ArnlMotionExecutor::finish(ArnlGoalResult::Status status)
+{
+  if (myRobot != NULL)
+    myRobot->clearDirectMotion();
+  myRunning = false;
+  ArnlGoalPromise promise = myCurrent.promise;
+  myCurrent = Sequence();
+  if (promise.complete(status, getRobotPose()))
+  {
+    const ArnlGoalResult result = promise.getFuture().getResult();
+    myDurationMetric->observe(result.msecs);
+    myMetrics->getCounter(ArnlMetricsRegistry::withLabel("arnl_motion_sequences_total", "result",
+      ArnlGoalResult::getStatusName(status)),
+      "Motion sequences which were completed or preempted")->add();
+  }
+}
@@ -0,0 +1,180 @@
+#ifndef ARNLMOTIONSEQUENCE_H
+#define ARNLMOTIONSEQUENCE_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include "ArnlCallbackProfiler.h"
+#include "ArnlClock.h"
+#include "ArnlGoalFuture.h"
+#include "ArnlMailbox.h"
+#include "ArnlMetrics.h"
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+  A list of motion primitives for a task to perform at a goal, such as
+  approaching a drop point, dwelling there and backing up, built with the
+  chaining methods below and run with ArnlMotionExecutor (or
+  ArnlASyncTask::runMotion()):
+
+  @code{.cpp}
+  ArnlMotionSequence seq("drop");
+  seq.status("Approaching").move(250).dwell(500)
+     .status("Waiting 3 sec").dwell(3000)
+     .status("Backing up").move(-250).dwell(500);
+  ArnlGoalResult r = waitForMotion(runMotion(seq));
+  @endcode
+*/
+class ArnlMotionSequence
+{
+public:
+  enum StepType {
+    MOVE,     ///< ArRobot::move() by value mm, done when ArRobot::isMoveDone()
+    HEADING,  ///< ArRobot::setDeltaHeading() by value degrees, done when ArRobot::isHeadingDone()
+    DWELL,    ///< Stay still for value ms
+    STATUS    ///< Set the active server mode's status to text (takes no time)
+  };
+
+  struct Step
+  {
+    StepType type;
+    double value;
+    std::string text;
+  };
+
+  explicit ArnlMotionSequence(const std::string& name = "motion") : myName(name) {}
+
+  /// Move forward (or back if negative) @a dist mm
+  ArnlMotionSequence& move(double dist) { return add(MOVE, dist, ""); }
+  /// Turn by @a degrees (positive is counterclockwise)
+  ArnlMotionSequence& turn(double degrees) { return add(HEADING, degrees, ""); }
+  /// Stay still for @a msecs
+  ArnlMotionSequence& dwell(long msecs) { return add(DWELL, msecs, ""); }
+  /// Log @a text and set the active server mode's status to it
+  ArnlMotionSequence& status(const std::string& text) { return add(STATUS, 0, text); }
+
+  const std::string& getName() const { return myName; }
+  const std::vector<Step>& getSteps() const { return mySteps; }
+  bool empty() const { return mySteps.empty(); }
+
+protected:
+  ArnlMotionSequence& add(StepType type, double value, const std::string& text)
+  {
+    Step step;
+    step.type = type;
+    step.value = value;
+    step.text = text;
+    mySteps.push_back(step);
+    return *this;
+  }
+
+  std::string myName;
+  std::vector<Step> mySteps;
+};
+
+/**
+  Runs ArnlMotionSequence steps for one robot in the robot thread, from a
+  sensor interpretation task, so that a task thread hands a whole approach,
+  dwell and back-up to the robot thread at once instead of locking the
+  robot, commanding a step, and polling for it to finish (with sleeps in
+  between) for each step. Each step starts in the same robot cycle in which
+  the previous one finished, so no time is lost between steps, and the task
+  thread is woken once when the sequence is done.
+
+  run() and cancel() post to an ArnlMailbox taken by the robot thread, so
+  they never lock the robot or wait for its cycle.
+
+  run() returns an ArnlGoalFuture (whose goal name is the sequence name)
+  which completes, in the robot thread, with status ARRIVED when all steps
+  are done, or PREEMPTED if the sequence is cancelled (with cancel(), or by
+  run() starting another sequence); or immediately with status FAILED if
+  too many requests are waiting. Direct motion is cleared when a sequence
+  ends, so path planning and other actions take over again.
+
+  Dwell steps go by ArnlClock time. ArnlSimulatedMotion (see
+  ArnlVirtualTime.h) overrides the robot-facing methods to run sequences
+  without a robot.
+
+  Metrics: arnl_motion_sequences_total{result="arrived"|"preempted"} and
+  arnl_motion_sequence_msecs.
+*/
+class ArnlMotionExecutor
+{
+public:
+  ArnlMotionExecutor(ArRobot *robot, ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlMotionExecutor();
+
+  /// The executor for @a robot, created the first time it is requested
+  static ArnlMotionExecutor *getExecutor(ArRobot *robot);
+
+  /** Use @a executor (not deleted, or NULL to stop using it) for @a robot
+   * from now on, e.g. an ArnlSimulatedMotion for a robot which is not
+   * connected */
+  static void setExecutor(ArRobot *robot, ArnlMotionExecutor *executor);
+
+  /** Start @a seq at the next robot cycle, preempting any sequence running or
+   * waiting to start. */
+  ArnlGoalFuture run(const ArnlMotionSequence& seq);
+
+  /// Stop the sequence @a future is for, if it is running or waiting to start
+  void cancel(const ArnlGoalFuture& future);
+
+  /// Whether a sequence is running or waiting to start
+  bool isBusy(void);
+
+protected:
+  struct Sequence
+  {
+    Sequence() : step(0), stepStarted(false), stepStartMSecs(0) {}
+    ArnlGoalPromise promise;
+    std::vector<ArnlMotionSequence::Step> steps;
+    size_t step;
+    bool stepStarted;
+    /// ArnlClock time at which the current step started
+    long long stepStartMSecs;
+  };
+
+  /// A run() (with a sequence) or cancel() (with the future to cancel) for the robot thread
+  struct Request
+  {
+    Sequence sequence;
+    ArnlGoalFuture cancel;
+  };
+
+  /** For subclasses which drive robotCycle() themselves instead of from a
+   * robot (myRobot is NULL, so they must override startStep(), stepDone()
+   * and getRobotPose()) */
+  explicit ArnlMotionExecutor(ArnlMetricsRegistry *metrics);
+
+  void robotCycle(void);
+  virtual void startStep(const ArnlMotionSequence::Step& step);
+  virtual bool stepDone(const ArnlMotionSequence::Step& step);
+  virtual ArPose getRobotPose(void) { return myRobot->getPose(); }
+  void finish(ArnlGoalResult::Status status);
+
+  ArRobot *myRobot;
+  ArnlMailbox<Request> myRequests;
+  /// Sequences posted and not yet taken by the robot thread
+  std::atomic<int> myNumPending;
+  /// Sequence being run (only used in the robot thread)
+  Sequence myCurrent;
+  std::atomic<bool> myRunning;
+  ArFunctorC<ArnlMotionExecutor> myCycleCB;
+  ArnlProfiledFunctor myProfiledCycleCB;
+  ArnlMetricsRegistry *myMetrics;
+  ArnlHistogram *myDurationMetric;
+
+  static ArMutex ourExecutorsMutex;
+  static std::map<ArRobot *, ArnlMotionExecutor *> ourExecutors;
+};
+
+#endif
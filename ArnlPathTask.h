@@ -0,0 +1,68 @@
+#ifndef ARNLPATHTASK_H
+#define ARNLPATHTASK_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "Arnl.h"
+#include "ArPathPlanningTask.h"
+
+#include <string>
+
+/**
+  The path planning that ArnlASyncTask uses: requesting a goal, the name of
+  the current goal, and callbacks for the outcome of goals.
+
+  ArnlPathPlanningTaskAdapter passes these on to an ArPathPlanningTask, and
+  is what ArnlASyncTask uses when given one. ArnlSimulatedNavigation (see
+  ArnlVirtualTime.h) implements them in virtual time without a robot or
+  map, so that taskChainSimulator can run a task class unchanged.
+*/
+class ArnlPathTask
+{
+public:
+  virtual ~ArnlPathTask() {}
+
+  /// Plan a path to @a goalName and drive there. @return false if the goal could not be planned to (e.g. there is no such goal)
+  virtual bool pathPlanToGoal(const char *goalName) = 0;
+
+  /// The goal last requested; in the goal callbacks, the goal they are for
+  virtual std::string getCurrentGoalName(void) = 0;
+
+  virtual void addGoalDoneCB(ArFunctor1<ArPose> *cb) = 0;
+  virtual void remGoalDoneCB(ArFunctor1<ArPose> *cb) = 0;
+  virtual void addGoalFailedCB(ArFunctor1<ArPose> *cb) = 0;
+  virtual void remGoalFailedCB(ArFunctor1<ArPose> *cb) = 0;
+  virtual void addGoalInterruptedCB(ArFunctor1<ArPose> *cb) = 0;
+  virtual void remGoalInterruptedCB(ArFunctor1<ArPose> *cb) = 0;
+
+  /// The ARNL path planning task behind this one, or NULL if there is none (e.g. in simulation)
+  virtual ArPathPlanningTask *getPathPlanningTask(void) { return NULL; }
+};
+
+/// An ArnlPathTask for an ArPathPlanningTask
+class ArnlPathPlanningTaskAdapter : public ArnlPathTask
+{
+public:
+  explicit ArnlPathPlanningTaskAdapter(ArPathPlanningTask *pathTask) : myPathTask(pathTask) {}
+
+  virtual bool pathPlanToGoal(const char *goalName) { return myPathTask->pathPlanToGoal(goalName); }
+  virtual std::string getCurrentGoalName(void) { return myPathTask->getCurrentGoalName(); }
+
+  virtual void addGoalDoneCB(ArFunctor1<ArPose> *cb) { myPathTask->addGoalDoneCB(cb); }
+  virtual void remGoalDoneCB(ArFunctor1<ArPose> *cb) { myPathTask->remGoalDoneCB(cb); }
+  virtual void addGoalFailedCB(ArFunctor1<ArPose> *cb) { myPathTask->addGoalFailedCB(cb); }
+  virtual void remGoalFailedCB(ArFunctor1<ArPose> *cb) { myPathTask->remGoalFailedCB(cb); }
+  virtual void addGoalInterruptedCB(ArFunctor1<ArPose> *cb) { myPathTask->addGoalInterruptedCB(cb); }
+  virtual void remGoalInterruptedCB(ArFunctor1<ArPose> *cb) { myPathTask->remGoalInterruptedCB(cb); }
+
+  virtual ArPathPlanningTask *getPathPlanningTask(void) { return myPathTask; }
+
+protected:
+  ArPathPlanningTask *myPathTask;
+};
+
+#endif
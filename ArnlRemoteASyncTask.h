@@ -9,6 +9,8 @@ All rights reserved. 
 #include "Aria.h"
 #include "ArNetworking.h"
 #include "ArClientHandlerRobotUpdate.h"
+#include "ArnlLocalTaskClient.h"
+#include "ArnlGoalFuture.h"
 
 /**
   Use this to help run your own custom tasks or activities, triggered when a 
@@ -62,8 +64,20 @@ All rights reserved. 
   parameters to this section if desired by calling addConfigParam().
 
   You may call nextGoal("goal name"); to request a new goal.
-  (This is just a shortcut to calling requestOnce() with "gotoGoal" and the new
-  goal name.)
+  (This is a shortcut to calling requestOnce() with "gotoGoal" and the new
+  goal name.) It returns an ArnlGoalFuture which completes when the server
+  reports that the robot arrived at the goal or failed to, or that it went
+  on to something else (preempted), so a task can wait for the outcome or
+  chain the next step with ArnlGoalFuture::then(). Outcomes are taken from
+  the server's mode status, or from the local task server's events.
+
+  If the task program runs on the same computer as the ARNL server, pass the
+  path of the server's local task socket (see ArnlLocalTaskServer) instead of
+  an ArClientBase to the constructor. Goal reached events and nextGoal()
+  requests then go over a Unix domain socket (ArnlLocalTaskClient) rather
+  than through ArNetworking over TCP, which has lower and more consistent
+  latency (see localTaskLatencyBenchmark). getClient() returns NULL in this
+  case. (Not available on Windows.)
 
   @note one instance of this class is typically created for the
   whole program, but new threads may be created at any time (whenever ARNL happens
@@ -181,11 +195,34 @@ public:
     const std::string& goalPrefix = "", const std::string& goalSuffix = ""
   ) :
     myName(name),
-    myUpdateHandler(client),
     myStatusChangedCB(this, &ArnlRemoteASyncTask::statusChanged),
+    myLocalGoalReachedCB(this, &ArnlRemoteASyncTask::goalReached),
+    myLocalGoalFailedCB(this, &ArnlRemoteASyncTask::localGoalFailed),
+    myLocalGoalStartedCB(this, &ArnlRemoteASyncTask::localGoalStarted),
     myFunctor(functor), myAllocatedFunctor(false)
   {
-    init(client, argParser, goalPrefix, goalPrefix);
+    init(client, NULL, argParser, goalPrefix, goalSuffix);
+  }
+
+  /**
+    Supply a callback functor to call at goals, and receive goal events from
+    an ARNL server on this computer through its local task socket.
+    @param localSocketPath Path of the socket opened by ArnlLocalTaskServer in the server
+    @param functor Functor referencing method or function to call.
+   */
+  ArnlRemoteASyncTask(const char *localSocketPath,
+    const std::string& name, TaskFunctor *functor,
+    ArArgumentParser *argParser = NULL,
+    const std::string& goalPrefix = "", const std::string& goalSuffix = ""
+  ) :
+    myName(name),
+    myStatusChangedCB(this, &ArnlRemoteASyncTask::statusChanged),
+    myLocalGoalReachedCB(this, &ArnlRemoteASyncTask::goalReached),
+    myLocalGoalFailedCB(this, &ArnlRemoteASyncTask::localGoalFailed),
+    myLocalGoalStartedCB(this, &ArnlRemoteASyncTask::localGoalStarted),
+    myFunctor(functor), myAllocatedFunctor(false)
+  {
+    init(NULL, localSocketPath, argParser, goalPrefix, goalSuffix);
   }
 
 protected:
@@ -206,30 +243,78 @@ protected:
     const std::string& goalPrefix = "", const std::string& goalSuffix = ""
   ) :
     myName(name),
-    myUpdateHandler(client),
     myStatusChangedCB(this, &ArnlRemoteASyncTask::statusChanged),
+    myLocalGoalReachedCB(this, &ArnlRemoteASyncTask::goalReached),
+    myLocalGoalFailedCB(this, &ArnlRemoteASyncTask::localGoalFailed),
+    myLocalGoalStartedCB(this, &ArnlRemoteASyncTask::localGoalStarted),
     myFunctor(new NullTaskFunctor()), myAllocatedFunctor(true)
   {
-    init(client, argParser, goalPrefix, goalPrefix);
+    init(client, NULL, argParser, goalPrefix, goalSuffix);
+  }
+
+  /** 
+    Use this when definining a subclass that overrides runTask(), to receive
+    goal events from an ARNL server on this computer through its local task
+    socket. See the other constructor for the other parameters.
+    @param localSocketPath Path of the socket opened by ArnlLocalTaskServer in the server
+  */
+  ArnlRemoteASyncTask(const char *localSocketPath,
+    const std::string& name = "unnamed ArnlASyncTask",
+    ArArgumentParser *argParser = NULL,
+    const std::string& goalPrefix = "", const std::string& goalSuffix = ""
+  ) :
+    myName(name),
+    myStatusChangedCB(this, &ArnlRemoteASyncTask::statusChanged),
+    myLocalGoalReachedCB(this, &ArnlRemoteASyncTask::goalReached),
+    myLocalGoalFailedCB(this, &ArnlRemoteASyncTask::localGoalFailed),
+    myLocalGoalStartedCB(this, &ArnlRemoteASyncTask::localGoalStarted),
+    myFunctor(new NullTaskFunctor()), myAllocatedFunctor(true)
+  {
+    init(NULL, localSocketPath, argParser, goalPrefix, goalSuffix);
   }
 
   virtual ~ArnlRemoteASyncTask()
   {
-    myUpdateHandler.remStatusChangedCB(&myStatusChangedCB);
-    myUpdateHandler.stopUpdates();
+    if(myUpdateHandler)
+    {
+      myUpdateHandler->remStatusChangedCB(&myStatusChangedCB);
+      myUpdateHandler->stopUpdates();
+      delete myUpdateHandler;
+    }
+    if(myLocalClient)
+    {
+      myLocalClient->remGoalReachedCB(&myLocalGoalReachedCB);
+      myLocalClient->remGoalFailedCB(&myLocalGoalFailedCB);
+      myLocalClient->remGoalStartedCB(&myLocalGoalStartedCB);
+      delete myLocalClient;
+    }
     if(myAllocatedFunctor) delete myFunctor;
   }
 
 private:
-  void init(ArClientBase *client, ArArgumentParser *argParser,
+  void init(ArClientBase *client, const char *localSocketPath, ArArgumentParser *argParser,
     const std::string& goalPrefix, const std::string& goalSuffix
   )
 	{
     myClient = client;
+    myUpdateHandler = NULL;
+    myLocalClient = NULL;
     myHaveGoalNamePrefix = false;
     myHaveGoalNameSuffix = false;
-    myUpdateHandler.addStatusChangedCB(&myStatusChangedCB);
-    myUpdateHandler.requestUpdates();
+    if(client)
+    {
+      myUpdateHandler = new ArClientHandlerRobotUpdate(client);
+      myUpdateHandler->addStatusChangedCB(&myStatusChangedCB);
+      myUpdateHandler->requestUpdates();
+    }
+    else
+    {
+      myLocalClient = new ArnlLocalTaskClient();
+      myLocalClient->addGoalReachedCB(&myLocalGoalReachedCB);
+      myLocalClient->addGoalFailedCB(&myLocalGoalFailedCB);
+      myLocalClient->addGoalStartedCB(&myLocalGoalStartedCB);
+      myLocalClient->connect(localSocketPath);
+    }
     if(goalPrefix != "")
       runIfGoalNamePrefix(goalPrefix);
     if(goalSuffix != "")
@@ -258,11 +343,39 @@ protected:
   virtual void runTask() {}
 
 
-  /// Utility that you can use to easily set a new goal on the path planner task
-  void nextGoal(const std::string goalName)
+  /** Utility that you can use to easily request a new goal from the server.
+   * The returned future completes (in the client's thread) when the server
+   * reports the outcome.
+   */
+  ArnlGoalFuture nextGoal(const std::string goalName)
   {
-    ArLog::log(ArLog::Normal, "%s: [%s] Sending request to go to new goal: %s", getName(), myClient->getHost(), goalName.c_str());
-    myClient->requestOnceWithString("gotoGoal", goalName.c_str());
+    ArLog::log(ArLog::Normal, "%s: [%s] Sending request to go to new goal: %s", getName(), getServerName(), goalName.c_str());
+    PendingGoal goal(goalName);
+    // Added before the request is sent, since the server's response may come before it returns
+    myGoalsMutex.lock();
+    myPendingGoals.push_back(goal);
+    myGoalsMutex.unlock();
+    bool sent;
+    if(myLocalClient)
+      sent = myLocalClient->requestGoal(goalName);
+    else
+      sent = myClient->requestOnceWithString("gotoGoal", goalName.c_str());
+    if(!sent)
+    {
+      ArLog::log(ArLog::Terse, "%s: [%s] Could not send request to go to %s", getName(), getServerName(), goalName.c_str());
+      myGoalsMutex.lock();
+      for(std::list<PendingGoal>::iterator i = myPendingGoals.begin(); i != myPendingGoals.end(); ++i)
+      {
+        if(i->promise == goal.promise)
+        {
+          myPendingGoals.erase(i);
+          break;
+        }
+      }
+      myGoalsMutex.unlock();
+      goal.promise.complete(ArnlGoalResult::FAILED, ArPose());
+    }
+    return goal.promise.getFuture();
   }
 
 protected:
@@ -274,13 +387,35 @@ protected:
     myMutex.unlock();
   }
 
+  /// @return the networking client, or NULL if using the local task socket
   ArClientBase *getClient() { return myClient; }
 
+  /// @return the ArNetworking server host, or the local task socket path
+  const char *getServerName()
+  {
+    return myLocalClient ? myLocalClient->getPath() : myClient->getHost();
+  }
+
 private:
   std::string myName;
 	ArClientBase *myClient;
-  ArClientHandlerRobotUpdate myUpdateHandler;
+  ArClientHandlerRobotUpdate *myUpdateHandler;
+  ArnlLocalTaskClient *myLocalClient;
   ArFunctor2C<ArnlRemoteASyncTask, const char*, const char*> myStatusChangedCB;
+  ArFunctor2C<ArnlRemoteASyncTask, const std::string&, const ArPose&> myLocalGoalReachedCB;
+  ArFunctor2C<ArnlRemoteASyncTask, const std::string&, const ArPose&> myLocalGoalFailedCB;
+  ArFunctor2C<ArnlRemoteASyncTask, const std::string&, const ArPose&> myLocalGoalStartedCB;
+
+  /// A goal requested by nextGoal() which has not completed
+  struct PendingGoal
+  {
+    explicit PendingGoal(const std::string& goalName) : promise(goalName), started(false) {}
+    ArnlGoalPromise promise;
+    /// Whether the server has reported starting toward the goal
+    bool started;
+  };
+  ArMutex myGoalsMutex;
+  std::list<PendingGoal> myPendingGoals;
   ArMutex myMutex;
   bool myHaveGoalNamePrefix, myHaveGoalNameSuffix;
   std::string myGoalNamePrefix, myGoalNameSuffix;
@@ -297,7 +432,7 @@ private:
   {
     const std::string gn = myLastGoalName;
     const ArPose& p = myLastGoalPose;
-    ArLog::log(ArLog::Normal, "%s: [%s] Running at %s (%.2f, %.2f, %.2f) ...", getName(), getClient()->getHost(), gn.c_str(), p.getX(), p.getY(), p.getTh());
+    ArLog::log(ArLog::Normal, "%s: [%s] Running at %s (%.2f, %.2f, %.2f) ...", getName(), getServerName(), gn.c_str(), p.getX(), p.getY(), p.getTh());
     runTask();
     myFunctor->invoke(gn, p);
     return 0;
@@ -310,25 +445,103 @@ private:
    */
 	void statusChanged(const char *m, const char *s)
 	{
-    const char *thisGoalName = getGoalNameFromStatus(s);
-
-    if(thisGoalName == NULL)
+    const std::string status(s);
+    const ArPose pose = myUpdateHandler->getPose();
+    std::string thisGoalName;
+    if(getGoalNameFromStatus(status, &thisGoalName))
     {
+      goalReached(thisGoalName, pose);
       return;
     }
-      
-    if(matchCriteria(thisGoalName))
+    if(prefixMatch(status, "Going to "))
+      goalStarted(status.substr(9), pose); // 9 == strlen("Going to ")
+    else if(prefixMatch(status, "Failed to get to "))
+      finishGoals(status.substr(17), ArnlGoalResult::FAILED, pose); // 17 == strlen("Failed to get to ")
+    else if(prefixMatch(status, "Failed to plan to "))
+      finishGoals(status.substr(18), ArnlGoalResult::FAILED, pose); // 18 == strlen("Failed to plan to ")
+    else if(!status.empty())
+      goalStarted("", pose); // Something else: any goal in progress was preempted
+	}
+
+  /** The server started toward @a goalName: mark it started, and any other
+   * started goal as preempted.
+   * @internal
+   */
+  void goalStarted(const std::string& goalName, const ArPose& pose)
+  {
+    std::list<PendingGoal> preempted;
+    myGoalsMutex.lock();
+    std::list<PendingGoal>::iterator i = myPendingGoals.begin();
+    while(i != myPendingGoals.end())
+    {
+      std::list<PendingGoal>::iterator next = i;
+      ++next;
+      if(i->promise.getGoalName() == goalName)
+        i->started = true;
+      else if(i->started)
+        preempted.splice(preempted.end(), myPendingGoals, i);
+      i = next;
+    }
+    myGoalsMutex.unlock();
+    for(i = preempted.begin(); i != preempted.end(); ++i)
+      i->promise.complete(ArnlGoalResult::PREEMPTED, pose);
+  }
+
+  /** The server reached or failed @a goalName: complete its futures with
+   * @a status, and any other started goal as preempted.
+   * @internal
+   */
+  void finishGoals(const std::string& goalName, ArnlGoalResult::Status status, const ArPose& pose)
+  {
+    std::list<PendingGoal> finished;
+    myGoalsMutex.lock();
+    std::list<PendingGoal>::iterator i = myPendingGoals.begin();
+    while(i != myPendingGoals.end())
+    {
+      std::list<PendingGoal>::iterator next = i;
+      ++next;
+      if(i->promise.getGoalName() == goalName || i->started)
+        finished.splice(finished.end(), myPendingGoals, i);
+      i = next;
+    }
+    myGoalsMutex.unlock();
+    for(i = finished.begin(); i != finished.end(); ++i)
+      i->promise.complete(i->promise.getGoalName() == goalName ? status : ArnlGoalResult::PREEMPTED, pose);
+  }
+
+  /// Local task client events (in its thread) @internal
+  void localGoalFailed(const std::string& goalName, const ArPose& pose)
+  {
+    finishGoals(goalName, ArnlGoalResult::FAILED, pose);
+  }
+
+  /// @internal
+  void localGoalStarted(const std::string& goalName, const ArPose& pose)
+  {
+    goalStarted(goalName, pose);
+  }
+
+  /** Called with each goal reached, from statusChanged() or by the local
+   * task client's thread; starts the task thread if the goal matches.
+   * @internal
+   */
+  void goalReached(const std::string& goalName, const ArPose& pose)
+  {
+    finishGoals(goalName, ArnlGoalResult::ARRIVED, pose);
+    if(matchCriteria(goalName))
     {
-      myLastGoalPose = myUpdateHandler.getPose();
-      myLastGoalName = thisGoalName;
+      myLastGoalPose = pose;
+      myLastGoalName = goalName;
       runAsync();
     }
-	}
+  }
 
   /// Check whether any criteria for running the task match the current goal
   /// @internal
   bool matchCriteria(const std::string& gn)
   {
+    if(!myHaveGoalNamePrefix && !myHaveGoalNameSuffix)
+      return true;
     if(myHaveGoalNamePrefix && prefixMatch(gn, myGoalNamePrefix))
       return true;
     if(myHaveGoalNameSuffix && suffixMatch(gn, myGoalNameSuffix))
@@ -348,16 +561,19 @@ private:
   bool suffixMatch(const std::string& str, const std::string& suffix)
   {
     // todo more efficient compare
-    return (str.compare(str.size()-suffix.size(), str.size(), suffix));
+    if(str.size() < suffix.size())
+      return false;
+    return (str.compare(str.size()-suffix.size(), suffix.size(), suffix) == 0);
   }
 
-  const char *getGoalNameFromStatus(const std::string& s)
+  bool getGoalNameFromStatus(const std::string& s, std::string *goalName)
   {
-    if(prefixMatch(s, "Arrived at"))
+    if(prefixMatch(s, "Arrived at "))
     {
-      return s.substr(11).c_str(); // 11 == strlen("Arrived at ")
+      *goalName = s.substr(11); // 11 == strlen("Arrived at ")
+      return true;
     }
-    return NULL;
+    return false;
   }
 
 };
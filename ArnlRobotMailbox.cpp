@@ -0,0 +1,198 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlRobotMailbox.h"
+#include "ArnlThreadScheduler.h"
+
+ArMutex ArnlRobotMailbox::ourMailboxesMutex;
+std::map<ArRobot *, ArnlRobotMailbox *> ArnlRobotMailbox::ourMailboxes;
+
+ArnlRobotMailbox::ArnlRobotMailbox(ArRobot *robot, ArnlMetricsRegistry *metrics) :
+  myRobot(robot),
+  myCommands(ARNL_ROBOT_MAILBOX_CAPACITY),
+  myPoseSeq(0),
+  myX(0), myY(0), myTh(0),
+  myMoveDone(true),
+  myCycles(0),
+  myCycleCB(this, &ArnlRobotMailbox::robotCycle),
+  myProfiledCycleCB(&myCycleCB, "ArnlRobotMailbox")
+{
+  myCommandsMetric = metrics->getCounter("arnl_robot_mailbox_commands_total",
+    "Commands carried out in the robot thread for task threads");
+  myRejectedMetric = metrics->getCounter("arnl_robot_mailbox_rejected_total",
+    "Commands which failed because the robot mailbox was full");
+  // What task threads used to spend waiting for the robot lock
+  myWaitMetric = metrics->getMSecsHistogram("arnl_robot_mailbox_wait_msecs",
+    "Time commands waited in the robot mailbox for the robot thread");
+  myRobot->lock();
+  // Before ArnlMotionExecutor, so a sequence can use the pose published here
+  myRobot->addSensorInterpTask("ArnlRobotMailbox", 45, &myProfiledCycleCB);
+  myRobot->unlock();
+}
+
+ArnlRobotMailbox::~ArnlRobotMailbox()
+{
+  myRobot->lock();
+  myRobot->remSensorInterpTask(&myProfiledCycleCB);
+  myRobot->unlock();
+  Command command;
+  while (myCommands.take(&command))
+    command.promise.complete(ArnlGoalResult::PREEMPTED, getPose());
+}
+
+ArnlRobotMailbox *ArnlRobotMailbox::getMailbox(ArRobot *robot)
+{
+  ourMailboxesMutex.lock();
+  ArnlRobotMailbox *&mailbox = ourMailboxes[robot];
+  if (mailbox == NULL)
+    mailbox = new ArnlRobotMailbox(robot);
+  ourMailboxesMutex.unlock();
+  return mailbox;
+}
+
+ArnlGoalFuture ArnlRobotMailbox::stop(void)
+{
+  Command command;
+  command.type = STOP;
+  return post(command, "stop");
+}
+
+ArnlGoalFuture ArnlRobotMailbox::clearDirectMotion(void)
+{
+  Command command;
+  command.type = CLEAR_DIRECT_MOTION;
+  return post(command, "clearDirectMotion");
+}
+
+ArnlGoalFuture ArnlRobotMailbox::setVel(double mmPerSec)
+{
+  Command command;
+  command.type = VEL;
+  command.value = mmPerSec;
+  return post(command, "setVel");
+}
+
+ArnlGoalFuture ArnlRobotMailbox::setRotVel(double degPerSec)
+{
+  Command command;
+  command.type = ROT_VEL;
+  command.value = degPerSec;
+  return post(command, "setRotVel");
+}
+
+ArnlGoalFuture ArnlRobotMailbox::setStatus(const std::string& status)
+{
+  Command command;
+  command.type = STATUS;
+  command.text = status;
+  return post(command, "setStatus");
+}
+
+ArnlGoalFuture ArnlRobotMailbox::setDigitalOutputs(unsigned char mask, unsigned char bits)
+{
+  Command command;
+  command.type = DIGITAL_OUT;
+  command.mask = mask;
+  command.bits = bits;
+  return post(command, "setDigitalOutputs");
+}
+
+ArnlGoalFuture ArnlRobotMailbox::call(ArFunctor *functor, const std::string& name)
+{
+  Command command;
+  command.type = CALL;
+  command.functor = functor;
+  return post(command, name);
+}
+
+ArPose ArnlRobotMailbox::getPose(void) const
+{
+  double x, y, th;
+  unsigned long seq;
+  do
+  {
+    seq = myPoseSeq.load(std::memory_order_acquire);
+    x = myX.load(std::memory_order_relaxed);
+    y = myY.load(std::memory_order_relaxed);
+    th = myTh.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) != 0 || seq != myPoseSeq.load(std::memory_order_relaxed));
+  return ArPose(x, y, th);
+}
+
+ArnlGoalFuture ArnlRobotMailbox::post(Command& command, const std::string& name)
+{
+  command.promise = ArnlGoalPromise(name);
+  command.postUSecs = ArnlThreadScheduler::getMonotonicUSecs();
+  const ArnlGoalFuture future = command.promise.getFuture();
+  if (!myCommands.post(command))
+  {
+    myRejectedMetric->add();
+    ArLog::log(ArLog::Normal, "ArnlRobotMailbox: Warning: mailbox full (%lu commands), %s failed",
+	       (unsigned long)myCommands.getCapacity(), name.c_str());
+    command.promise.complete(ArnlGoalResult::FAILED, getPose());
+  }
+  return future;
+}
+
+/// Robot sensor interpretation task: publish the robot's state and carry out the commands posted since the last cycle
+void ArnlRobotMailbox::robotCycle(void)
+{
+  const ArPose pose = myRobot->getPose();
+  const unsigned long seq = myPoseSeq.load(std::memory_order_relaxed);
+  myPoseSeq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  myX.store(pose.getX(), std::memory_order_relaxed);
+  myY.store(pose.getY(), std::memory_order_relaxed);
+  myTh.store(pose.getTh(), std::memory_order_relaxed);
+  myPoseSeq.store(seq + 2, std::memory_order_release);
+  myMoveDone.store(myRobot->isMoveDone() && myRobot->isHeadingDone(), std::memory_order_release);
+  myCycles.fetch_add(1, std::memory_order_release);
+
+  Command command;
+  long long n = 0;
+  while (myCommands.take(&command))
+  {
+    myWaitMetric->observe((ArnlThreadScheduler::getMonotonicUSecs() - command.postUSecs) / 1000.0);
+    execute(command);
+    command.promise.complete(ArnlGoalResult::ARRIVED, pose);
+    n++;
+  }
+  if (n > 0)
+    myCommandsMetric->add(n);
+}
+
+void ArnlRobotMailbox::execute(const Command& command)
+{
+  switch (command.type)
+  {
+  case STOP:
+    myRobot->stop();
+    break;
+  case CLEAR_DIRECT_MOTION:
+    myRobot->clearDirectMotion();
+    break;
+  case VEL:
+    myRobot->setVel(command.value);
+    break;
+  case ROT_VEL:
+    myRobot->setRotVel(command.value);
+    break;
+  case STATUS:
+    {
+      ArServerMode *mode = ArServerMode::getActiveMode();
+      if (mode != NULL)
+	mode->setStatus(command.text.c_str());
+    }
+    break;
+  case DIGITAL_OUT:
+    myRobot->com2Bytes(ArCommands::DIGOUT, command.mask, command.bits);
+    break;
+  case CALL:
+    if (command.functor != NULL)
+      command.functor->invoke();
+    break;
+  }
+}
@@ -0,0 +1,122 @@
+#ifndef ARNLROBOTMAILBOX_H
+#define ARNLROBOTMAILBOX_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include "ArnlCallbackProfiler.h"
+#include "ArnlGoalFuture.h"
+#include "ArnlMailbox.h"
+#include "ArnlMetrics.h"
+
+#include <atomic>
+#include <map>
+#include <string>
+
+/// Number of commands which may wait in an ArnlRobotMailbox for the next robot cycle
+#ifndef ARNL_ROBOT_MAILBOX_CAPACITY
+#define ARNL_ROBOT_MAILBOX_CAPACITY 256
+#endif
+
+/**
+  Lets task threads command the robot without locking it. Commands are
+  posted to an ArnlMailbox and carried out in the robot thread at the start
+  of its next cycle (from a sensor interpretation task), in the order they
+  were posted. Each command returns an ArnlGoalFuture which completes, in
+  the robot thread, with status ARRIVED once the command has been carried
+  out, or immediately with status FAILED if the mailbox is full.
+
+  The robot's pose and whether its last move() or heading change is done
+  are also published each cycle, so tasks can read them without locking the
+  robot (see getPose(), isMoveDone()).
+
+  For movements of several steps, see ArnlMotionExecutor, which also takes
+  its sequences through a mailbox.
+
+  @code{.cpp}
+  ArnlRobotMailbox *mailbox = ArnlRobotMailbox::getMailbox(robot);
+  mailbox->setDigitalOutputs(0x01, 0x01);
+  mailbox->setStatus("Dropping off").wait();
+  @endcode
+
+  Metrics: arnl_robot_mailbox_commands_total and
+  arnl_robot_mailbox_rejected_total (commands posted when it was full).
+*/
+class ArnlRobotMailbox
+{
+public:
+  ArnlRobotMailbox(ArRobot *robot, ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlRobotMailbox();
+
+  /// The mailbox for @a robot, created the first time it is requested
+  static ArnlRobotMailbox *getMailbox(ArRobot *robot);
+
+  /// Stop the robot (ArRobot::stop())
+  ArnlGoalFuture stop(void);
+  /// Give control back to actions (ArRobot::clearDirectMotion())
+  ArnlGoalFuture clearDirectMotion(void);
+  /// Drive at @a mmPerSec (ArRobot::setVel())
+  ArnlGoalFuture setVel(double mmPerSec);
+  /// Turn at @a degPerSec (ArRobot::setRotVel())
+  ArnlGoalFuture setRotVel(double degPerSec);
+  /// Set the active server mode's status
+  ArnlGoalFuture setStatus(const std::string& status);
+  /// Set the digital outputs selected by @a mask to @a bits (the DIGOUT command)
+  ArnlGoalFuture setDigitalOutputs(unsigned char mask, unsigned char bits);
+  /** Invoke @a functor in the robot thread, with the robot locked (not
+   * copied; it must remain valid until the returned future completes).
+   * @a name is the result's goal name. */
+  ArnlGoalFuture call(ArFunctor *functor, const std::string& name = "call");
+
+  /// The robot's pose as of its last cycle
+  ArPose getPose(void) const;
+
+  /// Whether the robot's last move() and heading change were done as of its last cycle
+  bool isMoveDone(void) const { return myMoveDone.load(std::memory_order_acquire); }
+
+  /// Number of robot cycles seen, to tell whether getPose() and isMoveDone() have been updated since
+  unsigned long getCycles(void) const { return myCycles.load(std::memory_order_acquire); }
+
+protected:
+  enum Type { STOP, CLEAR_DIRECT_MOTION, VEL, ROT_VEL, STATUS, DIGITAL_OUT, CALL };
+
+  struct Command
+  {
+    Command() : type(STOP), value(0), mask(0), bits(0), functor(NULL), postUSecs(0) {}
+    Type type;
+    double value;
+    unsigned char mask, bits;
+    std::string text;
+    ArFunctor *functor;
+    ArnlGoalPromise promise;
+    /// When posted, for myWaitMetric
+    long long postUSecs;
+  };
+
+  ArnlGoalFuture post(Command& command, const std::string& name);
+  void robotCycle(void);
+  void execute(const Command& command);
+
+  ArRobot *myRobot;
+  ArnlMailbox<Command> myCommands;
+  /// Pose published each cycle (a seqlock: odd while being written)
+  std::atomic<unsigned long> myPoseSeq;
+  std::atomic<double> myX, myY, myTh;
+  std::atomic<bool> myMoveDone;
+  std::atomic<unsigned long> myCycles;
+  ArFunctorC<ArnlRobotMailbox> myCycleCB;
+  ArnlProfiledFunctor myProfiledCycleCB;
+  ArnlCounter *myCommandsMetric;
+  ArnlCounter *myRejectedMetric;
+  ArnlHistogram *myWaitMetric;
+
+  static ArMutex ourMailboxesMutex;
+  static std::map<ArRobot *, ArnlRobotMailbox *> ourMailboxes;
+};
+
+#endif
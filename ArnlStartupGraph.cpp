@@ -0,0 +1,280 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlStartupGraph.h"
+
+#include <list>
+#include <stdio.h>
+#include <string.h>
+
+ArnlStartupGraph::ArnlStartupGraph() :
+  myThreads(3),
+  myStarted(false)
+{
+}
+
+ArnlStartupGraph::~ArnlStartupGraph()
+{
+  if (myStarted)
+    waitAll();
+  for (size_t i = 0; i < myWorkers.size(); i++)
+  {
+    myWorkers[i]->join();
+    delete myWorkers[i];
+  }
+}
+
+void ArnlStartupGraph::parseArgs(ArArgumentParser *parser)
+{
+  parser->checkParameterArgumentInteger("-startupThreads", &myThreads);
+  if (myThreads < 0)
+    myThreads = 0;
+}
+
+int ArnlStartupGraph::add(const char *name, ArRetFunctor<bool> *functor, int after1, int after2)
+{
+  std::lock_guard<std::mutex> guard(myMutex);
+  if (myStarted)
+    ArLog::log(ArLog::Terse, "ArnlStartupGraph: Error: %s added after start()", name);
+  Job job;
+  job.name = name;
+  job.functor = functor;
+  job.after1 = after1;
+  job.after2 = after2;
+  job.state = WAITING;
+  myJobs.push_back(job);
+  return (int)myJobs.size() - 1;
+}
+
+void ArnlStartupGraph::start(void)
+{
+  size_t jobs, threads;
+  {
+    std::lock_guard<std::mutex> guard(myMutex);
+    myStarted = true;
+    jobs = myJobs.size();
+    threads = jobs < (size_t)myThreads ? jobs : (size_t)myThreads;
+  }
+  ArLog::log(ArLog::Normal, "ArnlStartupGraph: starting %d jobs on %d threads",
+	     (int)jobs, (int)threads);
+  for (size_t i = 0; i < threads; i++)
+  {
+    Worker *worker = new Worker(this);
+    worker->setThreadName("ArnlStartupGraph");
+    myWorkers.push_back(worker);
+    worker->runAsync();
+  }
+}
+
+bool ArnlStartupGraph::dependenciesFailed(const Job& job)
+{
+  return (job.after1 >= 0 && myJobs[job.after1].state == FAILED) ||
+    (job.after2 >= 0 && myJobs[job.after2].state == FAILED);
+}
+
+int ArnlStartupGraph::takeReadyJob(void)
+{
+  for (size_t i = 0; i < myJobs.size(); i++)
+  {
+    Job& job = myJobs[i];
+    if (job.state != WAITING)
+      continue;
+    if (dependenciesFailed(job))
+    {
+      ArLog::log(ArLog::Normal, "ArnlStartupGraph: not running %s, since a job it needs failed", job.name.c_str());
+      job.state = FAILED;
+      myDoneCondition.notify_all();
+      continue;
+    }
+    if ((job.after1 < 0 || myJobs[job.after1].state == SUCCEEDED) &&
+	(job.after2 < 0 || myJobs[job.after2].state == SUCCEEDED))
+    {
+      job.state = RUNNING;
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+bool ArnlStartupGraph::allDone(void)
+{
+  for (size_t i = 0; i < myJobs.size(); i++)
+    if (myJobs[i].state == WAITING)
+      return false;
+  return true;
+}
+
+void ArnlStartupGraph::runJob(int num)
+{
+  ArTime started;
+  const bool ok = myJobs[num].functor->invokeR();
+  ArLog::log(ArLog::Normal, "ArnlStartupGraph: %s %s after %ld ms", myJobs[num].name.c_str(),
+	     ok ? "done" : "failed", started.mSecSince());
+  {
+    std::lock_guard<std::mutex> guard(myMutex);
+    myJobs[num].state = ok ? SUCCEEDED : FAILED;
+  }
+  myDoneCondition.notify_all();
+}
+
+void *ArnlStartupGraph::Worker::runThread(void *)
+{
+  myGraph->workerThread();
+  return NULL;
+}
+
+void ArnlStartupGraph::workerThread(void)
+{
+  std::unique_lock<std::mutex> guard(myMutex);
+  while (!allDone())
+  {
+    const int job = takeReadyJob();
+    if (job >= 0)
+    {
+      guard.unlock();
+      runJob(job);
+      guard.lock();
+    }
+    else
+      // Until another job finishes: checked and waited for with myMutex
+      // locked, so a job finishing in between is not missed
+      myDoneCondition.wait(guard);
+  }
+}
+
+bool ArnlStartupGraph::wait(int num)
+{
+  if (num < 0 || num >= (int)myJobs.size())
+    return false;
+  if (myWorkers.empty())
+  {
+    // No threads: run it (and what it needs) now
+    Job& job = myJobs[num];
+    if (job.state == WAITING)
+    {
+      if ((job.after1 >= 0 && !wait(job.after1)) || (job.after2 >= 0 && !wait(job.after2)))
+	job.state = FAILED;
+      else
+      {
+	job.state = RUNNING;
+	runJob(num);
+      }
+    }
+    return job.state == SUCCEEDED;
+  }
+
+  std::unique_lock<std::mutex> guard(myMutex);
+  myDoneCondition.wait(guard, [this, num] {
+      return myJobs[num].state != WAITING && myJobs[num].state != RUNNING; });
+  return myJobs[num].state == SUCCEEDED;
+}
+
+bool ArnlStartupGraph::waitAll(void)
+{
+  bool ok = true;
+  for (size_t i = 0; i < myJobs.size(); i++)
+    if (!wait((int)i))
+      ok = false;
+  return ok;
+}
+
+ArnlMapPreloader::ArnlMapPreloader(ArArgumentParser *parser, const char *mapDirectory,
+				   const char *paramFileName, ArnlMapCache *cache) :
+  myMapDirectory(mapDirectory),
+  myCache(cache),
+  myMap(NULL),
+  myRead(false),
+  myAppliedTo(NULL),
+  myChanged(false),
+  myReadCB(this, &ArnlMapPreloader::read),
+  myMapChangedCB(this, &ArnlMapPreloader::mapChanged)
+{
+  if (findMapFileName(parser, paramFileName))
+  {
+    // Not in the configuration: this is only a copy
+    myMap = new ArnlCachedMap(mapDirectory, false);
+    myMap->setIgnoreEmptyFileName(true);
+    myMap->setIgnoreCase(true);
+  }
+}
+
+ArnlMapPreloader::~ArnlMapPreloader()
+{
+  if (myAppliedTo != NULL)
+    myAppliedTo->remMapChangedCB(&myMapChangedCB);
+  delete myMap;
+}
+
+/** The map file the parameter file (or command line, which overrides it)
+ * will set. @return false if there is none */
+bool ArnlMapPreloader::findMapFileName(ArArgumentParser *parser, const char *paramFileName)
+{
+  for (size_t i = 0; i + 1 < parser->getArgc(); i++)
+  {
+    if (strcasecmp(parser->getArg(i), "-map") == 0)
+    {
+      myFileName = parser->getArg(i + 1);
+      return true;
+    }
+  }
+
+  // Read as loading the parameter file will read it, by a scratch ArConfig
+  // with only the parameter ArMap adds, and only its section
+  ArConfig config(Aria::getConfig()->getBaseDirectory(), false, false, false, false);
+  char fileName[1024] = "";
+  config.addParam(ArConfigArg("Map", fileName, "", sizeof(fileName)), "Files");
+  std::list<std::string> sections;
+  sections.push_back("Files");
+  // Any errors are reported when the parameter file is loaded
+  config.parseFile(paramFileName, true, true, NULL, 0, &sections);
+  myFileName = fileName;
+  return !myFileName.empty();
+}
+
+bool ArnlMapPreloader::read(void)
+{
+  if (myMap == NULL)
+    return true;
+  const bool ok = myCache != NULL ?
+    myCache->readMap(myMap, myMapDirectory.c_str(), myFileName.c_str()) :
+    myMap->readFile(myFileName.c_str());
+  if (!ok)
+    // Not an error here: loading the parameter file will report it
+    ArLog::log(ArLog::Normal, "ArnlMapPreloader: could not read map %s ahead of the parameter file",
+	       myFileName.c_str());
+  else
+    myRead = true;
+  return true;
+}
+
+void ArnlMapPreloader::apply(ArMapInterface *map)
+{
+  if (!myRead)
+    return;
+  myAppliedTo = map;
+  myChanged = false;
+  map->addMapChangedCB(&myMapChangedCB);
+  map->lock();
+  map->set(myMap);
+  map->unlock();
+  delete myMap;
+  myMap = NULL;
+  myRead = false;
+}
+
+void ArnlMapPreloader::finish(void)
+{
+  if (myAppliedTo == NULL)
+    return;
+  myAppliedTo->remMapChangedCB(&myMapChangedCB);
+  if (!myChanged)
+    myAppliedTo->mapChanged();
+  myAppliedTo = NULL;
+}
+
+void ArnlMapPreloader::mapChanged(void)
+{
+  myChanged = true;
+}
@@ -0,0 +1,154 @@
+#ifndef ARNLSTARTUPGRAPH_H
+#define ARNLSTARTUPGRAPH_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include "ArnlMapCache.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+  Runs independent parts of a program's startup (connecting devices,
+  opening the server, reading the map, ...) at the same time, on a few
+  threads, while the main thread goes on creating the objects which do not
+  need them. Each job is a functor returning false on failure, and may
+  depend on up to two earlier jobs, which must succeed before it is run:
+
+  @code{.cpp}
+  ArnlStartupGraph startupGraph;
+  const int lasers = startupGraph.add("connect lasers", &connectLasersCB);
+  const int server = startupGraph.add("open server", &openServerCB);
+  startupGraph.start();
+  ...  // create whatever does not need the lasers or server
+  if (!startupGraph.wait(lasers))
+    Aria::exit(2);
+  @endcode
+
+  The number of threads is given by -startupThreads on the command line
+  (default 3); with -startupThreads 0 each job is run by wait() in the
+  calling thread instead, one after another as before, to compare with
+  (e.g. with ArnlStartupProfiler's -startupVariant).
+
+  Jobs must only use objects which are not used by the main thread until
+  it has wait()ed for them.
+*/
+class ArnlStartupGraph
+{
+public:
+  ArnlStartupGraph();
+  /// Waits for any jobs still running
+  ~ArnlStartupGraph();
+
+  /// Check for -startupThreads
+  void parseArgs(ArArgumentParser *parser);
+
+  /** Add a job, to run after @a after1 and @a after2 (job numbers, or -1),
+   * once start() is called. @return the job's number */
+  int add(const char *name, ArRetFunctor<bool> *functor, int after1 = -1, int after2 = -1);
+
+  /// Start running the jobs (in the background, unless -startupThreads is 0)
+  void start(void);
+
+  /** Wait for a job to finish (running it and any it depends on now, if
+   * there are no threads). @return the job's result; false if a job it
+   * depends on failed */
+  bool wait(int job);
+
+  /// Wait for all jobs. @return true if all succeeded
+  bool waitAll(void);
+
+protected:
+  enum State { WAITING, RUNNING, SUCCEEDED, FAILED };
+
+  struct Job
+  {
+    std::string name;
+    ArRetFunctor<bool> *functor;
+    int after1, after2;
+    State state;
+  };
+
+  class Worker : public ArASyncTask
+  {
+  public:
+    Worker(ArnlStartupGraph *graph) : myGraph(graph) {}
+    virtual void *runThread(void *arg);
+  protected:
+    ArnlStartupGraph *myGraph;
+  };
+
+  /// Find a job which can run now, and mark it running (with myMutex locked). @return -1 if none
+  int takeReadyJob(void);
+  /// Whether every job has finished or cannot be run (with myMutex locked)
+  bool allDone(void);
+  void runJob(int job);
+  bool dependenciesFailed(const Job& job);
+  void workerThread(void);
+
+  std::mutex myMutex;
+  /// Notified when a job's state changes, after changing it with myMutex locked
+  std::condition_variable myDoneCondition;
+  /// (protected by myMutex once start() is called)
+  std::vector<Job> myJobs;
+  std::vector<Worker *> myWorkers;
+  int myThreads;
+  bool myStarted;
+};
+
+/**
+  Reads the map file given by -map on the command line, or else by the Map
+  parameter in the Files section of the parameter file, into a map of its
+  own, as an ArnlStartupGraph job, so that the (often slow) parsing of a
+  large map is done alongside the rest of startup. Before the parameter
+  file is loaded into ArConfig, apply() copies it into the map used by the
+  program. Loading the parameter file still sets the map as before: if it
+  names a different map, that map is read as usual.
+
+  After the parameter file is loaded, call finish(), which makes sure the
+  map's changed callbacks (the path planning and localization tasks', and
+  server handlers') are called once with the map, if loading the parameter
+  file did not.
+
+  Given an ArnlMapCache, the map is read from its cache when that is up to
+  date.
+*/
+class ArnlMapPreloader
+{
+public:
+  ArnlMapPreloader(ArArgumentParser *parser, const char *mapDirectory, const char *paramFileName,
+		   ArnlMapCache *cache = NULL);
+  ~ArnlMapPreloader();
+
+  /// The job which reads the map
+  ArRetFunctor<bool> *getReadCB(void) { return &myReadCB; }
+
+  /// Copy the map read into @a map, if it was read
+  void apply(ArMapInterface *map);
+  /// Call @a map's changed callbacks if nothing else has since apply()
+  void finish(void);
+
+protected:
+  bool findMapFileName(ArArgumentParser *parser, const char *paramFileName);
+  bool read(void);
+  void mapChanged(void);
+
+  std::string myFileName;
+  std::string myMapDirectory;
+  ArnlMapCache *myCache;
+  ArnlCachedMap *myMap;
+  bool myRead;
+  ArMapInterface *myAppliedTo;
+  bool myChanged;
+  ArRetFunctorC<bool, ArnlMapPreloader> myReadCB;
+  ArFunctorC<ArnlMapPreloader> myMapChangedCB;
+};
+
+#endif
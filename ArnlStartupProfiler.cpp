@@ -0,0 +1,198 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlStartupProfiler.h"
+#include "ArnlThreadScheduler.h"
+
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+
+ArnlStartupProfiler::ArnlStartupProfiler(ArnlMetricsRegistry *metrics) :
+  myMetrics(metrics),
+  myStartUSecs(ArnlThreadScheduler::getMonotonicUSecs()),
+  myFinishUSecs(0),
+  myCurrentStartUSecs(myStartUSecs),
+  myVariant("default"),
+  myFinished(false)
+{
+}
+
+void ArnlStartupProfiler::parseArgs(ArArgumentParser *parser)
+{
+  const char *fileName = NULL;
+  const char *variant = NULL;
+  parser->checkParameterArgumentString("-startupProfileFile", &fileName);
+  parser->checkParameterArgumentString("-startupVariant", &variant);
+  if (fileName != NULL)
+    myFileName = fileName;
+  if (variant != NULL && variant[0] != '\0')
+  {
+    // Commas would split the variant's column in the file
+    myVariant = variant;
+    for (size_t i = 0; i < myVariant.size(); i++)
+      if (myVariant[i] == ',')
+	myVariant[i] = ' ';
+  }
+}
+
+void ArnlStartupProfiler::beginPhase(const char *name)
+{
+  if (myFinished)
+    return;
+  if (myCurrent.empty())
+    endGap();
+  else
+    endPhase();
+  myCurrent = name;
+}
+
+void ArnlStartupProfiler::endPhase(void)
+{
+  if (myFinished || myCurrent.empty())
+    return;
+  const long long now = ArnlThreadScheduler::getMonotonicUSecs();
+  addPhase(myCurrent, (now - myCurrentStartUSecs) / 1000.0);
+  ArLog::log(ArLog::Verbose, "ArnlStartupProfiler: %s took %.1f ms", myCurrent.c_str(),
+	     (now - myCurrentStartUSecs) / 1000.0);
+  myCurrent.clear();
+  myCurrentStartUSecs = now;
+}
+
+/// Count the time since the last phase ended (or since the start) as "other"
+void ArnlStartupProfiler::endGap(void)
+{
+  const long long now = ArnlThreadScheduler::getMonotonicUSecs();
+  if (now > myCurrentStartUSecs)
+    addPhase("other", (now - myCurrentStartUSecs) / 1000.0);
+  myCurrentStartUSecs = now;
+}
+
+/// Add to @a name's time (phases may be begun more than once)
+void ArnlStartupProfiler::addPhase(const std::string& name, double msecs)
+{
+  for (size_t i = 0; i < myPhases.size(); i++)
+  {
+    if (myPhases[i].name == name)
+    {
+      myPhases[i].msecs += msecs;
+      return;
+    }
+  }
+  Phase phase;
+  phase.name = name;
+  phase.msecs = msecs;
+  myPhases.push_back(phase);
+}
+
+double ArnlStartupProfiler::getTotalMSecs(void) const
+{
+  const long long end = myFinished ? myFinishUSecs : ArnlThreadScheduler::getMonotonicUSecs();
+  return (end - myStartUSecs) / 1000.0;
+}
+
+void ArnlStartupProfiler::finish(void)
+{
+  if (myFinished)
+    return;
+  if (myCurrent.empty())
+    endGap();
+  else
+    endPhase();
+  myFinishUSecs = myCurrentStartUSecs;
+  myFinished = true;
+
+  const double total = getTotalMSecs();
+  ArLog::log(ArLog::Normal, "ArnlStartupProfiler: startup took %.0f ms:", total);
+  for (size_t i = 0; i < myPhases.size(); i++)
+  {
+    ArLog::log(ArLog::Normal, "ArnlStartupProfiler:   %-24s %9.1f ms %5.1f%%", myPhases[i].name.c_str(),
+	       myPhases[i].msecs, total > 0 ? 100 * myPhases[i].msecs / total : 0);
+    myMetrics->getGauge(ArnlMetricsRegistry::withLabel("arnl_startup_phase_msecs", "phase", myPhases[i].name),
+			"Time taken by a phase of the program's startup")->set(myPhases[i].msecs);
+  }
+  myMetrics->getGauge("arnl_startup_msecs", "Time taken by the program's startup")->set(total);
+
+  if (!myFileName.empty())
+  {
+    writeFile();
+    logComparison();
+  }
+}
+
+/// Append this startup's phases to the file, as "variant,phase,msecs" lines
+void ArnlStartupProfiler::writeFile(void)
+{
+  FILE *file = fopen(myFileName.c_str(), "a");
+  if (file == NULL)
+  {
+    ArLog::log(ArLog::Terse, "ArnlStartupProfiler: Error: could not write to %s", myFileName.c_str());
+    return;
+  }
+  for (size_t i = 0; i < myPhases.size(); i++)
+    fprintf(file, "%s,%s,%.1f\n", myVariant.c_str(), myPhases[i].name.c_str(), myPhases[i].msecs);
+  fprintf(file, "%s,total,%.1f\n", myVariant.c_str(), getTotalMSecs());
+  fclose(file);
+}
+
+/// Log the mean time of each phase for each variant in the file
+void ArnlStartupProfiler::logComparison(void)
+{
+  FILE *file = fopen(myFileName.c_str(), "r");
+  if (file == NULL)
+    return;
+  std::vector<std::string> variants;
+  std::vector<std::string> phases;
+  // Runs of each variant, and the total time of each phase of each variant
+  std::map<std::string, int> runs;
+  std::map<std::string, std::map<std::string, double> > sums;
+  char line[1024];
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    char *phase = strchr(line, ',');
+    char *msecs = phase != NULL ? strrchr(line, ',') : NULL;
+    if (phase == NULL || msecs == phase)
+      continue;
+    *phase++ = '\0';
+    *msecs++ = '\0';
+    const std::string variant = line;
+    if (runs.find(variant) == runs.end())
+    {
+      variants.push_back(variant);
+      runs[variant] = 0;
+    }
+    if (strcmp(phase, "total") == 0)
+      runs[variant]++;
+    else if (std::find(phases.begin(), phases.end(), std::string(phase)) == phases.end())
+      phases.push_back(phase);
+    sums[variant][phase] += atof(msecs);
+  }
+  fclose(file);
+  phases.push_back("total");
+
+  ArLog::log(ArLog::Normal, "ArnlStartupProfiler: mean startup times (ms) in %s:", myFileName.c_str());
+  std::string header;
+  char buf[256];
+  for (size_t v = 0; v < variants.size(); v++)
+  {
+    char name[128];
+    snprintf(name, sizeof(name), "%s(%d)", variants[v].c_str(), runs[variants[v]]);
+    snprintf(buf, sizeof(buf), " %15s", name);
+    header += buf;
+  }
+  ArLog::log(ArLog::Normal, "ArnlStartupProfiler:   %-24s%s", "", header.c_str());
+  for (size_t p = 0; p < phases.size(); p++)
+  {
+    std::string row;
+    for (size_t v = 0; v < variants.size(); v++)
+    {
+      const int n = runs[variants[v]];
+      snprintf(buf, sizeof(buf), " %15.1f", n > 0 ? sums[variants[v]][phases[p]] / n : 0);
+      row += buf;
+    }
+    ArLog::log(ArLog::Normal, "ArnlStartupProfiler:   %-24s%s", phases[p].c_str(), row.c_str());
+  }
+}
@@ -0,0 +1,102 @@
+#ifndef ARNLSTARTUPPROFILER_H
+#define ARNLSTARTUPPROFILER_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include "ArnlMetrics.h"
+
+#include <string>
+#include <vector>
+
+/**
+  Times the phases of a program's startup (connecting the robot and
+  lasers, creating tasks and server handlers, loading the configuration
+  and map, initial localization, ...) so that restart time can be
+  accounted for. Create it first thing in main(), mark each phase with
+  beginPhase() (which ends the previous one), or with an ArnlStartupPhase
+  around a block, and call finish() once startup is complete:
+
+  @code{.cpp}
+  ArnlStartupProfiler startupProfiler;
+  startupProfiler.beginPhase("connect robot");
+  robotConnector.connectRobot();
+  startupProfiler.beginPhase("connect lasers");
+  ...
+  startupProfiler.finish();
+  @endcode
+
+  finish() logs each phase's time, sets the arnl_startup_msecs and
+  arnl_startup_phase_msecs{phase="..."} gauges, and, if a file was given
+  with -startupProfileFile on the command line, appends the phase times to
+  it labelled with -startupVariant (default "default"), then logs the mean
+  time of each phase for each variant in the file. So to compare two ways of
+  starting up, run each a few times with the same file and different
+  variant names.
+
+  Time between phases (after endPhase() and before the next beginPhase())
+  is reported as "other".
+*/
+class ArnlStartupProfiler
+{
+public:
+  ArnlStartupProfiler(ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+
+  /// Check for -startupProfileFile and -startupVariant
+  void parseArgs(ArArgumentParser *parser);
+
+  /// End the current phase, if any, and begin @a name
+  void beginPhase(const char *name);
+  /// End the current phase
+  void endPhase(void);
+
+  /// End the current phase and report (only the first call does anything)
+  void finish(void);
+
+  /// Total startup time so far, or until finish() (msec)
+  double getTotalMSecs(void) const;
+
+protected:
+  struct Phase
+  {
+    std::string name;
+    double msecs;
+  };
+
+  void addPhase(const std::string& name, double msecs);
+  void endGap(void);
+  void writeFile(void);
+  void logComparison(void);
+
+  ArnlMetricsRegistry *myMetrics;
+  long long myStartUSecs;
+  long long myFinishUSecs;
+  std::string myCurrent;
+  long long myCurrentStartUSecs;
+  std::vector<Phase> myPhases;
+  std::string myFileName;
+  std::string myVariant;
+  bool myFinished;
+};
+
+/** Times one phase of startup, from its construction until the end of the
+ * enclosing block */
+class ArnlStartupPhase
+{
+public:
+  ArnlStartupPhase(ArnlStartupProfiler *profiler, const char *name) :
+    myProfiler(profiler)
+  {
+    myProfiler->beginPhase(name);
+  }
+  ~ArnlStartupPhase() { myProfiler->endPhase(); }
+
+protected:
+  ArnlStartupProfiler *myProfiler;
+};
+
+#endif
@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlTaskWatchdog.h"
+#include "ArnlRobotMailbox.h"
+#include "ArnlThreadScheduler.h"
+
+#include <stdio.h>
+
+thread_local ArnlTaskWatchdog::Watch *ArnlTaskWatchdog::ourCurrent = NULL;
+
+ArnlTaskWatchdog::ArnlTaskWatchdog(ArnlTimerWheel *wheel, ArnlMetricsRegistry *metrics) :
+  myWheel(wheel),
+  myMetrics(metrics),
+  myTimerCB(this, &ArnlTaskWatchdog::timerExpired),
+  myNumWatched(0),
+  myNumStuck(0)
+{
+  myMutex.setLogName("ArnlTaskWatchdog::myMutex");
+  myWatchedMetric = myMetrics->getGauge("arnl_task_threads_watched",
+    "Task threads currently running under the watchdog");
+  myStuckMetric = myMetrics->getGauge("arnl_task_threads_stuck",
+    "Task threads still running after the watchdog cancelled them");
+}
+
+ArnlTaskWatchdog::~ArnlTaskWatchdog()
+{
+  myMutex.lock();
+  for (std::unordered_map<ArnlTimerWheel::TimerId, Watch *>::iterator it = myTimers.begin(); it != myTimers.end(); ++it)
+    myWheel->cancel(it->first);
+  myTimers.clear();
+  myMutex.unlock();
+}
+
+ArnlTaskWatchdog *ArnlTaskWatchdog::getGlobal(void)
+{
+  static ArnlTaskWatchdog *global = new ArnlTaskWatchdog();
+  return global;
+}
+
+ArnlTaskWatchdog::Watch *ArnlTaskWatchdog::begin(const std::string& name,
+  long expectedMSecs, long maxMSecs, ArRobot *robot)
+{
+  Watch *watch = new Watch;
+  watch->name = name;
+  watch->startUSecs = ArnlThreadScheduler::getMonotonicUSecs();
+  watch->expectedMSecs = expectedMSecs;
+  watch->maxMSecs = maxMSecs;
+  watch->pastExpected = false;
+  watch->cancelled = false;
+  watch->robot = robot;
+  watch->timer = 0;
+
+  myMutex.lock();
+  if (expectedMSecs > 0 && (maxMSecs <= 0 || expectedMSecs < maxMSecs))
+    schedule(watch, expectedMSecs);
+  else if (maxMSecs > 0)
+    schedule(watch, maxMSecs);
+  myNumWatched++;
+  myWatchedMetric->set(myNumWatched);
+  myMutex.unlock();
+
+  ourCurrent = watch;
+  return watch;
+}
+
+void ArnlTaskWatchdog::end(Watch *watch)
+{
+  if (watch == NULL)
+    return;
+  myMutex.lock();
+  if (watch->timer != 0)
+  {
+    // If the timer has just expired, timerExpired() will not find the watch
+    myWheel->cancel(watch->timer);
+    myTimers.erase(watch->timer);
+  }
+  myNumWatched--;
+  myWatchedMetric->set(myNumWatched);
+  if (watch->cancelled)
+  {
+    myNumStuck--;
+    myStuckMetric->set(myNumStuck);
+  }
+  myMutex.unlock();
+
+  if (watch->cancelled)
+    ArLog::log(ArLog::Normal, "ArnlTaskWatchdog: %s returned %.1f sec after it was cancelled",
+	       watch->name.c_str(),
+	       (ArnlThreadScheduler::getMonotonicUSecs() - watch->startUSecs) / 1e6 - watch->maxMSecs / 1000.0);
+  if (ourCurrent == watch)
+    ourCurrent = NULL;
+  delete watch;
+}
+
+bool ArnlTaskWatchdog::cancelRequested(void)
+{
+  Watch *watch = ourCurrent;
+  return watch != NULL && watch->cancelled.load(std::memory_order_relaxed);
+}
+
+int ArnlTaskWatchdog::getNumWatched(void)
+{
+  myMutex.lock();
+  int n = myNumWatched;
+  myMutex.unlock();
+  return n;
+}
+
+/// Set a timer for @a msecsFromStart after @a watch started. Call with myMutex locked.
+void ArnlTaskWatchdog::schedule(Watch *watch, long msecsFromStart)
+{
+  const long long elapsedMSecs = (ArnlThreadScheduler::getMonotonicUSecs() - watch->startUSecs) / 1000;
+  watch->timer = myWheel->scheduleAfter(msecsFromStart - (long)elapsedMSecs, &myTimerCB);
+  myTimers[watch->timer] = watch;
+}
+
+/// Called in the timer wheel's thread
+void ArnlTaskWatchdog::timerExpired(ArnlTimerWheel::TimerId timer)
+{
+  myMutex.lock();
+  std::unordered_map<ArnlTimerWheel::TimerId, Watch *>::iterator it = myTimers.find(timer);
+  // Not found if the task ended meanwhile
+  if (it != myTimers.end())
+  {
+    Watch *watch = it->second;
+    myTimers.erase(it);
+    watch->timer = 0;
+    expired(watch);
+  }
+  myMutex.unlock();
+}
+
+/// A deadline of @a watch has passed. Call with myMutex locked.
+void ArnlTaskWatchdog::expired(Watch *watch)
+{
+  const long msecs = (long)((ArnlThreadScheduler::getMonotonicUSecs() - watch->startUSecs) / 1000);
+  if (!watch->pastExpected && watch->expectedMSecs > 0 &&
+      (watch->maxMSecs <= 0 || watch->expectedMSecs < watch->maxMSecs))
+  {
+    watch->pastExpected = true;
+    myMetrics->getCounter(ArnlMetricsRegistry::withLabel(ArnlMetricsRegistry::withLabel("arnl_task_overruns_total", "task", watch->name), "limit", "expected"),
+      "Task runs which took longer than expected or were cancelled for exceeding their maximum time")->add();
+    ArLog::log(ArLog::Normal, "ArnlTaskWatchdog: Warning: %s has run for %.1f sec, longer than expected (%.1f sec)",
+	       watch->name.c_str(), msecs / 1000.0, watch->expectedMSecs / 1000.0);
+    if (watch->maxMSecs > 0)
+      schedule(watch, watch->maxMSecs);
+    return;
+  }
+
+  watch->cancelled = true;
+  myNumStuck++;
+  myStuckMetric->set(myNumStuck);
+  myMetrics->getCounter(ArnlMetricsRegistry::withLabel(ArnlMetricsRegistry::withLabel("arnl_task_overruns_total", "task", watch->name), "limit", "max"),
+    "Task runs which took longer than expected or were cancelled for exceeding their maximum time")->add();
+  ArLog::log(ArLog::Terse, "ArnlTaskWatchdog: %s has run for %.1f sec, longer than its maximum (%.1f sec); cancelling it",
+	     watch->name.c_str(), msecs / 1000.0, watch->maxMSecs / 1000.0);
+  if (watch->robot != NULL)
+  {
+    // Not here in the timer thread: the status is read in the robot thread
+    char status[256];
+    snprintf(status, sizeof(status), "Task %s cancelled after %.0f sec", watch->name.c_str(), msecs / 1000.0);
+    ArnlRobotMailbox::getMailbox(watch->robot)->setStatus(status);
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef ARNLTASKWATCHDOG_H
+#define ARNLTASKWATCHDOG_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include "ArnlMetrics.h"
+#include "ArnlTimerWheel.h"
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+/**
+  Watches task threads (such as those run by ArnlASyncTask at goals) for
+  running longer than they should. A task thread calls begin() with the
+  task's expected and maximum durations when it starts and end() when it
+  finishes. Deadlines are timers in an ArnlTimerWheel, so starting and
+  ending a watch costs O(1) no matter how many task threads are running,
+  and no thread is needed for the watchdog itself.
+
+  When a task runs past its expected duration, a warning is logged and
+  counted. When it runs past its maximum duration, it is cancelled: this is
+  logged and counted, the active server mode's status is set to say so, and
+  cancelRequested() returns true in the task's thread. The status is set
+  through the robot's ArnlRobotMailbox, in the robot thread. Cancellation is
+  cooperative: tasks should check cancelRequested() between steps (and
+  ArnlASyncTask::waitForMoveDone() stops waiting) and return early.
+
+  Metrics: arnl_task_overruns_total{task="name",limit="expected"|"max"},
+  arnl_task_threads_watched (task threads currently running) and
+  arnl_task_threads_stuck (task threads still running after being cancelled).
+*/
+class ArnlTaskWatchdog
+{
+public:
+  /// The watch on one task thread, returned by begin()
+  struct Watch
+  {
+    std::string name;
+    long long startUSecs;
+    long expectedMSecs;
+    long maxMSecs;
+    bool pastExpected;
+    std::atomic<bool> cancelled;
+    /// Whose active server mode's status to set when cancelled, or NULL
+    ArRobot *robot;
+    /// Pending deadline, or 0
+    ArnlTimerWheel::TimerId timer;
+  };
+
+  ArnlTaskWatchdog(ArnlTimerWheel *wheel = ArnlTimerWheel::getGlobal(),
+    ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlTaskWatchdog();
+
+  /// The watchdog used by ArnlASyncTask
+  static ArnlTaskWatchdog *getGlobal(void);
+
+  /**
+    Start watching the calling thread's task.
+    @param expectedMSecs warn if the task runs longer than this (0 for no expected duration)
+    @param maxMSecs cancel the task if it runs longer than this (0 for no limit)
+    @param robot set its active server mode's status if the task is cancelled
+  */
+  Watch *begin(const std::string& name, long expectedMSecs, long maxMSecs,
+    ArRobot *robot = NULL);
+
+  /// Stop watching a task (call from the thread which called begin())
+  void end(Watch *watch);
+
+  /// Whether the task run by the calling thread has been cancelled by a watchdog
+  static bool cancelRequested(void);
+
+  /// @return number of task threads currently watched
+  int getNumWatched(void);
+
+protected:
+  void schedule(Watch *watch, long msecsFromStart);
+  void timerExpired(ArnlTimerWheel::TimerId timer);
+  void expired(Watch *watch);
+
+  ArnlTimerWheel *myWheel;
+  ArnlMetricsRegistry *myMetrics;
+  ArMutex myMutex;
+  /// The watch waiting for each pending timer
+  std::unordered_map<ArnlTimerWheel::TimerId, Watch *> myTimers;
+  ArFunctor1C<ArnlTaskWatchdog, ArnlTimerWheel::TimerId> myTimerCB;
+  int myNumWatched;
+  int myNumStuck;
+  ArnlGauge *myWatchedMetric;
+  ArnlGauge *myStuckMetric;
+
+  static thread_local Watch *ourCurrent;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef ARNLTELEMETRY_H
+#define ARNLTELEMETRY_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+/**
+  @file ArnlTelemetry.h
+
+  Layout of the shared memory telemetry block published by
+  ArnlTelemetryPublisher, and ArnlTelemetryReader, which other processes on
+  the same computer use to read it.
+
+  This header does not depend on ARIA or ARNL, so a reader program only needs
+  this file (and to link with -lrt on older Linux systems).
+
+  Example:
+  @code{.cpp}
+  ArnlTelemetryReader reader;
+  if(!reader.open())
+    return 1;
+  ArnlTelemetryData data;
+  if(reader.read(&data))
+    printf("robot at %.0f, %.0f going to %s\n", data.x, data.y, data.goalName);
+  @endcode
+*/
+
+#include <atomic>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// Default POSIX shared memory object name
+#define ARNL_TELEMETRY_DEFAULT_NAME "/arnlTelemetry"
+
+/// Identifies a telemetry block ("ARNT")
+#define ARNL_TELEMETRY_MAGIC 0x544e5241u
+
+/// Incremented when ArnlTelemetryData changes
+#define ARNL_TELEMETRY_VERSION 1u
+
+/// Values published each robot cycle. Poses are in mm and degrees, velocities in mm/s and deg/s.
+struct ArnlTelemetryData
+{
+  /// Robot cycle counter at the time of the update
+  uint64_t updateCount;
+  /// Time of the update, microseconds since the epoch
+  int64_t timeUSecs;
+  double x;
+  double y;
+  double th;
+  double vel;
+  double rotVel;
+  double latVel;
+  double localizationScore;
+  /// Index of the current goal among the map's goals, or -1
+  int32_t goalId;
+  /// Position in the current tour, or -1 if not touring
+  int32_t tourIndex;
+  char mode[32];
+  char status[96];
+  char goalName[64];
+};
+
+/// The shared memory block: a sequence lock followed by the data
+struct ArnlTelemetryBlock
+{
+  uint32_t magic;
+  uint32_t version;
+  /// Odd while the publisher is updating data
+  std::atomic<uint32_t> sequence;
+  uint32_t reserved;
+  ArnlTelemetryData data;
+};
+
+/**
+  Reads the telemetry block published by an ARNL server on this computer.
+  Reads never block the publisher: read() copies the data and retries if the
+  publisher updated it meanwhile (a sequence lock), which normally takes well
+  under a microsecond.
+*/
+class ArnlTelemetryReader
+{
+public:
+  ArnlTelemetryReader() : myBlock(NULL) {}
+  ~ArnlTelemetryReader() { close(); }
+
+  /// Map the shared memory block. @return false if no server has created it.
+  bool open(const char *name = ARNL_TELEMETRY_DEFAULT_NAME)
+  {
+#ifdef WIN32
+    return false;
+#else
+    close();
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0)
+      return false;
+    void *p = mmap(NULL, sizeof(ArnlTelemetryBlock), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED)
+      return false;
+    myBlock = (const ArnlTelemetryBlock *)p;
+    if(myBlock->magic != ARNL_TELEMETRY_MAGIC || myBlock->version != ARNL_TELEMETRY_VERSION)
+    {
+      close();
+      return false;
+    }
+    return true;
+#endif
+  }
+
+  void close()
+  {
+#ifndef WIN32
+    if(myBlock != NULL)
+      munmap((void *)myBlock, sizeof(ArnlTelemetryBlock));
+#endif
+    myBlock = NULL;
+  }
+
+  bool isOpen() const { return myBlock != NULL; }
+
+  /** Copy a consistent snapshot of the data.
+      @return false if not open, or the publisher was updating the data during
+      every one of @a maxTries attempts.
+  */
+  bool read(ArnlTelemetryData *data, int maxTries = 1000) const
+  {
+    if(myBlock == NULL)
+      return false;
+    for(int i = 0; i < maxTries; ++i)
+    {
+      uint32_t before = myBlock->sequence.load(std::memory_order_acquire);
+      if(before & 1)
+        continue;
+      memcpy(data, &myBlock->data, sizeof(ArnlTelemetryData));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(myBlock->sequence.load(std::memory_order_relaxed) == before)
+        return true;
+    }
+    return false;
+  }
+
+  /// @return the number of updates published so far, without copying the data
+  uint32_t getSequence() const
+  {
+    return myBlock == NULL ? 0 : myBlock->sequence.load(std::memory_order_acquire) / 2;
+  }
+
+protected:
+  const ArnlTelemetryBlock *myBlock;
+};
+
+#endif
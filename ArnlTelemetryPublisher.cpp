@@ -0,0 +1,159 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlTelemetryPublisher.h"
+#include "ArServerModeGoto2.h"
+
+#include <errno.h>
+#ifndef WIN32
+#include <sys/time.h>
+#endif
+
+ArnlTelemetryPublisher::ArnlTelemetryPublisher(ArRobot *robot,
+  ArPathPlanningTask *pathTask, ArLocalizationTask *locTask,
+  ArServerModeGoto2 *gotoMode, const char *name) :
+  myRobot(robot),
+  myPathTask(pathTask),
+  myLocTask(locTask),
+  myGotoMode(gotoMode),
+  myName(name),
+  myBlock(NULL),
+  myGoalId(-1),
+  myRobotTaskCB(this, &ArnlTelemetryPublisher::robotTask),
+  myProfiledRobotTaskCB(&myRobotTaskCB, "ArnlTelemetryPublisher::robotTask"),
+  myNewGoalCB(this, &ArnlTelemetryPublisher::newGoal)
+{
+  myGoalMutex.setLogName("ArnlTelemetryPublisher::myGoalMutex");
+}
+
+ArnlTelemetryPublisher::~ArnlTelemetryPublisher()
+{
+  close();
+}
+
+bool ArnlTelemetryPublisher::open(void)
+{
+#ifdef WIN32
+  ArLog::log(ArLog::Terse, "ArnlTelemetryPublisher: shared memory telemetry is not available on Windows.");
+  return false;
+#else
+  if (myBlock != NULL)
+    return true;
+  int fd = shm_open(myName.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+  {
+    ArLog::log(ArLog::Terse, "ArnlTelemetryPublisher: Error: could not create shared memory %s: %s", myName.c_str(), strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, sizeof(ArnlTelemetryBlock)) != 0)
+  {
+    ArLog::log(ArLog::Terse, "ArnlTelemetryPublisher: Error: could not size shared memory %s: %s", myName.c_str(), strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  void *p = mmap(NULL, sizeof(ArnlTelemetryBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    ArLog::log(ArLog::Terse, "ArnlTelemetryPublisher: Error: could not map shared memory %s: %s", myName.c_str(), strerror(errno));
+    return false;
+  }
+  myBlock = (ArnlTelemetryBlock *)p;
+  memset(&myBlock->data, 0, sizeof(myBlock->data));
+  myBlock->data.goalId = -1;
+  myBlock->data.tourIndex = -1;
+  myBlock->sequence.store(0, std::memory_order_relaxed);
+  myBlock->version = ARNL_TELEMETRY_VERSION;
+  // Readers check the magic number, so set it last
+  std::atomic_thread_fence(std::memory_order_release);
+  myBlock->magic = ARNL_TELEMETRY_MAGIC;
+
+  myPathTask->addNewGoalCB(&myNewGoalCB);
+  myRobot->lock();
+  // After the pose is updated from the robot and localization, but before
+  // anything that may take significant time.
+  myRobot->addSensorInterpTask("ArnlTelemetryPublisher", 20, &myProfiledRobotTaskCB);
+  myRobot->unlock();
+  ArLog::log(ArLog::Normal, "ArnlTelemetryPublisher: publishing telemetry in shared memory %s", myName.c_str());
+  return true;
+#endif
+}
+
+void ArnlTelemetryPublisher::close(void)
+{
+#ifndef WIN32
+  if (myBlock == NULL)
+    return;
+  myRobot->lock();
+  myRobot->remSensorInterpTask(&myProfiledRobotTaskCB);
+  myRobot->unlock();
+  myPathTask->remNewGoalCB(&myNewGoalCB);
+  munmap(myBlock, sizeof(ArnlTelemetryBlock));
+  shm_unlink(myName.c_str());
+  myBlock = NULL;
+#endif
+}
+
+void ArnlTelemetryPublisher::newGoal(ArPose /*pose*/)
+{
+  std::string goalName = myPathTask->getCurrentGoalName();
+  int goalId = -1;
+  if (myGotoMode != NULL && goalName.size() > 0)
+    goalId = myGotoMode->getGoalIndex(goalName.c_str());
+  myGoalMutex.lock();
+  myGoalName = goalName;
+  myGoalId = goalId;
+  myGoalMutex.unlock();
+}
+
+// Called in the robot thread with the robot locked
+void ArnlTelemetryPublisher::robotTask(void)
+{
+#ifndef WIN32
+  if (myBlock == NULL)
+    return;
+  ArnlTelemetryData& d = myBlock->data;
+  uint32_t seq = myBlock->sequence.load(std::memory_order_relaxed);
+  myBlock->sequence.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  d.updateCount++;
+  d.timeUSecs = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  ArPose pose = myRobot->getPose();
+  d.x = pose.getX();
+  d.y = pose.getY();
+  d.th = pose.getTh();
+  d.vel = myRobot->getVel();
+  d.rotVel = myRobot->getRotVel();
+  d.latVel = myRobot->getLatVel();
+  d.localizationScore = myLocTask->getLocalizationScore();
+  ArServerMode *mode = ArServerMode::getActiveMode();
+  if (mode != NULL)
+  {
+    // Modes' mode and status are only set in this thread: ArServerModeGoto2
+    // copies them in its userTask(), and other threads set the status through
+    // ArnlRobotMailbox.
+    strncpy(d.mode, mode->getMode(), sizeof(d.mode) - 1);
+    strncpy(d.status, mode->getStatus(), sizeof(d.status) - 1);
+  }
+  else
+  {
+    d.mode[0] = '\0';
+    d.status[0] = '\0';
+  }
+  d.tourIndex = myGotoMode != NULL ? myGotoMode->getTourIndex() : -1;
+  // Never wait for the goal callback; the previous goal stays until next cycle
+  if (myGoalMutex.tryLock() == 0)
+  {
+    strncpy(d.goalName, myGoalName.c_str(), sizeof(d.goalName) - 1);
+    d.goalId = myGoalId;
+    myGoalMutex.unlock();
+  }
+
+  myBlock->sequence.store(seq + 2, std::memory_order_release);
+#endif
+}
@@ -0,0 +1,68 @@
+#ifndef ARNLTELEMETRYPUBLISHER_H
+#define ARNLTELEMETRYPUBLISHER_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+#include "Arnl.h"
+#include "ArPathPlanningTask.h"
+#include "ArLocalizationTask.h"
+
+#include "ArnlTelemetry.h"
+#include "ArnlCallbackProfiler.h"
+
+class ArServerModeGoto2;
+
+/**
+  Publishes robot pose, velocity, localization score, server mode and status,
+  and the current goal in a POSIX shared memory block every robot cycle, for
+  other processes on the same computer (task executors, loggers, monitors)
+  to read with ArnlTelemetryReader instead of each connecting to the server.
+
+  The block is updated in the robot thread (as a sensor interpretation task)
+  without taking any lock that another thread might hold for long: the goal
+  name and index are captured by a path planning "new goal" callback, and
+  copied in only if that is not being updated at the same moment.
+
+  Not available on Windows.
+*/
+class ArnlTelemetryPublisher
+{
+public:
+  /** @param gotoMode If given, used to find goal and tour indices. */
+  ArnlTelemetryPublisher(ArRobot *robot, ArPathPlanningTask *pathTask,
+    ArLocalizationTask *locTask, ArServerModeGoto2 *gotoMode = NULL,
+    const char *name = ARNL_TELEMETRY_DEFAULT_NAME);
+  ~ArnlTelemetryPublisher();
+
+  /// Create the shared memory block and start updating it each robot cycle
+  bool open(void);
+
+  /// Stop updating and remove the shared memory block
+  void close(void);
+
+protected:
+  void robotTask(void);
+  void newGoal(ArPose pose);
+
+  ArRobot *myRobot;
+  ArPathPlanningTask *myPathTask;
+  ArLocalizationTask *myLocTask;
+  ArServerModeGoto2 *myGotoMode;
+  std::string myName;
+  ArnlTelemetryBlock *myBlock;
+
+  ArMutex myGoalMutex;
+  std::string myGoalName;
+  int myGoalId;
+
+  ArFunctorC<ArnlTelemetryPublisher> myRobotTaskCB;
+  ArnlProfiledFunctor myProfiledRobotTaskCB;
+  ArFunctor1C<ArnlTelemetryPublisher, ArPose> myNewGoalCB;
+};
+
+#endif
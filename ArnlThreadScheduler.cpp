@@ -0,0 +1,402 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlThreadScheduler.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const double ArnlThreadScheduler::ourLatencyBounds[] =
+  { 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000 };
+const size_t ArnlThreadScheduler::ourNumLatencyBounds =
+  sizeof(ArnlThreadScheduler::ourLatencyBounds) / sizeof(ArnlThreadScheduler::ourLatencyBounds[0]);
+
+ArnlThreadScheduler *ArnlThreadScheduler::ourInstance = NULL;
+
+#ifdef __linux__
+namespace {
+
+/** Parse a list of CPU numbers and ranges, e.g. "0-1,3", into @a set.
+ * @return false if it is malformed, has a CPU out of range, or has none */
+bool parseCPUs(const char *cpus, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  const char *p = cpus;
+  while (*p != '\0')
+  {
+    char *end;
+    const long first = strtol(p, &end, 10);
+    if (end == p || first < 0 || first >= CPU_SETSIZE)
+      return false;
+    long last = first;
+    if (*end == '-')
+    {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first || last >= CPU_SETSIZE)
+	return false;
+    }
+    for (long c = first; c <= last; c++)
+      CPU_SET(c, set);
+    if (*end == ',')
+      end++;
+    else if (*end != '\0')
+      return false;
+    p = end;
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+}
+#endif
+
+long long ArnlThreadScheduler::getMonotonicUSecs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+ArnlThreadScheduler::ArnlThreadScheduler(ArRobot *robot, ArnlMetricsRegistry *metrics) :
+  myRobot(robot),
+  myMetrics(metrics),
+  myRobotPending(false),
+  myRobotTID(0),
+  myLastRobotCycleUSecs(0),
+  myRobotTaskCB(this, &ArnlThreadScheduler::robotTask),
+  myProcessFileCB(this, &ArnlThreadScheduler::processFile)
+{
+  myMutex.setLogName("ArnlThreadScheduler::myMutex");
+  memset(mySettings, 0, sizeof(mySettings));
+  memset(myConfigSettings, 0, sizeof(myConfigSettings));
+  myRobotLatenessMetric = myMetrics->getHistogram("arnl_robot_cycle_lateness_usecs",
+    "Time by which each robot cycle started later than the cycle time after the previous one",
+    ourLatencyBounds, ourNumLatencyBounds);
+  myRobot->lock();
+  // Run first in each cycle, so the time measured is when the cycle started
+  myRobot->addSensorInterpTask("ArnlThreadScheduler", 100, &myRobotTaskCB);
+  myRobot->unlock();
+  addThread(ROBOT, NULL, "robot");
+  ourInstance = this;
+}
+
+ArnlThreadScheduler::~ArnlThreadScheduler()
+{
+  if (ourInstance == this)
+    ourInstance = NULL;
+  myRobot->lock();
+  myRobot->remSensorInterpTask(&myRobotTaskCB);
+  myRobot->unlock();
+}
+
+const char *ArnlThreadScheduler::getClassName(ThreadClass threadClass)
+{
+  switch (threadClass)
+  {
+  case ROBOT: return "Robot";
+  case LASERS: return "Lasers";
+  case LOCALIZATION: return "Localization";
+  case PATH_PLANNING: return "PathPlanning";
+  case NETWORKING: return "Networking";
+  case TASKS: return "Tasks";
+  default: return "Unknown";
+  }
+}
+
+void ArnlThreadScheduler::addToConfig(ArConfig *config, const char *section)
+{
+  for (int i = 0; i < NUM_THREAD_CLASSES; i++)
+  {
+    const std::string name = getClassName((ThreadClass)i);
+    Settings *s = &myConfigSettings[i];
+    config->addParam(
+	    ArConfigArg((name + "CPUs").c_str(), s->cpus,
+			"CPUs to run these threads on, e.g. \"0-1,3\". Empty leaves them unchanged.",
+			sizeof(s->cpus)),
+	    section, ArPriority::EXPERT);
+    config->addParam(
+	    ArConfigArg((name + "Policy").c_str(), s->policy,
+			"Scheduling policy: normal, fifo or rr. Empty leaves it unchanged.",
+			sizeof(s->policy)),
+	    section, ArPriority::EXPERT);
+    config->addParam(
+	    ArConfigArg((name + "Priority").c_str(), &s->priority,
+			"Real-time priority (1 to 99) for the fifo or rr policy, or nice value (-20 to 19) for normal.",
+			-20, 99),
+	    section, ArPriority::EXPERT);
+  }
+  config->addProcessFileCB(&myProcessFileCB, 40);
+}
+
+bool ArnlThreadScheduler::checkSettings(const Settings& s, const char *name)
+{
+  bool realTime = false;
+  if (ArUtil::strcasecmp(s.policy, "fifo") == 0 || ArUtil::strcasecmp(s.policy, "rr") == 0)
+    realTime = true;
+  else if (s.policy[0] != '\0' && ArUtil::strcasecmp(s.policy, "normal") != 0)
+  {
+    ArLog::log(ArLog::Terse, "ArnlThreadScheduler: Error: unknown %sPolicy \"%s\" (normal, fifo or rr)",
+	       name, s.policy);
+    return false;
+  }
+  // sched_setscheduler() fails on any other priority for these
+  if (realTime && (s.priority < 1 || s.priority > 99))
+  {
+    ArLog::log(ArLog::Terse, "ArnlThreadScheduler: Error: %sPriority %d is not a real-time priority (1 to 99) for policy %s",
+	       name, s.priority, s.policy);
+    return false;
+  }
+  if (!realTime && s.policy[0] != '\0' && (s.priority < -20 || s.priority > 19))
+  {
+    ArLog::log(ArLog::Terse, "ArnlThreadScheduler: Error: %sPriority %d is not a nice value (-20 to 19) for policy %s",
+	       name, s.priority, s.policy);
+    return false;
+  }
+#ifdef __linux__
+  cpu_set_t set;
+  if (s.cpus[0] != '\0' && !parseCPUs(s.cpus, &set))
+  {
+    ArLog::log(ArLog::Terse, "ArnlThreadScheduler: Error: %sCPUs \"%s\" is not a list of CPUs (0 to %d) and ranges, e.g. \"0-1,3\"",
+	       name, s.cpus, CPU_SETSIZE - 1);
+    return false;
+  }
+#endif
+  return true;
+}
+
+bool ArnlThreadScheduler::processFile(void)
+{
+  bool ok = true;
+  for (int i = 0; i < NUM_THREAD_CLASSES; i++)
+    if (!checkSettings(myConfigSettings[i], getClassName((ThreadClass)i)))
+      ok = false;
+  if (!ok)
+  {
+    // Keeping the settings already applied
+    ArLog::log(ArLog::Terse, "ArnlThreadScheduler: Error: thread scheduling settings rejected");
+    return false;
+  }
+  myMutex.lock();
+  memcpy(mySettings, myConfigSettings, sizeof(mySettings));
+  myMutex.unlock();
+  apply();
+  return true;
+}
+
+void ArnlThreadScheduler::addThread(ThreadClass threadClass, ArThread *thread, const char *label)
+{
+  Thread t;
+  t.threadClass = threadClass;
+  t.thread = thread;
+  t.name = label;
+  t.lastWaitNSecs = 0;
+  t.lastTimeSlices = 0;
+  myMutex.lock();
+  const int index = (int)myThreads.size();
+  myThreads.push_back(t);
+  myMutex.unlock();
+  myMetrics->getGauge(ArnlMetricsRegistry::withLabel("arnl_thread_runqueue_wait_usecs", "thread", label),
+    "Average time a thread waited to run after becoming runnable, since last exported",
+    new ArRetFunctor1C<double, ArnlThreadScheduler, int>(this, &ArnlThreadScheduler::getRunQueueWait, index));
+}
+
+void ArnlThreadScheduler::addThreadName(ThreadClass threadClass, const char *threadName)
+{
+  addThread(threadClass, NULL, threadName);
+}
+
+void ArnlThreadScheduler::addLasers(ArRobot *robot)
+{
+  robot->lock();
+  std::map<int, ArLaser *> *lasers = robot->getLaserMap();
+  std::vector<std::string> names;
+  for (std::map<int, ArLaser *>::iterator it = lasers->begin(); it != lasers->end(); ++it)
+    names.push_back(it->second->getName());
+  robot->unlock();
+  for (size_t i = 0; i < names.size(); i++)
+    addThreadName(LASERS, names[i].c_str());
+}
+
+void ArnlThreadScheduler::apply(void)
+{
+  myMutex.lock();
+  std::vector<Thread> threads = myThreads;
+  myMutex.unlock();
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    // The robot thread applies its settings in robotTask()
+    if (threads[i].threadClass == ROBOT)
+      continue;
+    int tid = getThreadTID(threads[i]);
+    if (tid > 0)
+      applyToThread(tid, threads[i].threadClass, threads[i].name.c_str());
+    else
+      ArLog::log(ArLog::Verbose, "ArnlThreadScheduler: thread %s is not running yet", threads[i].name.c_str());
+  }
+  myRobotPending = true;
+}
+
+void ArnlThreadScheduler::threadStarted(ThreadClass threadClass)
+{
+#ifdef __linux__
+  ArnlThreadScheduler *scheduler = ourInstance;
+  if (scheduler != NULL)
+    scheduler->applyToThread((int)syscall(SYS_gettid), threadClass, getClassName(threadClass));
+#endif
+}
+
+bool ArnlThreadScheduler::applyToThread(int tid, ThreadClass threadClass, const char *name)
+{
+  myMutex.lock();
+  Settings s = mySettings[threadClass];
+  myMutex.unlock();
+  if (s.cpus[0] == '\0' && s.policy[0] == '\0')
+    return true;
+#ifndef __linux__
+  ArLog::log(ArLog::Terse, "ArnlThreadScheduler: thread affinity and scheduling are only supported on Linux.");
+  return false;
+#else
+  bool ok = true;
+  if (s.cpus[0] != '\0')
+  {
+    cpu_set_t set;
+    if (!parseCPUs(s.cpus, &set) || sched_setaffinity(tid, sizeof(set), &set) != 0)
+    {
+      ArLog::log(ArLog::Terse, "ArnlThreadScheduler: Could not set CPUs of %s thread %d to \"%s\": %s",
+		 name, tid, s.cpus, strerror(errno));
+      ok = false;
+    }
+  }
+  if (s.policy[0] != '\0')
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    int policy = SCHED_OTHER;
+    if (ArUtil::strcasecmp(s.policy, "fifo") == 0)
+      policy = SCHED_FIFO;
+    else if (ArUtil::strcasecmp(s.policy, "rr") == 0)
+      policy = SCHED_RR;
+    else if (ArUtil::strcasecmp(s.policy, "normal") != 0)
+      ArLog::log(ArLog::Terse, "ArnlThreadScheduler: Unknown policy \"%s\" for %s, using normal", s.policy, name);
+    if (policy != SCHED_OTHER)
+      param.sched_priority = s.priority;
+    if (sched_setscheduler(tid, policy, &param) != 0 ||
+	(policy == SCHED_OTHER && setpriority(PRIO_PROCESS, tid, s.priority) != 0))
+    {
+      ArLog::log(ArLog::Terse, "ArnlThreadScheduler: Could not set scheduling of %s thread %d to %s %d: %s",
+		 name, tid, s.policy, s.priority, strerror(errno));
+      ok = false;
+    }
+  }
+  if (ok)
+    ArLog::log(ArLog::Normal, "ArnlThreadScheduler: %s thread %d: CPUs \"%s\" policy \"%s\" priority %d",
+	       name, tid, s.cpus, s.policy, s.priority);
+  return ok;
+#endif
+}
+
+int ArnlThreadScheduler::getThreadTID(const Thread& t)
+{
+  if (t.thread != NULL)
+    return (int)t.thread->getTID();
+  if (t.threadClass == ROBOT)
+    return myRobotTID;
+  return findThreadByName(t.name);
+}
+
+int ArnlThreadScheduler::findThreadByName(const std::string& name)
+{
+#ifdef __linux__
+  // Thread names are truncated to 15 characters by the kernel
+  const std::string wanted = name.substr(0, 15);
+  DIR *dir = opendir("/proc/self/task");
+  if (dir == NULL)
+    return 0;
+  int found = 0;
+  struct dirent *entry;
+  while (found == 0 && (entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] == '.')
+      continue;
+    char path[64];
+    char comm[32];
+    snprintf(path, sizeof(path), "/proc/self/task/%s/comm", entry->d_name);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+      continue;
+    if (fgets(comm, sizeof(comm), file) != NULL)
+    {
+      comm[strcspn(comm, "\n")] = '\0';
+      if (wanted == comm)
+	found = atoi(entry->d_name);
+    }
+    fclose(file);
+  }
+  closedir(dir);
+  return found;
+#else
+  return 0;
+#endif
+}
+
+double ArnlThreadScheduler::getRunQueueWait(int index)
+{
+#ifdef __linux__
+  myMutex.lock();
+  Thread t = myThreads[index];
+  myMutex.unlock();
+  int tid = getThreadTID(t);
+  if (tid <= 0)
+    return 0;
+  // Fields are time on the CPU (ns), time waiting on a run queue (ns), and
+  // number of times run
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", tid);
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return 0;
+  long long runNSecs = 0, waitNSecs = 0, timeSlices = 0;
+  int n = fscanf(file, "%lld %lld %lld", &runNSecs, &waitNSecs, &timeSlices);
+  fclose(file);
+  if (n != 3)
+    return 0;
+  myMutex.lock();
+  Thread *stored = &myThreads[index];
+  long long slices = timeSlices - stored->lastTimeSlices;
+  double usecs = (slices > 0) ? (waitNSecs - stored->lastWaitNSecs) / 1000.0 / slices : 0;
+  stored->lastWaitNSecs = waitNSecs;
+  stored->lastTimeSlices = timeSlices;
+  myMutex.unlock();
+  return usecs;
+#else
+  return 0;
+#endif
+}
+
+void ArnlThreadScheduler::robotTask(void)
+{
+  const long long now = getMonotonicUSecs();
+  if (myLastRobotCycleUSecs != 0)
+  {
+    long long late = now - myLastRobotCycleUSecs - (long long)myRobot->getCycleTime() * 1000;
+    myRobotLatenessMetric->observe(late > 0 ? late : 0);
+  }
+  myLastRobotCycleUSecs = now;
+#ifdef __linux__
+  if (myRobotTID == 0)
+    myRobotTID = (int)syscall(SYS_gettid);
+#endif
+  if (myRobotPending.exchange(false))
+    threadStarted(ROBOT);
+}
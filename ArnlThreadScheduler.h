@@ -0,0 +1,125 @@
+#ifndef ARNLTHREADSCHEDULER_H
+#define ARNLTHREADSCHEDULER_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include "ArnlMetrics.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+  Pins the server's threads to sets of CPUs and sets their scheduling
+  policy and priority, according to parameters in a config section, so
+  that task and networking threads can be kept from taking CPU time from
+  the robot cycle and the laser threads.
+
+  Threads are grouped in classes (robot, lasers, localization, path
+  planning, networking and goal tasks), each with the following parameters:
+    - CPUs: e.g. "0-1,3", or empty to leave the affinity unchanged
+    - Policy: "normal", "fifo", "rr", or empty to leave the policy unchanged
+    - Priority: 1 to 99 for fifo or rr, or a nice value (-20 to 19) for normal
+  Settings that are out of range for their policy, or CPU lists that are
+  not lists of CPU numbers, make the config be rejected, keeping the
+  settings already applied. Real-time policies and negative nice values
+  need the CAP_SYS_NICE capability (or running as root); failures are
+  logged.
+
+  Settings are applied when the config is loaded or changed, and by
+  apply(). Threads that ARIA or ARNL start as ArThread objects are given with
+  addThread(); threads that can only be identified by name (e.g. those of
+  the lasers) are given with addThreadName(). The robot thread applies its
+  settings itself at the start of its next cycle, and ArnlASyncTask threads
+  apply theirs (through threadStarted()) when they start at each goal.
+
+  To verify the effect, lateness of each robot cycle is recorded in
+  the arnl_robot_cycle_lateness_usecs histogram, and the average time each
+  registered thread waited to run after becoming runnable (from the Linux
+  scheduler statistics) in arnl_thread_runqueue_wait_usecs gauges.
+
+  Only available on Linux.
+*/
+class ArnlThreadScheduler
+{
+public:
+  enum ThreadClass { ROBOT, LASERS, LOCALIZATION, PATH_PLANNING, NETWORKING, TASKS, NUM_THREAD_CLASSES };
+
+  ArnlThreadScheduler(ArRobot *robot, ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  ~ArnlThreadScheduler();
+
+  void addToConfig(ArConfig *config, const char *section = "Thread scheduling");
+
+  /// Manage @a thread as part of @a threadClass (its settings are applied once it has started)
+  void addThread(ThreadClass threadClass, ArThread *thread, const char *label);
+
+  /// Manage the thread(s) named @a threadName as part of @a threadClass
+  void addThreadName(ThreadClass threadClass, const char *threadName);
+
+  /// Manage the threads of all of the robot's lasers
+  void addLasers(ArRobot *robot);
+
+  /// Apply the current settings to all managed threads
+  void apply(void);
+
+  /// Called by a thread of @a threadClass (e.g. a goal task thread) when it starts, to apply its settings to itself
+  static void threadStarted(ThreadClass threadClass);
+
+  static const char *getClassName(ThreadClass threadClass);
+
+  /// @return microseconds from a monotonic clock, for measuring latencies
+  static long long getMonotonicUSecs(void);
+
+  /// Bucket bounds, in microseconds, used for scheduling latency histograms
+  static const double ourLatencyBounds[];
+  static const size_t ourNumLatencyBounds;
+
+protected:
+  struct Settings
+  {
+    char cpus[64];
+    char policy[16];
+    int priority;
+  };
+
+  struct Thread
+  {
+    ThreadClass threadClass;
+    ArThread *thread;
+    std::string name;
+    long long lastWaitNSecs;
+    long long lastTimeSlices;
+  };
+
+  /// @return false (logging why) if @a s, the settings of class @a name, cannot be applied
+  static bool checkSettings(const Settings& s, const char *name);
+  bool applyToThread(int tid, ThreadClass threadClass, const char *name);
+  int getThreadTID(const Thread& t);
+  int findThreadByName(const std::string& name);
+  double getRunQueueWait(int index);
+  bool processFile(void);
+  void robotTask(void);
+
+  ArRobot *myRobot;
+  ArnlMetricsRegistry *myMetrics;
+  ArMutex myMutex;
+  Settings mySettings[NUM_THREAD_CLASSES];
+  Settings myConfigSettings[NUM_THREAD_CLASSES];
+  std::vector<Thread> myThreads;
+  std::atomic<bool> myRobotPending;
+  std::atomic<int> myRobotTID;
+  long long myLastRobotCycleUSecs;
+  ArnlHistogram *myRobotLatenessMetric;
+
+  ArFunctorC<ArnlThreadScheduler> myRobotTaskCB;
+  ArRetFunctorC<bool, ArnlThreadScheduler> myProcessFileCB;
+
+  static ArnlThreadScheduler *ourInstance;
+};
+
+#endif
@@ -0,0 +1,251 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlTimerWheel.h"
+#include "ArnlThreadScheduler.h"
+
+#include <limits.h>
+
+static const long long ourTickUSecs = ARNL_TIMER_WHEEL_TICK_MSECS * 1000LL;
+
+/// Ticks covered by all levels of the wheel; timers further ahead are placed at its end and placed again later
+static const long long ourWheelTicks = 1LL << (ARNL_TIMER_WHEEL_BITS * ARNL_TIMER_WHEEL_LEVELS);
+
+ArnlTimerWheel::ArnlTimerWheel(ArnlMetricsRegistry *metrics) :
+  myMetrics(metrics),
+  myStarted(false),
+  myManual(false),
+  myStartUSecs(ArnlClock::getUSecs()),
+  myTick(0),
+  myNextId(1)
+{
+  myMutex.setLogName("ArnlTimerWheel::myMutex");
+  setThreadName("ArnlTimerWheel");
+  myTimersMetric = myMetrics->getGauge("arnl_timers_scheduled",
+    "Timers scheduled in the task timer wheel and not yet expired");
+  myFiredMetric = myMetrics->getCounter("arnl_timers_fired_total",
+    "Timers which expired and had their callbacks invoked");
+  myLatenessMetric = myMetrics->getHistogram("arnl_timer_lateness_usecs",
+    "Time from each timer's expiry until its callback was invoked",
+    ArnlThreadScheduler::ourLatencyBounds, ArnlThreadScheduler::ourNumLatencyBounds);
+}
+
+ArnlTimerWheel::~ArnlTimerWheel()
+{
+  stopRunning();
+  myWakeCondition.signal();
+  myMutex.lock();
+  for (std::unordered_map<TimerId, Timer *>::iterator it = myTimers.begin(); it != myTimers.end(); ++it)
+    delete it->second;
+  myTimers.clear();
+  myMutex.unlock();
+}
+
+ArnlTimerWheel *ArnlTimerWheel::getGlobal(void)
+{
+  static ArnlTimerWheel *global = new ArnlTimerWheel();
+  return global;
+}
+
+ArnlTimerWheel::TimerId ArnlTimerWheel::scheduleAfter(long msecs, ArFunctor *cb)
+{
+  return add(msecs * 1000LL, cb, NULL);
+}
+
+ArnlTimerWheel::TimerId ArnlTimerWheel::scheduleAfter(long msecs, ArFunctor1<TimerId> *cb)
+{
+  return add(msecs * 1000LL, NULL, cb);
+}
+
+ArnlTimerWheel::TimerId ArnlTimerWheel::scheduleAt(const ArTime& when, ArFunctor *cb)
+{
+  return add(when.mSecTo() * 1000LL, cb, NULL);
+}
+
+ArnlTimerWheel::TimerId ArnlTimerWheel::scheduleAt(const ArTime& when, ArFunctor1<TimerId> *cb)
+{
+  return add(when.mSecTo() * 1000LL, NULL, cb);
+}
+
+ArnlTimerWheel::TimerId ArnlTimerWheel::add(long long delayUSecs, ArFunctor *cb, ArFunctor1<TimerId> *idCB)
+{
+  if (delayUSecs < 0)
+    delayUSecs = 0;
+  const long long sinceStart = ArnlClock::getUSecs() - myStartUSecs;
+  Timer *timer = new Timer;
+  timer->cb = cb;
+  timer->idCB = idCB;
+
+  myMutex.lock();
+  if (!myStarted && !myManual)
+  {
+    myStarted = true;
+    runAsync();
+  }
+  const bool wasIdle = myTimers.empty();
+  // The wheel is not advanced while it is empty
+  if (wasIdle)
+    myTick = sinceStart / ourTickUSecs;
+  // Round up, so a timer never expires early
+  timer->expiresTick = (sinceStart + delayUSecs + ourTickUSecs - 1) / ourTickUSecs;
+  if (timer->expiresTick <= myTick)
+    timer->expiresTick = myTick + 1;
+  timer->id = myNextId++;
+  place(timer);
+  myTimers[timer->id] = timer;
+  myTimersMetric->set(myTimers.size());
+  const TimerId id = timer->id;
+  myMutex.unlock();
+
+  if (wasIdle)
+    myWakeCondition.signal();
+  return id;
+}
+
+bool ArnlTimerWheel::cancel(TimerId id)
+{
+  myMutex.lock();
+  std::unordered_map<TimerId, Timer *>::iterator it = myTimers.find(id);
+  if (it == myTimers.end())
+  {
+    myMutex.unlock();
+    return false;
+  }
+  Timer *timer = it->second;
+  timer->slot->erase(timer->pos);
+  myTimers.erase(it);
+  myTimersMetric->set(myTimers.size());
+  myMutex.unlock();
+  delete timer;
+  return true;
+}
+
+size_t ArnlTimerWheel::getNumTimers(void)
+{
+  myMutex.lock();
+  size_t n = myTimers.size();
+  myMutex.unlock();
+  return n;
+}
+
+bool ArnlTimerWheel::setManual(bool manual)
+{
+  myMutex.lock();
+  const bool ok = !myStarted;
+  if (ok)
+    myManual = manual;
+  if (ok && myTimers.empty())
+  {
+    myStartUSecs = ArnlClock::getUSecs();
+    myTick = 0;
+  }
+  myMutex.unlock();
+  return ok;
+}
+
+bool ArnlTimerWheel::getNextExpiry(long long *usecs)
+{
+  myMutex.lock();
+  long long tick = LLONG_MAX;
+  for (std::unordered_map<TimerId, Timer *>::const_iterator it = myTimers.begin(); it != myTimers.end(); ++it)
+    if (it->second->expiresTick < tick)
+      tick = it->second->expiresTick;
+  const bool any = !myTimers.empty();
+  myMutex.unlock();
+  if (any)
+    *usecs = myStartUSecs + tick * ourTickUSecs;
+  return any;
+}
+
+/// Put @a timer in the slot of the lowest level which covers its expiry. Call with myMutex locked.
+void ArnlTimerWheel::place(Timer *timer)
+{
+  long long tick = timer->expiresTick;
+  if (tick - myTick >= ourWheelTicks)
+    tick = myTick + ourWheelTicks - 1;
+  const long long delta = tick - myTick;
+  int level = 0;
+  while (level < ARNL_TIMER_WHEEL_LEVELS - 1 &&
+	 delta >= (1LL << (ARNL_TIMER_WHEEL_BITS * (level + 1))))
+    level++;
+  const int index = (int)((tick >> (ARNL_TIMER_WHEEL_BITS * level)) & (ARNL_TIMER_WHEEL_SLOTS - 1));
+  timer->slot = &myLevels[level][index];
+  timer->pos = timer->slot->insert(timer->slot->end(), timer);
+}
+
+/// Move the timers in @a level's current slot to lower levels. Call with myMutex locked.
+void ArnlTimerWheel::cascade(int level)
+{
+  const int index = (int)((myTick >> (ARNL_TIMER_WHEEL_BITS * level)) & (ARNL_TIMER_WHEEL_SLOTS - 1));
+  std::list<Timer *> timers;
+  timers.swap(myLevels[level][index]);
+  for (std::list<Timer *>::iterator it = timers.begin(); it != timers.end(); ++it)
+    place(*it);
+}
+
+/// Advance one tick, removing the timers which expire at it into @a fired. Call with myMutex locked.
+void ArnlTimerWheel::advance(std::vector<Timer *> *fired)
+{
+  myTick++;
+  for (int level = 1; level < ARNL_TIMER_WHEEL_LEVELS &&
+	 (myTick & ((1LL << (ARNL_TIMER_WHEEL_BITS * level)) - 1)) == 0; level++)
+    cascade(level);
+  std::list<Timer *>& slot = myLevels[0][myTick & (ARNL_TIMER_WHEEL_SLOTS - 1)];
+  for (std::list<Timer *>::iterator it = slot.begin(); it != slot.end(); ++it)
+  {
+    fired->push_back(*it);
+    myTimers.erase((*it)->id);
+  }
+  slot.clear();
+}
+
+void *ArnlTimerWheel::runThread(void *)
+{
+  while (getRunning())
+  {
+    myMutex.lock();
+    const bool idle = myTimers.empty();
+    const long long nextTickUSecs = (myTick + 1) * ourTickUSecs;
+    myMutex.unlock();
+    if (idle)
+    {
+      // add() signals when the first timer is scheduled; the timeout covers a signal sent just before waiting
+      myWakeCondition.timedWait(100);
+      continue;
+    }
+    const long long wait = nextTickUSecs - (ArnlClock::getUSecs() - myStartUSecs);
+    if (wait > 0)
+      ArUtil::sleep((unsigned int)((wait + 999) / 1000));
+    runExpired();
+  }
+  return NULL;
+}
+
+size_t ArnlTimerWheel::runExpired(void)
+{
+  std::vector<Timer *> fired;
+  const long long sinceStart = ArnlClock::getUSecs() - myStartUSecs;
+  const long long nowTick = sinceStart / ourTickUSecs;
+  myMutex.lock();
+  // Catch up on every tick passed, in case this thread was delayed
+  while (myTick < nowTick && !myTimers.empty())
+    advance(&fired);
+  myTimersMetric->set(myTimers.size());
+  myMutex.unlock();
+
+  for (size_t i = 0; i < fired.size(); i++)
+  {
+    Timer *timer = fired[i];
+    const long long late = sinceStart - timer->expiresTick * ourTickUSecs;
+    myLatenessMetric->observe((double)(late > 0 ? late : 0));
+    if (timer->idCB != NULL)
+      timer->idCB->invoke(timer->id);
+    else if (timer->cb != NULL)
+      timer->cb->invoke();
+    delete timer;
+  }
+  myFiredMetric->add(fired.size());
+  return fired.size();
+}
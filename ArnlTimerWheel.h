@@ -0,0 +1,137 @@
+#ifndef ARNLTIMERWHEEL_H
+#define ARNLTIMERWHEEL_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include "ArnlClock.h"
+#include "ArnlMetrics.h"
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+/// Resolution of ArnlTimerWheel timers
+#define ARNL_TIMER_WHEEL_TICK_MSECS 10
+
+/// Bits of the tick count covered by each level of the wheel (64 slots)
+#define ARNL_TIMER_WHEEL_BITS 6
+#define ARNL_TIMER_WHEEL_SLOTS (1 << ARNL_TIMER_WHEEL_BITS)
+
+/// Number of levels: timers up to 64^4 ticks (about 46 hours) ahead are placed directly
+#define ARNL_TIMER_WHEEL_LEVELS 4
+
+/**
+  Runs callbacks after a delay or at a given time, for any number of timers
+  with one thread. Use this instead of sleeping in a task thread for dwell
+  times and timeouts: a pending timer costs a few dozen bytes instead of a
+  blocked thread.
+
+  Timers are kept in a hierarchical timer wheel: four levels of 64 slots,
+  the first level's slots one tick (10 ms) apart, each further level's slots
+  64 times further apart. Scheduling and cancelling are O(1); as time
+  advances, the timers in a slot of a higher level are redistributed to the
+  level below when that level wraps around, so each timer is moved at most
+  three times.
+
+  Callbacks are invoked in the wheel's thread, in order of their expiry
+  tick, and so should return quickly: to do something long, start a thread
+  or hand it to another one. A callback may schedule or cancel timers
+  (including rescheduling itself).
+
+  Time is ArnlClock time. Under ArnlVirtualTimeExecutor the wheel is put in
+  manual mode (setManual()): it starts no thread, and the executor calls
+  runExpired() each time it advances virtual time to getNextExpiry().
+
+  @code{.cpp}
+  ArnlTimerWheel::TimerId t = ArnlTimerWheel::getGlobal()->scheduleAfter(3000, &myDwellDoneCB);
+  ...
+  ArnlTimerWheel::getGlobal()->cancel(t);
+  @endcode
+*/
+class ArnlTimerWheel : public ArASyncTask
+{
+public:
+  /// Identifies a scheduled timer; 0 is never a valid timer
+  typedef unsigned long long TimerId;
+
+  ArnlTimerWheel(ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlTimerWheel();
+
+  /// The wheel shared by the task framework (its thread is started when it is first used)
+  static ArnlTimerWheel *getGlobal(void);
+
+  /// Invoke @a cb (not copied; it must remain valid until invoked or cancelled) after @a msecs milliseconds
+  TimerId scheduleAfter(long msecs, ArFunctor *cb);
+
+  /// Invoke @a cb with the timer's id after @a msecs milliseconds, so one functor can serve many timers
+  TimerId scheduleAfter(long msecs, ArFunctor1<TimerId> *cb);
+
+  /// Invoke @a cb at the time @a when (or as soon as possible if it has passed)
+  TimerId scheduleAt(const ArTime& when, ArFunctor *cb);
+  TimerId scheduleAt(const ArTime& when, ArFunctor1<TimerId> *cb);
+
+  /** Cancel a timer.
+      @return true if the timer was cancelled, false if it has already
+      expired (its callback may be running now in the wheel's thread) or
+      was never scheduled. */
+  bool cancel(TimerId id);
+
+  /// @return number of timers scheduled and not yet expired
+  size_t getNumTimers(void);
+
+  /** Don't start the wheel's thread: timers only fire when runExpired() is
+   * called. If no timers are scheduled, the wheel's ticks are also restarted
+   * from the current time, so that a virtual-time executor started now sees
+   * timers expire at the same points every run.
+   * @return false if the thread is already running */
+  bool setManual(bool manual);
+
+  /** Invoke, in this thread, the callbacks of the timers which have expired
+   * by now (ArnlClock::getUSecs()). @return number of callbacks invoked */
+  size_t runExpired(void);
+
+  /** Set @a usecs to the ArnlClock time at which the next timer expires
+   * (this looks at every timer, so is meant for virtual-time executors, not
+   * for frequent use). @return false if no timers are scheduled */
+  bool getNextExpiry(long long *usecs);
+
+  virtual void *runThread(void *arg);
+
+protected:
+  struct Timer
+  {
+    TimerId id;
+    long long expiresTick;
+    ArFunctor *cb;
+    ArFunctor1<TimerId> *idCB;
+    std::list<Timer *> *slot;
+    std::list<Timer *>::iterator pos;
+  };
+
+  TimerId add(long long delayUSecs, ArFunctor *cb, ArFunctor1<TimerId> *idCB);
+  void place(Timer *timer);
+  void cascade(int level);
+  void advance(std::vector<Timer *> *fired);
+
+  ArnlMetricsRegistry *myMetrics;
+  ArMutex myMutex;
+  ArCondition myWakeCondition;
+  bool myStarted;
+  bool myManual;
+  long long myStartUSecs;
+  long long myTick;
+  TimerId myNextId;
+  std::list<Timer *> myLevels[ARNL_TIMER_WHEEL_LEVELS][ARNL_TIMER_WHEEL_SLOTS];
+  std::unordered_map<TimerId, Timer *> myTimers;
+
+  ArnlGauge *myTimersMetric;
+  ArnlCounter *myFiredMetric;
+  ArnlHistogram *myLatenessMetric;
+};
+
+#endif
@@ -0,0 +1,244 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlTourBenchmark.h"
+#include "ArServerModeGoto2.h"
+
+ArnlTourBenchmark::ArnlTourBenchmark(ArServerModeGoto2 *modeGoto, ArPathPlanningTask *pathTask,
+  ArnlMetricsRegistry *metrics) :
+  myModeGoto(modeGoto),
+  myPathTask(pathTask),
+  myDurationSecs(3600),
+  myExitWhenDone(false),
+  myRecording(false),
+  myHaveLegStart(false),
+  myAtGoal(false),
+  myTravelMSecs(0),
+  myAtGoalMSecs(0),
+  myNewGoalCB(this, &ArnlTourBenchmark::newGoal),
+  myGoalDoneCB(this, &ArnlTourBenchmark::goalDone),
+  myGoalFailedCB(this, &ArnlTourBenchmark::goalFailed),
+  myViaPointPassedCB(this, &ArnlTourBenchmark::viaPointPassed)
+{
+  myMutex.setLogName("ArnlTourBenchmark::myMutex");
+  setThreadName("ArnlTourBenchmark");
+  myGoals[0] = '\0';
+  strcpy(myReportFile, "tourBenchmark.txt");
+  // Kept by ArServerModeGoto2
+  myArrivedMetric = metrics->getCounter("goto_goals_arrived_total");
+  myFailedMetric = metrics->getCounter("goto_goals_failed_total");
+  myPassedMetric = metrics->getCounter("goto_goals_passed_total");
+  myPlanMetric = metrics->getMSecsHistogram("goto_plan_msecs");
+  myDwellMetric = metrics->getMSecsHistogram("goto_dwell_msecs");
+  myPathTask->addNewGoalCB(&myNewGoalCB);
+  myPathTask->addGoalDoneCB(&myGoalDoneCB);
+  myPathTask->addGoalFailedCB(&myGoalFailedCB);
+  myModeGoto->getViaPoints()->addPassedCB(&myViaPointPassedCB);
+}
+
+ArnlTourBenchmark::~ArnlTourBenchmark()
+{
+  stopRunning();
+  myModeGoto->getViaPoints()->remPassedCB(&myViaPointPassedCB);
+  myPathTask->remNewGoalCB(&myNewGoalCB);
+  myPathTask->remGoalDoneCB(&myGoalDoneCB);
+  myPathTask->remGoalFailedCB(&myGoalFailedCB);
+}
+
+void ArnlTourBenchmark::addToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("BenchmarkGoals", myGoals,
+		      "Goals to tour for a throughput benchmark once the server has started: a comma-separated list as for TourGoalsList (e.g. \"Goal*\"), or \"all\" to tour all goals. Empty for no benchmark.",
+		      sizeof(myGoals)),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("BenchmarkSecs", &myDurationSecs,
+		      "How long to run the benchmark tour (sec)", 1),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("BenchmarkReportFile", myReportFile,
+		      "File to write the benchmark report to",
+		      sizeof(myReportFile)),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("BenchmarkExitWhenDone", &myExitWhenDone,
+		      "Exit the server when the benchmark is done"),
+	  section, ArPriority::NORMAL);
+}
+
+bool ArnlTourBenchmark::startIfConfigured(void)
+{
+  if (myGoals[0] == '\0')
+    return false;
+  runAsync();
+  return true;
+}
+
+ArnlTourBenchmark::Totals ArnlTourBenchmark::getTotals(void)
+{
+  Totals totals;
+  totals.arrived = myArrivedMetric->get();
+  totals.failed = myFailedMetric->get();
+  totals.passed = myPassedMetric->get();
+  totals.planMSecs = myPlanMetric->getSum();
+  totals.planCount = myPlanMetric->getCount();
+  totals.dwellMSecs = myDwellMetric->getSum();
+  return totals;
+}
+
+void *ArnlTourBenchmark::runThread(void *)
+{
+  const Totals before = getTotals();
+  myMutex.lock();
+  myRecording = true;
+  myStart.setToNow();
+  myHaveLegStart = false;
+  myAtGoal = false;
+  myTravelMSecs = 0;
+  myAtGoalMSecs = 0;
+  myArrivals.clear();
+  myMutex.unlock();
+
+  ArLog::log(ArLog::Normal, "ArnlTourBenchmark: touring \"%s\" for %d sec", myGoals, myDurationSecs);
+  if (strcasecmp(myGoals, "all") == 0)
+    myModeGoto->tourGoals();
+  else if (!myModeGoto->tourGoalsInList(myGoals))
+  {
+    ArLog::log(ArLog::Terse, "ArnlTourBenchmark: Error: bad goal list \"%s\", no benchmark", myGoals);
+    myMutex.lock();
+    myRecording = false;
+    myMutex.unlock();
+    return NULL;
+  }
+
+  while (getRunning() && myStart.mSecSince() < myDurationSecs * 1000L)
+    ArUtil::sleep(100);
+
+  myMutex.lock();
+  myRecording = false;
+  const double secs = myStart.mSecSince() / 1000.0;
+  // Count the time on the last leg, or at the last goal, up to the end
+  if (myHaveLegStart)
+    myTravelMSecs += myLegStart.mSecSince();
+  if (myAtGoal)
+    myAtGoalMSecs += myArrived.mSecSince();
+  myHaveLegStart = false;
+  myAtGoal = false;
+  myMutex.unlock();
+  myModeGoto->deactivate();
+
+  const Totals after = getTotals();
+  Totals totals;
+  totals.arrived = after.arrived - before.arrived;
+  totals.failed = after.failed - before.failed;
+  totals.passed = after.passed - before.passed;
+  totals.planMSecs = after.planMSecs - before.planMSecs;
+  totals.planCount = after.planCount - before.planCount;
+  totals.dwellMSecs = after.dwellMSecs - before.dwellMSecs;
+
+  writeReport(stdout, secs, totals);
+  FILE *file = fopen(myReportFile, "w");
+  if (file != NULL)
+  {
+    writeReport(file, secs, totals);
+    fclose(file);
+    ArLog::log(ArLog::Normal, "ArnlTourBenchmark: wrote report to %s", myReportFile);
+  }
+  else
+    ArLog::log(ArLog::Terse, "ArnlTourBenchmark: Error: could not write report to %s", myReportFile);
+
+  if (myExitWhenDone && getRunning())
+    Aria::exit(0);
+  return NULL;
+}
+
+/// Path planning callback: the robot set off for a goal
+void ArnlTourBenchmark::newGoal(ArPose)
+{
+  myMutex.lock();
+  if (myRecording)
+  {
+    if (myAtGoal)
+      myAtGoalMSecs += myArrived.mSecSince();
+    myAtGoal = false;
+    myHaveLegStart = true;
+    myLegStart.setToNow();
+  }
+  myMutex.unlock();
+}
+
+void ArnlTourBenchmark::goalDone(ArPose)
+{
+  record(myPathTask->getCurrentGoalName(), "arrived");
+}
+
+void ArnlTourBenchmark::goalFailed(ArPose)
+{
+  record(myPathTask->getCurrentGoalName(), "failed");
+}
+
+void ArnlTourBenchmark::viaPointPassed(const std::string& goalName, const ArPose&)
+{
+  record(goalName, "passed");
+}
+
+void ArnlTourBenchmark::record(const std::string& goalName, const char *result)
+{
+  myMutex.lock();
+  if (!myRecording || !myHaveLegStart)
+  {
+    myMutex.unlock();
+    return;
+  }
+  Arrival arrival;
+  arrival.secs = myStart.mSecSince() / 1000.0;
+  arrival.goalName = goalName;
+  arrival.result = result;
+  arrival.legMSecs = myLegStart.mSecSince();
+  myArrivals.push_back(arrival);
+  myTravelMSecs += arrival.legMSecs;
+  myHaveLegStart = false;
+  myAtGoal = true;
+  myArrived.setToNow();
+  myMutex.unlock();
+}
+
+void ArnlTourBenchmark::writeReport(FILE *file, double secs, const Totals& totals)
+{
+  myMutex.lock();
+  const double atGoalMSecs = myAtGoalMSecs;
+  const double travelMSecs = myTravelMSecs;
+  const std::vector<Arrival> arrivals = myArrivals;
+  myMutex.unlock();
+
+  ArMapInterface *map = myPathTask->getAriaMap();
+  const long long reached = totals.arrived + totals.passed;
+  const double totalMSecs = secs * 1000;
+  const double otherMSecs = totalMSecs - travelMSecs - atGoalMSecs;
+  fprintf(file, "Tour benchmark\n");
+  fprintf(file, "  Map:             %s\n", (map != NULL && map->getFileName() != NULL) ? map->getFileName() : "(none)");
+  fprintf(file, "  Goals:           %s\n", myGoals);
+  fprintf(file, "  Duration:        %.1f sec\n", secs);
+  fprintf(file, "  Goals reached:   %lld (%lld arrived, %lld passed through), %lld failed\n",
+	  reached, totals.arrived, totals.passed, totals.failed);
+  fprintf(file, "  Goals per hour:  %.1f\n", secs > 0 ? reached * 3600 / secs : 0);
+  fprintf(file, "  Travelling:      %8.1f sec (%5.1f%%), mean %.1f sec per goal\n",
+	  travelMSecs / 1000, totalMSecs > 0 ? 100 * travelMSecs / totalMSecs : 0,
+	  arrivals.empty() ? 0 : travelMSecs / 1000 / arrivals.size());
+  fprintf(file, "  At goals:        %8.1f sec (%5.1f%%), mean %.1f sec per goal\n",
+	  atGoalMSecs / 1000, totalMSecs > 0 ? 100 * atGoalMSecs / totalMSecs : 0,
+	  arrivals.empty() ? 0 : atGoalMSecs / 1000 / arrivals.size());
+  fprintf(file, "    in tasks:      %8.1f sec\n", totals.dwellMSecs / 1000);
+  fprintf(file, "    planning:      %8.1f sec, %lld plans, mean %.0f ms\n",
+	  totals.planMSecs / 1000, totals.planCount,
+	  totals.planCount > 0 ? totals.planMSecs / totals.planCount : 0);
+  fprintf(file, "  Starting:        %8.1f sec (%5.1f%%), before the first goal was set\n",
+	  otherMSecs / 1000, totalMSecs > 0 ? 100 * otherMSecs / totalMSecs : 0);
+  fprintf(file, "\nsecs,goal,result,leg_msecs\n");
+  for (size_t i = 0; i < arrivals.size(); i++)
+    fprintf(file, "%.3f,%s,%s,%ld\n", arrivals[i].secs, arrivals[i].goalName.c_str(),
+	    arrivals[i].result, arrivals[i].legMSecs);
+}
@@ -0,0 +1,115 @@
+#ifndef ARNLTOURBENCHMARK_H
+#define ARNLTOURBENCHMARK_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "ArNetworking.h"
+#include "Arnl.h"
+#include "ArPathPlanningTask.h"
+
+#include "ArnlMetrics.h"
+
+#include <string>
+#include <vector>
+
+class ArServerModeGoto2;
+
+/**
+  Measures tour throughput: tours the given goals with ArServerModeGoto2
+  for a fixed time (normally with MobileSim and a test map), records when
+  each goal was reached, and writes a report of goals per hour and where
+  the time went, so that changes to planning parameters or task code can be
+  compared run against run.
+
+  Configured in ArConfig (section "Tour benchmark"), so the parameters can
+  also be given on the command line, e.g.:
+
+  @code
+  arnlServerWithTourCallbacks -map office.map -BenchmarkGoals "Goal*" -BenchmarkSecs 1800 -BenchmarkExitWhenDone true
+  @endcode
+
+  The report gives the time spent travelling (from each goal being set
+  until it was reached or failed), at goals (from reaching a goal until the
+  next was set), and of that, in tasks (as reported through
+  ArServerModeGoto2::getTaskFinishedCB()) and in planning
+  (ArServerModeGoto2's goto_plan_msecs metric); then each arrival as CSV.
+*/
+class ArnlTourBenchmark : public ArASyncTask
+{
+public:
+  ArnlTourBenchmark(ArServerModeGoto2 *modeGoto, ArPathPlanningTask *pathTask,
+    ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlTourBenchmark();
+
+  void addToConfig(ArConfig *config, const char *section = "Tour benchmark");
+
+  /** Start the benchmark if BenchmarkGoals is set. Call once the robot is
+   * localized and the server is running. @return true if started */
+  bool startIfConfigured(void);
+
+  virtual void *runThread(void *arg);
+
+protected:
+  /// One goal reached, passed or failed
+  struct Arrival
+  {
+    double secs;
+    std::string goalName;
+    const char *result;
+    long legMSecs;
+  };
+
+  /// Totals of ArServerModeGoto2's metrics, to subtract from those at the end
+  struct Totals
+  {
+    long long arrived, failed, passed;
+    double planMSecs;
+    long long planCount;
+    double dwellMSecs;
+  };
+
+  Totals getTotals(void);
+  void newGoal(ArPose pose);
+  void goalDone(ArPose pose);
+  void goalFailed(ArPose pose);
+  void viaPointPassed(const std::string& goalName, const ArPose& pose);
+  void record(const std::string& goalName, const char *result);
+  void writeReport(FILE *file, double secs, const Totals& totals);
+
+  ArServerModeGoto2 *myModeGoto;
+  ArPathPlanningTask *myPathTask;
+
+  char myGoals[1024];
+  int myDurationSecs;
+  char myReportFile[1024];
+  bool myExitWhenDone;
+
+  ArMutex myMutex;
+  /// Whether a benchmark is being recorded, and what of it so far (protected by myMutex)
+  bool myRecording;
+  ArTime myStart;
+  bool myHaveLegStart;
+  ArTime myLegStart;
+  bool myAtGoal;
+  ArTime myArrived;
+  double myTravelMSecs;
+  double myAtGoalMSecs;
+  std::vector<Arrival> myArrivals;
+
+  ArnlCounter *myArrivedMetric;
+  ArnlCounter *myFailedMetric;
+  ArnlCounter *myPassedMetric;
+  ArnlHistogram *myPlanMetric;
+  ArnlHistogram *myDwellMetric;
+
+  ArFunctor1C<ArnlTourBenchmark, ArPose> myNewGoalCB;
+  ArFunctor1C<ArnlTourBenchmark, ArPose> myGoalDoneCB;
+  ArFunctor1C<ArnlTourBenchmark, ArPose> myGoalFailedCB;
+  ArFunctor2C<ArnlTourBenchmark, const std::string&, const ArPose&> myViaPointPassedCB;
+};
+
+#endif
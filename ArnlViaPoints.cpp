@@ -0,0 +1,275 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlViaPoints.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <set>
+
+ArMutex ArnlViaPoints::ourViaPointsMutex;
+std::map<ArPathPlanningTask *, ArnlViaPoints *> ArnlViaPoints::ourViaPoints;
+
+ArnlViaPoints::ArnlViaPoints(ArPathPlanningTask *pathTask, ArRobot *robot, ArnlMetricsRegistry *metrics) :
+  myPathTask(pathTask),
+  myRobot(robot),
+  myEnabled(true),
+  myPassRadius(1000),
+  myCycleCB(this, &ArnlViaPoints::robotCycle),
+  myProfiledCycleCB(&myCycleCB, "ArnlViaPoints"),
+  myFirePassedCB(this, &ArnlViaPoints::firePassed),
+  myGoalEndedCB(this, &ArnlViaPoints::goalEnded),
+  myGoalInterruptedCB(this, &ArnlViaPoints::goalInterrupted)
+{
+  myMutex.setLogName("ArnlViaPoints::myMutex");
+  myFireMutex.setLogName("ArnlViaPoints::myFireMutex");
+  myMapLockStats = ArnlLockProfiler::getStats("map");
+  strcpy(myPrefix, "Via");
+  strcpy(myTag, "via");
+  myPassedMetric = metrics->getCounter("arnl_via_points_passed_total",
+    "Via-point goals the robot passed through without stopping");
+  myPathTask->addGoalDoneCB(&myGoalEndedCB);
+  myPathTask->addGoalFailedCB(&myGoalEndedCB);
+  myPathTask->addGoalInterruptedCB(&myGoalInterruptedCB);
+  myRobot->lock();
+  myRobot->addUserTask("ArnlViaPoints", 50, &myProfiledCycleCB);
+  myRobot->unlock();
+}
+
+ArnlViaPoints::~ArnlViaPoints()
+{
+  myRobot->lock();
+  myRobot->remUserTask(&myProfiledCycleCB);
+  myRobot->unlock();
+  myPathTask->remGoalDoneCB(&myGoalEndedCB);
+  myPathTask->remGoalFailedCB(&myGoalEndedCB);
+  myPathTask->remGoalInterruptedCB(&myGoalInterruptedCB);
+}
+
+ArnlViaPoints *ArnlViaPoints::getViaPoints(ArPathPlanningTask *pathTask, ArRobot *robot)
+{
+  ourViaPointsMutex.lock();
+  ArnlViaPoints *&viaPoints = ourViaPoints[pathTask];
+  if (viaPoints == NULL)
+    viaPoints = new ArnlViaPoints(pathTask, robot);
+  ourViaPointsMutex.unlock();
+  return viaPoints;
+}
+
+void ArnlViaPoints::addToConfig(ArConfig *config, const char *section)
+{
+  config->addParam(
+	  ArConfigArg("Enabled", &myEnabled,
+		      "Whether goals marked as via-points are passed through without stopping"),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("ViaPointPrefix", myPrefix,
+		      "Goals whose names start with this are via-points. Empty for none.",
+		      sizeof(myPrefix)),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("ViaPointTag", myTag,
+		      "Goals whose descriptions in the map contain this word are via-points. Empty for none.",
+		      sizeof(myTag)),
+	  section, ArPriority::NORMAL);
+  config->addParam(
+	  ArConfigArg("PassRadius", &myPassRadius,
+		      "Distance (mm) from a via-point at which the robot is considered to have passed it and the next goal is planned",
+		      0),
+	  section, ArPriority::NORMAL);
+}
+
+bool ArnlViaPoints::isViaPoint(const std::string& goalName)
+{
+  if (!myEnabled || goalName.empty())
+    return false;
+  const size_t prefixLen = strlen(myPrefix);
+  if (prefixLen > 0 && goalName.compare(0, prefixLen, myPrefix) == 0)
+    return true;
+  if (myTag[0] == '\0')
+    return false;
+  ArMapInterface *map = myPathTask->getAriaMap();
+  if (map == NULL)
+    return false;
+  bool ret = false;
+  myMapLockStats->lock(map, ARNL_LOCK_SITE);
+  ArMapObject *obj = map->findMapObject(goalName.c_str(), "Goal");
+  if (obj == NULL)
+    obj = map->findMapObject(goalName.c_str(), "GoalWithHeading");
+  if (obj != NULL)
+    ret = hasTag(obj->getDescription());
+  myMapLockStats->unlock(map);
+  return ret;
+}
+
+/// Whether @a description contains myTag as a whole word (ignoring case)
+bool ArnlViaPoints::hasTag(const char *description)
+{
+  const size_t tagLen = strlen(myTag);
+  if (description == NULL || tagLen == 0)
+    return false;
+  for (const char *p = description; *p != '\0'; p++)
+  {
+    if ((p == description || !isalnum((unsigned char)p[-1])) &&
+	strncasecmp(p, myTag, tagLen) == 0 && !isalnum((unsigned char)p[tagLen]))
+      return true;
+  }
+  return false;
+}
+
+bool ArnlViaPoints::watch(const std::string& goalName, PassedCB *cb)
+{
+  ArMapInterface *map = myPathTask->getAriaMap();
+  if (map == NULL)
+    return false;
+  myMapLockStats->lock(map, ARNL_LOCK_SITE);
+  ArMapObject *obj = map->findMapObject(goalName.c_str(), "Goal");
+  if (obj == NULL)
+    obj = map->findMapObject(goalName.c_str(), "GoalWithHeading");
+  const bool found = (obj != NULL);
+  const ArPose pose = found ? obj->getPose() : ArPose();
+  myMapLockStats->unlock(map);
+  if (!found)
+    return false;
+
+  myMutex.lock();
+  Watch& w = myWatches[cb];
+  w.goalName = goalName;
+  w.goalPose = pose;
+  myMutex.unlock();
+  ArLog::log(ArLog::Verbose, "ArnlViaPoints: passing through \"%s\"", goalName.c_str());
+  return true;
+}
+
+void ArnlViaPoints::cancel(PassedCB *cb)
+{
+  myMutex.lock();
+  myWatches.erase(cb);
+  // Nor if it was just passed
+  for (std::list<Passed>::iterator it = myPassed.begin(); it != myPassed.end(); )
+  {
+    if (it->cb == cb)
+      it = myPassed.erase(it);
+    else
+      ++it;
+  }
+  myMutex.unlock();
+  // Wait in case firePassed() is invoking it
+  myFireMutex.lock();
+  myFireMutex.unlock();
+}
+
+void ArnlViaPoints::addPassedCB(PassedCB *cb)
+{
+  myMutex.lock();
+  myPassedCBs.push_back(cb);
+  myMutex.unlock();
+}
+
+void ArnlViaPoints::remPassedCB(PassedCB *cb)
+{
+  myMutex.lock();
+  myPassedCBs.remove(cb);
+  myMutex.unlock();
+  myFireMutex.lock();
+  myFireMutex.unlock();
+}
+
+/// Robot user task: check whether the robot has come within the pass radius of the watched via-points
+void ArnlViaPoints::robotCycle(void)
+{
+  myMutex.lock();
+  if (myWatches.empty())
+  {
+    myMutex.unlock();
+    return;
+  }
+  const ArPose robotPose = myRobot->getPose();
+  bool passed = false;
+  for (std::map<PassedCB *, Watch>::iterator it = myWatches.begin(); it != myWatches.end(); )
+  {
+    if (robotPose.findDistanceTo(it->second.goalPose) > myPassRadius)
+    {
+      ++it;
+      continue;
+    }
+    Passed p;
+    p.goalName = it->second.goalName;
+    p.pose = robotPose;
+    p.cb = it->first;
+    myPassed.push_back(p);
+    myWatches.erase(it++);
+    passed = true;
+  }
+  myMutex.unlock();
+  if (passed)
+    ArnlTimerWheel::getGlobal()->scheduleAfter(0, &myFirePassedCB);
+}
+
+/// Called in the timer wheel's thread after the robot passed via-points
+void ArnlViaPoints::firePassed(void)
+{
+  // Taken one at a time, so that one cancelled while another is invoked is
+  // not invoked afterwards
+  myFireMutex.lock();
+  // A via-point watched by several owners is only counted once
+  std::set<std::string> counted;
+  for (;;)
+  {
+    myMutex.lock();
+    if (myPassed.empty())
+    {
+      myMutex.unlock();
+      break;
+    }
+    const Passed p = myPassed.front();
+    myPassed.pop_front();
+    const std::list<PassedCB *> cbs = myPassedCBs;
+    myMutex.unlock();
+
+    if (counted.insert(p.goalName).second)
+    {
+      myPassedMetric->add();
+      ArLog::log(ArLog::Normal, "ArnlViaPoints: passed \"%s\"", p.goalName.c_str());
+      for (std::list<PassedCB *>::const_iterator i = cbs.begin(); i != cbs.end(); ++i)
+	(*i)->invoke(p.goalName, p.pose);
+    }
+    p.cb->invoke(p.goalName, p.pose);
+  }
+  myFireMutex.unlock();
+}
+
+/// Path planning callback: stop watching if the via-point was reached (e.g. it was too close to pass) or failed
+void ArnlViaPoints::goalEnded(ArPose)
+{
+  const std::string goalName = myPathTask->getCurrentGoalName();
+  myMutex.lock();
+  for (std::map<PassedCB *, Watch>::iterator it = myWatches.begin(); it != myWatches.end(); )
+  {
+    if (it->second.goalName == goalName)
+      myWatches.erase(it++);
+    else
+      ++it;
+  }
+  myMutex.unlock();
+}
+
+/** Path planning callback: stop watching if the via-point was replaced by
+ * another goal. (The previous goal's interruption, when the via-point itself
+ * was planned to, may be reported after watch() was called.) */
+void ArnlViaPoints::goalInterrupted(ArPose)
+{
+  const std::string goalName = myPathTask->getCurrentGoalName();
+  myMutex.lock();
+  for (std::map<PassedCB *, Watch>::iterator it = myWatches.begin(); it != myWatches.end(); )
+  {
+    if (it->second.goalName != goalName)
+      myWatches.erase(it++);
+    else
+      ++it;
+  }
+  myMutex.unlock();
+}
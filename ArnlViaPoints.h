@@ -0,0 +1,130 @@
+#ifndef ARNLVIAPOINTS_H
+#define ARNLVIAPOINTS_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+#include "Arnl.h"
+#include "ArPathPlanningTask.h"
+
+#include "ArnlCallbackProfiler.h"
+#include "ArnlLockProfiler.h"
+#include "ArnlMetrics.h"
+#include "ArnlTimerWheel.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+/**
+  Lets the robot pass through goals which are only routing waypoints
+  ("via-points") instead of stopping at each: once the robot comes within
+  the pass radius of a via-point it is heading for, the next goal is planned
+  and the path planner replaces the via-point with it, so the robot keeps
+  moving instead of slowing to a stop at the via-point.
+
+  A goal is a via-point if its name starts with the configured prefix
+  (ViaPointPrefix, default "Via"), or if its description in the map
+  contains the configured tag (ViaPointTag, default "via") as a word.
+
+  Whatever plans a path to a via-point (ArServerModeGoto2 when touring
+  goals, ArnlASyncTask::nextGoal()) calls watch() with a callback which
+  plans the next goal. Each callback has its own watch, so that one owner
+  watching or cancelling does not end another's. The robot's distance to the via-point is checked in
+  the robot thread each cycle; when it is passed, the callbacks added with
+  addPassedCB() (for bookkeeping) and then the watch() callback are invoked
+  in the ArnlTimerWheel's thread, since planning the next path may take a
+  while.
+
+  Metrics: arnl_via_points_passed_total.
+*/
+class ArnlViaPoints
+{
+public:
+  typedef ArFunctor2<const std::string&, const ArPose&> PassedCB;
+
+  ArnlViaPoints(ArPathPlanningTask *pathTask, ArRobot *robot,
+    ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlViaPoints();
+
+  /// The via-points for @a pathTask, created the first time they are requested
+  static ArnlViaPoints *getViaPoints(ArPathPlanningTask *pathTask, ArRobot *robot);
+
+  void addToConfig(ArConfig *config, const char *section = "Via points");
+
+  /// Whether @a goalName is a via-point (false if via-points are disabled)
+  bool isViaPoint(const std::string& goalName);
+
+  /** Call after planning a path to the via-point @a goalName: when the robot
+   * comes within the pass radius, invoke @a cb with the goal name and the
+   * robot's pose. The watch ends without invoking @a cb if the path planner
+   * reaches the goal, fails or is interrupted first, or if watch() or
+   * cancel() is called again with @a cb. @return false if @a goalName is not
+   * in the map
+   */
+  bool watch(const std::string& goalName, PassedCB *cb);
+
+  /** Stop watching for the robot to pass the via-point @a cb was given for.
+   * If @a cb is being invoked in another thread, waits for it to return, so
+   * that @a cb may be destroyed afterwards.
+   */
+  void cancel(PassedCB *cb);
+
+  /// Add a callback invoked each time the robot passes a watched via-point
+  void addPassedCB(PassedCB *cb);
+  /// Like cancel(), waits for @a cb to return if it is being invoked
+  void remPassedCB(PassedCB *cb);
+
+protected:
+  void robotCycle(void);
+  void firePassed(void);
+  void goalEnded(ArPose pose);
+  void goalInterrupted(ArPose pose);
+  bool hasTag(const char *description);
+
+  ArPathPlanningTask *myPathTask;
+  ArRobot *myRobot;
+  ArnlLockStats *myMapLockStats;
+  struct Watch
+  {
+    std::string goalName;
+    ArPose goalPose;
+  };
+  struct Passed
+  {
+    std::string goalName;
+    ArPose pose;
+    PassedCB *cb;
+  };
+
+  ArMutex myMutex;
+  /// The via-points being watched for, by the callback to invoke (protected by myMutex)
+  std::map<PassedCB *, Watch> myWatches;
+  /// The via-points just passed, for firePassed() (protected by myMutex)
+  std::list<Passed> myPassed;
+  std::list<PassedCB *> myPassedCBs;
+  /** Held by firePassed() while invoking the callbacks, and taken by cancel()
+   * and remPassedCB() after they have removed theirs, to wait for it. Never
+   * locked while myMutex is. */
+  ArMutex myFireMutex;
+
+  bool myEnabled;
+  char myPrefix[64];
+  char myTag[64];
+  int myPassRadius;
+
+  ArFunctorC<ArnlViaPoints> myCycleCB;
+  ArnlProfiledFunctor myProfiledCycleCB;
+  ArFunctorC<ArnlViaPoints> myFirePassedCB;
+  ArFunctor1C<ArnlViaPoints, ArPose> myGoalEndedCB;
+  ArFunctor1C<ArnlViaPoints, ArPose> myGoalInterruptedCB;
+  ArnlCounter *myPassedMetric;
+
+  static ArMutex ourViaPointsMutex;
+  static std::map<ArPathPlanningTask *, ArnlViaPoints *> ourViaPoints;
+};
+
+#endif
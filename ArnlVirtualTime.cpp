@@ -0,0 +1,210 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "ArnlVirtualTime.h"
+
+#include <math.h>
+
+ArnlVirtualTimeExecutor::ArnlVirtualTimeExecutor(long cycleMSecs, ArnlTimerWheel *wheel) :
+  myWheel(wheel),
+  myCycleUSecs(cycleMSecs * 1000LL),
+  myCycles(0),
+  myTimersFired(0)
+{
+  ArnlClock::startVirtual();
+  myValid = myWheel->setManual(true);
+  if (!myValid)
+    ArLog::log(ArLog::Terse, "ArnlVirtualTimeExecutor: Error: the timer wheel's thread is already running");
+  myStartUSecs = ArnlClock::getUSecs();
+  myNextCycleUSecs = myStartUSecs + myCycleUSecs;
+}
+
+void ArnlVirtualTimeExecutor::addCycleCB(ArFunctor *cb)
+{
+  myCycleCBs.push_back(cb);
+}
+
+void ArnlVirtualTimeExecutor::remCycleCB(ArFunctor *cb)
+{
+  myCycleCBs.remove(cb);
+}
+
+bool ArnlVirtualTimeExecutor::run(ArRetFunctor<bool> *doneCB, long long maxMSecs)
+{
+  if (!myValid)
+    return false;
+  const long long endUSecs = ArnlClock::getUSecs() + maxMSecs * 1000;
+  ArnlClock::lockTurn();
+  // Task threads run until they wait, so that they see the same time every run
+  ArnlClock::waitForThreads();
+  while (doneCB == NULL || !doneCB->invokeR())
+  {
+    long long next = myNextCycleUSecs;
+    long long expiry;
+    if (myWheel->getNextExpiry(&expiry) && expiry < next)
+      next = expiry;
+    if (ArnlClock::getNextWakeUSecs(&expiry) && expiry < next)
+      next = expiry;
+    if (next > endUSecs)
+    {
+      ArnlClock::advanceVirtual(endUSecs);
+      ArnlClock::unlockTurn();
+      return false;
+    }
+    ArnlClock::advanceVirtual(next);
+    ArnlClock::wakeSleepers();
+    // Robot cycle first, as a timer expiring at the same time would usually see it done
+    if (next == myNextCycleUSecs)
+    {
+      myNextCycleUSecs += myCycleUSecs;
+      myCycles++;
+      for (std::list<ArFunctor *>::const_iterator i = myCycleCBs.begin(); i != myCycleCBs.end(); ++i)
+	(*i)->invoke();
+    }
+    myTimersFired += myWheel->runExpired();
+    ArnlClock::waitForThreads();
+  }
+  ArnlClock::unlockTurn();
+  return true;
+}
+
+ArnlSimulatedMotion::ArnlSimulatedMotion(ArnlVirtualTimeExecutor *executor, ArnlMetricsRegistry *metrics) :
+  ArnlMotionExecutor(metrics),
+  myExecutor(executor),
+  myTransSpeed(500),
+  myRotSpeed(100),
+  myStepEndMSecs(0)
+{
+  myExecutor->addCycleCB(&myCycleCB);
+}
+
+ArnlSimulatedMotion::~ArnlSimulatedMotion()
+{
+  myExecutor->remCycleCB(&myCycleCB);
+}
+
+void ArnlSimulatedMotion::setSpeeds(double transMMPerSec, double rotDegPerSec)
+{
+  myTransSpeed = transMMPerSec;
+  myRotSpeed = rotDegPerSec;
+}
+
+void ArnlSimulatedMotion::startStep(const ArnlMotionSequence::Step& step)
+{
+  const long long now = ArnlClock::getMSecs();
+  switch (step.type)
+  {
+  case ArnlMotionSequence::MOVE:
+    myStepEndMSecs = now + (long long)(fabs(step.value) * 1000 / myTransSpeed);
+    myStepEndPose.setPose(myPose.getX() + step.value * ArMath::cos(myPose.getTh()),
+			  myPose.getY() + step.value * ArMath::sin(myPose.getTh()),
+			  myPose.getTh());
+    break;
+  case ArnlMotionSequence::HEADING:
+    myStepEndMSecs = now + (long long)(fabs(step.value) * 1000 / myRotSpeed);
+    myStepEndPose.setPose(myPose.getX(), myPose.getY(), ArMath::addAngle(myPose.getTh(), step.value));
+    break;
+  default:
+    ArnlMotionExecutor::startStep(step);
+    break;
+  }
+}
+
+bool ArnlSimulatedMotion::stepDone(const ArnlMotionSequence::Step& step)
+{
+  if (step.type != ArnlMotionSequence::MOVE && step.type != ArnlMotionSequence::HEADING)
+    return ArnlMotionExecutor::stepDone(step);
+  if (ArnlClock::getMSecs() < myStepEndMSecs)
+    return false;
+  myPose = myStepEndPose;
+  return true;
+}
+
+ArnlSimulatedNavigation::ArnlSimulatedNavigation(ArnlSimulatedMotion *motion, ArnlTimerWheel *wheel) :
+  myMotion(motion),
+  myWheel(wheel),
+  myTravelSpeed(500),
+  myPlanMSecs(200),
+  myFailPercent(0),
+  myRandom(1),
+  myTimer(0),
+  myArriveCB(this, &ArnlSimulatedNavigation::arrive)
+{
+}
+
+ArnlSimulatedNavigation::~ArnlSimulatedNavigation()
+{
+  if (myTimer != 0)
+    myWheel->cancel(myTimer);
+}
+
+void ArnlSimulatedNavigation::addGoal(const std::string& name, const ArPose& pose)
+{
+  myGoals[name] = pose;
+}
+
+void ArnlSimulatedNavigation::setFailPercent(int percent, unsigned int seed)
+{
+  myFailPercent = percent;
+  myRandom = (seed != 0) ? seed : 1;
+}
+
+/// xorshift32: the same sequence for the same seed on every platform
+unsigned int ArnlSimulatedNavigation::random(void)
+{
+  unsigned int x = myRandom;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  myRandom = x;
+  return x;
+}
+
+bool ArnlSimulatedNavigation::pathPlanToGoal(const char *goalName)
+{
+  // Like the path planner, a new goal replaces the one being driven to
+  if (myTimer != 0)
+  {
+    myWheel->cancel(myTimer);
+    myTimer = 0;
+    invoke(myInterruptedCBs, myMotion->getPose());
+  }
+
+  std::map<std::string, ArPose>::const_iterator it = myGoals.find(goalName);
+  if (it == myGoals.end())
+  {
+    ArLog::log(ArLog::Normal, "ArnlSimulatedNavigation: no goal \"%s\"", goalName);
+    return false;
+  }
+  myGoalName = goalName;
+  myGoalPose = it->second;
+  const double dist = myMotion->getPose().findDistanceTo(myGoalPose);
+  myTimer = myWheel->scheduleAfter(myPlanMSecs + (long)(dist * 1000 / myTravelSpeed), &myArriveCB);
+  return true;
+}
+
+/// Timer callback: the robot got to the goal (or failed to)
+void ArnlSimulatedNavigation::arrive(void)
+{
+  myTimer = 0;
+  if (myFailPercent > 0 && (int)(random() % 100) < myFailPercent)
+  {
+    invoke(myFailedCBs, myMotion->getPose());
+    return;
+  }
+  // Copied, since the callbacks may request the next goal
+  const ArPose goalPose = myGoalPose;
+  myMotion->setPose(goalPose);
+  // As with ArPathPlanningTask, the callbacks see this goal as the current one
+  invoke(myDoneCBs, goalPose);
+}
+
+void ArnlSimulatedNavigation::invoke(std::list<ArFunctor1<ArPose> *>& cbs, const ArPose& pose)
+{
+  // Copied, since a callback may request the next goal or remove itself
+  const std::list<ArFunctor1<ArPose> *> copy = cbs;
+  for (std::list<ArFunctor1<ArPose> *>::const_iterator i = copy.begin(); i != copy.end(); ++i)
+    (*i)->invoke(pose);
+}
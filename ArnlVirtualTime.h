@@ -0,0 +1,179 @@
+#ifndef ARNLVIRTUALTIME_H
+#define ARNLVIRTUALTIME_H
+
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+#include "Aria.h"
+
+#include "ArnlClock.h"
+#include "ArnlGoalFuture.h"
+#include "ArnlMetrics.h"
+#include "ArnlMotionSequence.h"
+#include "ArnlPathTask.h"
+#include "ArnlTimerWheel.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+/**
+  Runs the task framework in virtual time, in one thread, so that task
+  chains can be exercised at full speed and with the same event order every
+  run, without a robot, MobileSim or real sleeps.
+
+  Creating the executor switches ArnlClock to virtual time and puts the
+  timer wheel (normally ArnlTimerWheel::getGlobal()) in manual mode. run()
+  then repeatedly advances virtual time straight to the next event, which is
+  either the next robot cycle (every @a cycleMSecs of virtual time, invoking
+  the callbacks added with addCycleCB() in the order they were added) or
+  the next timer's expiry (invoking the expired timers' callbacks, in the
+  order of their expiry). Nothing waits for real time to pass, so a 3
+  second dwell costs only the callbacks run during it.
+
+  Events run in the thread calling run(). Code under test may also block in
+  threads counted by ArnlClock (ArnlASyncTask's task threads, waiting for
+  ArnlGoalFuture::wait() or waitFor()): before each event, run() waits for
+  every counted thread to be waiting or finished, and a timed wait ends when
+  virtual time reaches its end. Other blocking (e.g. ArUtil::sleep()) goes
+  by real time and holds virtual time still until it returns.
+
+  Create the executor before anything uses the timer wheel, and leave the
+  clock virtual until the program exits: switching back to the monotonic
+  clock would move time backwards for the timers still scheduled.
+
+  ArnlSimulatedMotion and ArnlSimulatedNavigation stand in for the robot
+  (for ArnlMotionExecutor sequences) and the path planner (goal requests and
+  their done, failed and interrupted callbacks). taskChainSimulator runs the
+  example goal chain task, ArnlASyncTaskExample, against them.
+*/
+class ArnlVirtualTimeExecutor
+{
+public:
+  ArnlVirtualTimeExecutor(long cycleMSecs = 100, ArnlTimerWheel *wheel = ArnlTimerWheel::getGlobal());
+
+  /// Whether the timer wheel could be put in manual mode (false if its thread had already been started)
+  bool isValid(void) const { return myValid; }
+
+  ArnlTimerWheel *getTimerWheel(void) const { return myWheel; }
+
+  /// Invoke @a cb (not copied) at each virtual robot cycle
+  void addCycleCB(ArFunctor *cb);
+  void remCycleCB(ArFunctor *cb);
+
+  /** Process events until @a doneCB (if given) returns true, checked after
+   * each event, or @a maxMSecs of virtual time have passed.
+   * @return true if @a doneCB returned true */
+  bool run(ArRetFunctor<bool> *doneCB, long long maxMSecs);
+
+  /// Virtual time passed in run() so far
+  long long getElapsedMSecs(void) const { return (ArnlClock::getUSecs() - myStartUSecs) / 1000; }
+  unsigned long long getCycles(void) const { return myCycles; }
+  unsigned long long getTimersFired(void) const { return myTimersFired; }
+
+protected:
+  ArnlTimerWheel *myWheel;
+  bool myValid;
+  long long myCycleUSecs;
+  long long myStartUSecs;
+  long long myNextCycleUSecs;
+  std::list<ArFunctor *> myCycleCBs;
+  unsigned long long myCycles;
+  unsigned long long myTimersFired;
+};
+
+/**
+  A motion executor for a simulated robot, run by an ArnlVirtualTimeExecutor
+  cycle: MOVE and HEADING steps take the time the robot would need at the
+  set speeds and then update the simulated pose; DWELL and STATUS steps are
+  run as by ArnlMotionExecutor.
+*/
+class ArnlSimulatedMotion : public ArnlMotionExecutor
+{
+public:
+  ArnlSimulatedMotion(ArnlVirtualTimeExecutor *executor,
+    ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal());
+  virtual ~ArnlSimulatedMotion();
+
+  void setSpeeds(double transMMPerSec, double rotDegPerSec);
+
+  ArPose getPose(void) const { return myPose; }
+  void setPose(const ArPose& pose) { myPose = pose; }
+
+protected:
+  virtual void startStep(const ArnlMotionSequence::Step& step);
+  virtual bool stepDone(const ArnlMotionSequence::Step& step);
+  virtual ArPose getRobotPose(void) { return myPose; }
+
+  ArnlVirtualTimeExecutor *myExecutor;
+  ArPose myPose;
+  double myTransSpeed;
+  double myRotSpeed;
+  /// End of the current MOVE or HEADING step and the pose it ends at
+  long long myStepEndMSecs;
+  ArPose myStepEndPose;
+};
+
+/**
+  Stands in for ArPathPlanningTask (as an ArnlPathTask, e.g. for
+  ArnlASyncTask): pathPlanToGoal() reaches the named goal after the planning
+  time plus the straight line distance at the travel speed (in virtual
+  time), moving the ArnlSimulatedMotion robot there, and invokes the goal
+  done callbacks; or, for the given percentage of goals (chosen with a
+  seeded random number generator, so the same every run), fails and invokes
+  the goal failed callbacks. Requesting a goal while another is pending
+  interrupts it.
+
+  The callbacks are invoked in the timer wheel's callback, i.e. from
+  ArnlVirtualTimeExecutor::run().
+*/
+class ArnlSimulatedNavigation : public ArnlPathTask
+{
+public:
+  ArnlSimulatedNavigation(ArnlSimulatedMotion *motion, ArnlTimerWheel *wheel = ArnlTimerWheel::getGlobal());
+  virtual ~ArnlSimulatedNavigation();
+
+  void addGoal(const std::string& name, const ArPose& pose);
+  bool hasGoal(const std::string& name) const { return myGoals.find(name) != myGoals.end(); }
+
+  void setTravelSpeed(double mmPerSec) { myTravelSpeed = mmPerSec; }
+  void setPlanMSecs(long msecs) { myPlanMSecs = msecs; }
+  void setFailPercent(int percent, unsigned int seed);
+
+  /// Start for @a goalName. @return false if there is no such goal
+  virtual bool pathPlanToGoal(const char *goalName);
+
+  virtual std::string getCurrentGoalName(void) { return myGoalName; }
+
+  virtual void addGoalDoneCB(ArFunctor1<ArPose> *cb) { myDoneCBs.push_back(cb); }
+  virtual void remGoalDoneCB(ArFunctor1<ArPose> *cb) { myDoneCBs.remove(cb); }
+  virtual void addGoalFailedCB(ArFunctor1<ArPose> *cb) { myFailedCBs.push_back(cb); }
+  virtual void remGoalFailedCB(ArFunctor1<ArPose> *cb) { myFailedCBs.remove(cb); }
+  virtual void addGoalInterruptedCB(ArFunctor1<ArPose> *cb) { myInterruptedCBs.push_back(cb); }
+  virtual void remGoalInterruptedCB(ArFunctor1<ArPose> *cb) { myInterruptedCBs.remove(cb); }
+
+protected:
+  void arrive(void);
+  void invoke(std::list<ArFunctor1<ArPose> *>& cbs, const ArPose& pose);
+  unsigned int random(void);
+
+  ArnlSimulatedMotion *myMotion;
+  ArnlTimerWheel *myWheel;
+  std::map<std::string, ArPose> myGoals;
+  double myTravelSpeed;
+  long myPlanMSecs;
+  int myFailPercent;
+  unsigned int myRandom;
+
+  std::string myGoalName;
+  ArPose myGoalPose;
+  ArnlTimerWheel::TimerId myTimer;
+  ArFunctorC<ArnlSimulatedNavigation> myArriveCB;
+  std::list<ArFunctor1<ArPose> *> myDoneCBs;
+  std::list<ArFunctor1<ArPose> *> myFailedCBs;
+  std::list<ArFunctor1<ArPose> *> myInterruptedCBs;
+};
+
+#endif
@@ -8,114 +8,65 @@
 #include "ArDocking.h"
 
 #include "ArnlASyncTask.h"
-
-
-class ArnlASyncTaskExample : public virtual ArnlASyncTask
+#include "ArnlASyncTaskExample.h"
+#include "ArnlCoroutineTask.h"
+#include "ArServerModeGoto2.h"
+#include "ArnlMetrics.h"
+#include "ArnlTelemetryPublisher.h"
+#include "ArnlLocalTaskServer.h"
+#include "ArnlThreadScheduler.h"
+#include "ArnlCallbackProfiler.h"
+#include "ArnlLockProfiler.h"
+#include "ArnlTourBenchmark.h"
+#include "ArnlStartupProfiler.h"
+#include "ArnlStartupGraph.h"
+#include "ArnlCheckpoint.h"
+#include "ArnlMapCache.h"
+#include "ArnlMapSet.h"
+#include "ArnlMapDeltaServer.h"
+
+
+#ifdef ARNL_HAVE_COROUTINES
+
+/* The same task as ArnlASyncTaskExample (in ArnlASyncTaskExample.h) written
+ * as a coroutine (when built with C++20): rather than
+ * blocking a thread while the robot moves and waits, each co_await suspends
+ * the task until the movement is done or the time has passed.  It runs at
+ * goals whose names begin with "Coroutine".
+ */
+class ArnlCoroutineTaskExample : public ArnlCoroutineTask
 {
-  ArServerModeGoto *myServerMode;
-  int myCurrentGoal;
-  int myNumGoals;
   int myApproachDist;
 public:
-  ArnlASyncTaskExample(ArPathPlanningTask *pp, ArRobot *robot, ArServerModeGoto *servermode, ArArgumentParser *argParser) : 
-    ArnlAsyncTask(pp, robot, "Example ARNL Goal Task", argParser),
-    myServerMode(servermode), myCurrentGoal(1), myNumGoals(4), myApproachDist(250)
-	{	
-    // Add some parameters to ArConfig so they can be changed in MobileEyes.
-		addConfigParam(ArConfigArg("ApproachDist", &myApproachDist, "distance to approach drop point"));
-		addConfigParam(ArConfigArg("NumGoals", &myNumGoals, "number of goals in chain"));
-
-    ArLog::log(ArLog::Normal, "ArArnlASyncTaskExample created:  will perform tasks at each goal, and then send ARNL to another. ");
-	}
-
-  /* This is called at each goal point.  It moves the robot forward a bit, waits 3 seconds
-   * then backs the mobile robot up.  Then it tells the ARNL path planner to
-   * navigate to the next goal point in the chain (named Goal 0, Goal 1, Goal 2, etc.)
-   * The last goal point is special, no action and the chain of ARNL goals
-   * stops.  The robot will wait at this goal point until sent to the first
-   * goal manually from MobileEyes.
-   */
-	void runTask()
-	{
-    // Make copies of variables shared between threads 
-    lock();
-    int currentGoal = myCurrentGoal;
-    int numGoals = myNumGoals;
-    int moveDist = myApproachDist;
-    unlock();
+  ArnlCoroutineTaskExample(ArPathPlanningTask *pp, ArRobot *robot, ArArgumentParser *argParser) :
+    ArnlCoroutineTask(pp, robot, "Example ARNL Coroutine Task", argParser, "Coroutine"),
+    myApproachDist(250)
+  {
+    addConfigParam(ArConfigArg("ApproachDist", &myApproachDist, "distance to approach drop point"));
+  }
 
-		// if at end of chain, stop chain
-		if(currentGoal == numGoals)
-		{
-			ArLog::log(ArLog::Normal, "Waiting to be loaded, end of chain.");
-			if(myServerMode) myServerMode->setStatus("End of goal chain.");
-      lock();
-			myCurrentGoal = 1;
-      unlock();
-			return; // end of thread
-		}
-
-
-
-    /* In this example, we will move the robot forward a bit, wait, then move it
-       back. 
-
-       In your application, you could do somethng here like trigger devices, cameras,
-       sensors, output, speech, etc.  You can access the current goal name and
-       use that to control the activity, or use that goal name to obtain the
-       goal object from the map ArMap object which has additional properties of
-       the goal.
-    */
-
-		// move forward a bit
-		ArLog::log(ArLog::Normal, "Moving forward a bit");
-    if(myServerMode) myServerMode->setStatus("Moving forward");
-		getRobot()->clearDirectMotion();
-		getRobot()->move(moveDist);
-		waitForMoveDone();
-		getRobot()->clearDirectMotion();
-    ArUtil::sleep(500);
-
-    // Wait a bit.  
-    ArLog::log(ArLog::Normal, "Would do goal-specific task at goal %d.", currentGoal);
-    ArLog::log(ArLog::Normal, "Waiting 3 sec.");
-    if(myServerMode) myServerMode->setStatus("Waiting 3 sec");
-    ArUtil::sleep(3000);
-
-		// back up a bit
-		ArLog::log(ArLog::Normal, "Backing up a bit");
-		if(myServerMode) myServerMode->setStatus("Backing up a bit");
-		getRobot()->clearDirectMotion();
-		getRobot()->move(-moveDist);
-		waitForMoveDone();
-		getRobot()->clearDirectMotion();
-    ArUtil::sleep(500);
-
-
-		/* Go to the next goal in the chain. The name is assumed to be "Goal X"
-		   where X is the goal index number.  You could use another scheme for
-		   naming goals, or you could store a list of strings in this class
-    */
-		++currentGoal;
-		if(currentGoal > numGoals) currentGoal = 0;
-		char name[128];
-		snprintf(name, 127, "Goal %d", currentGoal); 
-		ArLog::log(ArLog::Normal, "Going to next goal %s", name);
-    if(myServerMode) myServerMode->setStatus("ASyncTask example done. Going to next goal.");
-    nextGoal(name);
-
-    // Save the new goal index
-    lock();
-    myCurrentGoal = currentGoal;
+protected:
+  virtual ArnlTaskCoroutine runCoroutine(std::string goalName, ArPose pose)
+  {
+    lock(ARNL_LOCK_SITE);
+    const int moveDist = myApproachDist;
     unlock();
 
-    // This is the end of the thread. 
-    return;
-	}
-	
-};
+    ArLog::log(ArLog::Normal, "%s: Moving forward a bit at %s", getName(), goalName.c_str());
+    co_await move(moveDist);
+    co_await sleep(500);
 
+    ArLog::log(ArLog::Normal, "%s: Waiting 3 sec.", getName());
+    co_await sleep(3000);
+
+    ArLog::log(ArLog::Normal, "%s: Backing up a bit", getName());
+    co_await move(-moveDist);
+    co_await sleep(500);
+    ArLog::log(ArLog::Normal, "%s: Done at %s", getName(), goalName.c_str());
+  }
+};
 
+#endif
 
 
 /* ------------ original arnlServer.cpp code follows -------------------- */
@@ -145,6 +96,18 @@ const char* getGyroStatusString(ArRobot* robot)
   return "OK";
 }
 
+// Parts of startup run at the same time by ArnlStartupGraph
+
+static bool connectLasers(ArLaserConnector *laserConnector)
+{
+  return laserConnector->connectLasers();
+}
+
+static bool openServer(ArServerSimpleOpener *opener, ArServerBase *server, const char *fileDir)
+{
+  return opener->open(server, fileDir, 240);
+}
+
 int main(int argc, char **argv)
 {
   // Initialize Aria and Arnl global information
@@ -158,16 +121,33 @@ int main(int argc, char **argv)
   // Parse the command line arguments.
   ArArgumentParser parser(&argc, argv);
 
+  // Time each phase of startup, and log the times once it is done. Give
+  // -startupProfileFile and -startupVariant to compare ways of starting up
+  // (see ArnlStartupProfiler).
+  ArnlStartupProfiler startupProfiler;
+  startupProfiler.parseArgs(&parser);
+
+  // Runs the parts of startup which can be done at the same time (see below)
+  ArnlStartupGraph startupGraph;
+  startupGraph.parseArgs(&parser);
+
+  // Name of the shared memory telemetry block (see ArnlTelemetryPublisher
+  // below); give each server on a computer its own with -telemetryName
+  const char *telemetryName = ARNL_TELEMETRY_DEFAULT_NAME;
+  parser.checkParameterArgumentString("-telemetryName", &telemetryName);
+
   // Set up our simpleConnector, to connect to the robot and laser
   //ArSimpleConnector simpleConnector(&parser);
   ArRobotConnector robotConnector(&parser, &robot);
 
   // Connect to the robot
+  startupProfiler.beginPhase("connect robot");
   if (!robotConnector.connectRobot())
   {
     ArLog::log(ArLog::Normal, "Error: Could not connect to robot... exiting");
     Aria::exit(3);
   }
+  startupProfiler.beginPhase("set up robot");
 
 
 
@@ -240,27 +220,26 @@ int main(int argc, char **argv)
   robot.runAsync(true);
   
 
-  // connect the laser(s) if it was requested, this adds them to the
-  // robot too, and starts them running in their own threads
-  if (!laserConnector.connectLasers())
-  {
-    ArLog::log(ArLog::Normal, "Could not connect to all lasers... exiting\n");
-    Aria::exit(2);
-  }
-
-  // find the laser we should use for localization and/or mapping,
-  // which will be the first laser
-  robot.lock();
-  ArLaser *firstLaser = robot.findLaser(1);
-  if (firstLaser == NULL || !firstLaser->isConnected())
-  {
-    ArLog::log(ArLog::Normal, "Did not have laser 1 or it is not connected, cannot start localization and/or mapping... exiting");
-    Aria::exit(2);
-  }
-  robot.unlock();
+  // Connect the lasers, open the networking server and read the map at the
+  // same time, while creating the objects which don't need them (see
+  // ArnlStartupGraph). Each is waited for before it is used.
+  ArGlobalRetFunctor1<bool, ArLaserConnector *> connectLasersCB(&connectLasers, &laserConnector);
+  ArGlobalRetFunctor3<bool, ArServerSimpleOpener *, ArServerBase *, const char *>
+    openServerCB(&openServer, &simpleOpener, &server, fileDir);
+  // Large maps are read from a binary cache beside the map file when it is
+  // up to date (see ArnlMapCache; -noMapCache to not)
+  ArnlMapCache mapCache;
+  mapCache.parseArgs(&parser);
+  ArnlMapPreloader mapPreloader(&parser, fileDir, Arnl::getTypicalParamFileName(), &mapCache);
+  const int lasersJob = startupGraph.add("connect lasers", &connectLasersCB);
+  const int serverJob = startupGraph.add("open server", &openServerCB);
+  const int mapJob = startupGraph.add("read map", mapPreloader.getReadCB());
+  startupGraph.start();
 
 
     /* Create and set up map object */
+
+  startupProfiler.beginPhase("create map and tasks");
   
   // Set up the map object, this will look for files in the examples
   // directory (unless the file name starts with a /, \, or .
@@ -276,6 +255,8 @@ int main(int argc, char **argv)
   // MobilePlanner from Windows and changes the case on a map name,
   // it will still work.
   map.setIgnoreCase(true);
+  // Cache new maps too, so they are read fast the next time
+  mapCache.watch(&map, fileDir);
 
     
     /* Create localization and path planning threads */
@@ -284,6 +265,28 @@ int main(int argc, char **argv)
   ArPathPlanningTask pathTask(&robot, &sonarDev, &map);
 
 
+  startupProfiler.beginPhase("wait for lasers");
+  // wait for the laser(s) to be connected if it was requested, this adds them
+  // to the robot too, and starts them running in their own threads
+  if (!startupGraph.wait(lasersJob))
+  {
+    ArLog::log(ArLog::Normal, "Could not connect to all lasers... exiting\n");
+    Aria::exit(2);
+  }
+
+  // find the laser we should use for localization and/or mapping,
+  // which will be the first laser
+  robot.lock();
+  ArLaser *firstLaser = robot.findLaser(1);
+  if (firstLaser == NULL || !firstLaser->isConnected())
+  {
+    ArLog::log(ArLog::Normal, "Did not have laser 1 or it is not connected, cannot start localization and/or mapping... exiting");
+    Aria::exit(2);
+  }
+  robot.unlock();
+  startupProfiler.beginPhase("create localization task");
+
+
 
   ArLog::log(ArLog::Normal, "Creating laser localization task");
   // Laser Monte-Carlo Localization
@@ -330,17 +333,15 @@ int main(int argc, char **argv)
   }
 
 
-  // Used for optional multirobot features (see below) (TODO move to multirobot
-  // example?)
-  ArClientSwitchManager clientSwitch(&server, &parser);
 
 
 
 
     /* Start the server */
 
-  // Open the networking server
-  if (!simpleOpener.open(&server, fileDir, 240))
+  startupProfiler.beginPhase("wait for server");
+  // Wait for the networking server to be opened
+  if (!startupGraph.wait(serverJob))
   {
     ArLog::log(ArLog::Normal, "Error: Could not open server.");
     exit(2);
@@ -351,6 +352,12 @@ int main(int argc, char **argv)
     /* Create various services that provide network access to clients (such as
      * MobileEyes), as well as add various additional features to ARNL */
 
+  startupProfiler.beginPhase("create server handlers");
+
+  // Used for optional multirobot features (see below) (TODO move to multirobot
+  // example?)
+  ArClientSwitchManager clientSwitch(&server, &parser);
+
 
   // ARNL can optionally get information about the positions of other robots from a
   // "central server" (see central server example program), if command
@@ -540,6 +547,10 @@ int main(int argc, char **argv)
 
   // Provide the map to the client (and related controls):
   ArServerHandlerMap serverMap(&server, &map);
+  // Fleet clients can instead get only what changed in the map since the
+  // version they have, compressed (see ArnlMapDeltaServer)
+  ArnlMapDeltaServer mapDeltaServer(&server, &map);
+  mapDeltaServer.addToConfig(Aria::getConfig(), "Map delta");
 
   // These objects add some simple (custom) commands to 'commands' for testing and debugging:
   ArServerSimpleComUC uCCommands(&commands, &robot);                   // Send any command to the microcontroller
@@ -567,10 +578,37 @@ int main(int argc, char **argv)
    */
 
   // Mode To go to a goal or other specific point:
-  ArServerModeGoto modeGoto(&server, &robot, &pathTask, &map,
+  ArServerModeGoto2 modeGoto(&server, &robot, &pathTask, &map,
 			    locTask.getRobotHome(),
 			    locTask.getRobotHomeCallback());
 
+  // Keep per-goal statistics (available with the goalStats request, and
+  // optionally written to a CSV file)
+  modeGoto.addGoalStatsToConfig(Aria::getConfig(), "Goal statistics");
+  modeGoto.addGoalStatsSimpleCommand(&commands);
+
+  // Goals which are only waypoints (see ArnlViaPoints) are passed through
+  // without stopping
+  modeGoto.getViaPoints()->addToConfig(Aria::getConfig(), "Via points");
+
+  // Optional throughput benchmark: tours the goals given by BenchmarkGoals
+  // (e.g. -BenchmarkGoals "Goal*" on the command line) once the server is
+  // running, and reports goals per hour (see ArnlTourBenchmark)
+  ArnlTourBenchmark tourBenchmark(&modeGoto, &pathTask);
+  tourBenchmark.addToConfig(Aria::getConfig(), "Tour benchmark");
+
+  // Optional warm restart: if CheckpointFile is set, where the robot is and
+  // what it is doing are saved there, and after a restart the robot is
+  // localized where it was and carries on (see ArnlCheckpoint)
+  ArnlCheckpoint checkpoint(&robot, &locTask, &pathTask, &modeGoto);
+  checkpoint.addToConfig(Aria::getConfig(), "Warm restart");
+
+  // Optional set of maps kept in memory (PreloadMaps), e.g. one per floor,
+  // which the SwitchMap command switches between at once (see ArnlMapSet)
+  ArnlMapSet mapSet(&map, fileDir, &mapCache);
+  mapSet.addToConfig(Aria::getConfig(), "Map set");
+  mapSet.addSimpleCommands(&commands);
+
 
   // Mode To stop and remain stopped:
   ArServerModeStop modeStop(&server, &robot);
@@ -630,6 +668,62 @@ int main(int argc, char **argv)
 	  "%4d");
 
 
+  // Publish some of the same values as metrics. Metrics are available to
+  // clients with the "metrics" request, and to monitoring agents on this
+  // computer over HTTP if MetricsHttpPort is set in the Metrics section of the
+  // configuration. ArServerModeGoto2 and ArnlASyncTask publish their own
+  // metrics too.
+  ArnlMetricsRegistry *metrics = ArnlMetricsRegistry::getGlobal();
+  metrics->getGauge("arnl_localization_score", "Laser localization score",
+	  new ArRetFunctorC<double, ArLocalizationTask>(
+		  &locTask, &ArLocalizationTask::getLocalizationScore));
+  metrics->getGauge("arnl_localization_samples", "Laser localization number of samples",
+	  new ArRetFunctorC<int, ArLocalizationTask>(
+		  &locTask, &ArLocalizationTask::getCurrentNumSamples));
+  metrics->getGauge("robot_motor_packets", "Motor packets received from the robot in the last second",
+	  new ArConstRetFunctorC<int, ArRobot>(&robot, &ArRobot::getMotorPacCount));
+  metrics->getGauge("server_clients", "Number of connected clients",
+	  new ArRetFunctorC<int, ArServerBase>(&server, &ArServerBase::getNumClients));
+  ArServerHandlerMetrics handlerMetrics(&server, metrics);
+  ArnlMetricsHttpServer metricsHttpServer(metrics);
+  metricsHttpServer.addToConfig(Aria::getConfig(), "Metrics");
+
+  // Publish pose, velocity, mode and goal each robot cycle in shared memory,
+  // so that other programs on this computer can read them without connecting
+  // to the server (see ArnlTelemetry.h and telemetryReaderExample.cpp).
+  ArnlTelemetryPublisher telemetryPublisher(&robot, &pathTask, &locTask, &modeGoto, telemetryName);
+  telemetryPublisher.open();
+
+  // Task programs on this computer can receive goal events and request goals
+  // through a Unix domain socket instead of ArNetworking (see
+  // ArnlRemoteASyncTask). The socket is opened once the config is loaded.
+  ArnlLocalTaskServer localTaskServer(&pathTask, &modeGoto);
+  localTaskServer.addToConfig(Aria::getConfig(), "Local tasks");
+
+  // Pin the robot, laser, localization, path planning, networking and goal
+  // task threads to CPUs and set their scheduling policies and priorities as
+  // given in the "Thread scheduling" section (applied when the config is
+  // loaded or changed).
+  ArnlThreadScheduler threadScheduler(&robot);
+  threadScheduler.addLasers(&robot);
+  threadScheduler.addThread(ArnlThreadScheduler::LOCALIZATION, &locTask, "localization");
+  threadScheduler.addThread(ArnlThreadScheduler::PATH_PLANNING, &pathTask, "pathPlanning");
+  threadScheduler.addThread(ArnlThreadScheduler::NETWORKING, &server, "server");
+  threadScheduler.addToConfig(Aria::getConfig(), "Thread scheduling");
+
+  // When enabled in the "Callback profiling" section, log which callbacks
+  // took the most time whenever a robot cycle overruns.
+  ArnlCallbackProfiler callbackProfiler(&robot, metrics);
+  callbackProfiler.addToConfig(Aria::getConfig(), "Callback profiling");
+
+  // Lock contention statistics for the map and task locks, and the robot
+  // lock where it is still taken outside the robot thread. Task threads send
+  // commands to the robot thread through ArnlRobotMailbox instead, timed by
+  // the arnl_robot_mailbox_wait_msecs histogram.
+  ArnlLockProfiler lockProfiler(&server, &commands);
+  lockProfiler.addToConfig(Aria::getConfig(), "Lock profiling");
+
+
   // Display gyro status if gyro is enabled and is being handled by the firmware (gyro types 2, 3, or 4).
   // (If the firmware detects an error communicating with the gyro or IMU it
   // returns a flag, and stops using it.)
@@ -800,11 +894,18 @@ int main(int argc, char **argv)
 
     /* Load configuration values, map, and begin! */
 
+  // Copy in the map read during startup (see ArnlMapPreloader). Loading the
+  // parameter file below still sets the map as before.
+  startupProfiler.beginPhase("wait for map");
+  startupGraph.wait(mapJob);
+  mapPreloader.apply(&map);
+
   
   // When parsing the configuration file, also look at the program's command line options 
   // from the command-line argument parser as well as the configuration file.
   // (So you can use any argument on the command line, namely -map.) 
   Aria::getConfig()->useArgumentParser(&parser);
+  startupProfiler.beginPhase("load config and map");
   puts("xxx");puts("aaa"); fflush(stdout);
   // Read in parameter files.
   ArLog::log(ArLog::Normal, "Loading config file %s into ArConfig (base directory %s)...", Arnl::getTypicalParamFileName(), Aria::getConfig()->getBaseDirectory());
@@ -813,6 +914,7 @@ int main(int argc, char **argv)
     ArLog::log(ArLog::Normal, "Trouble loading configuration file, exiting");
     Aria::exit(5);
   }
+  mapPreloader.finish();
 
   // Warn about unknown params.
   if (!simpleOpener.checkAndLog() || !parser.checkHelpAndWarnUnparsed())
@@ -857,8 +959,14 @@ int main(int argc, char **argv)
   // places the robot is likely to be at startup.   If successful, it will
   // also save the position it found to be the best localized position as the
   // "Home" position, which can be obtained from the localization task (and is
-  // used by the "Go to home" network request).
-  locTask.localizeRobotAtHomeBlocking();
+  // used by the "Go to home" network request).  After a restart, the robot
+  // is localized where it was last instead, if it still is there.
+  {
+    ArnlStartupPhase phase(&startupProfiler, "localize");
+    if (!checkpoint.restoreLocalization())
+      locTask.localizeRobotAtHomeBlocking();
+  }
+  startupProfiler.beginPhase("start server and tasks");
   
   // Let the client switch manager (for multirobot) spin off into its own thread
   // TODO move to multirobot example?
@@ -867,6 +975,9 @@ int main(int argc, char **argv)
   // Start the networking server's thread
   server.runAsync();
 
+  // Apply thread scheduling settings again now that the server thread is running
+  threadScheduler.apply();
+
 
   // Add a key handler so that you can exit by pressing
   // escape. Note that this key handler, however, prevents this program from
@@ -888,11 +999,31 @@ int main(int argc, char **argv)
  	
    ArnlASyncTaskExample asyncTaskExample(&pathTask, &robot, &modeGoto, &parser);
 
+   // Include the time the task spends at each goal in the goal statistics
+   asyncTaskExample.addTaskFinishedCB(modeGoto.getTaskFinishedCB());
+
+   // Carry on along the chain after a restart
+   ArRetFunctorC<int, ArnlASyncTaskExample> getChainGoalCB(&asyncTaskExample, &ArnlASyncTaskExample::getCurrentGoal);
+   ArFunctor1C<ArnlASyncTaskExample, int> setChainGoalCB(&asyncTaskExample, &ArnlASyncTaskExample::setCurrentGoal);
+   checkpoint.addValue("chainGoal", &getChainGoalCB, &setChainGoalCB);
+
+#ifdef ARNL_HAVE_COROUTINES
+   ArnlCoroutineTaskExample coroutineTaskExample(&pathTask, &robot, &parser);
+   coroutineTaskExample.addTaskFinishedCB(modeGoto.getTaskFinishedCB());
+#endif
+
 
 
   // Enable the motors and wait until the robot exits (disconnection, etc.) or this program is
   // canceled.
   robot.enableMotors();
+  startupProfiler.finish();
+  checkpoint.resume();
+  // Write any caches of maps read or changed (after startup, not to slow it)
+  mapCache.runAsync();
+  mapSet.runAsync();
+  mapDeltaServer.runAsync();
+  tourBenchmark.startIfConfigured();
   robot.waitForRunExit();
   Aria::exit(0);
 }
@@ -0,0 +1,275 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+/* Compares round trip times of the two ways a task program can talk to an
+ * ARNL server on the same computer: ArNetworking over loopback TCP (what
+ * ArnlRemoteASyncTask uses when given an ArClientBase) and the local task
+ * Unix domain socket (ArnlLocalTaskServer / ArnlLocalTaskClient).
+ *
+ * By default both ends run in this program: an ArServerBase with an echo
+ * request on a loopback port, and a minimal responder on a temporary socket
+ * implementing the local task protocol's ping. Give -localTaskSocket to ping
+ * the ArnlLocalTaskServer in a running ARNL server instead.
+ *
+ * Usage: localTaskLatencyBenchmark [-n count] [-port port] [-localTaskSocket path]
+ */
+
+#include "Aria.h"
+#include "ArNetworking.h"
+#include "ArnlLocalTaskClient.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <time.h>
+
+static double nowUSecs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void printStats(const char *name, std::vector<double>& usecs, int lost)
+{
+  if(usecs.empty())
+  {
+    printf("%-28s no replies\n", name);
+    return;
+  }
+  std::sort(usecs.begin(), usecs.end());
+  double sum = 0;
+  for(size_t i = 0; i < usecs.size(); ++i)
+    sum += usecs[i];
+  printf("%-28s n=%-6d mean %8.1f  p50 %8.1f  p99 %8.1f  max %8.1f usec  (%d lost)\n",
+    name, (int)usecs.size(), sum / usecs.size(), usecs[usecs.size() / 2],
+    usecs[(usecs.size() * 99) / 100], usecs.back(), lost);
+}
+
+/// Answers "ping" on a Unix domain socket like ArnlLocalTaskServer does
+class LocalPingResponder : public ArASyncTask
+{
+public:
+  LocalPingResponder() : myListenFD(-1), myClientFD(-1), myStopping(false) {}
+  ~LocalPingResponder()
+  {
+    // Joined so that the thread is not using the sockets when they are closed
+    const bool running = getRunning();
+    stopRunning();
+    // Wake the thread from accept() or read()
+    {
+      std::lock_guard<std::mutex> guard(myMutex);
+      myStopping = true;
+      if(myListenFD >= 0)
+        shutdown(myListenFD, SHUT_RDWR);
+      if(myClientFD >= 0)
+        shutdown(myClientFD, SHUT_RDWR);
+    }
+    if(running)
+      join();
+    if(myListenFD >= 0)
+    {
+      close(myListenFD);
+      unlink(myPath.c_str());
+    }
+  }
+
+  bool open(const char *path)
+  {
+    myPath = path;
+    myListenFD = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if(myListenFD < 0 || bind(myListenFD, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(myListenFD, 1) != 0)
+      return false;
+    runAsync();
+    return true;
+  }
+
+  virtual void *runThread(void *)
+  {
+    int fd = accept(myListenFD, NULL, NULL);
+    {
+      // Not kept if the destructor has already shut the sockets down
+      std::lock_guard<std::mutex> guard(myMutex);
+      if(fd >= 0 && myStopping)
+      {
+        close(fd);
+        fd = -1;
+      }
+      myClientFD = fd;
+    }
+    std::string buffer;
+    char chunk[256];
+    ssize_t n;
+    while(getRunning() && fd >= 0 && (n = read(fd, chunk, sizeof(chunk))) > 0)
+    {
+      buffer.append(chunk, n);
+      std::string::size_type eol;
+      while((eol = buffer.find('\n')) != std::string::npos)
+      {
+        std::string reply = "pong " + buffer.substr(5, eol - 5) + "\n";
+        send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+        buffer.erase(0, eol + 1);
+      }
+    }
+    if(fd >= 0)
+    {
+      std::lock_guard<std::mutex> guard(myMutex);
+      myClientFD = -1;
+      close(fd);
+    }
+    return NULL;
+  }
+
+protected:
+  int myListenFD;
+  std::string myPath;
+  std::mutex myMutex;
+  /// The connection being answered, and whether the destructor has run (protected by myMutex)
+  int myClientFD;
+  bool myStopping;
+};
+
+/// ArNetworking echo request and the client side reply handler
+class NetworkPing
+{
+public:
+  NetworkPing(ArServerBase *server, ArClientBase *client) :
+    myServer(server), myClient(client), myLastReply(0),
+    myServerCB(this, &NetworkPing::serverPing),
+    myClientCB(this, &NetworkPing::clientPong)
+  {
+    myServer->addData("benchmarkPing", "Replies with the number in the request",
+      &myServerCB, "uByte4: token", "uByte4: token", "Benchmark", "RETURN_SINGLE");
+  }
+
+  void addHandler() { myClient->addHandler("benchmarkPing", &myClientCB); }
+
+  bool ping(unsigned int token, unsigned int msecs)
+  {
+    ArNetPacket packet;
+    packet.uByte4ToBuf(token);
+    std::unique_lock<std::mutex> guard(myMutex);
+    myClient->requestOnce("benchmarkPing", &packet);
+    return myCondition.wait_for(guard, std::chrono::milliseconds(msecs),
+      [this, token] { return myLastReply == token; });
+  }
+
+protected:
+  void serverPing(ArServerClient *client, ArNetPacket *packet)
+  {
+    ArNetPacket reply;
+    reply.uByte4ToBuf(packet->bufToUByte4());
+    client->sendPacketTcp(&reply);
+  }
+
+  void clientPong(ArNetPacket *packet)
+  {
+    {
+      std::lock_guard<std::mutex> guard(myMutex);
+      myLastReply = packet->bufToUByte4();
+    }
+    myCondition.notify_all();
+  }
+
+  ArServerBase *myServer;
+  ArClientBase *myClient;
+  /// Waited on with myCondition, so that a reply just before waiting is not missed
+  std::mutex myMutex;
+  std::condition_variable myCondition;
+  unsigned int myLastReply;
+  ArFunctor2C<NetworkPing, ArServerClient *, ArNetPacket *> myServerCB;
+  ArFunctor1C<NetworkPing, ArNetPacket *> myClientCB;
+};
+
+int main(int argc, char **argv)
+{
+  Aria::init();
+  ArArgumentParser parser(&argc, argv);
+  parser.loadDefaultArguments();
+
+  int count = 2000;
+  int port = 7373;
+  const char *localTaskSocket = NULL;
+  parser.checkParameterArgumentInteger("-n", &count);
+  parser.checkParameterArgumentInteger("-port", &port);
+  parser.checkParameterArgumentString("-localTaskSocket", &localTaskSocket);
+  if(!parser.checkHelpAndWarnUnparsed())
+  {
+    printf("Usage: localTaskLatencyBenchmark [-n count] [-port port] [-localTaskSocket path]\n");
+    Aria::exit(1);
+  }
+  ArLog::init(ArLog::StdOut, ArLog::Terse);
+
+  // ArNetworking over loopback TCP
+  ArServerBase server(false);
+  ArClientBase client;
+  NetworkPing networkPing(&server, &client);
+  if(!server.open(port, "127.0.0.1"))
+  {
+    printf("Could not open ArNetworking server on port %d\n", port);
+    Aria::exit(2);
+  }
+  server.runAsync();
+  if(!client.blockingConnect("127.0.0.1", port, false))
+  {
+    printf("Could not connect ArNetworking client to port %d\n", port);
+    Aria::exit(2);
+  }
+  networkPing.addHandler();
+  client.runAsync();
+
+  // Local task socket
+  LocalPingResponder responder;
+  char tmpPath[64];
+  if(localTaskSocket == NULL)
+  {
+    snprintf(tmpPath, sizeof(tmpPath), "/tmp/localTaskLatencyBenchmark.%d.sock", (int)getpid());
+    if(!responder.open(tmpPath))
+    {
+      printf("Could not open local socket %s\n", tmpPath);
+      Aria::exit(2);
+    }
+    localTaskSocket = tmpPath;
+  }
+  ArnlLocalTaskClient localClient;
+  if(!localClient.connect(localTaskSocket))
+  {
+    printf("Could not connect to local task socket %s\n", localTaskSocket);
+    Aria::exit(2);
+  }
+
+  // Alternate between the transports so that both see the same system load
+  std::vector<double> networkUSecs, localUSecs;
+  int networkLost = 0, localLost = 0;
+  for(int i = 1; i <= count; ++i)
+  {
+    double start = nowUSecs();
+    if(networkPing.ping(i, 1000))
+      networkUSecs.push_back(nowUSecs() - start);
+    else
+      ++networkLost;
+
+    start = nowUSecs();
+    if(localClient.ping(i) && localClient.waitForPong(i, 1000))
+      localUSecs.push_back(nowUSecs() - start);
+    else
+      ++localLost;
+  }
+
+  printf("Round trip times over %d requests:\n", count);
+  printStats("ArNetworking loopback TCP", networkUSecs, networkLost);
+  printStats("Local task socket", localUSecs, localLost);
+
+  client.disconnect();
+  Aria::exit(0);
+  return 0;
+}
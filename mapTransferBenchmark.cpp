@@ -0,0 +1,325 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+/* Measures the bytes and time it takes an ArNetworking client to get an
+ * ARNL server's map, and to get it again each time it changes, both the
+ * way MobileEyes does (ArServerHandlerMap's getMap, the whole map as text
+ * every time) and with ArnlMapDeltaServer's getMapDelta (only the changes
+ * since the client's version, compressed). Start the server first (e.g.
+ * arnlServerWithTourCallbacks), then:
+ *
+ *   mapTransferBenchmark -changes 3
+ *
+ * and change the map 3 times while it waits, e.g. by editing it in
+ * MobilePlanner and sending it to the robot, or with the SwitchMap simple
+ * command. After each change both requests are made again and their sizes
+ * printed. The bytes counted are those of the reply packets, headers
+ * included.
+ *
+ * With -out, the map as put together from the getMapDelta replies is
+ * written to a file at the end, to compare with the server's map file.
+ *
+ * Usage: mapTransferBenchmark [-host host] [-port port] [-user user] [-password password]
+ *   [-changes n] [-waitSecs n] [-out file]
+ */
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include "ArnlMapDelta.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <time.h>
+
+static double nowMSecs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+class MapTransferClient
+{
+public:
+  MapTransferClient() :
+    myEpoch(0), myVersion(0), myUpdatedVersion(0), myDone(false), myBytes(0),
+    myReplyKind(ArnlMapDelta::REPLY_NO_MAP),
+    myGetMapCB(this, &MapTransferClient::handleGetMap),
+    myGetMapDeltaCB(this, &MapTransferClient::handleGetMapDelta),
+    myMapDeltaUpdatedCB(this, &MapTransferClient::handleMapDeltaUpdated)
+  {
+  }
+
+  bool connect(const char *host, int port, const char *user, const char *password)
+  {
+    if(!myClient.blockingConnect(host, port, false, user, password))
+      return false;
+    if(!myClient.dataExists("getMapDelta"))
+    {
+      printf("Server has no getMapDelta request (it needs an ArnlMapDeltaServer)\n");
+      return false;
+    }
+    myClient.addHandler("getMap", &myGetMapCB);
+    myClient.addHandler("getMapDelta", &myGetMapDeltaCB);
+    myClient.addHandler("mapDeltaUpdated", &myMapDeltaUpdatedCB);
+    myClient.runAsync();
+    // Only sent when the server broadcasts it
+    myClient.request("mapDeltaUpdated", -1);
+    return true;
+  }
+
+  void disconnect()
+  {
+    myClient.disconnect();
+  }
+
+  /// Get the whole map as MobileEyes does. @return false if it did not all arrive
+  bool getMap(size_t *bytes, double *msecs)
+  {
+    return timedRequest("getMap", NULL, bytes, msecs);
+  }
+
+  /** Get the changes since the version we have (the whole map the first
+   * time) and apply them to myContents, giving what the reply held in @a
+   * kind (an ArnlMapDelta::ReplyKind). @return false if it did not all
+   * arrive, could not be applied, or the server could not make it */
+  bool getMapDelta(size_t *bytes, double *msecs, int *kind)
+  {
+    ArNetPacket packet;
+    packet.uByte4ToBuf(myEpoch);
+    packet.uByte4ToBuf(myVersion);
+    if(!timedRequest("getMapDelta", &packet, bytes, msecs))
+      return false;
+    std::lock_guard<std::mutex> guard(myMutex);
+    *kind = myReplyKind;
+    if(myReplyKind == ArnlMapDelta::REPLY_NO_MAP)
+      // Nothing to apply: keep asking from the version we have
+      return true;
+    if(myReplyKind != ArnlMapDelta::REPLY_CHANGES && myReplyKind != ArnlMapDelta::REPLY_FULL)
+      return false;
+    std::string payload;
+    if(!ArnlMapDelta::uncompress(myCompressed, myPayloadBytes, &payload) ||
+       !ArnlMapDelta::apply(payload, &myContents))
+      return false;
+    myEpoch = myReplyEpoch;
+    myVersion = myReplyVersion;
+    return true;
+  }
+
+  /// Wait for the server to say the map changed. @return false if it did not in @a secs
+  bool waitForUpdate(int secs)
+  {
+    const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(secs);
+    std::unique_lock<std::mutex> guard(myMutex);
+    // Waking every 100 ms to notice a disconnection
+    while(myUpdatedVersion <= myVersion && std::chrono::steady_clock::now() < deadline &&
+	  myClient.isConnected())
+      myCondition.wait_for(guard, std::chrono::milliseconds(100));
+    return myUpdatedVersion > myVersion;
+  }
+
+  unsigned int getVersion() const { return myVersion; }
+  const ArnlMapContents& getContents() const { return myContents; }
+
+protected:
+  bool timedRequest(const char *name, ArNetPacket *packet, size_t *bytes, double *msecs)
+  {
+    std::unique_lock<std::mutex> guard(myMutex);
+    myDone = false;
+    myBytes = 0;
+    const double start = nowMSecs();
+    myClient.requestOnce(name, packet);
+    const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while(!myDone && std::chrono::steady_clock::now() < deadline && myClient.isConnected())
+      myCondition.wait_for(guard, std::chrono::milliseconds(100));
+    const bool ok = myDone;
+    *bytes = myBytes;
+    guard.unlock();
+    *msecs = nowMSecs() - start;
+    return ok;
+  }
+
+  /// One or more lines of the map in each packet, ending with an empty line
+  void handleGetMap(ArNetPacket *packet)
+  {
+    char buf[4096];
+    bool end = false;
+    while(packet->getDataReadLength() < packet->getDataLength() && !end)
+    {
+      packet->bufToStr(buf, sizeof(buf));
+      end = (buf[0] == '\0');
+    }
+    if(packet->getDataLength() == 0)
+      end = true;
+    {
+      std::lock_guard<std::mutex> guard(myMutex);
+      myBytes += packet->getLength();
+      if(end)
+	myDone = true;
+    }
+    if(end)
+      myCondition.notify_all();
+  }
+
+  void handleGetMapDelta(ArNetPacket *packet)
+  {
+    std::unique_lock<std::mutex> guard(myMutex);
+    myReplyEpoch = packet->bufToUByte4();
+    myReplyVersion = packet->bufToUByte4();
+    myReplyKind = packet->bufToUByte();
+    myPayloadBytes = packet->bufToUByte4();
+    const unsigned int compressedBytes = packet->bufToUByte4();
+    const unsigned int offset = packet->bufToUByte4();
+    const unsigned int len = packet->bufToUByte2();
+    if(offset == 0)
+      myCompressed.clear();
+    if(len > 0)
+    {
+      std::string data(len, '\0');
+      packet->bufToData(&data[0], len);
+      myCompressed += data;
+    }
+    myBytes += packet->getLength();
+    const bool end = (offset + len >= compressedBytes);
+    if(end)
+      myDone = true;
+    guard.unlock();
+    if(end)
+      myCondition.notify_all();
+  }
+
+  void handleMapDeltaUpdated(ArNetPacket *packet)
+  {
+    {
+      std::lock_guard<std::mutex> guard(myMutex);
+      packet->bufToUByte4();
+      myUpdatedVersion = packet->bufToUByte4();
+    }
+    myCondition.notify_all();
+  }
+
+  ArClientBase myClient;
+  /// Waited on with myCondition, so that a reply between checking and waiting is not missed
+  std::mutex myMutex;
+  std::condition_variable myCondition;
+  ArnlMapContents myContents;
+  unsigned int myEpoch;
+  unsigned int myVersion;
+  unsigned int myUpdatedVersion;
+  // The reply being received
+  bool myDone;
+  size_t myBytes;
+  unsigned int myReplyEpoch;
+  unsigned int myReplyVersion;
+  int myReplyKind;
+  size_t myPayloadBytes;
+  std::string myCompressed;
+  ArFunctor1C<MapTransferClient, ArNetPacket *> myGetMapCB;
+  ArFunctor1C<MapTransferClient, ArNetPacket *> myGetMapDeltaCB;
+  ArFunctor1C<MapTransferClient, ArNetPacket *> myMapDeltaUpdatedCB;
+};
+
+/// Get the map both ways and print what each took. @return false if either failed
+static bool measure(MapTransferClient *client, size_t *getMapTotal, size_t *deltaTotal)
+{
+  const unsigned int before = client->getVersion();
+  size_t bytes;
+  double msecs;
+  int kind;
+  if(!client->getMap(&bytes, &msecs))
+  {
+    printf("  getMap: no complete reply\n");
+    return false;
+  }
+  printf("  getMap (as MobileEyes does)    %10lu bytes %8.1f ms\n", (unsigned long)bytes, msecs);
+  *getMapTotal += bytes;
+  if(!client->getMapDelta(&bytes, &msecs, &kind))
+  {
+    printf("  getMapDelta: no complete reply, it could not be applied, or the server could not make it\n");
+    return false;
+  }
+  const bool full = (kind == ArnlMapDelta::REPLY_FULL);
+  printf("  getMapDelta (%-16s) %10lu bytes %8.1f ms\n",
+	 full ? "whole map" : kind == ArnlMapDelta::REPLY_NO_MAP ? "no map yet" : "changes",
+	 (unsigned long)bytes, msecs);
+  *deltaTotal += bytes;
+  if(before != 0 && kind == ArnlMapDelta::REPLY_CHANGES)
+    printf("  (version %u to %u)\n", before, client->getVersion());
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  Aria::init();
+  ArArgumentParser parser(&argc, argv);
+  parser.loadDefaultArguments();
+
+  const char *host = "localhost";
+  int port = 7272;
+  const char *user = NULL;
+  const char *password = NULL;
+  int changes = 1;
+  int waitSecs = 300;
+  const char *out = NULL;
+  parser.checkParameterArgumentString("-host", &host);
+  parser.checkParameterArgumentInteger("-port", &port);
+  parser.checkParameterArgumentString("-user", &user);
+  parser.checkParameterArgumentString("-password", &password);
+  parser.checkParameterArgumentInteger("-changes", &changes);
+  parser.checkParameterArgumentInteger("-waitSecs", &waitSecs);
+  parser.checkParameterArgumentString("-out", &out);
+  if(!parser.checkHelpAndWarnUnparsed() || changes < 0)
+  {
+    printf("Usage: mapTransferBenchmark [-host host] [-port port] [-user user] [-password password]\n"
+	   "  [-changes n] [-waitSecs n] [-out file]\n");
+    Aria::exit(1);
+  }
+  ArLog::init(ArLog::StdOut, ArLog::Terse);
+
+  MapTransferClient client;
+  if(!client.connect(host, port, user, password))
+  {
+    printf("Could not connect to %s:%d\n", host, port);
+    Aria::exit(2);
+  }
+
+  size_t getMapTotal = 0;
+  size_t deltaTotal = 0;
+  printf("Whole map:\n");
+  if(!measure(&client, &getMapTotal, &deltaTotal))
+    Aria::exit(3);
+  int measured = 0;
+  for(; measured < changes; ++measured)
+  {
+    printf("Waiting up to %d sec for the map to change (%d of %d)...\n", waitSecs, measured + 1, changes);
+    if(!client.waitForUpdate(waitSecs))
+    {
+      printf("The map did not change\n");
+      break;
+    }
+    printf("Map changed:\n");
+    if(!measure(&client, &getMapTotal, &deltaTotal))
+      break;
+  }
+
+  printf("Total for the map and %d changes: getMap %lu bytes, getMapDelta %lu bytes (%.1f%%)\n",
+	 measured, (unsigned long)getMapTotal, (unsigned long)deltaTotal,
+	 getMapTotal > 0 ? 100.0 * deltaTotal / getMapTotal : 0.0);
+  if(out != NULL)
+  {
+    if(client.getContents().writeFile(out))
+      printf("Wrote the map from getMapDelta to %s\n", out);
+    else
+      printf("Could not write %s\n", out);
+  }
+  client.disconnect();
+  Aria::exit(0);
+  return 0;
+}
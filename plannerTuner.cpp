@@ -0,0 +1,536 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+/* Tunes ARNL's ArConfig parameters (path planning, motion, etc.) by running
+ * the tour benchmark (see ArnlTourBenchmark) with different values: each
+ * trial starts its own MobileSim and example server, with the parameters to
+ * try given on the server's command line, tours the goals for a fixed time,
+ * and is scored from the goals per hour and failures in its report. Several
+ * trials run at once, each with its own simulator and ports, local task
+ * socket and telemetry block (so a -server other than the examples must
+ * take -telemetryName), and with no metrics port or checkpoint file. At the
+ * end the best parameters are written as an ArConfig file section, to merge
+ * into arnl.p.
+ *
+ * The parameters to tune are given in a file in the same form as ArConfig
+ * files, with a range and step instead of each value:
+ *
+ *   ; Parameters to tune: name min max step
+ *   Section Path planning
+ *   MaxSpeed 500 1500 250
+ *   PlanRes 50 150 25
+ *   Section Robot config
+ *   TransAccel 300 900 200
+ *
+ * With -search grid every combination is tried (unless there are more than
+ * -trials, in which case -search random is used instead); with -search
+ * random, -trials combinations are picked at random (by -seed). Trial 0 is
+ * always run with no parameters given, as a baseline.
+ *
+ * Each trial is scored as its goals per hour less -failPenalty times its
+ * failures per hour, so that with the default of 5, one failed goal costs as
+ * much as five reached. All results are written to -outDir/results.csv, and
+ * the best parameters to -output.
+ *
+ * Usage: plannerTuner -space file -map file [-goals list] [-secs n]
+ *   [-search grid|random] [-trials n] [-jobs n] [-seed n] [-failPenalty n]
+ *   [-server command] [-serverArgs args] [-sim command] [-simStartSecs n]
+ *   [-simPort port] [-serverPort port] [-outDir dir] [-output file]
+ */
+
+#include "Aria.h"
+
+#include <errno.h>
+#include <math.h>
+#include <set>
+#include <signal.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+/// One ArConfig parameter to tune, and the values to try
+struct TunedParam
+{
+  std::string section;
+  std::string name;
+  double min, max, step;
+  int numValues() const { return step > 0 ? (int)floor((max - min) / step + 1e-9) + 1 : 1; }
+  double value(int i) const { return min + i * step; }
+};
+
+/// One set of values to try, and how it did
+struct Trial
+{
+  int index;
+  /// Index into each TunedParam's values, or empty for the baseline
+  std::vector<int> values;
+  bool done;
+  double goalsPerHour;
+  long long reached, failed;
+  double secs;
+  double score;
+};
+
+/// A simulator and server running a trial
+struct Slot
+{
+  int trial;
+  pid_t sim, server;
+  ArTime simStarted, serverStarted;
+  bool interrupted;
+};
+
+/** Read the parameter space from @a fileName, in the form of an ArConfig
+ * file with "name min max step" for each parameter. @return false on error */
+static bool parseSpace(const char *fileName, std::vector<TunedParam>& params)
+{
+  FILE *file = fopen(fileName, "r");
+  if(file == NULL)
+  {
+    printf("Could not open parameter space file %s\n", fileName);
+    return false;
+  }
+  std::string section;
+  char line[1024];
+  int lineNum = 0;
+  bool ok = true;
+  while(fgets(line, sizeof(line), file) != NULL)
+  {
+    lineNum++;
+    char *p = line;
+    while(*p == ' ' || *p == '\t')
+      p++;
+    p[strcspn(p, ";\r\n")] = '\0';
+    if(*p == '\0')
+      continue;
+    if(strncasecmp(p, "Section ", 8) == 0)
+    {
+      section = p + 8;
+      while(!section.empty() && (section[section.size() - 1] == ' ' || section[section.size() - 1] == '\t'))
+	section.erase(section.size() - 1);
+      continue;
+    }
+    char name[256];
+    TunedParam param;
+    if(sscanf(p, "%255s %lf %lf %lf", name, &param.min, &param.max, &param.step) != 4 ||
+       param.max < param.min || param.step < 0)
+    {
+      printf("%s:%d: expected \"name min max step\"\n", fileName, lineNum);
+      ok = false;
+      continue;
+    }
+    param.section = section;
+    param.name = name;
+    params.push_back(param);
+  }
+  fclose(file);
+  if(ok && params.empty())
+  {
+    printf("No parameters to tune in %s\n", fileName);
+    ok = false;
+  }
+  return ok;
+}
+
+/// Quote @a s for sh
+static std::string quote(const std::string& s)
+{
+  std::string quoted = "'";
+  for(size_t i = 0; i < s.size(); ++i)
+  {
+    if(s[i] == '\'')
+      quoted += "'\\''";
+    else
+      quoted += s[i];
+  }
+  return quoted + "'";
+}
+
+/// Start @a command with sh, with its output to @a logFile. @return its pid, or -1
+static pid_t start(const std::string& command, const std::string& logFile)
+{
+  const std::string line = "exec " + command + " > " + quote(logFile) + " 2>&1 < /dev/null";
+  pid_t pid = fork();
+  if(pid == 0)
+  {
+    execl("/bin/sh", "sh", "-c", line.c_str(), (char *)NULL);
+    _exit(127);
+  }
+  if(pid < 0)
+    printf("Could not start %s: %s\n", command.c_str(), strerror(errno));
+  return pid;
+}
+
+/// Stop @a pid: SIGTERM, then SIGKILL if it has not exited after a few seconds
+static void stop(pid_t pid)
+{
+  if(pid <= 0)
+    return;
+  kill(pid, SIGTERM);
+  for(int i = 0; i < 50; ++i)
+  {
+    if(waitpid(pid, NULL, WNOHANG) != 0)
+      return;
+    ArUtil::sleep(100);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+}
+
+/// Read the totals from an ArnlTourBenchmark report. @return false if it is incomplete
+static bool readReport(const std::string& fileName, Trial *trial)
+{
+  FILE *file = fopen(fileName.c_str(), "r");
+  if(file == NULL)
+    return false;
+  bool haveReached = false, haveRate = false, haveSecs = false;
+  char line[1024];
+  while(fgets(line, sizeof(line), file) != NULL)
+  {
+    const char *colon = strchr(line, ':');
+    if(colon == NULL)
+      continue;
+    if(strstr(line, "Goals reached:") != NULL)
+    {
+      // "N (A arrived, P passed through), F failed"
+      trial->reached = strtoll(colon + 1, NULL, 10);
+      const char *failed = strstr(colon, "), ");
+      trial->failed = failed != NULL ? strtoll(failed + 3, NULL, 10) : 0;
+      haveReached = true;
+    }
+    else if(strstr(line, "Goals per hour:") != NULL)
+    {
+      trial->goalsPerHour = atof(colon + 1);
+      haveRate = true;
+    }
+    else if(strstr(line, "Duration:") != NULL)
+    {
+      trial->secs = atof(colon + 1);
+      haveSecs = true;
+    }
+  }
+  fclose(file);
+  return haveReached && haveRate && haveSecs;
+}
+
+/// Generate the parameter values of the trials after the baseline
+static void makeTrials(const std::vector<TunedParam>& params, bool grid, int maxTrials,
+		       unsigned int seed, std::vector<Trial>& trials)
+{
+  double gridSize = 1;
+  for(size_t p = 0; p < params.size(); ++p)
+    gridSize *= params[p].numValues();
+  if(grid && gridSize > maxTrials)
+  {
+    printf("The grid has %.0f combinations, more than %d trials: searching at random instead\n",
+	   gridSize, maxTrials);
+    grid = false;
+  }
+  // Random trials are all different, so there can be no more of them than the grid has
+  const int count = (grid || gridSize < maxTrials) ? (int)gridSize : maxTrials;
+
+  std::set<std::vector<int> > tried;
+  unsigned int random = seed != 0 ? seed : 1;
+  for(int i = 0; i < count; ++i)
+  {
+    Trial trial;
+    trial.index = (int)trials.size();
+    trial.done = false;
+    trial.goalsPerHour = trial.secs = trial.score = 0;
+    trial.reached = trial.failed = 0;
+    trial.values.resize(params.size());
+    if(grid)
+    {
+      // Mixed-radix count through every combination
+      int n = i;
+      for(size_t p = 0; p < params.size(); ++p)
+      {
+	trial.values[p] = n % params[p].numValues();
+	n /= params[p].numValues();
+      }
+    }
+    else
+    {
+      do
+      {
+	for(size_t p = 0; p < params.size(); ++p)
+	{
+	  // xorshift32, for the same trials from the same seed everywhere
+	  random ^= random << 13;
+	  random ^= random >> 17;
+	  random ^= random << 5;
+	  trial.values[p] = random % params[p].numValues();
+	}
+      } while(!tried.insert(trial.values).second);
+    }
+    trials.push_back(trial);
+  }
+}
+
+static std::string describe(const std::vector<TunedParam>& params, const Trial& trial)
+{
+  if(trial.values.empty())
+    return "(baseline)";
+  std::string s;
+  char buf[256];
+  for(size_t p = 0; p < params.size(); ++p)
+  {
+    snprintf(buf, sizeof(buf), "%s%s=%g", p > 0 ? " " : "", params[p].name.c_str(),
+	     params[p].value(trial.values[p]));
+    s += buf;
+  }
+  return s;
+}
+
+int main(int argc, char **argv)
+{
+  Aria::init();
+  ArArgumentParser parser(&argc, argv);
+  parser.loadDefaultArguments();
+
+  const char *spaceFile = NULL;
+  const char *map = NULL;
+  const char *goals = "all";
+  int secs = 600;
+  const char *search = "random";
+  int maxTrials = 50;
+  int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN) / 2;
+  int seed = 1;
+  double failPenalty = 5;
+  const char *server = "./arnlServerWithTourCallbacks";
+  const char *serverArgs = "";
+  const char *sim = "MobileSim --nogui --noninteractive";
+  int simStartSecs = 3;
+  int simPort = 8101;
+  int serverPort = 7300;
+  const char *outDir = "plannerTuner";
+  const char *output = "tunedParams.p";
+  parser.checkParameterArgumentString("-space", &spaceFile);
+  parser.checkParameterArgumentString("-map", &map);
+  parser.checkParameterArgumentString("-goals", &goals);
+  parser.checkParameterArgumentInteger("-secs", &secs);
+  parser.checkParameterArgumentString("-search", &search);
+  parser.checkParameterArgumentInteger("-trials", &maxTrials);
+  parser.checkParameterArgumentInteger("-jobs", &jobs);
+  parser.checkParameterArgumentInteger("-seed", &seed);
+  parser.checkParameterArgumentDouble("-failPenalty", &failPenalty);
+  parser.checkParameterArgumentString("-server", &server);
+  parser.checkParameterArgumentString("-serverArgs", &serverArgs);
+  parser.checkParameterArgumentString("-sim", &sim);
+  parser.checkParameterArgumentInteger("-simStartSecs", &simStartSecs);
+  parser.checkParameterArgumentInteger("-simPort", &simPort);
+  parser.checkParameterArgumentInteger("-serverPort", &serverPort);
+  parser.checkParameterArgumentString("-outDir", &outDir);
+  parser.checkParameterArgumentString("-output", &output);
+  const bool grid = search != NULL && strcasecmp(search, "grid") == 0;
+  if(!parser.checkHelpAndWarnUnparsed() || spaceFile == NULL || map == NULL || secs < 1 ||
+     maxTrials < 1 || (!grid && (search == NULL || strcasecmp(search, "random") != 0)))
+  {
+    printf("Usage: plannerTuner -space file -map file [-goals list] [-secs n]\n"
+	   "  [-search grid|random] [-trials n] [-jobs n] [-seed n] [-failPenalty n]\n"
+	   "  [-server command] [-serverArgs args] [-sim command] [-simStartSecs n]\n"
+	   "  [-simPort port] [-serverPort port] [-outDir dir] [-output file]\n");
+    Aria::exit(1);
+  }
+  ArLog::init(ArLog::StdOut, ArLog::Terse);
+  if(jobs < 1)
+    jobs = 1;
+
+  std::vector<TunedParam> params;
+  if(!parseSpace(spaceFile, params))
+    Aria::exit(2);
+  if(mkdir(outDir, 0777) != 0 && errno != EEXIST)
+  {
+    printf("Could not create %s: %s\n", outDir, strerror(errno));
+    Aria::exit(2);
+  }
+
+  std::vector<Trial> trials(1);
+  trials[0].index = 0;
+  trials[0].done = false;
+  trials[0].goalsPerHour = trials[0].secs = trials[0].score = 0;
+  trials[0].reached = trials[0].failed = 0;
+  makeTrials(params, grid, maxTrials, (unsigned int)seed, trials);
+  // The server exits after its report; allow for it starting up and localizing
+  const long timeoutMSecs = (secs + 120) * 1000L;
+  printf("%d trials of %d sec, %d at a time, about %.1f hours\n", (int)trials.size(), secs, jobs,
+	 ceil((double)trials.size() / jobs) * (secs + simStartSecs + 30) / 3600);
+
+  const std::string resultsFile = std::string(outDir) + "/results.csv";
+  FILE *results = fopen(resultsFile.c_str(), "w");
+  if(results == NULL)
+  {
+    printf("Could not write %s\n", resultsFile.c_str());
+    Aria::exit(2);
+  }
+  fprintf(results, "trial");
+  for(size_t p = 0; p < params.size(); ++p)
+    fprintf(results, ",%s", params[p].name.c_str());
+  fprintf(results, ",secs,reached,failed,goals_per_hour,score\n");
+  fflush(results);
+
+  std::vector<Slot> slots(jobs);
+  for(int s = 0; s < jobs; ++s)
+  {
+    slots[s].trial = -1;
+    slots[s].sim = slots[s].server = 0;
+    slots[s].interrupted = false;
+  }
+  size_t nextTrial = 0;
+  int running = 0;
+  int best = -1;
+  while(nextTrial < trials.size() || running > 0)
+  {
+    for(int s = 0; s < jobs; ++s)
+    {
+      Slot& slot = slots[s];
+      char buf[64];
+      if(slot.trial < 0 && nextTrial < trials.size())
+      {
+	// Start the simulator, and the server once it has had time to start
+	slot.trial = (int)nextTrial++;
+	slot.server = 0;
+	slot.interrupted = false;
+	snprintf(buf, sizeof(buf), " --port %d", simPort + s);
+	const std::string command = std::string(sim) + " --map " + quote(map) + buf;
+	snprintf(buf, sizeof(buf), "/trial%d.sim.log", slot.trial);
+	slot.sim = start(command, outDir + std::string(buf));
+	slot.simStarted.setToNow();
+	running++;
+	if(slot.sim < 0)
+	{
+	  slot.sim = 0;
+	  slot.server = -1;
+	}
+      }
+      else if(slot.trial >= 0 && slot.server == 0 &&
+	      slot.simStarted.mSecSince() >= simStartSecs * 1000L)
+      {
+	const Trial& trial = trials[slot.trial];
+	char portArgs[256];
+	snprintf(portArgs, sizeof(portArgs), " -remoteHost localhost -remoteRobotTcpPort %d -serverPort %d",
+		 simPort + s, serverPort + s);
+	snprintf(buf, sizeof(buf), "/trial%d.txt", trial.index);
+	std::string command = std::string(server) + " -map " + quote(map) + portArgs +
+	  " -BenchmarkGoals " + quote(goals) + " -BenchmarkReportFile " + quote(outDir + std::string(buf)) +
+	  " -BenchmarkExitWhenDone true";
+	snprintf(buf, sizeof(buf), " -BenchmarkSecs %d", secs);
+	command += buf;
+	// Servers running at once mustn't share the local task socket (each
+	// removes it on starting), telemetry shared memory, metrics port or
+	// checkpoint, so each slot has its own or none
+	snprintf(buf, sizeof(buf), " -LocalTaskSocket /tmp/plannerTuner%d.%d.sock -telemetryName /plannerTuner%d.%d"
+		 " -MetricsHttpPort 0 -CheckpointFile ''", (int)getpid(), s, (int)getpid(), s);
+	command += buf;
+	for(size_t p = 0; p < trial.values.size(); ++p)
+	{
+	  snprintf(buf, sizeof(buf), " %g", params[p].value(trial.values[p]));
+	  command += " -" + params[p].name + buf;
+	}
+	if(serverArgs[0] != '\0')
+	  command += std::string(" ") + serverArgs;
+	// Remove any report left from an earlier run
+	snprintf(buf, sizeof(buf), "/trial%d.txt", trial.index);
+	unlink((outDir + std::string(buf)).c_str());
+	snprintf(buf, sizeof(buf), "/trial%d.log", trial.index);
+	slot.server = start(command, outDir + std::string(buf));
+	slot.serverStarted.setToNow();
+	printf("Trial %d started: %s\n", trial.index, describe(params, trial).c_str());
+      }
+      else if(slot.trial >= 0 && slot.server != 0)
+      {
+	bool exited = slot.server < 0 || waitpid(slot.server, NULL, WNOHANG) != 0;
+	if(!exited && slot.serverStarted.mSecSince() > timeoutMSecs)
+	{
+	  if(!slot.interrupted)
+	  {
+	    printf("Trial %d: the server has not exited, interrupting it\n", slot.trial);
+	    kill(slot.server, SIGINT);
+	    slot.interrupted = true;
+	  }
+	  else if(slot.serverStarted.mSecSince() > timeoutMSecs + 10000)
+	  {
+	    kill(slot.server, SIGKILL);
+	    waitpid(slot.server, NULL, 0);
+	    exited = true;
+	  }
+	}
+	if(!exited)
+	  continue;
+
+	stop(slot.sim);
+	Trial& trial = trials[slot.trial];
+	snprintf(buf, sizeof(buf), "/trial%d.txt", trial.index);
+	if(readReport(outDir + std::string(buf), &trial) && trial.secs > 0)
+	{
+	  trial.done = true;
+	  trial.score = trial.goalsPerHour - failPenalty * trial.failed * 3600 / trial.secs;
+	  if(best < 0 || trial.score > trials[best].score)
+	    best = trial.index;
+	  printf("Trial %d: %.1f goals per hour, %lld failed, score %.1f%s\n", trial.index,
+		 trial.goalsPerHour, trial.failed, trial.score, best == trial.index ? " (best so far)" : "");
+	  fprintf(results, "%d", trial.index);
+	  for(size_t p = 0; p < params.size(); ++p)
+	  {
+	    if(trial.values.empty())
+	      fprintf(results, ",");
+	    else
+	      fprintf(results, ",%g", params[p].value(trial.values[p]));
+	  }
+	  fprintf(results, ",%.1f,%lld,%lld,%.1f,%.1f\n", trial.secs, trial.reached, trial.failed,
+		  trial.goalsPerHour, trial.score);
+	  fflush(results);
+	}
+	else
+	  printf("Trial %d: no report (see %s/trial%d.log)\n", trial.index, outDir, trial.index);
+	slot.trial = -1;
+	slot.sim = slot.server = 0;
+	running--;
+      }
+    }
+    ArUtil::sleep(200);
+  }
+  fclose(results);
+
+  if(best < 0)
+  {
+    printf("No trial completed\n");
+    Aria::exit(3);
+  }
+  const Trial& bestTrial = trials[best];
+  printf("Best: trial %d, %s: %.1f goals per hour, %lld failed, score %.1f",
+	 best, describe(params, bestTrial).c_str(), bestTrial.goalsPerHour, bestTrial.failed, bestTrial.score);
+  if(trials[0].done)
+    printf(" (baseline %.1f)", trials[0].score);
+  printf("\n");
+
+  FILE *file = fopen(output, "w");
+  if(file == NULL)
+  {
+    printf("Could not write %s\n", output);
+    Aria::exit(3);
+  }
+  fprintf(file, "; Best of %d trials by plannerTuner with %s: %.1f goals per hour, %lld failed in %.0f sec\n",
+	  (int)trials.size(), map, bestTrial.goalsPerHour, bestTrial.failed, bestTrial.secs);
+  if(bestTrial.values.empty())
+    fprintf(file, "; The baseline (the parameters as they are) did best\n");
+  std::string section;
+  for(size_t p = 0; p < params.size() && !bestTrial.values.empty(); ++p)
+  {
+    if(p == 0 || params[p].section != section)
+    {
+      section = params[p].section;
+      fprintf(file, "Section %s\n", section.c_str());
+    }
+    fprintf(file, "%s %g\n", params[p].name.c_str(), params[p].value(bestTrial.values[p]));
+  }
+  fclose(file);
+  printf("Wrote %s and %s\n", output, resultsFile.c_str());
+  Aria::exit(0);
+  return 0;
+}
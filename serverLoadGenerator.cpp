@@ -0,0 +1,437 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+/* Loads an ARNL server's ArServerModeGoto2 requests from many ArNetworking
+ * clients at once, to size the server for fleet dashboards and similar
+ * clients. Start the server first (e.g. arnlServerWithTourCallbacks with
+ * MobileSim), then:
+ *
+ *   serverLoadGenerator -clients 50 -secs 60 -mix getGoals=50,goalName=40,gotoGoal=5,TourGoalsList=5
+ *
+ * Each client opens its own connection and, in its own thread, issues
+ * requests picked at random according to the mix (weights need not add up
+ * to 100), one at a time, optionally at a fixed rate. At the end the
+ * latency percentiles of each request type are printed, along with the
+ * server's CPU use if it runs on this computer (found by -serverPid, or
+ * else by looking for a process whose name starts with -serverName).
+ *
+ * getGoals and goalName are timed until their reply arrives. gotoGoal,
+ * tourGoals and TourGoalsList (a custom command, with the goal list given by
+ * -tourList) have no reply, so each is followed on the same connection by
+ * a goalName request and timed until its reply: the server handles each
+ * client's requests in order, so this covers the request itself plus one
+ * goalName. gotoGoal picks a goal at random from the getGoals reply. A
+ * request with no reply within 5 seconds is counted as lost, and its reply,
+ * if it comes later, is ignored.
+ *
+ * Usage: serverLoadGenerator [-host host] [-port port] [-user user] [-password password]
+ *   [-clients n] [-secs n] [-rate requests/sec/client] [-mix name=weight,...]
+ *   [-tourList goals] [-serverPid pid] [-serverName name] [-seed n]
+ */
+
+#include "Aria.h"
+#include "ArNetworking.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <dirent.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+
+static double nowUSecs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void printStats(const char *name, std::vector<double>& usecs, int lost)
+{
+  if(usecs.empty())
+  {
+    printf("%-16s no replies (%d lost)\n", name, lost);
+    return;
+  }
+  std::sort(usecs.begin(), usecs.end());
+  double sum = 0;
+  for(size_t i = 0; i < usecs.size(); ++i)
+    sum += usecs[i];
+  printf("%-16s n=%-7d mean %9.1f  p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f usec  (%d lost)\n",
+    name, (int)usecs.size(), sum / usecs.size(), usecs[usecs.size() / 2],
+    usecs[(usecs.size() * 90) / 100], usecs[(usecs.size() * 99) / 100], usecs.back(), lost);
+}
+
+/// The request types a client can issue
+enum RequestType { GET_GOALS, GOAL_NAME, GOTO_GOAL, TOUR_GOALS, TOUR_GOALS_LIST, NUM_REQUEST_TYPES };
+static const char *ourRequestNames[NUM_REQUEST_TYPES] = { "getGoals", "goalName", "gotoGoal", "tourGoals", "TourGoalsList" };
+
+/// Parse "name=weight,..." into @a weights. @return false if a name is not a request type
+static bool parseMix(const char *mix, int weights[NUM_REQUEST_TYPES])
+{
+  for(int t = 0; t < NUM_REQUEST_TYPES; ++t)
+    weights[t] = 0;
+  std::string s(mix);
+  size_t start = 0;
+  while(start < s.size())
+  {
+    size_t end = s.find(',', start);
+    if(end == std::string::npos)
+      end = s.size();
+    const std::string item = s.substr(start, end - start);
+    const size_t eq = item.find('=');
+    int t = 0;
+    while(t < NUM_REQUEST_TYPES && item.substr(0, eq) != ourRequestNames[t])
+      ++t;
+    if(t == NUM_REQUEST_TYPES)
+    {
+      printf("Unknown request type in -mix: %s\n", item.c_str());
+      return false;
+    }
+    weights[t] = (eq == std::string::npos) ? 1 : atoi(item.c_str() + eq + 1);
+    start = end + 1;
+  }
+  return true;
+}
+
+/// Total user and system CPU time of process @a pid in seconds, or -1 if unknown
+static double getProcessCPUSecs(int pid)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *f = fopen(path, "r");
+  if(f == NULL)
+    return -1;
+  char buf[1024];
+  size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = '\0';
+  // Fields after the command name (which may contain spaces) in parentheses
+  const char *p = strrchr(buf, ')');
+  unsigned long utime, stime;
+  if(p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    return -1;
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/// The first process (other than this one) whose name starts with @a name, or 0
+static int findProcess(const char *name)
+{
+  DIR *dir = opendir("/proc");
+  if(dir == NULL)
+    return 0;
+  int found = 0;
+  struct dirent *entry;
+  while(found == 0 && (entry = readdir(dir)) != NULL)
+  {
+    const int pid = atoi(entry->d_name);
+    if(pid <= 0 || pid == (int)getpid())
+      continue;
+    char path[64], comm[256];
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    FILE *f = fopen(path, "r");
+    if(f == NULL)
+      continue;
+    if(fgets(comm, sizeof(comm), f) != NULL && strncmp(comm, name, strlen(name)) == 0)
+      found = pid;
+    fclose(f);
+  }
+  closedir(dir);
+  return found;
+}
+
+/// One connection to the server, issuing requests from its own thread
+class LoadClient : public ArASyncTask
+{
+public:
+  LoadClient(int index, const int weights[NUM_REQUEST_TYPES], double rate,
+	     const std::string& tourList, unsigned int seed) :
+    myIndex(index), myRate(rate), myTourList(tourList),
+    myRandom(seed * 2654435761u + index + 1), mySent(0), myReceived(0),
+    myGetGoalsCB(this, &LoadClient::handleGetGoals),
+    myGoalNameCB(this, &LoadClient::handleGoalName)
+  {
+    for(int t = 0; t < NUM_REQUEST_TYPES; ++t)
+    {
+      myWeights[t] = weights[t];
+      myLost[t] = 0;
+    }
+  }
+
+  bool connect(const char *host, int port, const char *user, const char *password)
+  {
+    if(!myClient.blockingConnect(host, port, false, user, password))
+      return false;
+    myClient.addHandler("getGoals", &myGetGoalsCB);
+    myClient.addHandler("goalName", &myGoalNameCB);
+    myClient.runAsync();
+    // Leave out what this server doesn't have (e.g. TourGoalsList without its command handler)
+    for(int t = 0; t < NUM_REQUEST_TYPES; ++t)
+    {
+      if(myWeights[t] > 0 && !myClient.dataExists(ourRequestNames[t]))
+      {
+	if(myIndex == 0)
+	  printf("Server has no %s request, leaving it out\n", ourRequestNames[t]);
+	myWeights[t] = 0;
+      }
+    }
+    // gotoGoal needs the goal names
+    double usecs;
+    if(myWeights[GOTO_GOAL] > 0 && (!timedRequest("getGoals", NULL, &usecs) || myGoals.empty()))
+      myWeights[GOTO_GOAL] = 0;
+    return true;
+  }
+
+  void disconnect()
+  {
+    myClient.disconnect();
+  }
+
+  virtual void *runThread(void *)
+  {
+    int total = 0;
+    for(int t = 0; t < NUM_REQUEST_TYPES; ++t)
+      total += myWeights[t];
+    if(total <= 0)
+      return NULL;
+    const double started = nowUSecs();
+    long long issued = 0;
+    while(getRunning())
+    {
+      int pick = (int)(random() % (unsigned int)total);
+      int t = 0;
+      while(pick >= myWeights[t])
+	pick -= myWeights[t++];
+      double usecs;
+      if(issue((RequestType)t, &usecs))
+	myUSecs[t].push_back(usecs);
+      else
+	++myLost[t];
+      ++issued;
+      if(myRate > 0)
+      {
+	// Hold to the rate, without trying to catch up after a slow reply
+	const double next = started + issued * 1e6 / myRate;
+	const double wait = next - nowUSecs();
+	if(wait > 0)
+	  ArUtil::sleep((unsigned int)(wait / 1000));
+      }
+    }
+    return NULL;
+  }
+
+  std::vector<double> myUSecs[NUM_REQUEST_TYPES];
+  int myLost[NUM_REQUEST_TYPES];
+
+protected:
+  bool issue(RequestType type, double *usecs)
+  {
+    switch(type)
+    {
+    case GET_GOALS:
+      return timedRequest("getGoals", NULL, usecs);
+    case GOAL_NAME:
+      return timedRequest("goalName", NULL, usecs);
+    case GOTO_GOAL:
+      {
+	// A late getGoals reply may replace the list
+	std::unique_lock<std::mutex> guard(myMutex);
+	const std::string goal = myGoals.empty() ? std::string() : myGoals[random() % myGoals.size()];
+	guard.unlock();
+	return !goal.empty() && timedRequest("gotoGoal", goal.c_str(), usecs);
+      }
+    case TOUR_GOALS:
+      return timedRequest("tourGoals", NULL, usecs);
+    case TOUR_GOALS_LIST:
+      return timedRequest("TourGoalsList", myTourList.c_str(), usecs);
+    default:
+      return false;
+    }
+  }
+
+  /** Request @a name (with string argument @a arg if not NULL) and wait for
+   * the reply, or for the reply to a following goalName if @a name has none.
+   * Replies come in the order of the requests, so each request expecting
+   * one is numbered, and it is its reply once that many have arrived: a
+   * reply to an earlier request which timed out does not count for it. */
+  bool timedRequest(const char *name, const char *arg, double *usecs)
+  {
+    const bool hasReply = (strcmp(name, "getGoals") == 0 || strcmp(name, "goalName") == 0);
+    std::unique_lock<std::mutex> guard(myMutex);
+    const unsigned long seq = ++mySent;
+    const double start = nowUSecs();
+    if(arg != NULL)
+      myClient.requestOnceWithString(name, arg);
+    else
+      myClient.requestOnce(name);
+    if(!hasReply)
+      myClient.requestOnce("goalName");
+    const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    // Waking every 100 ms to notice a disconnection
+    while(myReceived < seq && std::chrono::steady_clock::now() < deadline && myClient.isConnected())
+      myCondition.wait_for(guard, std::chrono::milliseconds(100));
+    const bool ok = (myReceived >= seq);
+    guard.unlock();
+    *usecs = nowUSecs() - start;
+    return ok;
+  }
+
+  void handleGetGoals(ArNetPacket *packet)
+  {
+    std::vector<std::string> goals;
+    char buf[512];
+    while(packet->getDataReadLength() < packet->getDataLength())
+    {
+      packet->bufToStr(buf, sizeof(buf));
+      goals.push_back(buf);
+    }
+    {
+      std::lock_guard<std::mutex> guard(myMutex);
+      myGoals.swap(goals);
+      ++myReceived;
+    }
+    myCondition.notify_all();
+  }
+
+  void handleGoalName(ArNetPacket *)
+  {
+    {
+      std::lock_guard<std::mutex> guard(myMutex);
+      ++myReceived;
+    }
+    myCondition.notify_all();
+  }
+
+  /// xorshift32, seeded per client
+  unsigned int random()
+  {
+    unsigned int x = myRandom;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    myRandom = x;
+    return x;
+  }
+
+  int myIndex;
+  int myWeights[NUM_REQUEST_TYPES];
+  double myRate;
+  std::string myTourList;
+  unsigned int myRandom;
+  ArClientBase myClient;
+  /// Waited on with myCondition, so that a reply between checking and waiting is not missed
+  std::mutex myMutex;
+  std::condition_variable myCondition;
+  /// Number of the last request expecting a reply, and replies so far (protected by myMutex)
+  unsigned long mySent;
+  unsigned long myReceived;
+  std::vector<std::string> myGoals;
+  ArFunctor1C<LoadClient, ArNetPacket *> myGetGoalsCB;
+  ArFunctor1C<LoadClient, ArNetPacket *> myGoalNameCB;
+};
+
+int main(int argc, char **argv)
+{
+  Aria::init();
+  ArArgumentParser parser(&argc, argv);
+  parser.loadDefaultArguments();
+
+  const char *host = "localhost";
+  int port = 7272;
+  const char *user = NULL;
+  const char *password = NULL;
+  int numClients = 10;
+  int secs = 30;
+  double rate = 0;
+  const char *mix = "getGoals=50,goalName=40,gotoGoal=5,TourGoalsList=5";
+  const char *tourList = "Goal*";
+  int serverPid = 0;
+  const char *serverName = "arnlServer";
+  int seed = 1;
+  parser.checkParameterArgumentString("-host", &host);
+  parser.checkParameterArgumentInteger("-port", &port);
+  parser.checkParameterArgumentString("-user", &user);
+  parser.checkParameterArgumentString("-password", &password);
+  parser.checkParameterArgumentInteger("-clients", &numClients);
+  parser.checkParameterArgumentInteger("-secs", &secs);
+  parser.checkParameterArgumentDouble("-rate", &rate);
+  parser.checkParameterArgumentString("-mix", &mix);
+  parser.checkParameterArgumentString("-tourList", &tourList);
+  parser.checkParameterArgumentInteger("-serverPid", &serverPid);
+  parser.checkParameterArgumentString("-serverName", &serverName);
+  parser.checkParameterArgumentInteger("-seed", &seed);
+  int weights[NUM_REQUEST_TYPES];
+  if(!parser.checkHelpAndWarnUnparsed() || numClients < 1 || secs < 1 || !parseMix(mix, weights))
+  {
+    printf("Usage: serverLoadGenerator [-host host] [-port port] [-user user] [-password password]\n"
+	   "  [-clients n] [-secs n] [-rate requests/sec/client] [-mix name=weight,...]\n"
+	   "  [-tourList goals] [-serverPid pid] [-serverName name] [-seed n]\n"
+	   "Request types for -mix: getGoals goalName gotoGoal tourGoals TourGoalsList\n");
+    Aria::exit(1);
+  }
+  ArLog::init(ArLog::StdOut, ArLog::Terse);
+
+  std::vector<LoadClient *> clients;
+  for(int i = 0; i < numClients; ++i)
+  {
+    LoadClient *client = new LoadClient(i, weights, rate, tourList, (unsigned int)seed);
+    if(!client->connect(host, port, user, password))
+    {
+      printf("Could not connect client %d to %s:%d\n", i + 1, host, port);
+      Aria::exit(2);
+    }
+    clients.push_back(client);
+  }
+  printf("%d clients connected to %s:%d, running for %d sec with mix %s\n", numClients, host, port, secs, mix);
+
+  if(serverPid == 0)
+    serverPid = findProcess(serverName);
+  const double cpuBefore = serverPid != 0 ? getProcessCPUSecs(serverPid) : -1;
+  const double started = nowUSecs();
+  for(size_t i = 0; i < clients.size(); ++i)
+    clients[i]->runAsync();
+  ArUtil::sleep(secs * 1000);
+  for(size_t i = 0; i < clients.size(); ++i)
+    clients[i]->stopRunning();
+  for(size_t i = 0; i < clients.size(); ++i)
+    clients[i]->join();
+  const double elapsed = (nowUSecs() - started) / 1e6;
+  const double cpuAfter = serverPid != 0 ? getProcessCPUSecs(serverPid) : -1;
+
+  long long total = 0;
+  printf("Latency by request type:\n");
+  for(int t = 0; t < NUM_REQUEST_TYPES; ++t)
+  {
+    if(weights[t] <= 0)
+      continue;
+    std::vector<double> usecs;
+    int lost = 0;
+    for(size_t i = 0; i < clients.size(); ++i)
+    {
+      usecs.insert(usecs.end(), clients[i]->myUSecs[t].begin(), clients[i]->myUSecs[t].end());
+      lost += clients[i]->myLost[t];
+    }
+    total += usecs.size();
+    printStats(ourRequestNames[t], usecs, lost);
+  }
+  printf("%lld requests in %.1f sec: %.1f requests/sec\n", total, elapsed, total / elapsed);
+  if(cpuBefore >= 0 && cpuAfter >= 0)
+    printf("Server (pid %d) CPU use: %.1f%% of one core\n", serverPid, 100 * (cpuAfter - cpuBefore) / elapsed);
+  else
+    printf("Server CPU use unknown (give -serverPid for a server on this computer)\n");
+
+  for(size_t i = 0; i < clients.size(); ++i)
+  {
+    clients[i]->disconnect();
+    delete clients[i];
+  }
+  Aria::exit(0);
+  return 0;
+}
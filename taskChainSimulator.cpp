@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+/* Runs the example goal chain task of arnlServerWithAsyncTaskChain,
+ * ArnlASyncTaskExample (go to "Goal 1", move forward, wait 3 seconds, back
+ * up, go to "Goal 2", ... until the end of the chain), in virtual time,
+ * against the simulated robot and path planner in ArnlVirtualTime.h, with no
+ * robot, MobileSim or map. The task is the real class, given
+ * ArnlSimulatedNavigation as its path planner (see ArnlPathTask) and run in
+ * its own threads as on a robot. Every dwell, move and trip between goals
+ * takes its usual (virtual) time, but none of it is waited for, so many
+ * goals are run per second.
+ *
+ * The example task stops where a goal fails, and at the end of the chain,
+ * for the operator to send the robot on from MobileEyes. Here a simulated
+ * operator does that: it sends the robot to a failed goal again, and from
+ * the end of the chain back to "Goal 1".
+ *
+ * Each run prints a digest of the goal results and task runs and the
+ * virtual times at which they happened. The same options always give the
+ * same digest; with -repeat, the chain is run several times and the digests
+ * compared, to catch changes to the task framework which make event order
+ * depend on anything but virtual time.
+ *
+ * Usage: taskChainSimulator [-goals count] [-chainLength n] [-approach mm]
+ *   [-speed mm/sec] [-planMSecs ms] [-failPercent p] [-seed n] [-repeat n]
+ */
+
+#include "Aria.h"
+#include "ArnlVirtualTime.h"
+#include "ArnlASyncTaskExample.h"
+
+#include <time.h>
+
+static double nowSecs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Stands in for the operator: sends the robot to the first goal, again to
+ * a goal it failed to reach, and back to the first goal when the task has
+ * finished at the last one; and records what happens. The goal callbacks
+ * are invoked in the executor's thread and the task finished callback in
+ * the task's, but never at once (see ArnlClock). */
+class SimulatedOperator
+{
+public:
+  SimulatedOperator(ArnlSimulatedNavigation *nav, ArnlASyncTask *task, int chainLength, int goalsToReach) :
+    myNav(nav), myTask(task), myStopped(false), myGoalsToReach(goalsToReach),
+    myReached(0), myFailed(0), myChains(0),
+    myDigest(14695981039346656037ULL), myStartMSecs(0),
+    myGoalDoneCB(this, &SimulatedOperator::goalDone),
+    myGoalFailedCB(this, &SimulatedOperator::goalFailed),
+    myTaskFinishedCB(this, &SimulatedOperator::taskFinished),
+    myIsDoneCB(this, &SimulatedOperator::isDone)
+  {
+    char name[128];
+    snprintf(name, sizeof(name), "Goal %d", chainLength);
+    myLastGoal = name;
+    myNav->addGoalDoneCB(&myGoalDoneCB);
+    myNav->addGoalFailedCB(&myGoalFailedCB);
+    myTask->addTaskFinishedCB(&myTaskFinishedCB);
+  }
+
+  ~SimulatedOperator()
+  {
+    myNav->remGoalDoneCB(&myGoalDoneCB);
+    myNav->remGoalFailedCB(&myGoalFailedCB);
+    myTask->remTaskFinishedCB(&myTaskFinishedCB);
+  }
+
+  void start()
+  {
+    myStartMSecs = ArnlClock::getMSecs();
+    myNav->pathPlanToGoal("Goal 1");
+  }
+
+  /// Send no more goals and ignore what happens from now on (call when no task thread is running)
+  void stop() { myStopped = true; }
+
+  bool isDone() { return myReached + myFailed >= myGoalsToReach; }
+  ArRetFunctor<bool> *getIsDoneCB() { return &myIsDoneCB; }
+
+  int getReached() const { return myReached; }
+  int getFailed() const { return myFailed; }
+  int getChains() const { return myChains; }
+  unsigned long long getDigest() const { return myDigest; }
+
+protected:
+  void goalDone(ArPose)
+  {
+    if(myStopped)
+      return;
+    record(myNav->getCurrentGoalName(), "arrived");
+    myReached++;
+  }
+
+  void goalFailed(ArPose)
+  {
+    if(myStopped)
+      return;
+    const std::string goalName = myNav->getCurrentGoalName();
+    record(goalName, "failed");
+    myFailed++;
+    // Try again, as the operator would
+    if(!isDone())
+      myNav->pathPlanToGoal(goalName.c_str());
+  }
+
+  void taskFinished(const std::string& goalName, long)
+  {
+    if(myStopped)
+      return;
+    record(goalName, "task finished");
+    if(goalName != myLastGoal)
+      return;
+    // End of the chain: send the robot back to the first goal, as the operator would
+    myChains++;
+    if(!isDone())
+      myNav->pathPlanToGoal("Goal 1");
+  }
+
+  /// Add @a what happened at @a goalName, and when, to the digest (FNV-1a)
+  void record(const std::string& goalName, const char *what)
+  {
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), "%s %s %lld;", goalName.c_str(), what,
+		     ArnlClock::getMSecs() - myStartMSecs);
+    for(int i = 0; i < n && i < (int)sizeof(buf); i++)
+    {
+      myDigest ^= (unsigned char)buf[i];
+      myDigest *= 1099511628211ULL;
+    }
+  }
+
+  ArnlSimulatedNavigation *myNav;
+  ArnlASyncTask *myTask;
+  std::string myLastGoal;
+  bool myStopped;
+  int myGoalsToReach;
+  int myReached;
+  int myFailed;
+  int myChains;
+  unsigned long long myDigest;
+  long long myStartMSecs;
+  ArFunctor1C<SimulatedOperator, ArPose> myGoalDoneCB;
+  ArFunctor1C<SimulatedOperator, ArPose> myGoalFailedCB;
+  ArFunctor2C<SimulatedOperator, const std::string&, long> myTaskFinishedCB;
+  ArRetFunctorC<bool, SimulatedOperator> myIsDoneCB;
+};
+
+/// Whether every task thread has finished
+static bool tasksFinished()
+{
+  return ArnlClock::getThreads() == 0;
+}
+
+int main(int argc, char **argv)
+{
+  Aria::init();
+  ArArgumentParser parser(&argc, argv);
+  parser.loadDefaultArguments();
+
+  int goals = 10000;
+  int chainLength = 4;
+  int approach = 250;
+  int speed = 750;
+  int planMSecs = 200;
+  int failPercent = 0;
+  int seed = 1;
+  int repeat = 1;
+  parser.checkParameterArgumentInteger("-goals", &goals);
+  parser.checkParameterArgumentInteger("-chainLength", &chainLength);
+  parser.checkParameterArgumentInteger("-approach", &approach);
+  parser.checkParameterArgumentInteger("-speed", &speed);
+  parser.checkParameterArgumentInteger("-planMSecs", &planMSecs);
+  parser.checkParameterArgumentInteger("-failPercent", &failPercent);
+  parser.checkParameterArgumentInteger("-seed", &seed);
+  parser.checkParameterArgumentInteger("-repeat", &repeat);
+  if(!parser.checkHelpAndWarnUnparsed() || chainLength < 1 || speed <= 0)
+  {
+    printf("Usage: taskChainSimulator [-goals count] [-chainLength n] [-approach mm]\n"
+	   "  [-speed mm/sec] [-planMSecs ms] [-failPercent p] [-seed n] [-repeat n]\n");
+    Aria::exit(1);
+  }
+  ArLog::init(ArLog::StdOut, ArLog::Terse);
+
+  // Not connected: it only keys the motion executor and robot mailbox the task uses
+  ArRobot robot;
+  unsigned long long firstDigest = 0;
+  bool same = true;
+  for(int run = 1; run <= repeat; ++run)
+  {
+    ArnlVirtualTimeExecutor executor;
+    if(!executor.isValid())
+      Aria::exit(2);
+    ArnlSimulatedMotion motion(&executor);
+    ArnlMotionExecutor::setExecutor(&robot, &motion);
+    ArnlSimulatedNavigation nav(&motion);
+    nav.setTravelSpeed(speed);
+    nav.setPlanMSecs(planMSecs);
+    nav.setFailPercent(failPercent, seed);
+    // Goals 5 m apart around a circle, with the robot starting at the last
+    for(int i = 1; i <= chainLength; ++i)
+    {
+      const double radius = chainLength > 1 ? 2500 / ArMath::sin(180.0 / chainLength) : 0;
+      const double angle = i * 360.0 / chainLength;
+      char name[128];
+      snprintf(name, sizeof(name), "Goal %d", i);
+      nav.addGoal(name, ArPose(radius * ArMath::cos(angle), radius * ArMath::sin(angle), angle + 90));
+      if(i == chainLength)
+	motion.setPose(ArPose(radius * ArMath::cos(angle), radius * ArMath::sin(angle), angle + 90));
+    }
+
+    ArnlASyncTaskExample task(&nav, &robot, NULL, NULL);
+    task.setChain(chainLength, approach);
+    SimulatedOperator chain(&nav, &task, chainLength, goals);
+
+    const double started = nowSecs();
+    chain.start();
+    // A year of virtual time is plenty for any sensible -goals
+    const bool done = executor.run(chain.getIsDoneCB(), 365LL * 24 * 3600 * 1000);
+    const double secs = nowSecs() - started;
+    const double virtualSecs = executor.getElapsedMSecs() / 1000.0;
+
+    // The task sends the robot on by itself: have the next goal fail, so that
+    // it stops, and let any task thread still running finish before the
+    // task is destroyed
+    chain.stop();
+    nav.setFailPercent(100, seed);
+    ArGlobalRetFunctor<bool> tasksFinishedCB(&tasksFinished);
+    executor.run(&tasksFinishedCB, 365LL * 24 * 3600 * 1000);
+    // The last task thread (started at each goal reached) may still be exiting
+    if(chain.getReached() > 0)
+      task.join();
+
+    printf("Run %d: %s %d goals reached, %d failed, %d chains in %.1f virtual hours\n",
+	   run, done ? "done:" : "incomplete:", chain.getReached(), chain.getFailed(),
+	   chain.getChains(), virtualSecs / 3600);
+    printf("  %.3f s real time, %.0f goals/s, %.0fx real time, %llu robot cycles, %llu timers\n",
+	   secs, secs > 0 ? (chain.getReached() + chain.getFailed()) / secs : 0,
+	   secs > 0 ? virtualSecs / secs : 0, executor.getCycles(), executor.getTimersFired());
+    printf("  %.1f goals per virtual hour, digest %016llx\n",
+	   virtualSecs > 0 ? chain.getReached() * 3600 / virtualSecs : 0, chain.getDigest());
+    if(run == 1)
+      firstDigest = chain.getDigest();
+    else if(chain.getDigest() != firstDigest)
+      same = false;
+    ArnlMotionExecutor::setExecutor(&robot, NULL);
+  }
+  if(repeat > 1)
+    printf("%s\n", same ? "All runs had the same digest" : "Runs differed: event order is not deterministic");
+  Aria::exit(same ? 0 : 3);
+  return 0;
+}
@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2017 Omron Adept MobileRobots LLC
+All rights reserved.
+*/
+
+/* Example of reading the telemetry that arnlServerWithAsyncTaskChain or
+ * arnlServerWithTourCallbacks publish in shared memory (see
+ * ArnlTelemetry.h). This does not use ARIA or ArNetworking at all.
+ *
+ * Usage: telemetryReaderExample [shared memory name]
+ */
+
+#include "ArnlTelemetry.h"
+
+#include <stdio.h>
+#include <time.h>
+
+static double nowUSecs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv)
+{
+  const char *name = (argc > 1) ? argv[1] : ARNL_TELEMETRY_DEFAULT_NAME;
+  ArnlTelemetryReader reader;
+  if(!reader.open(name))
+  {
+    fprintf(stderr, "Could not open telemetry shared memory %s. Is the server running?\n", name);
+    return 1;
+  }
+
+  uint64_t lastUpdate = 0;
+  while(true)
+  {
+    ArnlTelemetryData data;
+    const int reps = 1000;
+    double start = nowUSecs();
+    bool ok = true;
+    for(int i = 0; i < reps && ok; ++i)
+      ok = reader.read(&data);
+    double usecsPerRead = (nowUSecs() - start) / reps;
+    if(!ok)
+    {
+      fprintf(stderr, "Could not read a consistent snapshot.\n");
+    }
+    else if(data.updateCount != lastUpdate)
+    {
+      printf("#%llu pose (%.0f, %.0f, %.1f) vel %.0f rotvel %.1f loc %.2f mode \"%s\" status \"%s\" goal %d \"%s\" tour index %d (read %.3f usec)\n",
+        (unsigned long long)data.updateCount, data.x, data.y, data.th, data.vel,
+        data.rotVel, data.localizationScore, data.mode, data.status,
+        data.goalId, data.goalName, data.tourIndex, usecsPerRead);
+      lastUpdate = data.updateCount;
+    }
+    struct timespec ts = { 0, 100 * 1000 * 1000 };
+    nanosleep(&ts, NULL);
+  }
+  return 0;
+}